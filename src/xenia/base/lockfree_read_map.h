@@ -0,0 +1,140 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_LOCKFREE_READ_MAP_H_
+#define XENIA_BASE_LOCKFREE_READ_MAP_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace xe {
+/*
+        maps 32 bit keys to pointers, for lookups that must not take a lock.
+   lookups may run concurrently with each other and with a writer, but writers
+   must be serialized externally. the table is open addressed, when it gets too
+   full a larger copy is published and the old one is retired - it stays alive
+   until the map is destroyed, as readers may still be probing it. erasing only
+   clears the value, the key is reused if it's inserted again
+*/
+template <typename TValue>
+class lockfree_read_map {
+ public:
+  lockfree_read_map() { table_.store(new table(kInitialBits)); }
+  ~lockfree_read_map() { delete table_.load(std::memory_order_relaxed); }
+  lockfree_read_map(const lockfree_read_map&) = delete;
+  lockfree_read_map& operator=(const lockfree_read_map&) = delete;
+
+  TValue* find(uint32_t key) const {
+    const table* t = table_.load(std::memory_order_acquire);
+    uint64_t tag = make_tag(key);
+    for (uint32_t i = t->index_for_key(key);; i = (i + 1) & t->mask) {
+      uint64_t slot_tag = t->slots[i].tag.load(std::memory_order_acquire);
+      if (slot_tag == tag) {
+        return t->slots[i].value.load(std::memory_order_acquire);
+      }
+      if (!slot_tag) {
+        return nullptr;
+      }
+    }
+  }
+
+  // Must be serialized with other writes.
+  void insert_or_assign(uint32_t key, TValue* value) {
+    table* t = table_.load(std::memory_order_relaxed);
+    slot* s = t->find_slot(key);
+    if (s->tag.load(std::memory_order_relaxed)) {
+      s->value.store(value, std::memory_order_release);
+      return;
+    }
+    if ((t->used + 1) * 2 > t->mask + 1) {
+      t = grow();
+      s = t->find_slot(key);
+    }
+    s->value.store(value, std::memory_order_relaxed);
+    // Publish the value along with the key.
+    s->tag.store(make_tag(key), std::memory_order_release);
+    ++t->used;
+  }
+
+  // Must be serialized with other writes.
+  void erase(uint32_t key) {
+    table* t = table_.load(std::memory_order_relaxed);
+    slot* s = t->find_slot(key);
+    if (s->tag.load(std::memory_order_relaxed)) {
+      s->value.store(nullptr, std::memory_order_release);
+    }
+  }
+
+ private:
+  static constexpr uint32_t kInitialBits = 10;
+
+  struct slot {
+    // Key with bit 32 set if used, 0 if empty.
+    std::atomic<uint64_t> tag{0};
+    std::atomic<TValue*> value{nullptr};
+  };
+
+  struct table {
+    explicit table(uint32_t bits)
+        : shift(64 - bits),
+          mask((uint32_t(1) << bits) - 1),
+          slots(new slot[size_t(1) << bits]) {}
+
+    uint32_t index_for_key(uint32_t key) const {
+      // Fibonacci hashing, keys are often aligned guest addresses.
+      return uint32_t((uint64_t(key) * 0x9E3779B97F4A7C15ull) >> shift);
+    }
+    slot* find_slot(uint32_t key) {
+      uint64_t tag = make_tag(key);
+      for (uint32_t i = index_for_key(key);; i = (i + 1) & mask) {
+        uint64_t slot_tag = slots[i].tag.load(std::memory_order_relaxed);
+        if (!slot_tag || slot_tag == tag) {
+          return &slots[i];
+        }
+      }
+    }
+
+    uint32_t shift;
+    uint32_t mask;
+    uint32_t used = 0;
+    std::unique_ptr<slot[]> slots;
+  };
+
+  static uint64_t make_tag(uint32_t key) { return (uint64_t(1) << 32) | key; }
+
+  table* grow() {
+    table* old_table = table_.load(std::memory_order_relaxed);
+    auto new_table = new table(64 - old_table->shift + 1);
+    for (uint32_t i = 0; i <= old_table->mask; ++i) {
+      const slot& old_slot = old_table->slots[i];
+      uint64_t tag = old_slot.tag.load(std::memory_order_relaxed);
+      TValue* value = old_slot.value.load(std::memory_order_relaxed);
+      // Erased keys are dropped.
+      if (!tag || !value) {
+        continue;
+      }
+      slot* new_slot = new_table->find_slot(uint32_t(tag));
+      new_slot->tag.store(tag, std::memory_order_relaxed);
+      new_slot->value.store(value, std::memory_order_relaxed);
+      ++new_table->used;
+    }
+    table_.store(new_table, std::memory_order_release);
+    retired_tables_.emplace_back(old_table);
+    return new_table;
+  }
+
+  std::atomic<table*> table_;
+  std::vector<std::unique_ptr<table>> retired_tables_;
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_LOCKFREE_READ_MAP_H_
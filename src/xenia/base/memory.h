@@ -14,6 +14,7 @@
 #include <cstring>
 #include <filesystem>
 #include <functional>
+#include <memory>
 #include <string>
 #include <string_view>
 
@@ -89,6 +90,54 @@ bool Protect(void* base_address, size_t length, PageAccess access,
 // the region.
 bool QueryProtect(void* base_address, size_t& length, PageAccess& access_out);
 
+// Returns the size of the transparent huge pages the system may back memory
+// with, or 0 if they're not available.
+size_t huge_page_size();
+
+// Asks the system to back the aligned huge pages of the given committed block
+// of memory with huge pages, until it's mapped anew. Changing the access
+// rights of a part of a huge page splits it.
+bool AdviseHugePages(void* base_address, size_t length);
+
+// Returns how many bytes of the given block of memory are currently backed by
+// huge pages.
+size_t QueryHugePageBackedLength(const void* base_address, size_t length);
+
+// Write protection of pages that reports the first write to every protected
+// page to a thread of the watch instead of raising an access violation in the
+// writing thread, without changing the protection of the mappings like
+// Protect, which splits them and is serialized with all other changes to the
+// address space. The writer waits until the callback has returned, after which
+// the page is writable again. Writes done by the kernel on behalf of system
+// calls are reported too.
+// Available on Linux 6.4+ with userfaultfd write-protection of unpopulated
+// pages (and with the permission to handle faults in the kernel mode),
+// returning nullptr from Create elsewhere.
+class WriteWatch {
+ public:
+  // Called with the base of the written page. On the thread of the watch,
+  // may_wait is false, as the writer may be holding locks the callback needs -
+  // in this case the callback may return false, and the writer will be resumed
+  // without waiting for the write to be handled, with the callback invoked for
+  // the page again later by the watch or from ProcessPendingWrites.
+  typedef bool (*WriteCallback)(void* context, void* host_address,
+                                bool may_wait);
+
+  static std::unique_ptr<WriteWatch> Create(WriteCallback callback,
+                                            void* context);
+
+  virtual ~WriteWatch() = default;
+
+  // Ranges must be added before protecting pages in them, and again after
+  // being mapped anew, such as by AllocFixed.
+  virtual bool AddRange(void* base_address, size_t length) = 0;
+  // Write-protects or unprotects pages in ranges that have been added.
+  virtual bool Protect(void* base_address, size_t length, bool protect) = 0;
+  // Invokes the callback with may_wait for the writes not handled yet, on the
+  // calling thread, which must not be the thread of the watch.
+  virtual void ProcessPendingWrites() = 0;
+};
+
 // Allocates a block of memory for a type with the given alignment.
 // The memory must be freed with AlignedFree.
 template <typename T>
@@ -12,12 +12,31 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <algorithm>
 #include <cstddef>
+#include <fstream>
+#include <sstream>
+#include <string>
 
 #include "xenia/base/math.h"
 #include "xenia/base/platform.h"
 #include "xenia/base/string.h"
 
+#if XE_PLATFORM_LINUX
+#include <linux/userfaultfd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <cerrno>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "xenia/base/threading.h"
+#endif
+
 #if XE_PLATFORM_ANDROID
 #include <dlfcn.h>
 #include <linux/ashmem.h>
@@ -118,6 +137,253 @@ bool QueryProtect(void* base_address, size_t& length, PageAccess& access_out) {
   return false;
 }
 
+size_t huge_page_size() {
+#if XE_PLATFORM_LINUX
+  static const size_t huge_page_size = []() -> size_t {
+    // With "never", madvise doesn't enable them either.
+    std::ifstream enabled_stream("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string enabled;
+    if (!std::getline(enabled_stream, enabled) ||
+        enabled.find("[never]") != std::string::npos) {
+      return 0;
+    }
+    std::ifstream size_stream(
+        "/sys/kernel/mm/transparent_hugepage/hpage_pmd_size");
+    size_t size = 0;
+    if (!(size_stream >> size)) {
+      return 0;
+    }
+    return size;
+  }();
+  return huge_page_size;
+#else
+  return 0;
+#endif
+}
+
+bool AdviseHugePages(void* base_address, size_t length) {
+#if XE_PLATFORM_LINUX && defined(MADV_HUGEPAGE)
+  // Parts not containing whole aligned huge pages are left with small pages by
+  // the system, and adjacent advised mappings are merged.
+  if (!huge_page_size()) {
+    return false;
+  }
+  return madvise(base_address, length, MADV_HUGEPAGE) == 0;
+#else
+  return false;
+#endif
+}
+
+size_t QueryHugePageBackedLength(const void* base_address, size_t length) {
+#if XE_PLATFORM_LINUX
+  if (!huge_page_size()) {
+    return 0;
+  }
+  std::ifstream smaps_stream("/proc/self/smaps");
+  if (!smaps_stream.is_open()) {
+    return 0;
+  }
+  uintptr_t range_start = reinterpret_cast<uintptr_t>(base_address);
+  uintptr_t range_end = range_start + length;
+  size_t overlap = 0;
+  size_t backed_length = 0;
+  std::string line;
+  while (std::getline(smaps_stream, line)) {
+    std::istringstream line_stream(line);
+    std::string key;
+    line_stream >> key;
+    size_t separator = key.find('-');
+    if (separator != std::string::npos) {
+      // A new mapping, "start-end perms offset device inode path".
+      uintptr_t mapping_start =
+          uintptr_t(std::stoull(key.substr(0, separator), nullptr, 16));
+      uintptr_t mapping_end =
+          uintptr_t(std::stoull(key.substr(separator + 1), nullptr, 16));
+      overlap = mapping_start < range_end && range_start < mapping_end
+                    ? std::min(mapping_end, range_end) -
+                          std::max(mapping_start, range_start)
+                    : 0;
+    } else if (overlap && key == "AnonHugePages:") {
+      size_t kilobytes = 0;
+      line_stream >> kilobytes;
+      backed_length += std::min(kilobytes * 1024, overlap);
+    }
+  }
+  return backed_length;
+#else
+  return 0;
+#endif
+}
+
+#if XE_PLATFORM_LINUX && defined(UFFDIO_WRITEPROTECT)
+// Not in the headers before Linux 6.4.
+#ifndef UFFD_FEATURE_WP_UNPOPULATED
+#define UFFD_FEATURE_WP_UNPOPULATED (1 << 13)
+#endif
+
+class UserfaultfdWriteWatch : public WriteWatch {
+ public:
+  UserfaultfdWriteWatch(int userfaultfd, int shutdown_eventfd,
+                        WriteCallback callback, void* context)
+      : userfaultfd_(userfaultfd),
+        shutdown_eventfd_(shutdown_eventfd),
+        callback_(callback),
+        context_(context) {
+    thread_ = std::thread(&UserfaultfdWriteWatch::ThreadMain, this);
+  }
+
+  ~UserfaultfdWriteWatch() override {
+    uint64_t shutdown = 1;
+    write(shutdown_eventfd_, &shutdown, sizeof(shutdown));
+    thread_.join();
+    close(shutdown_eventfd_);
+    // Wakes any writers still waiting.
+    close(userfaultfd_);
+  }
+
+  bool AddRange(void* base_address, size_t length) override {
+    uffdio_register range_register = {};
+    range_register.range.start = reinterpret_cast<uintptr_t>(base_address);
+    range_register.range.len = length;
+    range_register.mode = UFFDIO_REGISTER_MODE_WP;
+    return ioctl(userfaultfd_, UFFDIO_REGISTER, &range_register) == 0;
+  }
+
+  bool Protect(void* base_address, size_t length, bool protect) override {
+    // Unprotecting also wakes the writers waiting for the pages.
+    uffdio_writeprotect write_protect = {};
+    write_protect.range.start = reinterpret_cast<uintptr_t>(base_address);
+    write_protect.range.len = length;
+    write_protect.mode = protect ? UFFDIO_WRITEPROTECT_MODE_WP : 0;
+    return ioctl(userfaultfd_, UFFDIO_WRITEPROTECT, &write_protect) == 0;
+  }
+
+  void ProcessPendingWrites() override { ProcessPendingWrites(true); }
+
+ private:
+  void ProcessPendingWrites(bool may_wait) {
+    if (!has_pending_writes_.load(std::memory_order_acquire)) {
+      return;
+    }
+    // Not holding pending_writes_mutex_ while invoking the callbacks, which
+    // may be waiting for a writer that has faulted, and is waiting for the
+    // thread of the watch.
+    std::vector<void*> pages;
+    {
+      std::lock_guard<std::mutex> lock(pending_writes_mutex_);
+      pages.swap(pending_writes_);
+      has_pending_writes_.store(false, std::memory_order_relaxed);
+    }
+    std::vector<void*> pages_not_handled;
+    for (void* page : pages) {
+      if (!callback_(context_, page, may_wait)) {
+        pages_not_handled.push_back(page);
+      }
+    }
+    if (!pages_not_handled.empty()) {
+      std::lock_guard<std::mutex> lock(pending_writes_mutex_);
+      pending_writes_.insert(pending_writes_.end(), pages_not_handled.cbegin(),
+                             pages_not_handled.cend());
+      has_pending_writes_.store(true, std::memory_order_release);
+    }
+  }
+
+  void ThreadMain() {
+    xe::threading::set_name("Write Watch");
+
+    size_t page_size = xe::memory::page_size();
+    pollfd poll_fds[2] = {{userfaultfd_, POLLIN, 0},
+                          {shutdown_eventfd_, POLLIN, 0}};
+    uffd_msg messages[16];
+    while (true) {
+      // Retrying the writes that could not be handled without waiting
+      // periodically until they're handled here or by ProcessPendingWrites.
+      int poll_result = poll(
+          poll_fds, 2,
+          has_pending_writes_.load(std::memory_order_relaxed) ? 1 : -1);
+      if (poll_result < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        break;
+      }
+      if (poll_fds[1].revents) {
+        break;
+      }
+      ProcessPendingWrites(false);
+      if (!poll_fds[0].revents) {
+        continue;
+      }
+      ssize_t read_size = read(userfaultfd_, messages, sizeof(messages));
+      if (read_size <= 0) {
+        continue;
+      }
+      for (size_t i = 0; i < size_t(read_size) / sizeof(uffd_msg); ++i) {
+        const uffd_msg& message = messages[i];
+        if (message.event != UFFD_EVENT_PAGEFAULT ||
+            !(message.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP)) {
+          continue;
+        }
+        void* page = reinterpret_cast<void*>(
+            uintptr_t(message.arg.pagefault.address) & ~(page_size - 1));
+        if (!callback_(context_, page, false)) {
+          // Before resuming the writer, so the write is pending by the time
+          // its result can be observed.
+          std::lock_guard<std::mutex> lock(pending_writes_mutex_);
+          pending_writes_.push_back(page);
+          has_pending_writes_.store(true, std::memory_order_release);
+        }
+        // Resuming the writer, also in case the callback has left the page
+        // protected.
+        Protect(page, page_size, false);
+      }
+    }
+  }
+
+  int userfaultfd_;
+  int shutdown_eventfd_;
+  WriteCallback callback_;
+  void* context_;
+  std::thread thread_;
+
+  std::mutex pending_writes_mutex_;
+  std::vector<void*> pending_writes_;
+  std::atomic<bool> has_pending_writes_ = false;
+};
+
+std::unique_ptr<WriteWatch> WriteWatch::Create(WriteCallback callback,
+                                              void* context) {
+  // Not limited to the user mode (UFFD_USER_MODE_ONLY), as system calls
+  // writing to the protected pages would fail with EFAULT instead of faulting.
+  // Without the permission to handle kernel-mode faults (CAP_SYS_PTRACE or
+  // vm.unprivileged_userfaultfd), protection is changed with mprotect.
+  int userfaultfd = int(syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK));
+  if (userfaultfd < 0) {
+    return nullptr;
+  }
+  // Pages not written yet when protected must be protected too.
+  uffdio_api api = {};
+  api.api = UFFD_API;
+  api.features = UFFD_FEATURE_PAGEFAULT_FLAG_WP | UFFD_FEATURE_WP_UNPOPULATED;
+  if (ioctl(userfaultfd, UFFDIO_API, &api) != 0) {
+    close(userfaultfd);
+    return nullptr;
+  }
+  int shutdown_eventfd = eventfd(0, EFD_CLOEXEC);
+  if (shutdown_eventfd < 0) {
+    close(userfaultfd);
+    return nullptr;
+  }
+  return std::make_unique<UserfaultfdWriteWatch>(userfaultfd, shutdown_eventfd,
+                                                 callback, context);
+}
+#else
+std::unique_ptr<WriteWatch> WriteWatch::Create(WriteCallback callback,
+                                              void* context) {
+  return nullptr;
+}
+#endif  // XE_PLATFORM_LINUX && defined(UFFDIO_WRITEPROTECT)
+
 FileMappingHandle CreateFileMappingHandle(const std::filesystem::path& path,
                                           size_t length, PageAccess access,
                                           bool commit) {
@@ -210,6 +210,22 @@ bool QueryProtect(void* base_address, size_t& length, PageAccess& access_out) {
   return true;
 }
 
+// Large pages on Windows can't be reserved and committed separately or mapped
+// from a section that isn't entirely committed, and need the "Lock pages in
+// memory" privilege.
+size_t huge_page_size() { return 0; }
+
+bool AdviseHugePages(void* base_address, size_t length) { return false; }
+
+size_t QueryHugePageBackedLength(const void* base_address, size_t length) {
+  return 0;
+}
+
+std::unique_ptr<WriteWatch> WriteWatch::Create(WriteCallback callback,
+                                              void* context) {
+  return nullptr;
+}
+
 FileMappingHandle CreateFileMappingHandle(const std::filesystem::path& path,
                                           size_t length, PageAccess access,
                                           bool commit) {
@@ -0,0 +1,90 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/lockfree_read_map.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace base {
+namespace test {
+
+TEST_CASE("lockfree_read_map insert, find and erase", "[lockfree_read_map]") {
+  lockfree_read_map<uint32_t> map;
+  std::vector<uint32_t> values(10000);
+  REQUIRE(map.find(0) == nullptr);
+
+  // Enough keys to grow the table several times, including key 0.
+  for (uint32_t i = 0; i < values.size(); ++i) {
+    values[i] = i;
+    map.insert_or_assign(0x82000000 + i * 4, &values[i]);
+  }
+  map.insert_or_assign(0, &values[1]);
+  for (uint32_t i = 0; i < values.size(); ++i) {
+    REQUIRE(map.find(0x82000000 + i * 4) == &values[i]);
+  }
+  REQUIRE(map.find(0) == &values[1]);
+  REQUIRE(map.find(0x82000002) == nullptr);
+  REQUIRE(map.find(0x82000000 + uint32_t(values.size()) * 4) == nullptr);
+
+  map.insert_or_assign(0x82000000, &values[2]);
+  REQUIRE(map.find(0x82000000) == &values[2]);
+
+  map.erase(0x82000004);
+  REQUIRE(map.find(0x82000004) == nullptr);
+  REQUIRE(map.find(0x82000008) == &values[2]);
+  map.insert_or_assign(0x82000004, &values[3]);
+  REQUIRE(map.find(0x82000004) == &values[3]);
+}
+
+TEST_CASE("lockfree_read_map concurrent find", "[lockfree_read_map]") {
+  lockfree_read_map<uint32_t> map;
+  constexpr uint32_t kCount = 50000;
+  std::vector<uint32_t> values(kCount);
+  std::atomic<uint32_t> inserted_count{0};
+  std::atomic<bool> mismatch{false};
+
+  // Readers must see either nothing or the correct value for every key, and
+  // always see keys inserted before they started looking, while the table is
+  // growing under them.
+  std::vector<std::thread> readers;
+  for (uint32_t t = 0; t < 3; ++t) {
+    readers.emplace_back([&]() {
+      while (true) {
+        uint32_t count = inserted_count.load(std::memory_order_acquire);
+        for (uint32_t i = 0; i < kCount; ++i) {
+          uint32_t* value = map.find(0x82000000 + i * 4);
+          if ((i < count && value != &values[i]) ||
+              (value && value != &values[i])) {
+            mismatch = true;
+          }
+        }
+        if (count == kCount) {
+          break;
+        }
+      }
+    });
+  }
+  for (uint32_t i = 0; i < kCount; ++i) {
+    map.insert_or_assign(0x82000000 + i * 4, &values[i]);
+    inserted_count.store(i + 1, std::memory_order_release);
+  }
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  REQUIRE_FALSE(mismatch);
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
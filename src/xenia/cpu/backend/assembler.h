@@ -41,6 +41,10 @@ class Assembler {
                         uint32_t debug_info_flags,
                         std::unique_ptr<FunctionDebugInfo> debug_info) = 0;
 
+  // Floating-point mode switches in the code of the last assembled function,
+  // for backends that have to switch between the FPU and VMX modes.
+  virtual uint32_t mode_switch_count() const { return 0; }
+
  protected:
   Backend* backend_;
 };
@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_BACKEND_BACKEND_H_
 #define XENIA_CPU_BACKEND_BACKEND_H_
 
+#include <filesystem>
 #include <memory>
 
 #include "xenia/cpu/backend/machine_info.h"
@@ -63,6 +64,18 @@ class Backend {
   virtual std::unique_ptr<GuestFunction> CreateGuestFunction(
       Module* module, uint32_t address) = 0;
 
+  // Opens the persistent storage of code translated from the module, if the
+  // backend supports it. module_cache_path is the directory where data
+  // specific to the module image is cached.
+  virtual void InitializeModuleCodeStorage(
+      Module* module, const std::filesystem::path& module_cache_path) {}
+  // Defines the function from code stored by a previous run instead of
+  // translating it. Returns false if there's no valid stored code for it.
+  virtual bool LoadStoredFunction(GuestFunction* function) { return false; }
+  // Called when the function at the address is removed, for the backend to
+  // stop entering its code directly from other functions.
+  virtual void UnlinkGuestFunction(uint32_t guest_address) {}
+
   // Calculates the next host instruction based on the current thread state and
   // current PC. This will look for branches and other control flow
   // instructions.
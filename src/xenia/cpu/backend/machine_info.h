@@ -18,6 +18,8 @@ namespace backend {
 
 struct MachineInfo {
   bool supports_extended_load_store;
+  // Locals may be assigned registers that are kept over several blocks.
+  bool supports_register_locals;
 
   struct RegisterSet {
     enum Types {
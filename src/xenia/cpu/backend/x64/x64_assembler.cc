@@ -62,6 +62,10 @@ bool X64Assembler::Initialize() {
   return true;
 }
 
+uint32_t X64Assembler::mode_switch_count() const {
+  return emitter_->mxcsr_switch_count();
+}
+
 void X64Assembler::Reset() {
   string_buffer_.Reset();
   Assembler::Reset();
@@ -78,22 +82,24 @@ bool X64Assembler::Assemble(GuestFunction* function, HIRBuilder* builder,
   // Lower HIR -> x64.
   void* machine_code = nullptr;
   size_t code_size = 0;
+  auto code_version = std::make_unique<GuestFunction::CodeVersion>();
   if (!emitter_->Emit(function, builder, debug_info_flags, debug_info.get(),
-                      &machine_code, &code_size, &function->source_map())) {
+                      &machine_code, &code_size, &code_version->source_map)) {
     return false;
   }
 
   // Stash generated machine code.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmMachineCode) {
-    DumpMachineCode(machine_code, code_size, function->source_map(),
+    DumpMachineCode(machine_code, code_size, code_version->source_map,
                     &string_buffer_);
     debug_info->set_machine_code_disasm(xe_strdup(string_buffer_.buffer()));
     string_buffer_.Reset();
   }
 
   function->set_debug_info(std::move(debug_info));
-  static_cast<X64Function*>(function)->Setup(
-      reinterpret_cast<uint8_t*>(machine_code), code_size);
+  code_version->machine_code = reinterpret_cast<uint8_t*>(machine_code);
+  code_version->machine_code_length = code_size;
+  function->PublishCodeVersion(std::move(code_version));
 
   // Install into indirection table.
   uint64_t host_address = reinterpret_cast<uint64_t>(machine_code);
@@ -11,11 +11,18 @@
 
 #include <stddef.h>
 #include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <type_traits>
 #include "third_party/capstone/include/capstone/capstone.h"
 #include "third_party/capstone/include/capstone/x86.h"
 
+#include "build/version.h"
 #include "xenia/base/exception_handler.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/platform_amd64.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/cpu/backend/x64/x64_assembler.h"
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/backend/x64/x64_emitter.h"
@@ -23,6 +30,7 @@
 #include "xenia/cpu/backend/x64/x64_sequences.h"
 #include "xenia/cpu/backend/x64/x64_stack_layout.h"
 #include "xenia/cpu/breakpoint.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/cpu/stack_walker.h"
 #include "xenia/cpu/xex_module.h"
@@ -41,6 +49,14 @@ DEFINE_bool(enable_host_guest_stack_synchronization, true,
             "and checks for reentry at return sites. Has slight performance "
             "impact, but fixes crashes in games that use setjmp/longjmp.",
             "x64");
+
+DEFINE_bool(x64_code_storage, false,
+            "Store the machine code emitted for guest functions in the cache "
+            "directory of the title and reuse it on subsequent runs instead of "
+            "translating the functions again. Stored code is discarded if the "
+            "emulator build, the host CPU features or any CPU/x64 option "
+            "changes.",
+            "x64");
 #if XE_X64_PROFILER_AVAILABLE == 1
 DECLARE_bool(instrument_call_times);
 #endif
@@ -64,6 +80,7 @@ class X64HelperEmitter : public X64Emitter {
   HostToGuestThunk EmitHostToGuestThunk();
   GuestToHostThunk EmitGuestToHostThunk();
   ResolveFunctionThunk EmitResolveFunctionThunk();
+  void* EmitCallSiteThunk();
   void* EmitGuestAndHostSynchronizeStackHelper();
   // 1 for loading byte, 2 for halfword and 4 for word.
   // these specialized versions save space in the caller
@@ -236,6 +253,7 @@ bool X64Backend::Initialize(Processor* processor) {
   } else {
     machine_info_.supports_extended_load_store = false;
   }
+  machine_info_.supports_register_locals = true;
 
   auto& gprs = machine_info_.register_sets[0];
   gprs.id = 0;
@@ -267,6 +285,8 @@ bool X64Backend::Initialize(Processor* processor) {
   host_to_guest_thunk_ = thunk_emitter.EmitHostToGuestThunk();
   guest_to_host_thunk_ = thunk_emitter.EmitGuestToHostThunk();
   resolve_function_thunk_ = thunk_emitter.EmitResolveFunctionThunk();
+  call_site_thunk_ = thunk_emitter.EmitCallSiteThunk();
+  code_cache_->set_call_site_thunk(call_site_thunk_);
 
   if (cvars::enable_host_guest_stack_synchronization) {
     synchronize_guest_and_host_stack_helper_ =
@@ -299,6 +319,8 @@ bool X64Backend::Initialize(Processor* processor) {
   // Allocate some special indirections.
   code_cache_->CommitExecutableRange(0x9FFF0000, 0x9FFFFFFF);
 
+  code_storage_fingerprint_ = CalculateCodeStorageFingerprint();
+
   // Setup exception callback
   ExceptionHandler::Install(&ExceptionCallbackThunk, this);
   if (cvars::record_mmio_access_exceptions) {
@@ -337,6 +359,222 @@ std::unique_ptr<GuestFunction> X64Backend::CreateGuestFunction(
   return std::make_unique<X64Function>(module, address);
 }
 
+template <typename T>
+static bool HashCommandVarValue(XXH3_state_t* state, cvar::IConfigVar* var) {
+  auto command_var = dynamic_cast<cvar::CommandVar<T>*>(var);
+  if (!command_var) {
+    return false;
+  }
+  const T& value = *command_var->current_value();
+  if constexpr (std::is_same_v<T, std::string>) {
+    XXH3_64bits_update(state, value.data(), value.size());
+  } else {
+    XXH3_64bits_update(state, &value, sizeof(value));
+  }
+  return true;
+}
+
+uint64_t X64Backend::CalculateCodeStorageFingerprint() const {
+  // Increment this to invalidate all stored code.
+  static constexpr uint32_t kStorageVersion = 2;
+
+  // Options that affect the emitted code.
+  static const char* const kCodegenCvars[] = {
+      "align_all_basic_blocks",
+      "break_condition_gpr",
+      "break_condition_op",
+      "break_condition_truncate",
+      "break_condition_value",
+      "break_on_debugbreak",
+      "break_on_instruction",
+      "break_on_unimplemented_instructions",
+      "clock_no_scaling",
+      "clock_source_raw",
+      "dead_store_elimination",
+      "debug",
+      "debugprint_trap_log",
+      "delay_via_maybeyield",
+      "detect_idle_loops",
+      "disable_prefetch_and_cachecontrol",
+      "elide_e0_check",
+      "emit_mmio_aware_stores_for_recorded_exception_addresses",
+      "emit_source_annotations",
+      "enable_host_guest_stack_synchronization",
+      "enable_incorrect_roundingmode_behavior",
+      "enable_rmw_context_merging",
+      "fast_reserved_ops",
+      "full_optimization_even_with_debug",
+      "global_register_allocation",
+      "hot_path_layout",
+      "host_crt_routines",
+      "ignore_trap_instructions",
+      "ignore_undefined_externs",
+      "inline_loadclock",
+      "inline_max_instructions",
+      "inline_mmio_access",
+      "instrument_call_times",
+      "link_guest_calls",
+      "loop_optimization",
+      "max_stackpoints",
+      "mxcsr_mode_scheduling",
+      "no_reserved_ops",
+      "no_round_to_single",
+      "permit_float_constant_evaluation",
+      "pvr",
+      "store_all_context_values",
+      "tiered_compilation",
+      "use_fast_dot_product",
+      "x64_extension_mask",
+      "xop_arithmetic_right_shifts",
+      "xop_compares",
+      "xop_left_shifts",
+      "xop_right_shifts",
+      "xop_rotates",
+  };
+
+  XXH3_state_t hash_state;
+  XXH3_64bits_reset(&hash_state);
+  XXH3_64bits_update(&hash_state, &kStorageVersion, sizeof(kStorageVersion));
+  XXH3_64bits_update(&hash_state, XE_BUILD_BRANCH,
+                     std::strlen(XE_BUILD_BRANCH));
+  XXH3_64bits_update(&hash_state, XE_BUILD_COMMIT,
+                     std::strlen(XE_BUILD_COMMIT));
+  XXH3_64bits_update(&hash_state, XE_BUILD_DATE, std::strlen(XE_BUILD_DATE));
+  // Local builds of the same commit may differ, and stored code refers to
+  // functions and data in the executable by their offsets within it, so
+  // identify the executable itself too.
+  std::filesystem::path executable_path = xe::filesystem::GetExecutablePath();
+  std::error_code error_code;
+  uint64_t executable_size =
+      std::filesystem::file_size(executable_path, error_code);
+  int64_t executable_write_time =
+      std::filesystem::last_write_time(executable_path, error_code)
+          .time_since_epoch()
+          .count();
+  XXH3_64bits_update(&hash_state, &executable_size, sizeof(executable_size));
+  XXH3_64bits_update(&hash_state, &executable_write_time,
+                     sizeof(executable_write_time));
+
+  // Thunks, helpers and emitter constants are referenced by their absolute
+  // addresses. They're at fixed addresses in the code cache, but stored code
+  // is only valid while they stay the same.
+  const uintptr_t host_addresses[] = {
+      uintptr_t(processor()->memory()->virtual_membase()),
+      emitter_data_,
+      uintptr_t(host_to_guest_thunk_),
+      uintptr_t(guest_to_host_thunk_),
+      uintptr_t(resolve_function_thunk_),
+      uintptr_t(synchronize_guest_and_host_stack_helper_),
+      uintptr_t(synchronize_guest_and_host_stack_helper_size8_),
+      uintptr_t(synchronize_guest_and_host_stack_helper_size16_),
+      uintptr_t(synchronize_guest_and_host_stack_helper_size32_),
+      uintptr_t(try_acquire_reservation_helper_),
+      uintptr_t(reserved_store_32_helper),
+      uintptr_t(reserved_store_64_helper),
+      uintptr_t(vrsqrtefp_vector_helper),
+      uintptr_t(vrsqrtefp_scalar_helper),
+      uintptr_t(frsqrtefp_helper),
+  };
+  XXH3_64bits_update(&hash_state, host_addresses, sizeof(host_addresses));
+
+  uint64_t feature_flags = amd64::GetFeatureFlags();
+  XXH3_64bits_update(&hash_state, &feature_flags, sizeof(feature_flags));
+
+  if (cvar::ConfigVars) {
+    for (const char* name : kCodegenCvars) {
+      auto it = cvar::ConfigVars->find(name);
+      assert_true(it != cvar::ConfigVars->end());
+      if (it == cvar::ConfigVars->end()) {
+        continue;
+      }
+      cvar::IConfigVar* var = it->second;
+      XXH3_64bits_update(&hash_state, it->first.data(), it->first.size());
+      HashCommandVarValue<bool>(&hash_state, var) ||
+          HashCommandVarValue<int32_t>(&hash_state, var) ||
+          HashCommandVarValue<uint32_t>(&hash_state, var) ||
+          HashCommandVarValue<int64_t>(&hash_state, var) ||
+          HashCommandVarValue<uint64_t>(&hash_state, var) ||
+          HashCommandVarValue<double>(&hash_state, var) ||
+          HashCommandVarValue<std::string>(&hash_state, var);
+    }
+  }
+
+  return XXH3_64bits_digest(&hash_state);
+}
+
+void X64Backend::InitializeModuleCodeStorage(
+    Module* module, const std::filesystem::path& module_cache_path) {
+  if (!cvars::x64_code_storage) {
+    return;
+  }
+  // Instrumented code can't be reused.
+  if (cvars::disassemble_functions || cvars::trace_functions ||
+      cvars::trace_function_coverage || cvars::trace_function_references ||
+      cvars::trace_function_data) {
+    return;
+  }
+  code_cache_->InitializeCodeStorage(
+      module, module_cache_path / "x64_code.bin", code_storage_fingerprint_);
+}
+
+uint64_t X64Backend::HashGuestFunction(Module* module, uint32_t address,
+                                       uint32_t end_address) {
+  XXH3_state_t hash_state;
+  XXH3_64bits_reset(&hash_state);
+  // end_address is the address of the last instruction.
+  uint32_t length = end_address + 4 - address;
+  XXH3_64bits_update(&hash_state,
+                     processor()->memory()->TranslateVirtual(address), length);
+  // The translation also depends on what was recorded about the instructions
+  // (MMIO accesses, return sites), but not on whether and how often they were
+  // resolved.
+  auto xex_module = dynamic_cast<XexModule*>(module);
+  if (xex_module) {
+    for (uint32_t i = address; i <= end_address; i += 4) {
+      InfoCacheFlags* flags = xex_module->GetInstructionAddressFlags(i);
+      InfoCacheFlags hashed_flags = {};
+      if (flags) {
+        hashed_flags = *flags;
+        hashed_flags.was_resolved = 0;
+        hashed_flags.resolve_count = 0;
+      }
+      XXH3_64bits_update(&hash_state, &hashed_flags, sizeof(hashed_flags));
+    }
+  }
+  return XXH3_64bits_digest(&hash_state);
+}
+
+bool X64Backend::LoadStoredFunction(GuestFunction* function) {
+  Module* module = function->module();
+  if (!code_cache_->has_code_storage(module)) {
+    return false;
+  }
+  uint32_t end_address;
+  if (!code_cache_->LookupStoredGuestCode(function, end_address)) {
+    return false;
+  }
+  uint64_t guest_hash =
+      HashGuestFunction(module, function->address(), end_address);
+  void* code_execute_address;
+  size_t code_size;
+  auto code_version = std::make_unique<GuestFunction::CodeVersion>();
+  if (!code_cache_->PlaceStoredGuestCode(function, guest_hash,
+                                         code_execute_address, code_size,
+                                         code_version->source_map)) {
+    return false;
+  }
+  code_version->machine_code = reinterpret_cast<uint8_t*>(code_execute_address);
+  code_version->machine_code_length = code_size;
+  function->PublishCodeVersion(std::move(code_version));
+  // Only code translated with all optimizations is stored.
+  function->set_tier(GuestFunction::Tier::kOptimized);
+  return true;
+}
+
+void X64Backend::UnlinkGuestFunction(uint32_t guest_address) {
+  code_cache_->UnlinkCallSites(guest_address);
+}
+
 uint64_t ReadCapstoneReg(HostThreadContext* context, x86_reg reg) {
   switch (reg) {
     case X86_REG_RAX:
@@ -784,6 +1022,29 @@ ResolveFunctionThunk X64HelperEmitter::EmitResolveFunctionThunk() {
   void* fn = Emplace(func_info);
   return (ResolveFunctionThunk)fn;
 }
+void* X64HelperEmitter::EmitCallSiteThunk() {
+  // ebx = target PPC address
+  // rcx = guest return address
+
+  _code_offsets code_offsets = {};
+
+  code_offsets.prolog = getSize();
+  code_offsets.prolog_stack_alloc = getSize();
+  code_offsets.body = getSize();
+
+  // The indirection table holds either the code of the target or the
+  // ResolveFunction thunk, both expecting the same registers as we do.
+  mov(eax, dword[ebx]);
+
+  code_offsets.epilog = getSize();
+
+  jmp(rax);
+
+  code_offsets.tail = getSize();
+
+  return EmitCurrentForOffsets(code_offsets);
+}
+
 // r11 = size of callers stack, r8 = return address w/ adjustment
 // i'm not proud of this code, but it shouldn't be executed frequently at all
 void* X64HelperEmitter::EmitGuestAndHostSynchronizeStackHelper() {
@@ -133,6 +133,9 @@ class X64Backend : public Backend {
   ResolveFunctionThunk resolve_function_thunk() const {
     return resolve_function_thunk_;
   }
+  // Initial target of linkable guest call sites, going through the
+  // indirection table.
+  void* call_site_thunk() const { return call_site_thunk_; }
 
   void* synchronize_guest_and_host_stack_helper() const {
     return synchronize_guest_and_host_stack_helper_;
@@ -156,6 +159,15 @@ class X64Backend : public Backend {
   std::unique_ptr<GuestFunction> CreateGuestFunction(Module* module,
                                                      uint32_t address) override;
 
+  void InitializeModuleCodeStorage(
+      Module* module, const std::filesystem::path& module_cache_path) override;
+  bool LoadStoredFunction(GuestFunction* function) override;
+  void UnlinkGuestFunction(uint32_t guest_address) override;
+  // Hash of the guest state the code of the function is translated from - the
+  // instructions and the recorded per-instruction flags.
+  uint64_t HashGuestFunction(Module* module, uint32_t address,
+                             uint32_t end_address);
+
   uint64_t CalculateNextHostInstruction(ThreadDebugInfo* thread_info,
                                         uint64_t current_pc) override;
 
@@ -189,16 +201,20 @@ class X64Backend : public Backend {
 #endif
  private:
   static bool ExceptionCallbackThunk(Exception* ex, void* data);
+  uint64_t CalculateCodeStorageFingerprint() const;
   bool ExceptionCallback(Exception* ex);
 
   uintptr_t capstone_handle_ = 0;
 
   std::unique_ptr<X64CodeCache> code_cache_;
   uintptr_t emitter_data_ = 0;
+  // Identifies everything besides the guest code that stored code depends on.
+  uint64_t code_storage_fingerprint_ = 0;
 
   HostToGuestThunk host_to_guest_thunk_;
   GuestToHostThunk guest_to_host_thunk_;
   ResolveFunctionThunk resolve_function_thunk_;
+  void* call_site_thunk_ = nullptr;
   void* synchronize_guest_and_host_stack_helper_ = nullptr;
 
   // loads stack sizes 1 byte, 2 bytes or 4 bytes
@@ -9,6 +9,7 @@
 
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 
@@ -19,11 +20,14 @@
 
 #include "third_party/fmt/include/fmt/format.h"
 #include "xenia/base/assert.h"
+#include "xenia/base/atomic.h"
 #include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/literals.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/module.h"
 
@@ -34,9 +38,52 @@ namespace x64 {
 
 using namespace xe::literals;
 
+namespace {
+// 'XJIT'.
+constexpr uint32_t kCodeStorageMagic = 0x54494A58;
+// Increment when the layout of the stored records changes.
+constexpr uint32_t kCodeStorageVersion = 2;
+
+struct CodeStorageFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t fingerprint;
+};
+
+// Followed by the machine code (padded to 8 bytes), the relocations and the
+// source map.
+struct StoredFunctionHeader {
+  uint32_t guest_address;
+  uint32_t guest_end_address;
+  uint64_t guest_hash;
+  uint32_t code_size;
+  uint32_t relocation_count;
+  uint32_t source_map_count;
+  uint32_t reserved;
+  EmitFunctionInfo func_info;
+  // Hash of the payload, seeded with the hash of the header up to this field.
+  uint64_t record_hash;
+};
+
+size_t GetStoredFunctionPayloadSize(const StoredFunctionHeader& header) {
+  return xe::round_up(size_t(header.code_size), size_t(8)) +
+         sizeof(CodeRelocation) * header.relocation_count +
+         sizeof(SourceMapEntry) * header.source_map_count;
+}
+
+uint64_t HashStoredFunction(const StoredFunctionHeader& header,
+                            const uint8_t* payload) {
+  return XXH3_64bits_withSeed(
+      payload, GetStoredFunctionPayloadSize(header),
+      XXH3_64bits(&header, offsetof(StoredFunctionHeader, record_hash)));
+}
+}  // namespace
+
 X64CodeCache::X64CodeCache() = default;
 
 X64CodeCache::~X64CodeCache() {
+  ShutdownCodeStorage();
+
   if (indirection_table_base_) {
     xe::memory::DeallocFixed(indirection_table_base_, 0,
                              xe::memory::DeallocationType::kRelease);
@@ -136,9 +183,112 @@ void X64CodeCache::AddIndirection(uint32_t guest_address,
     return;
   }
 
+  auto global_lock = global_critical_region_.Acquire();
+
   uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
       indirection_table_base_ + (guest_address - kIndirectionTableBase));
   *indirection_slot = host_address;
+
+  auto call_sites_it = call_sites_.find(guest_address);
+  if (call_sites_it != call_sites_.end()) {
+    for (uint8_t* rel32_execute_address : call_sites_it->second) {
+      LinkCallSite(rel32_execute_address, host_address);
+    }
+  }
+}
+
+void X64CodeCache::AddCallSites(uint32_t caller_guest_address,
+                                const void* code_execute_address,
+                                const std::vector<CallSite>& call_sites) {
+  if (!indirection_table_base_) {
+    return;
+  }
+
+  auto global_lock = global_critical_region_.Acquire();
+
+  // The caller is being given new code - threads still running the old code
+  // finish with it, but its call sites don't need to be linked anymore.
+  auto caller_it = caller_call_sites_.find(caller_guest_address);
+  if (caller_it != caller_call_sites_.end()) {
+    for (const auto& [callee_guest_address, rel32_execute_address] :
+         caller_it->second) {
+      auto call_sites_it = call_sites_.find(callee_guest_address);
+      if (call_sites_it == call_sites_.end()) {
+        continue;
+      }
+      auto& callee_call_sites = call_sites_it->second;
+      callee_call_sites.erase(std::remove(callee_call_sites.begin(),
+                                          callee_call_sites.end(),
+                                          rel32_execute_address),
+                              callee_call_sites.end());
+      if (callee_call_sites.empty()) {
+        call_sites_.erase(call_sites_it);
+      }
+    }
+    caller_call_sites_.erase(caller_it);
+  }
+
+  if (call_sites.empty()) {
+    return;
+  }
+  auto& caller_call_sites = caller_call_sites_[caller_guest_address];
+  for (const CallSite& call_site : call_sites) {
+    uint8_t* rel32_execute_address =
+        const_cast<uint8_t*>(
+            reinterpret_cast<const uint8_t*>(code_execute_address)) +
+        call_site.code_offset;
+    call_sites_[call_site.guest_address].push_back(rel32_execute_address);
+    caller_call_sites.emplace_back(call_site.guest_address,
+                                   rel32_execute_address);
+    // The callee may have been placed while the caller was being emitted.
+    uint32_t host_address = *reinterpret_cast<const uint32_t*>(
+        indirection_table_base_ +
+        (call_site.guest_address - kIndirectionTableBase));
+    if (host_address != indirection_default_value_) {
+      LinkCallSite(rel32_execute_address, host_address);
+    }
+  }
+}
+
+void X64CodeCache::UnlinkCallSites(uint32_t guest_address) {
+  if (!indirection_table_base_) {
+    return;
+  }
+
+  auto global_lock = global_critical_region_.Acquire();
+
+  // The thunk the call sites are pointed to jumps through the indirection
+  // table, which must not lead to the removed code either.
+  uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
+      indirection_table_base_ + (guest_address - kIndirectionTableBase));
+  *indirection_slot = indirection_default_value_;
+
+  auto call_sites_it = call_sites_.find(guest_address);
+  if (call_sites_it == call_sites_.end()) {
+    return;
+  }
+  for (uint8_t* rel32_execute_address : call_sites_it->second) {
+    LinkCallSite(rel32_execute_address, uintptr_t(call_site_thunk_));
+  }
+}
+
+void X64CodeCache::LinkCallSite(uint8_t* rel32_execute_address,
+                                uintptr_t target) {
+  int64_t displacement =
+      int64_t(target) -
+      int64_t(uintptr_t(rel32_execute_address) + sizeof(int32_t));
+  if (displacement != int32_t(displacement)) {
+    // Not reachable directly, keep going through the indirection table.
+    displacement =
+        int64_t(uintptr_t(call_site_thunk_)) -
+        int64_t(uintptr_t(rel32_execute_address) + sizeof(int32_t));
+  }
+  // Other threads may be executing the code, but an aligned 4 byte store is
+  // seen by them either entirely or not at all.
+  auto rel32_write_address = reinterpret_cast<volatile int32_t*>(
+      generated_code_write_base_ +
+      (rel32_execute_address - generated_code_execute_base_));
+  xe::atomic_exchange(int32_t(displacement), rel32_write_address);
 }
 
 void X64CodeCache::CommitExecutableRange(uint32_t guest_low,
@@ -170,11 +320,11 @@ void X64CodeCache::PlaceHostCode(uint32_t guest_address, void* machine_code,
                  code_execute_address_out, code_write_address_out);
 }
 
-void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
-                                  const EmitFunctionInfo& func_info,
-                                  GuestFunction* function_info,
-                                  void*& code_execute_address_out,
-                                  void*& code_write_address_out) {
+void X64CodeCache::PlaceGuestCode(
+    uint32_t guest_address, void* machine_code,
+    const EmitFunctionInfo& func_info, GuestFunction* function_info,
+    void*& code_execute_address_out, void*& code_write_address_out,
+    const std::vector<CodeRelocation>* relocations) {
   // Hold a lock while we bump the pointers up. This is important as the
   // unwind table requires entries AND code to be sorted in order.
   size_t low_mark;
@@ -249,6 +399,33 @@ void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
     // Copy code.
     std::memcpy(code_write_address, machine_code, func_info.code_size.total);
 
+    // Retarget branches to host code outside of the function, which are
+    // relative to where the code was originally placed, and references to the
+    // host executable, which may have been loaded at a different address.
+    if (relocations) {
+      for (const CodeRelocation& relocation : *relocations) {
+        uint8_t* field_write_address =
+            code_write_address + relocation.code_offset;
+        switch (relocation.type) {
+          case CodeRelocationType::kCodeCacheRel32: {
+            int64_t displacement =
+                int64_t(relocation.target) -
+                int64_t(reinterpret_cast<uintptr_t>(code_execute_address) +
+                        relocation.code_offset + sizeof(int32_t));
+            assert_true(displacement == int32_t(displacement));
+            xe::store(field_write_address, int32_t(displacement));
+          } break;
+          case CodeRelocationType::kHostImageAbs64:
+            assert_not_zero(host_image_size_);
+            xe::store(field_write_address,
+                      uint64_t(host_image_base_ + relocation.target));
+            break;
+          default:
+            assert_unhandled_case(relocation.type);
+        }
+      }
+    }
+
     // Fill unused slots with 0xCC
     std::memset(tail_write_address, 0xCC,
                 static_cast<size_t>(end_write_address - tail_write_address));
@@ -283,10 +460,8 @@ void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
   // Note that we do support code that doesn't have an indirection fixup, so
   // ignore those when we see them.
   if (guest_address && indirection_table_base_) {
-    uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
-        indirection_table_base_ + (guest_address - kIndirectionTableBase));
-    *indirection_slot =
-        uint32_t(reinterpret_cast<uint64_t>(code_execute_address));
+    AddIndirection(guest_address,
+                   uint32_t(reinterpret_cast<uint64_t>(code_execute_address)));
   }
 }
 
@@ -335,6 +510,212 @@ uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
   return uint32_t(uintptr_t(data_address));
 }
 
+bool X64CodeCache::InitializeCodeStorage(
+    const Module* module, const std::filesystem::path& storage_path,
+    uint64_t fingerprint) {
+  if (!xe::filesystem::CreateParentFolder(storage_path)) {
+    XELOGE(
+        "Failed to create the code storage directory, persistent code storage "
+        "will be disabled: {}",
+        xe::path_to_utf8(storage_path));
+    return false;
+  }
+  FILE* file = xe::filesystem::OpenFile(storage_path, "a+b");
+  if (!file) {
+    XELOGE(
+        "Failed to open the code storage file for writing, persistent code "
+        "storage will be disabled: {}",
+        xe::path_to_utf8(storage_path));
+    return false;
+  }
+
+  auto storage = std::make_unique<CodeStorage>();
+  storage->file = file;
+  CodeStorageFileHeader file_header;
+  if (fread(&file_header, sizeof(file_header), 1, file) &&
+      file_header.magic == kCodeStorageMagic &&
+      file_header.version == kCodeStorageVersion &&
+      file_header.fingerprint == fingerprint) {
+    xe::filesystem::Seek(file, 0, SEEK_END);
+    int64_t told_end = xe::filesystem::Tell(file);
+    std::vector<uint8_t>& stored_data = storage->stored_data;
+    if (told_end > int64_t(sizeof(file_header)) &&
+        xe::filesystem::Seek(file, int64_t(sizeof(file_header)), SEEK_SET)) {
+      stored_data.resize(size_t(told_end) - sizeof(file_header));
+      stored_data.resize(
+          fread(stored_data.data(), 1, stored_data.size(), file));
+    }
+    // Index the records until the end of the file or until a corrupted one is
+    // found, and drop everything after the last valid one. Later records for
+    // the same address supersede earlier ones.
+    size_t offset = 0;
+    while (stored_data.size() - offset >= sizeof(StoredFunctionHeader)) {
+      const auto& function_header =
+          *reinterpret_cast<const StoredFunctionHeader*>(stored_data.data() +
+                                                         offset);
+      size_t record_size = sizeof(StoredFunctionHeader) +
+                           GetStoredFunctionPayloadSize(function_header);
+      if (stored_data.size() - offset < record_size ||
+          HashStoredFunction(function_header,
+                             stored_data.data() + offset +
+                                 sizeof(StoredFunctionHeader)) !=
+              function_header.record_hash) {
+        break;
+      }
+      storage->stored_functions[function_header.guest_address] = offset;
+      offset += record_size;
+    }
+    stored_data.resize(offset);
+    xe::filesystem::TruncateStdioFile(file, sizeof(file_header) + offset);
+  } else {
+    xe::filesystem::TruncateStdioFile(file, 0);
+    file_header.magic = kCodeStorageMagic;
+    file_header.version = kCodeStorageVersion;
+    file_header.fingerprint = fingerprint;
+    fwrite(&file_header, sizeof(file_header), 1, file);
+  }
+
+  XELOGI("Code storage {}: {} stored functions",
+         xe::path_to_utf8(storage_path), storage->stored_functions.size());
+
+  std::lock_guard<xe_mutex> lock(code_storages_mutex_);
+  auto& module_storage = code_storages_[module];
+  if (module_storage) {
+    fclose(module_storage->file);
+  }
+  module_storage = std::move(storage);
+  return true;
+}
+
+void X64CodeCache::ShutdownCodeStorage() {
+  std::lock_guard<xe_mutex> lock(code_storages_mutex_);
+  if (code_storages_.empty()) {
+    return;
+  }
+  for (auto& it : code_storages_) {
+    std::lock_guard<xe_mutex> write_lock(it.second->write_mutex);
+    fclose(it.second->file);
+  }
+  code_storages_.clear();
+  XELOGI("Code storage: {} hits, {} misses, {} stale",
+         code_storage_hits_.load(), code_storage_misses_.load(),
+         code_storage_stale_.load());
+}
+
+X64CodeCache::CodeStorage* X64CodeCache::LookupCodeStorage(
+    const Module* module) {
+  std::lock_guard<xe_mutex> lock(code_storages_mutex_);
+  auto it = code_storages_.find(module);
+  return it != code_storages_.end() ? it->second.get() : nullptr;
+}
+
+bool X64CodeCache::has_code_storage(const Module* module) {
+  return LookupCodeStorage(module) != nullptr;
+}
+
+void X64CodeCache::StoreGuestCode(
+    GuestFunction* function, const void* machine_code,
+    const EmitFunctionInfo& func_info,
+    const std::vector<CodeRelocation>& relocations,
+    const std::vector<SourceMapEntry>& source_map, uint64_t guest_hash) {
+  CodeStorage* storage = LookupCodeStorage(function->module());
+  if (!storage) {
+    return;
+  }
+
+  StoredFunctionHeader function_header = {};
+  function_header.guest_address = function->address();
+  function_header.guest_end_address = function->end_address();
+  function_header.guest_hash = guest_hash;
+  function_header.code_size = uint32_t(func_info.code_size.total);
+  function_header.relocation_count = uint32_t(relocations.size());
+  function_header.source_map_count = uint32_t(source_map.size());
+  function_header.func_info = func_info;
+
+  std::vector<uint8_t> payload(GetStoredFunctionPayloadSize(function_header));
+  uint8_t* payload_ptr = payload.data();
+  std::memcpy(payload_ptr, machine_code, function_header.code_size);
+  payload_ptr += xe::round_up(size_t(function_header.code_size), size_t(8));
+  if (!relocations.empty()) {
+    std::memcpy(payload_ptr, relocations.data(),
+                sizeof(CodeRelocation) * relocations.size());
+    payload_ptr += sizeof(CodeRelocation) * relocations.size();
+  }
+  if (!source_map.empty()) {
+    std::memcpy(payload_ptr, source_map.data(),
+                sizeof(SourceMapEntry) * source_map.size());
+  }
+  function_header.record_hash =
+      HashStoredFunction(function_header, payload.data());
+
+  std::lock_guard<xe_mutex> lock(storage->write_mutex);
+  fwrite(&function_header, sizeof(function_header), 1, storage->file);
+  fwrite(payload.data(), 1, payload.size(), storage->file);
+}
+
+bool X64CodeCache::LookupStoredGuestCode(GuestFunction* function,
+                                         uint32_t& guest_end_address_out) {
+  CodeStorage* storage = LookupCodeStorage(function->module());
+  if (!storage) {
+    return false;
+  }
+  auto it = storage->stored_functions.find(function->address());
+  if (it == storage->stored_functions.end()) {
+    ++code_storage_misses_;
+    return false;
+  }
+  guest_end_address_out =
+      reinterpret_cast<const StoredFunctionHeader*>(
+          storage->stored_data.data() + it->second)
+          ->guest_end_address;
+  return true;
+}
+
+bool X64CodeCache::PlaceStoredGuestCode(
+    GuestFunction* function, uint64_t guest_hash,
+    void*& code_execute_address_out, size_t& code_size_out,
+    std::vector<SourceMapEntry>& source_map_out) {
+  CodeStorage* storage = LookupCodeStorage(function->module());
+  if (!storage) {
+    return false;
+  }
+  auto it = storage->stored_functions.find(function->address());
+  if (it == storage->stored_functions.end()) {
+    return false;
+  }
+  const uint8_t* record = storage->stored_data.data() + it->second;
+  const auto& function_header =
+      *reinterpret_cast<const StoredFunctionHeader*>(record);
+  if (function_header.guest_hash != guest_hash) {
+    // The guest code (or what's known about it) has changed since the code was
+    // stored.
+    ++code_storage_stale_;
+    return false;
+  }
+
+  const uint8_t* payload_ptr = record + sizeof(StoredFunctionHeader);
+  const uint8_t* machine_code = payload_ptr;
+  payload_ptr += xe::round_up(size_t(function_header.code_size), size_t(8));
+  auto relocations_ptr = reinterpret_cast<const CodeRelocation*>(payload_ptr);
+  std::vector<CodeRelocation> relocations(
+      relocations_ptr, relocations_ptr + function_header.relocation_count);
+  payload_ptr += sizeof(CodeRelocation) * function_header.relocation_count;
+  auto source_map_ptr = reinterpret_cast<const SourceMapEntry*>(payload_ptr);
+
+  function->set_end_address(function_header.guest_end_address);
+  source_map_out.assign(source_map_ptr,
+                        source_map_ptr + function_header.source_map_count);
+
+  void* code_write_address;
+  PlaceGuestCode(function_header.guest_address,
+                 const_cast<uint8_t*>(machine_code), function_header.func_info,
+                 function, code_execute_address_out, code_write_address,
+                 &relocations);
+  code_size_out = function_header.code_size;
+  ++code_storage_hits_;
+  return true;
+}
+
 GuestFunction* X64CodeCache::LookupFunction(uint64_t host_pc) {
   uint32_t key = uint32_t(host_pc - kGeneratedCodeExecuteBase);
   void* fn_entry = std::bsearch(
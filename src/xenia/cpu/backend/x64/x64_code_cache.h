@@ -13,11 +13,15 @@
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
+#include <filesystem>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "xenia/base/assert.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/backend/code_cache.h"
@@ -39,6 +43,34 @@ struct EmitFunctionInfo {
   size_t stack_size;
 };
 
+enum class CodeRelocationType : uint32_t {
+  // rel32 branch displacement targeting a thunk or a helper in the code cache,
+  // which are at the same address in every run, but must be recomputed when
+  // the code is placed at a different address. target is the absolute address.
+  kCodeCacheRel32,
+  // 64-bit immediate holding the address of a function or data in the host
+  // executable, which may be loaded at a different address in every run. target
+  // is the offset from the base of the executable image.
+  kHostImageAbs64,
+};
+
+// A host address referenced by emitted code that must be fixed up when the code
+// is loaded from the persistent code storage.
+struct CodeRelocation {
+  uint32_t code_offset;  // Offset of the rel32 or imm64 field.
+  CodeRelocationType type;
+  uint64_t target;
+};
+static_assert_size(CodeRelocation, 16);
+
+// A rel32 displacement of a call or a jump to a guest function with a static
+// address, linked directly to the code of the callee once it's known. Aligned
+// to 4 bytes so it can be replaced atomically while the code may be running.
+struct CallSite {
+  uint32_t code_offset;    // Offset of the rel32 field from the code start.
+  uint32_t guest_address;  // Guest function being called.
+};
+
 class X64CodeCache : public CodeCache {
  public:
   ~X64CodeCache() override;
@@ -53,14 +85,33 @@ class X64CodeCache : public CodeCache {
   }
   size_t total_size() const override { return kGeneratedCodeSize; }
 
-  // TODO(benvanik): ELF serialization/etc
   // TODO(benvanik): keep track of code blocks
   // TODO(benvanik): padding/guards/etc
 
+  // Whether the address is inside the host executable image, which code may
+  // refer to only through kHostImageAbs64 relocations.
+  bool IsHostImageAddress(const void* address) const {
+    return uintptr_t(address) - host_image_base_ < host_image_size_;
+  }
+  uintptr_t host_image_base() const { return host_image_base_; }
+
   bool has_indirection_table() { return indirection_table_base_ != nullptr; }
   void set_indirection_default(uint32_t default_value);
+  // Also links the call sites of the function to the new code.
   void AddIndirection(uint32_t guest_address, uint32_t host_address);
 
+  // Call sites initially branch to the thunk, which reads the target from the
+  // indirection table, and are linked to whatever the indirection table holds
+  // for their target from then on.
+  void set_call_site_thunk(void* thunk) { call_site_thunk_ = thunk; }
+  // Replaces the call sites of the previous code of the caller, if any.
+  void AddCallSites(uint32_t caller_guest_address,
+                    const void* code_execute_address,
+                    const std::vector<CallSite>& call_sites);
+  // Makes the call sites of the function and its indirection table entry go
+  // through the resolve thunk again until it's given new code.
+  void UnlinkCallSites(uint32_t guest_address);
+
   void CommitExecutableRange(uint32_t guest_low, uint32_t guest_high);
 
   void PlaceHostCode(uint32_t guest_address, void* machine_code,
@@ -71,11 +122,44 @@ class X64CodeCache : public CodeCache {
                       const EmitFunctionInfo& func_info,
                       GuestFunction* function_info,
                       void*& code_execute_address_out,
-                      void*& code_write_address_out);
+                      void*& code_write_address_out,
+                      const std::vector<CodeRelocation>* relocations = nullptr);
   uint32_t PlaceData(const void* data, size_t length);
 
   GuestFunction* LookupFunction(uint64_t host_pc) override;
 
+  // Persistent storage of emitted guest code, one file per module. The
+  // fingerprint covers everything the emitted code depends on besides the
+  // guest code itself (host addresses, codegen options), and the stored code
+  // is discarded if it doesn't match.
+  bool InitializeCodeStorage(const Module* module,
+                             const std::filesystem::path& storage_path,
+                             uint64_t fingerprint);
+  void ShutdownCodeStorage();
+  bool has_code_storage(const Module* module);
+  // Appends the function's placed code to the storage of its module. guest_hash
+  // identifies the guest state the code was translated from.
+  void StoreGuestCode(GuestFunction* function, const void* machine_code,
+                      const EmitFunctionInfo& func_info,
+                      const std::vector<CodeRelocation>& relocations,
+                      const std::vector<SourceMapEntry>& source_map,
+                      uint64_t guest_hash);
+  // Returns whether there's stored code for the function, and the end address
+  // it was translated with, needed to hash the guest state to validate it.
+  bool LookupStoredGuestCode(GuestFunction* function,
+                             uint32_t& guest_end_address_out);
+  // Places stored code for the function if there is an entry for it translated
+  // from the same guest state. On success, the end address of the function is
+  // restored as well.
+  bool PlaceStoredGuestCode(GuestFunction* function, uint64_t guest_hash,
+                            void*& code_execute_address_out,
+                            size_t& code_size_out,
+                            std::vector<SourceMapEntry>& source_map_out);
+
+  uint64_t code_storage_hits() const { return code_storage_hits_; }
+  uint64_t code_storage_misses() const { return code_storage_misses_; }
+  uint64_t code_storage_stale() const { return code_storage_stale_; }
+
  protected:
   // All executable code falls within 0x80000000 to 0x9FFFFFFF, so we can
   // only map enough for lookups within that range.
@@ -96,6 +180,15 @@ class X64CodeCache : public CodeCache {
   //chrispy: raised this, some games that were compiled with low optimization levels can exceed this
   static const size_t kMaximumFunctionCount = 1000000;
 
+  struct CodeStorage {
+    FILE* file = nullptr;
+    // Contents of the file read at initialization, and offsets of the latest
+    // valid record for each guest address within it.
+    std::vector<uint8_t> stored_data;
+    std::unordered_map<uint32_t, size_t> stored_functions;
+    xe_mutex write_mutex;
+  };
+
   struct UnwindReservation {
     size_t data_size = 0;
     size_t table_slot = 0;
@@ -104,6 +197,9 @@ class X64CodeCache : public CodeCache {
 
   X64CodeCache();
 
+  CodeStorage* LookupCodeStorage(const Module* module);
+  void LinkCallSite(uint8_t* rel32_execute_address, uintptr_t target);
+
   virtual UnwindReservation RequestUnwindReservation(uint8_t* entry_address) {
     return UnwindReservation();
   }
@@ -142,6 +238,29 @@ class X64CodeCache : public CodeCache {
   // This can be used to bsearch on host PC to find the guest function.
   // The key is [start address | end address].
   std::vector<std::pair<uint64_t, GuestFunction*>> generated_code_map_;
+
+  // Bounds of the host executable image, set up by the platform-specific
+  // implementation. Empty if unknown, which excludes code referring to the
+  // image from the code storage.
+  uintptr_t host_image_base_ = 0;
+  size_t host_image_size_ = 0;
+
+  void* call_site_thunk_ = nullptr;
+  // Guest address -> execute addresses of the rel32 fields calling it. Guarded
+  // by the global critical region.
+  std::unordered_map<uint32_t, std::vector<uint8_t*>> call_sites_;
+  // Caller guest address -> callee guest addresses and execute addresses of
+  // the rel32 fields in the current code of the caller. Guarded by the global
+  // critical region.
+  std::unordered_map<uint32_t, std::vector<std::pair<uint32_t, uint8_t*>>>
+      caller_call_sites_;
+
+  xe_mutex code_storages_mutex_;
+  std::unordered_map<const Module*, std::unique_ptr<CodeStorage>>
+      code_storages_;
+  std::atomic<uint64_t> code_storage_hits_ = {0};
+  std::atomic<uint64_t> code_storage_misses_ = {0};
+  std::atomic<uint64_t> code_storage_stale_ = {0};
 };
 
 }  // namespace x64
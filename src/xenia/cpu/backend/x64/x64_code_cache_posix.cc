@@ -9,6 +9,9 @@
 
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 
+#include <link.h>
+#include <algorithm>
+
 namespace xe {
 namespace cpu {
 namespace backend {
@@ -43,7 +46,40 @@ std::unique_ptr<X64CodeCache> X64CodeCache::Create() {
 PosixX64CodeCache::PosixX64CodeCache() = default;
 PosixX64CodeCache::~PosixX64CodeCache() = default;
 
-bool PosixX64CodeCache::Initialize() { return X64CodeCache::Initialize(); }
+bool PosixX64CodeCache::Initialize() {
+  if (!X64CodeCache::Initialize()) {
+    return false;
+  }
+
+  // Find the loaded segments of the executable containing this code.
+  dl_iterate_phdr(
+      [](dl_phdr_info* info, size_t size, void* data) -> int {
+        auto code_cache = static_cast<PosixX64CodeCache*>(data);
+        uintptr_t anchor = reinterpret_cast<uintptr_t>(&X64CodeCache::Create);
+        uintptr_t image_start = UINTPTR_MAX, image_end = 0;
+        bool contains_anchor = false;
+        for (ElfW(Half) i = 0; i < info->dlpi_phnum; ++i) {
+          const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+          if (phdr.p_type != PT_LOAD) {
+            continue;
+          }
+          uintptr_t segment_start = info->dlpi_addr + phdr.p_vaddr;
+          uintptr_t segment_end = segment_start + phdr.p_memsz;
+          image_start = std::min(image_start, segment_start);
+          image_end = std::max(image_end, segment_end);
+          contains_anchor |= anchor >= segment_start && anchor < segment_end;
+        }
+        if (!contains_anchor) {
+          return 0;
+        }
+        code_cache->host_image_base_ = image_start;
+        code_cache->host_image_size_ = image_end - image_start;
+        return 1;
+      },
+      this);
+
+  return true;
+}
 
 }  // namespace x64
 }  // namespace backend
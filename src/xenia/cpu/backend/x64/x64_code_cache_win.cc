@@ -153,6 +153,20 @@ bool Win32X64CodeCache::Initialize() {
     return false;
   }
 
+  // Get the bounds of the executable containing this code.
+  HMODULE image_module;
+  if (GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                             GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                         reinterpret_cast<LPCWSTR>(&X64CodeCache::Create),
+                         &image_module)) {
+    auto image_base = reinterpret_cast<const uint8_t*>(image_module);
+    auto dos_header = reinterpret_cast<const IMAGE_DOS_HEADER*>(image_base);
+    auto nt_headers = reinterpret_cast<const IMAGE_NT_HEADERS*>(
+        image_base + dos_header->e_lfanew);
+    host_image_base_ = reinterpret_cast<uintptr_t>(image_base);
+    host_image_size_ = nt_headers->OptionalHeader.SizeOfImage;
+  }
+
   // Compute total number of unwind entries we should allocate.
   // We don't support reallocing right now, so this should be high.
   unwind_table_.resize(kMaximumFunctionCount);
@@ -53,11 +53,21 @@ DEFINE_bool(enable_incorrect_roundingmode_behavior, false,
             "code. The workaround may cause reduced CPU performance but is a "
             "more accurate emulation",
             "x64");
+DEFINE_bool(mxcsr_mode_scheduling, true,
+            "Switch the MXCSR between the FPU and VMX modes on the branches to "
+            "blocks rather than in every block, so loops don't switch on every "
+            "iteration.",
+            "x64");
 DEFINE_uint32(align_all_basic_blocks, 0,
               "Aligns the start of all basic blocks to N bytes. Only specify a "
               "power of 2, 16 is the recommended value. Results in larger "
               "icache usage, but potentially faster loops",
               "x64");
+DEFINE_bool(link_guest_calls, true,
+            "Patch calls to guest functions at known addresses into direct "
+            "calls to their code once it's compiled, instead of going through "
+            "the indirection table every time.",
+            "x64");
 #if XE_X64_PROFILER_AVAILABLE == 1
 DEFINE_bool(instrument_call_times, false,
             "Compute time taken for functions, for profiling guest code",
@@ -108,6 +118,15 @@ X64Emitter::X64Emitter(X64Backend* backend, XbyakAllocator* allocator)
 
 X64Emitter::~X64Emitter() = default;
 
+// Called by baseline tier code once the function has been called
+// tier_up_call_count times.
+static uint64_t RequestFunctionTierUp(void* raw_context, uint64_t function) {
+  auto guest_context = reinterpret_cast<ppc::PPCContext_s*>(raw_context);
+  guest_context->thread_state->processor()->RequestFunctionTierUp(
+      reinterpret_cast<GuestFunction*>(function));
+  return 0;
+}
+
 bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
                       uint32_t debug_info_flags, FunctionDebugInfo* debug_info,
                       void** out_code_address, size_t* out_code_size,
@@ -120,6 +139,23 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
   debug_info_flags_ = debug_info_flags;
   trace_data_ = &function->trace_data();
   source_map_arena_.Reset();
+  // Debug info and tracing reference per-run data, don't store such code.
+  code_storable_ =
+      !debug_info_flags && code_cache_->has_code_storage(function->module());
+  relocations_.clear();
+  call_sites_.clear();
+  // Baseline tier code is temporary and refers to the function object.
+  if (function->tier() == GuestFunction::Tier::kBaseline) {
+    tier_up_function_ = function;
+    DisallowCodeStorage();
+  } else {
+    tier_up_function_ = nullptr;
+  }
+  // The stored code is looked up by the hash of the function's own guest code
+  // only, which inlined code from other functions is not part of.
+  if (!function->inlined_functions().empty()) {
+    DisallowCodeStorage();
+  }
 
   // Fill the generator with code.
   EmitFunctionInfo func_info = {};
@@ -130,10 +166,19 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
   // Copy the final code to the cache and relocate it.
   *out_code_size = getSize();
   *out_code_address = Emplace(func_info, function);
+  code_cache_->AddCallSites(function->address(), *out_code_address,
+                            call_sites_);
 
   // Stash source map.
   source_map_arena_.CloneContents(out_source_map);
 
+  if (code_storable_) {
+    code_cache_->StoreGuestCode(
+        function, *out_code_address, func_info, relocations_, *out_source_map,
+        backend_->HashGuestFunction(function->module(), function->address(),
+                                    function->end_address()));
+  }
+
   return true;
 }
 void* X64Emitter::Emplace(const EmitFunctionInfo& func_info,
@@ -169,6 +214,49 @@ void* X64Emitter::Emplace(const EmitFunctionInfo& func_info,
   return new_execute_address;
 }
 
+// Block a branch instruction jumps to, null if it's not a branch.
+static const hir::Block* GetBranchTarget(const Instr* i) {
+  switch (i->GetOpcodeNum()) {
+    case hir::OPCODE_BRANCH:
+      return i->src1.label->block;
+    case hir::OPCODE_BRANCH_TRUE:
+    case hir::OPCODE_BRANCH_FALSE:
+      return i->src2.label->block;
+    default:
+      return nullptr;
+  }
+}
+
+// Branch following the compare that will jump on the flags of the compare
+// rather than testing its result, or null.
+static const Instr* GetFusedBranch(const Instr* i) {
+  if (!i || !i->next || i->next->GetOpcodeNum() != hir::OPCODE_BRANCH_TRUE ||
+      i->next->src1.value != i->dest) {
+    return nullptr;
+  }
+  switch (i->GetOpcodeNum()) {
+    case hir::OPCODE_COMPARE_EQ:
+    case hir::OPCODE_COMPARE_NE:
+    case hir::OPCODE_COMPARE_SLT:
+    case hir::OPCODE_COMPARE_SLE:
+    case hir::OPCODE_COMPARE_SGT:
+    case hir::OPCODE_COMPARE_SGE:
+    case hir::OPCODE_COMPARE_ULT:
+    case hir::OPCODE_COMPARE_ULE:
+    case hir::OPCODE_COMPARE_UGT:
+    case hir::OPCODE_COMPARE_UGE:
+      return i->next;
+    default:
+      return nullptr;
+  }
+}
+
+static bool FallsThrough(const hir::Block* block) {
+  const Instr* tail = block->instr_tail;
+  return !tail || (tail->GetOpcodeNum() != hir::OPCODE_BRANCH &&
+                   tail->GetOpcodeNum() != hir::OPCODE_RETURN);
+}
+
 bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
   Xbyak::Label epilog_label;
   epilog_label_ = &epilog_label;
@@ -179,6 +267,10 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
   size_t stack_offset = StackLayout::GUEST_STACK_SIZE;
   for (auto it = locals.begin(); it != locals.end(); ++it) {
     auto slot = *it;
+    if (slot->reg.set) {
+      // Kept in a register for all of its lifetime.
+      continue;
+    }
     size_t type_size = GetTypeSize(slot->type);
 
     // Align to natural size.
@@ -283,6 +375,24 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
     bts(qword[low_address(&trace_header->function_thread_use)], rax);
   }
 
+  if (tier_up_function_) {
+    // Count the calls, and once the function is hot, request retranslation
+    // with all optimizations. The counter is not updated atomically - missing
+    // some calls doesn't matter.
+    Xbyak::Label& tier_up_done = NewCachedLabel();
+    GuestFunction* tier_up_function = tier_up_function_;
+    Xbyak::Label& tier_up = AddToTail(
+        [tier_up_function, &tier_up_done](X64Emitter& e, Xbyak::Label& me) {
+          e.L(me);
+          e.CallNative(&RequestFunctionTierUp, uint64_t(tier_up_function));
+          e.jmp(tier_up_done, T_NEAR);
+        });
+    mov(rax, uint64_t(tier_up_function_->tier_up_countdown()));
+    sub(dword[rax], 1);
+    jz(tier_up, T_NEAR);
+    L(tier_up_done);
+  }
+
   // Load membase.
   /*
   * chrispy: removed this, as long as we load it in HostToGuestThunk we can
@@ -290,10 +400,19 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
       qword[GetContextReg() + offsetof(ppc::PPCContext, virtual_membase)]);
   */
   // Body.
+  mxcsr_switch_count_ = 0;
+  AssignBlockMxcsrModes(builder);
   auto block = builder->first_block();
+  if (block) {
+    // Switched once here rather than in the first block, which may be a loop.
+    ForgetMxcsrMode();
+    ChangeMxcsrModeForBlock(block);
+  }
   synchronize_stack_on_next_instruction_ = false;
   while (block) {
-    ForgetMxcsrMode();  // at start of block, mxcsr mode is undefined
+    // At start of block, mxcsr mode is whatever all branches to it switched
+    // to, or undefined.
+    mxcsr_mode_ = block_mxcsr_modes_[GetBlockIndex(block)];
 
     // Mark block labels.
     auto label = block->label_head;
@@ -305,6 +424,9 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
     if (cvars::align_all_basic_blocks) {
       align(cvars::align_all_basic_blocks, true);
     }
+    if (tier_up_function_ && trace_data_->is_valid()) {
+      EmitBlockEntryCount(block);
+    }
     // Process instructions.
     const Instr* instr = block->instr_head;
     while (instr) {
@@ -314,6 +436,22 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
           EnsureSynchronizedGuestAndHostStack();
         }
       }
+      // A fused branch uses the flags of the compare before it, so the mode
+      // for the branch target must be set before the compare.
+      const Instr* branch = GetFusedBranch(instr);
+      if (!branch && GetFusedBranch(instr->prev) != instr) {
+        branch = instr;
+      }
+      const hir::Block* target = branch ? GetBranchTarget(branch) : nullptr;
+      if (target) {
+        size_t mxcsr_switch_offset = getSize();
+        ChangeMxcsrModeForBlock(target);
+        if (getSize() != mxcsr_switch_offset) {
+          // The compare can't reuse the flags of an earlier one anymore.
+          const_cast<Instr*>(instr)->backend_flags |=
+              INSTR_X64_FLAGS_AFTER_MXCSR_SWITCH;
+        }
+      }
       const Instr* new_tail = instr;
       if (!SelectSequence(this, instr, &new_tail)) {
         // No sequence found!
@@ -325,6 +463,9 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
       }
       instr = new_tail;
     }
+    if (block->next && FallsThrough(block)) {
+      ChangeMxcsrModeForBlock(block->next);
+    }
 
     block = block->next;
   }
@@ -372,6 +513,7 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
 void X64Emitter::EmitProfilerEpilogue() {
 #if XE_X64_PROFILER_AVAILABLE == 1
   if (cvars::instrument_call_times) {
+    DisallowCodeStorage();
     uint64_t* profiler_entry =
         backend()->GetProfilerRecordForFunction(current_guest_function_);
 
@@ -412,6 +554,236 @@ void X64Emitter::MarkSourceOffset(const Instr* i) {
   }
 }
 
+void X64Emitter::EmitBlockEntryCount(const hir::Block* block) {
+  // Counted at the guest instruction the block starts with. The counters of
+  // such instructions start at 1 so the hot path layout can tell them from
+  // instructions in the middle of blocks. Not updated atomically - the counts
+  // only need to be roughly right.
+  uint32_t guest_address = block->GetSourceAddress();
+  if (guest_address < trace_data_->start_address() ||
+      guest_address > trace_data_->end_address()) {
+    return;
+  }
+  uint64_t* count = reinterpret_cast<uint64_t*>(
+                        trace_data_->instruction_execute_counts()) +
+                    (guest_address - trace_data_->start_address()) / 4;
+  if (!*count) {
+    *count = 1;
+  }
+  mov(rax, uint64_t(count));
+  inc(qword[rax]);
+}
+
+// Mode the sequence for the instruction is likely to switch to. This is only
+// a hint for where to switch ahead of time, the sequences still switch to the
+// mode they need.
+static MXCSRMode GetInstrMxcsrMode(const Instr* i) {
+  switch (i->GetOpcodeNum()) {
+    case hir::OPCODE_ADD:
+    case hir::OPCODE_SUB:
+    case hir::OPCODE_MUL:
+    case hir::OPCODE_DIV:
+    case hir::OPCODE_MUL_ADD:
+    case hir::OPCODE_MUL_SUB:
+    case hir::OPCODE_NEG:
+    case hir::OPCODE_ABS:
+    case hir::OPCODE_SQRT:
+    case hir::OPCODE_RSQRT:
+    case hir::OPCODE_RECIP:
+    case hir::OPCODE_MAX:
+    case hir::OPCODE_MIN:
+    case hir::OPCODE_ROUND:
+      if (i->dest->type == hir::FLOAT32_TYPE ||
+          i->dest->type == hir::FLOAT64_TYPE) {
+        return MXCSRMode::Fpu;
+      }
+      if (i->dest->type == hir::VEC128_TYPE) {
+        return MXCSRMode::Vmx;
+      }
+      return MXCSRMode::Unknown;
+    case hir::OPCODE_SELECT:
+      return i->dest->type == hir::FLOAT32_TYPE ||
+                     i->dest->type == hir::FLOAT64_TYPE
+                 ? MXCSRMode::Fpu
+                 : MXCSRMode::Unknown;
+    case hir::OPCODE_IS_NAN:
+    case hir::OPCODE_COMPARE_EQ:
+    case hir::OPCODE_COMPARE_NE:
+      return i->src1.value->type == hir::FLOAT32_TYPE ||
+                     i->src1.value->type == hir::FLOAT64_TYPE
+                 ? MXCSRMode::Fpu
+                 : MXCSRMode::Unknown;
+    case hir::OPCODE_CONVERT:
+    case hir::OPCODE_TO_SINGLE:
+    case hir::OPCODE_SET_ROUNDING_MODE:
+      return MXCSRMode::Fpu;
+    case hir::OPCODE_VECTOR_ADD:
+    case hir::OPCODE_VECTOR_SUB:
+    case hir::OPCODE_VECTOR_COMPARE_EQ:
+    case hir::OPCODE_VECTOR_COMPARE_SGT:
+    case hir::OPCODE_VECTOR_COMPARE_SGE:
+    case hir::OPCODE_VECTOR_COMPARE_UGT:
+    case hir::OPCODE_VECTOR_COMPARE_UGE:
+      return (i->flags & 0xFF) == hir::FLOAT32_TYPE ? MXCSRMode::Vmx
+                                                    : MXCSRMode::Unknown;
+    case hir::OPCODE_VECTOR_CONVERT_I2F:
+    case hir::OPCODE_VECTOR_CONVERT_F2I:
+    case hir::OPCODE_VECTOR_DENORMFLUSH:
+    case hir::OPCODE_POW2:
+    case hir::OPCODE_LOG2:
+    case hir::OPCODE_DOT_PRODUCT_3:
+    case hir::OPCODE_DOT_PRODUCT_4:
+    case hir::OPCODE_PACK:
+    case hir::OPCODE_UNPACK:
+    case hir::OPCODE_SET_NJM:
+      return MXCSRMode::Vmx;
+    default:
+      return MXCSRMode::Unknown;
+  }
+}
+
+static bool ForgetsMxcsrMode(const Instr* i) {
+  switch (i->GetOpcodeNum()) {
+    case hir::OPCODE_CALL:
+    case hir::OPCODE_CALL_TRUE:
+    case hir::OPCODE_CALL_INDIRECT:
+    case hir::OPCODE_CALL_INDIRECT_TRUE:
+    case hir::OPCODE_CALL_EXTERN:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void X64Emitter::AssignBlockMxcsrModes(HIRBuilder* builder) {
+  // Blocks are entered in a known mode if every branch to them and the block
+  // before them, if it falls through, switch to the mode the block needs
+  // first. The switches then happen where the mode is already known, usually
+  // once before a loop, instead of in every block that needs a mode.
+  // Indexed by the position of the block rather than by its ordinal, which
+  // other parts of the backend (source maps) rely on.
+  block_indices_.clear();
+  uint16_t block_count = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block_indices_.emplace(block, block_count++);
+  }
+  block_mxcsr_modes_.assign(block_count, MXCSRMode::Unknown);
+  if (!cvars::mxcsr_mode_scheduling ||
+      cvars::enable_incorrect_roundingmode_behavior || !block_count) {
+    return;
+  }
+
+  // Mode each block needs before anything else it does, Unknown if it calls
+  // before that, or if it doesn't care.
+  std::vector<MXCSRMode> first_modes(block_count, MXCSRMode::Unknown);
+  std::vector<bool> uses_mode(block_count, false);
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (ForgetsMxcsrMode(i)) {
+        uses_mode[GetBlockIndex(block)] = true;
+        break;
+      }
+      MXCSRMode mode = GetInstrMxcsrMode(i);
+      if (mode != MXCSRMode::Unknown) {
+        first_modes[GetBlockIndex(block)] = mode;
+        uses_mode[GetBlockIndex(block)] = true;
+        break;
+      }
+    }
+  }
+  auto for_each_successor = [](const hir::Block* block, auto&& callback) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (auto target = GetBranchTarget(i)) {
+        callback(target);
+      }
+    }
+    if (block->next && FallsThrough(block)) {
+      callback(block->next);
+    }
+  };
+  // Blocks that don't care about the mode, like loop conditions, pass through
+  // the mode their successors agree on.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto block = builder->last_block(); block; block = block->prev) {
+      if (uses_mode[GetBlockIndex(block)] ||
+          first_modes[GetBlockIndex(block)] != MXCSRMode::Unknown) {
+        continue;
+      }
+      MXCSRMode mode = MXCSRMode::Unknown;
+      bool agree = true;
+      for_each_successor(block, [&](const hir::Block* successor) {
+        MXCSRMode successor_mode = first_modes[GetBlockIndex(successor)];
+        if (mode == MXCSRMode::Unknown) {
+          mode = successor_mode;
+        } else if (successor_mode != MXCSRMode::Unknown &&
+                   successor_mode != mode) {
+          agree = false;
+        }
+      });
+      if (agree && mode != MXCSRMode::Unknown) {
+        first_modes[GetBlockIndex(block)] = mode;
+        changed = true;
+      }
+    }
+  }
+
+  // A conditional branch switches the mode for the path not taken too, so it
+  // may only switch if that path doesn't need the other mode. Branches fused
+  // with a float compare can't switch at all, as the compare needs the FPU
+  // mode and the flags it sets.
+  std::vector<bool> entered(block_count, false);
+  std::vector<bool> switchable(block_count, true);
+  entered[0] = true;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      auto target = GetBranchTarget(i);
+      if (!target) {
+        continue;
+      }
+      entered[GetBlockIndex(target)] = true;
+      if (i->GetOpcodeNum() == hir::OPCODE_BRANCH) {
+        continue;
+      }
+      const hir::Block* other = nullptr;
+      if (i->next) {
+        other = GetBranchTarget(i->next);
+        if (!other || i->next->GetOpcodeNum() != hir::OPCODE_BRANCH) {
+          switchable[GetBlockIndex(target)] = false;
+          continue;
+        }
+      } else {
+        other = block->next;
+      }
+      MXCSRMode mode = first_modes[GetBlockIndex(target)];
+      if (other && first_modes[GetBlockIndex(other)] != MXCSRMode::Unknown &&
+          first_modes[GetBlockIndex(other)] != mode) {
+        switchable[GetBlockIndex(target)] = false;
+      }
+      if (GetFusedBranch(i->prev) == i &&
+          !hir::IsScalarIntegralType(i->prev->src1.value->type)) {
+        switchable[GetBlockIndex(target)] = false;
+      }
+    }
+    if (block->next && FallsThrough(block)) {
+      entered[GetBlockIndex(block->next)] = true;
+    }
+  }
+  for (uint16_t i = 0; i < block_count; ++i) {
+    if (entered[i] && switchable[i]) {
+      block_mxcsr_modes_[i] = first_modes[i];
+    }
+  }
+}
+
+void X64Emitter::ChangeMxcsrModeForBlock(const hir::Block* block) {
+  MXCSRMode mode = block_mxcsr_modes_[GetBlockIndex(block)];
+  if (mode != MXCSRMode::Unknown) {
+    ChangeMxcsrMode(mode);
+  }
+}
+
 void X64Emitter::EmitGetCurrentThreadId() {
   // rsi must point to context. We could fetch from the stack if needed.
   mov(ax, word[GetContextReg() + offsetof(ppc::PPCContext, thread_id)]);
@@ -699,7 +1071,34 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   auto fn = static_cast<X64Function*>(function);
   // Resolve address to the function to call and store in rax.
 
-  if (fn->machine_code()) {
+  // Direct calls depend on where the callee was placed in this run, so stored
+  // code must go through the indirection table.
+  if (cvars::link_guest_calls && !code_storable_ &&
+      code_cache_->has_indirection_table()) {
+    mov(ebx, function->address());
+    if (!(instr->flags & hir::CALL_TAIL)) {
+      // Return address is from the previous SET_RETURN_ADDRESS.
+      mov(rcx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
+
+      CallLinkable(function->address(), false);
+      synchronize_stack_on_next_instruction_ = true;
+    } else {
+      // tail call
+      EmitTraceUserCallReturn();
+      EmitProfilerEpilogue();
+      // Pass the callers return address over.
+      mov(rcx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
+
+      add(rsp, static_cast<uint32_t>(stack_size()));
+      PopStackpoint();
+      CallLinkable(function->address(), true);
+    }
+
+    return;
+  } else if (fn->machine_code() && !code_storable_ &&
+             fn->tier() == GuestFunction::Tier::kOptimized) {
+    // Baseline tier code will be replaced, so it's called through the
+    // indirection table.
     if (!(instr->flags & hir::CALL_TAIL)) {
       mov(rcx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
 
@@ -751,6 +1150,20 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   }
 }
 
+void X64Emitter::CallLinkable(uint32_t guest_address, bool tail) {
+  // Initially going through the indirection table, the code cache replaces
+  // the displacement with the callee's code when it's placed. Keep it aligned
+  // so the replacement is atomic.
+  nop((3 - getSize()) & 3);
+  if (tail) {
+    jmp(backend()->call_site_thunk(), T_NEAR);
+  } else {
+    call(backend()->call_site_thunk());
+  }
+  call_sites_.push_back(
+      {uint32_t(getSize() - sizeof(int32_t)), guest_address});
+}
+
 void X64Emitter::CallIndirect(const hir::Instr* instr,
                               const Xbyak::Reg64& reg) {
   ForgetMxcsrMode();
@@ -772,7 +1185,7 @@ void X64Emitter::CallIndirect(const hir::Instr* instr,
     // Old-style resolve.
     // Not too important because indirection table is almost always available.
     mov(edx, reg.cvt32());
-    mov(rax, reinterpret_cast<uint64_t>(ResolveFunction));
+    MovHostAddress(rax, reinterpret_cast<const void*>(ResolveFunction));
     mov(rcx, GetContextReg());
     call(rax);
   }
@@ -815,6 +1228,7 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
     auto builtin_function = static_cast<const BuiltinFunction*>(function);
     if (builtin_function->handler()) {
       undefined = false;
+      DisallowCodeStorage();
       // rcx = target function
       // rdx = arg0
       // r8  = arg1
@@ -833,7 +1247,8 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
       // rdx = arg0
       // r8  = arg1
       // r9  = arg2
-      mov(rcx, reinterpret_cast<uint64_t>(extern_function->extern_handler()));
+      MovHostAddress(rcx, reinterpret_cast<const void*>(
+                              extern_function->extern_handler()));
       mov(rdx,
           qword[GetContextReg() + offsetof(ppc::PPCContext, kernel_state)]);
       call(backend()->guest_to_host_thunk());
@@ -841,6 +1256,7 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
     }
   }
   if (undefined) {
+    DisallowCodeStorage();
     CallNative(UndefinedCallExtern, reinterpret_cast<uint64_t>(function));
   }
 }
@@ -866,11 +1282,62 @@ void X64Emitter::CallNativeSafe(void* fn) {
   // rdx = arg0
   // r8  = arg1
   // r9  = arg2
-  mov(rcx, reinterpret_cast<uint64_t>(fn));
+  MovHostAddress(rcx, fn);
   call(backend()->guest_to_host_thunk());
   // rax = host return
 }
 
+void X64Emitter::call(const void* addr) {
+  Xbyak::CodeGenerator::call(addr);
+  RelocateHostBranch(addr);
+}
+
+void X64Emitter::jmp(const void* addr, LabelType type) {
+  Xbyak::CodeGenerator::jmp(addr, type);
+  RelocateHostBranch(addr);
+}
+
+void X64Emitter::RelocateHostBranch(const void* addr) {
+  if (!code_storable_) {
+    return;
+  }
+  // Only the code cache is at the same address in every run and close enough
+  // to be reachable with a rel32 displacement after relocation.
+  uintptr_t code_cache_offset =
+      reinterpret_cast<uintptr_t>(addr) - code_cache_->execute_base_address();
+  if (code_cache_offset >= code_cache_->total_size()) {
+    DisallowCodeStorage();
+    return;
+  }
+  relocations_.push_back({uint32_t(getSize() - sizeof(int32_t)),
+                          CodeRelocationType::kCodeCacheRel32,
+                          uint64_t(addr)});
+}
+
+void X64Emitter::MovHostAddress(const Xbyak::Reg64& reg, const void* addr) {
+  // mov r64, imm64 - not letting Xbyak pick a shorter encoding for addresses
+  // that happen to fit in 32 bits, since the relocated one may not.
+  db(0x48 | (reg.getIdx() >> 3));
+  db(0xB8 | (reg.getIdx() & 7));
+  dq(reinterpret_cast<uint64_t>(addr));
+  if (!code_storable_) {
+    return;
+  }
+  uintptr_t code_cache_offset =
+      reinterpret_cast<uintptr_t>(addr) - code_cache_->execute_base_address();
+  if (code_cache_offset < code_cache_->total_size()) {
+    return;
+  }
+  if (!code_cache_->IsHostImageAddress(addr)) {
+    DisallowCodeStorage();
+    return;
+  }
+  relocations_.push_back({uint32_t(getSize() - sizeof(uint64_t)),
+                          CodeRelocationType::kHostImageAbs64,
+                          uint64_t(reinterpret_cast<uintptr_t>(addr) -
+                                   code_cache_->host_image_base())});
+}
+
 void X64Emitter::SetReturnAddress(uint64_t value) {
   mov(rax, value);
   mov(qword[rsp + StackLayout::GUEST_CALL_RET_ADDR], rax);
@@ -1679,6 +2146,7 @@ bool X64Emitter::ChangeMxcsrMode(MXCSRMode new_mode, bool already_set) {
     // check the mode dynamically
     mxcsr_mode_ = new_mode;
     if (!already_set) {
+      ++mxcsr_switch_count_;
       if (new_mode == MXCSRMode::Fpu) {
         ChangeMxcsrModeDynamicHelper<true>(*this);
       } else if (new_mode == MXCSRMode::Vmx) {
@@ -1699,6 +2167,7 @@ bool X64Emitter::ChangeMxcsrMode(MXCSRMode new_mode, bool already_set) {
   } else {
     mxcsr_mode_ = new_mode;
     if (!already_set) {
+      ++mxcsr_switch_count_;
       if (new_mode == MXCSRMode::Fpu) {
         LoadFpuMxcsrDirect();
         btr(GetBackendFlagsPtr(), kX64BackendMXCSRModeBit);
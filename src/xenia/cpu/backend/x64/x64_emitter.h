@@ -10,9 +10,11 @@
 #ifndef XENIA_CPU_BACKEND_X64_X64_EMITTER_H_
 #define XENIA_CPU_BACKEND_X64_X64_EMITTER_H_
 
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/base/arena.h"
+#include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/function_trace_data.h"
 #include "xenia/cpu/hir/hir_builder.h"
@@ -36,9 +38,6 @@ namespace backend {
 namespace x64 {
 using namespace amd64;
 class X64Backend;
-class X64CodeCache;
-
-struct EmitFunctionInfo;
 
 enum RegisterFlags {
   REG_DEST = (1 << 0),
@@ -186,6 +185,9 @@ enum : uint32_t {
   INSTR_X64_FLAGS_ELIMINATED =
       1,  // another sequence marked this instruction as not needing codegen,
           // meaning they likely already handled it
+  INSTR_X64_FLAGS_AFTER_MXCSR_SWITCH =
+      2,  // an MXCSR mode switch, which clobbers the x86 flags, was emitted
+          // right before this instruction
 };
 
 // Unfortunately due to the design of xbyak we have to pass this to the ctor.
@@ -218,6 +220,24 @@ class X64Emitter : public Xbyak::CodeGenerator {
             void** out_code_address, size_t* out_code_size,
             std::vector<SourceMapEntry>* out_source_map);
 
+  // Branches to absolute host addresses are recorded as relocations so the
+  // code can be moved when it's loaded from the persistent code storage.
+  using Xbyak::CodeGenerator::call;
+  using Xbyak::CodeGenerator::jmp;
+  void call(const void* addr);
+  template <class Ret, class... Params>
+  void call(Ret (*func)(Params...)) {
+    call(reinterpret_cast<const void*>(func));
+  }
+  void jmp(const void* addr, LabelType type = T_AUTO);
+  // Loads the address of a host function or data into the register, always as
+  // a 64-bit immediate so it can be relocated if it's in the host executable.
+  void MovHostAddress(const Xbyak::Reg64& reg, const void* addr);
+
+  // Must be called when emitting host pointers that may differ between runs
+  // (heap objects and such), excluding the function from the code storage.
+  void DisallowCodeStorage() { code_storable_ = false; }
+
  public:
   // Reserved:  rsp, rsi, rdi
   // Scratch:   rax/rcx/rdx
@@ -257,6 +277,9 @@ class X64Emitter : public Xbyak::CodeGenerator {
   void UnimplementedInstr(const hir::Instr* i);
 
   void Call(const hir::Instr* instr, GuestFunction* function);
+  // Emits a call or a jump to the guest function that the code cache links to
+  // its code directly. ebx must contain the guest address.
+  void CallLinkable(uint32_t guest_address, bool tail);
   void CallIndirect(const hir::Instr* instr, const Xbyak::Reg64& reg);
   void CallExtern(const hir::Instr* instr, const Function* function);
   void CallNative(void* fn);
@@ -324,6 +347,11 @@ class X64Emitter : public Xbyak::CodeGenerator {
 
   void LoadFpuMxcsrDirect();  // unsafe, does not change mxcsr_mode_
   void LoadVmxMxcsrDirect();  // unsafe, does not change mxcsr_mode_
+  // Switches to the mode the block is entered in, if it has one, before a
+  // branch to it or falling through to it.
+  void ChangeMxcsrModeForBlock(const hir::Block* block);
+  // MXCSR loads and dynamic mode checks in the last emitted function.
+  uint32_t mxcsr_switch_count() const { return mxcsr_switch_count_; }
 
   XexModule* GuestModule() { return guest_module_; }
 
@@ -387,6 +415,14 @@ class X64Emitter : public Xbyak::CodeGenerator {
   void* Emplace(const EmitFunctionInfo& func_info,
                 GuestFunction* function = nullptr);
   bool Emit(hir::HIRBuilder* builder, EmitFunctionInfo& func_info);
+  void EmitBlockEntryCount(const hir::Block* block);
+  void AssignBlockMxcsrModes(hir::HIRBuilder* builder);
+  uint16_t GetBlockIndex(const hir::Block* block) const {
+    return block_indices_.at(block);
+  }
+  // Records the rel32 displacement just emitted by a call or a jump to a host
+  // address as a relocation.
+  void RelocateHostBranch(const void* addr);
   void EmitGetCurrentThreadId();
   void EmitTraceUserCallReturn();
   static void HandleStackpointOverflowError(ppc::PPCContext* context);
@@ -410,6 +446,13 @@ class X64Emitter : public Xbyak::CodeGenerator {
   FunctionTraceData* trace_data_ = nullptr;
   Arena source_map_arena_;
 
+  // Whether the function being emitted will be written to the code storage.
+  bool code_storable_ = false;
+  std::vector<CodeRelocation> relocations_;
+  std::vector<CallSite> call_sites_;
+  // Function whose calls the code being emitted counts for tiered compilation.
+  GuestFunction* tier_up_function_ = nullptr;
+
   size_t stack_size_ = 0;
 
   static const uint32_t gpr_reg_map_[GPR_COUNT];
@@ -425,6 +468,12 @@ class X64Emitter : public Xbyak::CodeGenerator {
       label_cache_;  // for creating labels that need to be referenced much
                      // later by tail emitters
   MXCSRMode mxcsr_mode_ = MXCSRMode::Unknown;
+  // Position of every block of the function being emitted.
+  std::unordered_map<const hir::Block*, uint16_t> block_indices_;
+  // Mode every block is entered in by all branches to it, indexed by the block
+  // position, or Unknown if it must be checked when needed.
+  std::vector<MXCSRMode> block_mxcsr_modes_;
+  uint32_t mxcsr_switch_count_ = 0;
 };
 
 }  // namespace x64
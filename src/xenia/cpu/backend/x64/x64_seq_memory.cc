@@ -563,33 +563,52 @@ EMITTER_OPCODE_TABLE(OPCODE_RESERVED_STORE, RESERVED_STORE_INT32,
 // ============================================================================
 // OPCODE_ATOMIC_COMPARE_EXCHANGE
 // ============================================================================
+// The guest address may be a constant when the guest code compares and
+// exchanges at a fixed location.
+template <typename T>
+static void EmitAtomicCompareExchangeAddress(X64Emitter& e, const T& src1) {
+  if (src1.is_constant) {
+    e.mov(e.ecx, uint32_t(src1.constant()));
+  } else {
+    e.mov(e.ecx, src1.reg().cvt32());
+  }
+  if (xe::memory::allocation_granularity() > 0x1000) {
+    // Emulate the 4 KB physical address offset in 0xE0000000+ when can't do
+    // it via memory mapping.
+    e.cmp(e.ecx, e.GetContextReg().cvt32());
+    Xbyak::Label& backtous = e.NewCachedLabel();
+
+    Xbyak::Label& fixup_label =
+        e.AddToTail([&backtous](X64Emitter& e, Xbyak::Label& our_tail_label) {
+          e.L(our_tail_label);
+
+          Do0x1000Add(e, e.ecx);
+
+          e.jmp(backtous, e.T_NEAR);
+        });
+    e.jae(fixup_label, e.T_NEAR);
+    e.L(backtous);
+  }
+}
 struct ATOMIC_COMPARE_EXCHANGE_I32
     : Sequence<ATOMIC_COMPARE_EXCHANGE_I32,
                I<OPCODE_ATOMIC_COMPARE_EXCHANGE, I8Op, I64Op, I32Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    e.mov(e.eax, i.src2);
-    if (xe::memory::allocation_granularity() > 0x1000) {
-      // Emulate the 4 KB physical address offset in 0xE0000000+ when can't do
-      // it via memory mapping.
-      e.mov(e.ecx, i.src1.reg().cvt32());
-      e.cmp(i.src1.reg().cvt32(), e.GetContextReg().cvt32());
-      Xbyak::Label& backtous = e.NewCachedLabel();
-
-      Xbyak::Label& fixup_label =
-          e.AddToTail([&backtous](X64Emitter& e, Xbyak::Label& our_tail_label) {
-            e.L(our_tail_label);
-
-            Do0x1000Add(e, e.ecx);
-
-            e.jmp(backtous, e.T_NEAR);
-          });
-      e.jae(fixup_label, e.T_NEAR);
-      e.L(backtous);
+    if (i.src2.is_constant) {
+      e.mov(e.eax, i.src2.constant());
+    } else {
+      e.mov(e.eax, i.src2);
+    }
+    Reg32 new_value;
+    if (i.src3.is_constant) {
+      new_value = e.edx;
+      e.mov(new_value, i.src3.constant());
     } else {
-      e.mov(e.ecx, i.src1.reg().cvt32());
+      new_value = i.src3.reg();
     }
+    EmitAtomicCompareExchangeAddress(e, i.src1);
     e.lock();
-    e.cmpxchg(e.dword[e.GetMembaseReg() + e.rcx], i.src3);
+    e.cmpxchg(e.dword[e.GetMembaseReg() + e.rcx], new_value);
     e.sete(i.dest);
   }
 };
@@ -597,29 +616,21 @@ struct ATOMIC_COMPARE_EXCHANGE_I64
     : Sequence<ATOMIC_COMPARE_EXCHANGE_I64,
                I<OPCODE_ATOMIC_COMPARE_EXCHANGE, I8Op, I64Op, I64Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    e.mov(e.rax, i.src2);
-    if (xe::memory::allocation_granularity() > 0x1000) {
-      // Emulate the 4 KB physical address offset in 0xE0000000+ when can't do
-      // it via memory mapping.
-      e.mov(e.ecx, i.src1.reg().cvt32());
-      e.cmp(i.src1.reg().cvt32(), e.GetContextReg().cvt32());
-      Xbyak::Label& backtous = e.NewCachedLabel();
-
-      Xbyak::Label& fixup_label =
-          e.AddToTail([&backtous](X64Emitter& e, Xbyak::Label& our_tail_label) {
-            e.L(our_tail_label);
-
-            Do0x1000Add(e, e.ecx);
-
-            e.jmp(backtous, e.T_NEAR);
-          });
-      e.jae(fixup_label, e.T_NEAR);
-      e.L(backtous);
+    if (i.src2.is_constant) {
+      e.mov(e.rax, i.src2.constant());
     } else {
-      e.mov(e.ecx, i.src1.reg().cvt32());
+      e.mov(e.rax, i.src2);
     }
+    Reg64 new_value;
+    if (i.src3.is_constant) {
+      new_value = e.rdx;
+      e.mov(new_value, i.src3.constant());
+    } else {
+      new_value = i.src3.reg();
+    }
+    EmitAtomicCompareExchangeAddress(e, i.src1);
     e.lock();
-    e.cmpxchg(e.qword[e.GetMembaseReg() + e.rcx], i.src3);
+    e.cmpxchg(e.qword[e.GetMembaseReg() + e.rcx], new_value);
     e.sete(i.dest);
   }
 };
@@ -679,9 +690,29 @@ struct LOAD_LOCAL_V128
     // e.TraceLoadV128(DATA_LOCAL, i.src1.constant, i.dest);
   }
 };
+// Locals given a register by RegisterAllocationPass are not constants.
+struct LOAD_LOCAL_REG_I64
+    : Sequence<LOAD_LOCAL_REG_I64, I<OPCODE_LOAD_LOCAL, I64Op, I64Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    e.mov(i.dest, i.src1);
+  }
+};
+struct LOAD_LOCAL_REG_F64
+    : Sequence<LOAD_LOCAL_REG_F64, I<OPCODE_LOAD_LOCAL, F64Op, F64Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    e.vmovaps(i.dest, i.src1);
+  }
+};
+struct LOAD_LOCAL_REG_V128
+    : Sequence<LOAD_LOCAL_REG_V128, I<OPCODE_LOAD_LOCAL, V128Op, V128Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    e.vmovdqa(i.dest, i.src1);
+  }
+};
 EMITTER_OPCODE_TABLE(OPCODE_LOAD_LOCAL, LOAD_LOCAL_I8, LOAD_LOCAL_I16,
                      LOAD_LOCAL_I32, LOAD_LOCAL_I64, LOAD_LOCAL_F32,
-                     LOAD_LOCAL_F64, LOAD_LOCAL_V128);
+                     LOAD_LOCAL_F64, LOAD_LOCAL_V128, LOAD_LOCAL_REG_I64,
+                     LOAD_LOCAL_REG_F64, LOAD_LOCAL_REG_V128);
 
 // ============================================================================
 // OPCODE_STORE_LOCAL
@@ -755,9 +786,44 @@ struct STORE_LOCAL_V128
     e.vmovaps(e.ptr[e.GetLocalsBase() + i.src1.constant()], i.src2);
   }
 };
+struct STORE_LOCAL_REG_I64
+    : Sequence<STORE_LOCAL_REG_I64,
+               I<OPCODE_STORE_LOCAL, VoidOp, I64Op, I64Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (i.src2.is_constant) {
+      e.mov(i.src1.reg(), i.src2.constant());
+    } else {
+      e.mov(i.src1.reg(), i.src2);
+    }
+  }
+};
+struct STORE_LOCAL_REG_F64
+    : Sequence<STORE_LOCAL_REG_F64,
+               I<OPCODE_STORE_LOCAL, VoidOp, F64Op, F64Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (i.src2.is_constant) {
+      e.mov(e.rax, i.src2.value->constant.i64);
+      e.vmovq(i.src1.reg(), e.rax);
+    } else {
+      e.vmovaps(i.src1.reg(), i.src2);
+    }
+  }
+};
+struct STORE_LOCAL_REG_V128
+    : Sequence<STORE_LOCAL_REG_V128,
+               I<OPCODE_STORE_LOCAL, VoidOp, V128Op, V128Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (i.src2.is_constant) {
+      e.LoadConstantXmm(i.src1.reg(), i.src2.constant());
+    } else {
+      e.vmovdqa(i.src1.reg(), i.src2);
+    }
+  }
+};
 EMITTER_OPCODE_TABLE(OPCODE_STORE_LOCAL, STORE_LOCAL_I8, STORE_LOCAL_I16,
                      STORE_LOCAL_I32, STORE_LOCAL_I64, STORE_LOCAL_F32,
-                     STORE_LOCAL_F64, STORE_LOCAL_V128);
+                     STORE_LOCAL_F64, STORE_LOCAL_V128, STORE_LOCAL_REG_I64,
+                     STORE_LOCAL_REG_F64, STORE_LOCAL_REG_V128);
 
 // ============================================================================
 // OPCODE_LOAD_CONTEXT
@@ -1124,6 +1190,7 @@ struct LOAD_MMIO_I32
     // uint64_t (context, addr)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto read_address = uint32_t(i.src2.value);
+    e.DisallowCodeStorage();
     e.mov(e.GetNativeParam(0), uint64_t(mmio_range->callback_context));
     e.mov(e.GetNativeParam(1).cvt32(), read_address);
     e.CallNativeSafe(reinterpret_cast<void*>(mmio_range->read));
@@ -1149,6 +1216,7 @@ struct STORE_MMIO_I32
     // void (context, addr, value)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto write_address = uint32_t(i.src2.value);
+    e.DisallowCodeStorage();
     e.mov(e.GetNativeParam(0), uint64_t(mmio_range->callback_context));
     e.mov(e.GetNativeParam(1).cvt32(), write_address);
     if (i.src3.is_constant) {
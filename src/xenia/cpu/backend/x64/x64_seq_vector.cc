@@ -2171,7 +2171,7 @@ struct EXTRACT_I32
       e.mov(e.al, i.src2);
       e.and_(e.al, 0x03);
       e.shl(e.al, 4);
-      e.mov(e.rdx, reinterpret_cast<uint64_t>(extract_table_32));
+      e.MovHostAddress(e.rdx, extract_table_32);
       e.vmovaps(e.xmm0, e.ptr[e.rdx + e.rax]);
       e.vpshufb(e.xmm0, src1, e.xmm0);
       e.vpextrd(i.dest, e.xmm0, 0);
@@ -2344,6 +2344,10 @@ struct PERMUTE_V128
     : Sequence<PERMUTE_V128,
                I<OPCODE_PERMUTE, V128Op, V128Op, V128Op, V128Op>> {
   static void EmitByInt8(X64Emitter& e, const EmitArgType& i) {
+    if (i.src1.is_constant && !i.src2.is_constant &&
+        EmitConstantShuffle(e, i)) {
+      return;
+    }
     // TODO(benvanik): find out how to do this with only one temp register!
     // Permute bytes between src2 and src3.
     // src1 is an array of indices corresponding to positions within src2 and
@@ -2459,6 +2463,29 @@ struct PERMUTE_V128
     }
   }
 
+  // A single pshufb if only bytes of src2 and zeros are selected, such as from
+  // byte swaps combined with shuffles.
+  static bool EmitConstantShuffle(X64Emitter& e, const EmitArgType& i) {
+    bool src3_is_src2 = i.src3.value == i.src2.value;
+    bool src3_is_zero = i.src3.value->IsConstantZero();
+    vec128_t control = i.src1.constant();
+    vec128_t shuffle;
+    for (size_t n = 0; n < 16; ++n) {
+      uint8_t index = control.u8[n] & 0x1F;
+      if (index < 16 || src3_is_src2) {
+        // Both the control and the bytes are in 32-bit little-endian elements.
+        shuffle.u8[n] = (index & 0xF) ^ 0x3;
+      } else if (src3_is_zero) {
+        shuffle.u8[n] = 0x80;
+      } else {
+        return false;
+      }
+    }
+    e.LoadConstantXmm(e.xmm0, shuffle);
+    e.vpshufb(i.dest, i.src2, e.xmm0);
+    return true;
+  }
+
   static void EmitByInt16(X64Emitter& e, const EmitArgType& i) {
     // src1 is an array of indices corresponding to positions within src2 and
     // src3
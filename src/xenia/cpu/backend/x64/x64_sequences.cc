@@ -85,6 +85,7 @@ struct COMMENT : Sequence<COMMENT, I<OPCODE_COMMENT, VoidOp, OffsetOp>> {
       // TODO(benvanik): pass through.
       // TODO(benvanik): don't just leak this memory.
       auto str_copy = strdup(str);
+      e.DisallowCodeStorage();
       e.mov(e.rdx, reinterpret_cast<uint64_t>(str_copy));
       e.CallNative(reinterpret_cast<void*>(TraceString));
     }
@@ -859,6 +860,12 @@ static bool HasPrecedingCmpOfSameValues(const hir::Instr* i) {
   if (IsTracingData()) {
     return false;  // no cmp elim if tracing
   }
+  // The flags set by the previous compare were clobbered by the mode switch
+  // emitted for the fused branch. Instructions between the two compares are
+  // never preceded by a switch, so only the second compare needs checking.
+  if (i->backend_flags & INSTR_X64_FLAGS_AFTER_MXCSR_SWITCH) {
+    return false;
+  }
   auto prev = GetFirstPrecedingInstrWithPossibleFlagEffects(i);
 
   if (prev == nullptr) {
@@ -3229,6 +3236,27 @@ struct SET_ROUNDING_MODE_I32
 EMITTER_OPCODE_TABLE(OPCODE_SET_ROUNDING_MODE, SET_ROUNDING_MODE_I32);
 
 static void MaybeYieldForwarder(void* ctx) { xe::threading::MaybeYield(); }
+
+// Backs off the longer the guest thread keeps spinning in an idle loop - most
+// waits are short, so only pausing at first, then letting other threads run,
+// and then sleeping. Iterations too far apart are from different waits.
+static void IdleLoopWaitForwarder(void* ctx) {
+  thread_local uint64_t spin_count = 0;
+  thread_local uint64_t last_spin_ticks = 0;
+  uint64_t ticks = Clock::QueryHostTickCount();
+  if (ticks - last_spin_ticks > Clock::QueryHostTickFrequency() / 1000) {
+    spin_count = 0;
+  }
+  if (spin_count < 64) {
+    _mm_pause();
+  } else if (spin_count < 1024) {
+    xe::threading::MaybeYield();
+  } else {
+    xe::threading::Sleep(std::chrono::microseconds(100));
+  }
+  ++spin_count;
+  last_spin_ticks = Clock::QueryHostTickCount();
+}
 // ============================================================================
 // OPCODE_DELAY_EXECUTION
 // ============================================================================
@@ -3236,7 +3264,9 @@ struct DELAY_EXECUTION
     : Sequence<DELAY_EXECUTION, I<OPCODE_DELAY_EXECUTION, VoidOp>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     // todo: what if they dont have smt?
-    if (cvars::delay_via_maybeyield) {
+    if (i.instr->flags & DELAY_EXECUTION_IDLE_LOOP) {
+      e.CallNativeSafe((void*)IdleLoopWaitForwarder);
+    } else if (cvars::delay_via_maybeyield) {
       e.CallNativeSafe((void*)MaybeYieldForwarder);
     } else {
       e.pause();
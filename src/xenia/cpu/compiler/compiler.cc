@@ -9,6 +9,7 @@
 
 #include "xenia/cpu/compiler/compiler.h"
 
+#include "xenia/base/clock.h"
 #include "xenia/base/profiling.h"
 #include "xenia/cpu/compiler/compiler_pass.h"
 
@@ -25,15 +26,16 @@ void Compiler::AddPass(std::unique_ptr<CompilerPass> pass) {
   passes_.push_back(std::move(pass));
 }
 
-void Compiler::Reset() {}
+void Compiler::Reset() { pass_stats_.clear(); }
 
 bool Compiler::Compile(xe::cpu::hir::HIRBuilder* builder) {
   // TODO(benvanik): sophisticated stuff. Run passes in parallel, run until they
   //                 stop changing things, etc.
+  pass_stats_.clear();
   for (size_t i = 0; i < passes_.size(); ++i) {
     auto& pass = passes_[i];
     scratch_arena_.Reset();
-    if (!pass->Run(builder)) {
+    if (!RunPass(pass.get(), builder)) {
       return false;
     }
   }
@@ -41,6 +43,42 @@ bool Compiler::Compile(xe::cpu::hir::HIRBuilder* builder) {
   return true;
 }
 
+bool Compiler::RunPass(CompilerPass* pass, hir::HIRBuilder* builder) {
+  if (!collects_stats_) {
+    return pass->Run(builder);
+  }
+  size_t stats_index = BeginPassStats(pass, builder);
+  bool result = pass->Run(builder);
+  EndPassStats(stats_index, builder);
+  return result;
+}
+
+size_t Compiler::BeginPassStats(const CompilerPass* pass,
+                                hir::HIRBuilder* builder) {
+  size_t index = pass_stats_.size();
+  pass_stats_.push_back({pass->name(), 0, CountInstrs(builder), 0});
+  // Last so counting isn't included.
+  pass_stats_[index].ticks = Clock::QueryHostTickCount();
+  return index;
+}
+
+void Compiler::EndPassStats(size_t index, hir::HIRBuilder* builder) {
+  uint64_t end_ticks = Clock::QueryHostTickCount();
+  PassStats& stats = pass_stats_[index];
+  stats.ticks = end_ticks - stats.ticks;
+  stats.instr_count_out = CountInstrs(builder);
+}
+
+uint32_t Compiler::CountInstrs(hir::HIRBuilder* builder) {
+  uint32_t count = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      ++count;
+    }
+  }
+  return count;
+}
+
 }  // namespace compiler
 }  // namespace cpu
 }  // namespace xe
@@ -42,10 +42,38 @@ class Compiler {
 
   bool Compile(hir::HIRBuilder* builder);
 
+  struct PassStats {
+    const char* name;
+    // Host ticks spent in the pass.
+    uint64_t ticks;
+    uint32_t instr_count_in;
+    uint32_t instr_count_out;
+  };
+  // When enabled, Compile records the passes it runs in pass_stats(). Passes
+  // run by other passes (like the subpasses of conditional groups) are listed
+  // as well, every time they're run, and their time is also included in the
+  // time of the pass running them.
+  bool collects_stats() const { return collects_stats_; }
+  void set_collects_stats(bool collects_stats) {
+    collects_stats_ = collects_stats;
+  }
+  const std::vector<PassStats>& pass_stats() const { return pass_stats_; }
+  // Runs the pass, recording its statistics if enabled.
+  bool RunPass(CompilerPass* pass, hir::HIRBuilder* builder);
+  // Called around running a pass some other way, only when collecting
+  // statistics. The index returned by Begin must be passed to End.
+  size_t BeginPassStats(const CompilerPass* pass, hir::HIRBuilder* builder);
+  void EndPassStats(size_t index, hir::HIRBuilder* builder);
+
+  static uint32_t CountInstrs(hir::HIRBuilder* builder);
+
  private:
   Processor* processor_;
   Arena scratch_arena_;
 
+  bool collects_stats_ = false;
+  std::vector<PassStats> pass_stats_;
+
   std::vector<std::unique_ptr<CompilerPass>> passes_;
 };
 
@@ -55,12 +55,19 @@ bool ConditionalGroupPass::Run(HIRBuilder* builder) {
       auto& pass = passes_[i];
       auto subpass = dynamic_cast<ConditionalGroupSubpass*>(pass.get());
       if (!subpass) {
-        if (!pass->Run(builder)) {
+        if (!compiler_->RunPass(pass.get(), builder)) {
           return false;
         }
       } else {
         bool result = false;
-        if (!subpass->Run(builder, result)) {
+        size_t stats_index = compiler_->collects_stats()
+                                 ? compiler_->BeginPassStats(subpass, builder)
+                                 : 0;
+        bool succeeded = subpass->Run(builder, result);
+        if (compiler_->collects_stats()) {
+          compiler_->EndPassStats(stats_index, builder);
+        }
+        if (!succeeded) {
           return false;
         }
         dirty |= result;
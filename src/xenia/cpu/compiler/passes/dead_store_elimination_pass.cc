@@ -0,0 +1,285 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/dead_store_elimination_pass.h"
+
+#include <algorithm>
+#include <set>
+#include <utility>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/cvar.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+#include "xenia/cpu/processor.h"
+
+DECLARE_bool(debug);
+DECLARE_bool(store_all_context_values);
+DECLARE_bool(full_optimization_even_with_debug);
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+
+DeadStoreEliminationPass::DeadStoreEliminationPass() : CompilerPass() {}
+
+DeadStoreEliminationPass::~DeadStoreEliminationPass() {}
+
+bool DeadStoreEliminationPass::Initialize(Compiler* compiler) {
+  if (!CompilerPass::Initialize(compiler)) {
+    return false;
+  }
+  byte_indices_.resize(sizeof(ppc::PPCContext), -1);
+  return true;
+}
+
+bool DeadStoreEliminationPass::Run(HIRBuilder* builder) {
+  // Like ContextPromotionPass, keep all stores when they may be needed to
+  // recover register values while debugging.
+  if (!cvars::full_optimization_even_with_debug &&
+      (cvars::debug || cvars::store_all_context_values)) {
+    return true;
+  }
+
+  // Liveness is tracked only for the context bytes the function writes, which
+  // usually are a small part of the context.
+  uint32_t byte_count = IndexStoredBytes(builder);
+  if (!byte_count) {
+    return true;
+  }
+
+  blocks_.clear();
+  uint16_t block_ordinal = 0;
+  auto block = builder->first_block();
+  while (block) {
+    block->ordinal = block_ordinal++;
+    blocks_.push_back(block);
+    block = block->next;
+  }
+
+  // Backwards dataflow over the blocks until the live-in sets stop growing.
+  // Successors are found from the branches in the block rather than the edges
+  // as the earlier passes may have changed branches without updating them.
+  live_in_.resize(blocks_.size());
+  for (auto& live_in : live_in_) {
+    live_in.clear();
+    live_in.resize(byte_count);
+  }
+  llvm::BitVector live(byte_count);
+  bool changed;
+  do {
+    changed = false;
+    for (auto it = blocks_.rbegin(); it != blocks_.rend(); ++it) {
+      TransferBlock(*it, live, nullptr);
+      auto& live_in = live_in_[(*it)->ordinal];
+      if (live != live_in) {
+        live_in = live;
+        changed = true;
+      }
+    }
+  } while (changed);
+
+  dead_stores_.clear();
+  for (Block* block : blocks_) {
+    TransferBlock(block, live, &dead_stores_);
+  }
+
+  uint32_t context_store_count = 0;
+  uint32_t instr_count = 0;
+  bool report = cvars::validate_hir;
+  if (report) {
+    for (Block* block : blocks_) {
+      for (Instr* i = block->instr_head; i; i = i->next) {
+        ++instr_count;
+        if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+          ++context_store_count;
+        }
+      }
+    }
+  }
+
+  uint32_t removed_count = 0;
+  for (Instr* store : dead_stores_) {
+    if (cvars::validate_hir && !IsStoreDead(store)) {
+      XELOGE("DeadStoreEliminationPass: store_context +{} is live",
+             store->src1.offset);
+      assert_always();
+      continue;
+    }
+    store->UnlinkAndNOP();
+    ++removed_count;
+  }
+  COUNT_profile_add("cpu/compiler/dead_context_stores", removed_count);
+
+  if (report) {
+    XELOGD(
+        "DeadStoreEliminationPass: {} -> {} instructions, {} -> {} context "
+        "stores",
+        instr_count, instr_count - removed_count, context_store_count,
+        context_store_count - removed_count);
+  }
+
+  for (uint32_t byte : indexed_bytes_) {
+    byte_indices_[byte] = -1;
+  }
+  return true;
+}
+
+uint32_t DeadStoreEliminationPass::IndexStoredBytes(HIRBuilder* builder) {
+  indexed_bytes_.clear();
+  auto block = builder->first_block();
+  while (block) {
+    for (Instr* i = block->instr_head; i; i = i->next) {
+      if (i->opcode != &OPCODE_STORE_CONTEXT_info) {
+        continue;
+      }
+      size_t offset = i->src1.offset;
+      size_t size = GetTypeSize(i->src2.value->type);
+      assert_true(offset + size <= byte_indices_.size());
+      for (size_t byte = offset; byte < offset + size; ++byte) {
+        if (byte_indices_[byte] < 0) {
+          byte_indices_[byte] = int32_t(indexed_bytes_.size());
+          indexed_bytes_.push_back(uint32_t(byte));
+        }
+      }
+    }
+    block = block->next;
+  }
+  return uint32_t(indexed_bytes_.size());
+}
+
+void DeadStoreEliminationPass::SetBytes(llvm::BitVector& bits, size_t offset,
+                                        size_t size, bool value) {
+  size_t end = std::min(offset + size, byte_indices_.size());
+  for (size_t byte = offset; byte < end; ++byte) {
+    int32_t index = byte_indices_[byte];
+    if (index >= 0) {
+      bits[index] = value;
+    }
+  }
+}
+
+bool DeadStoreEliminationPass::AnyBytesSet(const llvm::BitVector& bits,
+                                           size_t offset, size_t size) {
+  for (size_t byte = offset; byte < offset + size; ++byte) {
+    int32_t index = byte_indices_[byte];
+    if (index >= 0 && bits[index]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void DeadStoreEliminationPass::TransferBlock(Block* block,
+                                             llvm::BitVector& live,
+                                             std::vector<Instr*>* dead_stores) {
+  // Falling off the end of the last block leaves the function.
+  if (block->next) {
+    live = live_in_[block->next->ordinal];
+  } else {
+    live.set();
+  }
+
+  for (Instr* i = block->instr_tail; i; i = i->prev) {
+    if (i->opcode == &OPCODE_BRANCH_info) {
+      live = live_in_[i->src1.label->block->ordinal];
+    } else if (i->opcode == &OPCODE_BRANCH_TRUE_info ||
+               i->opcode == &OPCODE_BRANCH_FALSE_info) {
+      live |= live_in_[i->src2.label->block->ordinal];
+    } else if (ObservesContext(i->opcode)) {
+      live.set();
+    } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+      SetBytes(live, i->src1.offset, GetTypeSize(i->dest->type), true);
+    } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+      size_t offset = i->src1.offset;
+      size_t size = GetTypeSize(i->src2.value->type);
+      if (dead_stores && !AnyBytesSet(live, offset, size)) {
+        dead_stores->push_back(i);
+      }
+      SetBytes(live, offset, size, false);
+    }
+  }
+}
+
+bool DeadStoreEliminationPass::IsStoreDead(Instr* store) {
+  // Follows every path from the store, with a mask of the stored bytes not
+  // overwritten yet, looking for a read of them or an exit.
+  size_t offset = store->src1.offset;
+  size_t size = GetTypeSize(store->src2.value->type);
+  assert_true(size <= 32);
+  struct Path {
+    Block* block;
+    Instr* instr;
+    uint32_t mask;
+  };
+  uint32_t store_mask = uint32_t((uint64_t(1) << size) - 1);
+  std::vector<Path> paths = {{store->block, store->next, store_mask}};
+  std::set<std::pair<Block*, uint32_t>> visited;
+  auto enter_block = [&paths, &visited](Block* block, uint32_t mask) {
+    if (visited.emplace(block, mask).second) {
+      paths.push_back({block, block->instr_head, mask});
+    }
+  };
+  auto overlap = [offset, size](const Instr* i, size_t i_size) {
+    uint32_t mask = 0;
+    for (size_t byte = 0; byte < size; ++byte) {
+      if (offset + byte >= i->src1.offset &&
+          offset + byte < i->src1.offset + i_size) {
+        mask |= uint32_t(1) << byte;
+      }
+    }
+    return mask;
+  };
+  while (!paths.empty()) {
+    Path path = paths.back();
+    paths.pop_back();
+    bool path_ended = false;
+    for (Instr* i = path.instr; i && !path_ended; i = i->next) {
+      if (i->opcode == &OPCODE_BRANCH_info) {
+        enter_block(i->src1.label->block, path.mask);
+        path_ended = true;
+      } else if (i->opcode == &OPCODE_BRANCH_TRUE_info ||
+                 i->opcode == &OPCODE_BRANCH_FALSE_info) {
+        enter_block(i->src2.label->block, path.mask);
+      } else if (ObservesContext(i->opcode)) {
+        return false;
+      } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+        if (overlap(i, GetTypeSize(i->dest->type)) & path.mask) {
+          return false;
+        }
+      } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+        path.mask &= ~overlap(i, GetTypeSize(i->src2.value->type));
+        path_ended = !path.mask;
+      }
+    }
+    if (!path_ended) {
+      if (!path.block->next) {
+        return false;
+      }
+      enter_block(path.block->next, path.mask);
+    }
+  }
+  return true;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
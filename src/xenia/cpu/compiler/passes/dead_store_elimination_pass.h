@@ -0,0 +1,71 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+
+#include <vector>
+
+#include "xenia/base/platform.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+#if XE_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#pragma warning(disable : 4267)
+#include <llvm/ADT/BitVector.h>
+#pragma warning(pop)
+#else
+#include <llvm/ADT/BitVector.h>
+#endif  // XE_COMPILER_MSVC
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Removes context stores that are overwritten on every path before the value
+// is loaded or the function is left, across blocks, unlike the block-local
+// removal in ContextPromotionPass.
+class DeadStoreEliminationPass : public CompilerPass {
+ public:
+  DeadStoreEliminationPass();
+  ~DeadStoreEliminationPass() override;
+
+  bool Initialize(Compiler* compiler) override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+  const char* name() const override { return "DeadStoreElimination"; }
+
+ private:
+  uint32_t IndexStoredBytes(hir::HIRBuilder* builder);
+  void SetBytes(llvm::BitVector& bits, size_t offset, size_t size, bool value);
+  bool AnyBytesSet(const llvm::BitVector& bits, size_t offset, size_t size);
+  // Walks the block backwards from its live-out set, optionally collecting
+  // the stores that are dead.
+  void TransferBlock(hir::Block* block, llvm::BitVector& live,
+                     std::vector<hir::Instr*>* dead_stores);
+  // Independent forward check of a single store for --validate_hir.
+  bool IsStoreDead(hir::Instr* store);
+
+ private:
+  // Context byte -> index in the liveness sets, or -1 if never stored.
+  std::vector<int32_t> byte_indices_;
+  std::vector<uint32_t> indexed_bytes_;
+  std::vector<hir::Block*> blocks_;
+  std::vector<llvm::BitVector> live_in_;
+  std::vector<hir::Instr*> dead_stores_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
@@ -0,0 +1,183 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/hot_path_layout_pass.h"
+
+#include "xenia/base/profiling.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Label;
+
+namespace {
+Label* GetBranchLabel(const Instr* i) {
+  if (i->opcode == &OPCODE_BRANCH_info) {
+    return i->src1.label;
+  } else if (i->opcode == &OPCODE_BRANCH_TRUE_info ||
+             i->opcode == &OPCODE_BRANCH_FALSE_info) {
+    return i->src2.label;
+  }
+  return nullptr;
+}
+
+bool FallsThrough(const Block* block) {
+  const Instr* tail = block->instr_tail;
+  if (!tail) {
+    return true;
+  }
+  if (tail->opcode == &OPCODE_CALL_info ||
+      tail->opcode == &OPCODE_CALL_INDIRECT_info) {
+    return !(tail->flags & CALL_TAIL);
+  }
+  return tail->opcode != &OPCODE_BRANCH_info &&
+         tail->opcode != &OPCODE_RETURN_info;
+}
+}  // namespace
+
+HotPathLayoutPass::HotPathLayoutPass() : CompilerPass() {}
+
+HotPathLayoutPass::~HotPathLayoutPass() {}
+
+bool HotPathLayoutPass::Run(HIRBuilder* builder) {
+  if (!trace_data_ || !trace_data_->is_valid()) {
+    return true;
+  }
+
+  // The baseline tier code counts the entries of every block at the guest
+  // instruction it starts with, and the counters of those instructions start
+  // at 1 - 0 means no block started there. Blocks here may start elsewhere -
+  // after inlined code, for instance - and are counted as the block they were
+  // part of. Blocks without a guest address in the function, like inlined
+  // code, are counted as the block before them.
+  auto counts = reinterpret_cast<const uint64_t*>(
+      trace_data_->instruction_execute_counts());
+  uint32_t start_address = trace_data_->start_address();
+  uint32_t end_address = trace_data_->end_address();
+  blocks_.clear();
+  uint64_t count = 0;
+  for (Block* block = builder->first_block(); block; block = block->next) {
+    uint32_t address = block->GetSourceAddress();
+    if (address >= start_address && address <= end_address) {
+      uint32_t index = (address - start_address) / 4;
+      while (index && !counts[index]) {
+        --index;
+      }
+      count = counts[index] ? counts[index] - 1 : 0;
+    }
+    block->ordinal = uint16_t(blocks_.size());
+    blocks_.push_back({block, count, block->next, false});
+  }
+  if (blocks_.size() < 3 || !blocks_.front().count ||
+      FallsThrough(blocks_.back().block)) {
+    return true;
+  }
+
+  // Starting with the entry, chain every hot block with its most frequently
+  // executed successor, then put the blocks never executed at the end.
+  std::vector<Block*> order;
+  order.reserve(blocks_.size());
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    BlockInfo* info = &blocks_[i];
+    if (info->placed || !info->count) {
+      continue;
+    }
+    while (info) {
+      info->placed = true;
+      order.push_back(info->block);
+      info = SelectSuccessor(*info);
+    }
+  }
+  uint32_t cold_count = 0;
+  for (BlockInfo& info : blocks_) {
+    if (!info.placed) {
+      order.push_back(info.block);
+      ++cold_count;
+    }
+  }
+  bool reordered = false;
+  for (size_t i = 0; i < order.size(); ++i) {
+    if (order[i] != blocks_[i].block) {
+      reordered = true;
+      break;
+    }
+  }
+  if (!reordered) {
+    return true;
+  }
+
+  // Blocks that used to fall through to a block that doesn't follow them
+  // anymore must branch to it instead. If the block ends with a conditional
+  // branch to the block following it now, the condition is inverted instead.
+  for (size_t i = 0; i < order.size(); ++i) {
+    BlockInfo& info = blocks_[order[i]->ordinal];
+    Block* new_next = i + 1 < order.size() ? order[i + 1] : nullptr;
+    if (!FallsThrough(info.block) || info.original_next == new_next) {
+      continue;
+    }
+    Instr* tail = info.block->instr_tail;
+    if (new_next && tail &&
+        (tail->opcode == &OPCODE_BRANCH_TRUE_info ||
+         tail->opcode == &OPCODE_BRANCH_FALSE_info) &&
+        tail->src2.label->block == new_next) {
+      if (!info.original_next->label_head) {
+        builder->MarkLabel(builder->NewLabel(), info.original_next);
+      }
+      tail->opcode = tail->opcode == &OPCODE_BRANCH_TRUE_info
+                         ? &OPCODE_BRANCH_FALSE_info
+                         : &OPCODE_BRANCH_TRUE_info;
+      tail->src2.label = info.original_next->label_head;
+    } else {
+      builder->AppendBranch(info.block, info.original_next);
+    }
+  }
+  for (Block* block : order) {
+    builder->MoveBlockToEnd(block);
+  }
+  COUNT_profile_add("cpu/compiler/cold_blocks", cold_count);
+
+  return true;
+}
+
+HotPathLayoutPass::BlockInfo* HotPathLayoutPass::SelectSuccessor(
+    const BlockInfo& info) {
+  // Falling through is preferred if it's as frequent.
+  BlockInfo* best = nullptr;
+  if (FallsThrough(info.block) && info.original_next) {
+    BlockInfo& next = blocks_[info.original_next->ordinal];
+    if (!next.placed && next.count) {
+      best = &next;
+    }
+  }
+  for (Instr* i = info.block->instr_head; i; i = i->next) {
+    Label* label = GetBranchLabel(i);
+    if (!label) {
+      continue;
+    }
+    BlockInfo& target = blocks_[label->block->ordinal];
+    if (!target.placed && target.count &&
+        (!best || target.count > best->count)) {
+      best = &target;
+    }
+  }
+  return best;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,61 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_HOT_PATH_LAYOUT_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_HOT_PATH_LAYOUT_PASS_H_
+
+#include <vector>
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/function_trace_data.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Reorders the blocks using the block entry counts recorded in the trace data
+// of the function, so the most frequently taken successor of every block
+// follows it, and blocks that have never been entered go to the end of the
+// function, out of the way of the hot code.
+// Blocks only have to be laid out, so this can run after register allocation.
+class HotPathLayoutPass : public CompilerPass {
+ public:
+  HotPathLayoutPass();
+  ~HotPathLayoutPass() override;
+
+  // Trace data of the function being compiled, or null if it has no profile.
+  void set_trace_data(const FunctionTraceData* trace_data) {
+    trace_data_ = trace_data;
+  }
+
+  bool Run(hir::HIRBuilder* builder) override;
+  const char* name() const override { return "HotPathLayout"; }
+
+ private:
+  struct BlockInfo {
+    hir::Block* block;
+    uint64_t count;
+    // Block following it before the layout.
+    hir::Block* original_next;
+    bool placed;
+  };
+
+  BlockInfo* SelectSuccessor(const BlockInfo& info);
+
+  const FunctionTraceData* trace_data_ = nullptr;
+  std::vector<BlockInfo> blocks_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_HOT_PATH_LAYOUT_PASS_H_
@@ -0,0 +1,148 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/idle_loop_detection_pass.h"
+
+#include "xenia/base/profiling.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+
+namespace {
+// Longer loops likely do actual work on every iteration.
+constexpr uint32_t kMaxIdleLoopInstrs = 32;
+
+bool Overlaps(const std::vector<std::pair<uint32_t, uint32_t>>& ranges,
+              uint32_t offset, uint32_t size) {
+  for (const auto& range : ranges) {
+    if (offset < range.first + range.second && range.first < offset + size) {
+      return true;
+    }
+  }
+  return false;
+}
+}  // namespace
+
+IdleLoopDetectionPass::IdleLoopDetectionPass() : CompilerPass() {}
+
+IdleLoopDetectionPass::~IdleLoopDetectionPass() {}
+
+bool IdleLoopDetectionPass::Run(HIRBuilder* builder) {
+  uint32_t idle_loop_count = 0;
+  for (Block* block = builder->first_block(); block; block = block->next) {
+    Instr* branch = block->instr_tail;
+    if (!branch) {
+      continue;
+    }
+    Block* target = nullptr;
+    if (branch->opcode == &OPCODE_BRANCH_info) {
+      target = branch->src1.label->block;
+    } else if (branch->opcode == &OPCODE_BRANCH_TRUE_info ||
+               branch->opcode == &OPCODE_BRANCH_FALSE_info) {
+      target = branch->src2.label->block;
+    }
+    if (target != block || !IsIdleLoop(block)) {
+      continue;
+    }
+    builder->DelayExecution(DELAY_EXECUTION_IDLE_LOOP);
+    builder->last_instr()->MoveBefore(branch);
+    ++idle_loop_count;
+  }
+  COUNT_profile_add("cpu/compiler/idle_loops", idle_loop_count);
+  return true;
+}
+
+bool IdleLoopDetectionPass::IsIdleLoop(Block* block) {
+  // Every iteration must do the same thing - if anything the block loads from
+  // the context before storing it is also stored, like a counter, the loop is
+  // not just waiting.
+  stored_ranges_.clear();
+  loaded_ranges_.clear();
+  uint32_t instr_count = 0;
+  for (Instr* i = block->instr_head; i != block->instr_tail; i = i->next) {
+    switch (i->GetOpcodeNum()) {
+      case OPCODE_COMMENT:
+      case OPCODE_NOP:
+      case OPCODE_SOURCE_OFFSET:
+        continue;
+      case OPCODE_LOAD_CONTEXT: {
+        uint32_t offset = uint32_t(i->src1.offset);
+        uint32_t size = uint32_t(GetTypeSize(i->dest->type));
+        if (!Overlaps(stored_ranges_, offset, size)) {
+          loaded_ranges_.emplace_back(offset, size);
+        }
+      } break;
+      case OPCODE_STORE_CONTEXT: {
+        uint32_t offset = uint32_t(i->src1.offset);
+        uint32_t size = uint32_t(GetTypeSize(i->src2.value->type));
+        if (Overlaps(loaded_ranges_, offset, size)) {
+          return false;
+        }
+        stored_ranges_.emplace_back(offset, size);
+      } break;
+      case OPCODE_LOAD:
+      case OPCODE_LOAD_OFFSET:
+      case OPCODE_LOAD_MMIO:
+      case OPCODE_LOAD_CLOCK:
+      case OPCODE_CONTEXT_BARRIER:
+      case OPCODE_MEMORY_BARRIER:
+      case OPCODE_CACHE_CONTROL:
+      case OPCODE_DELAY_EXECUTION:
+      case OPCODE_ASSIGN:
+      case OPCODE_CAST:
+      case OPCODE_ZERO_EXTEND:
+      case OPCODE_SIGN_EXTEND:
+      case OPCODE_TRUNCATE:
+      case OPCODE_BYTE_SWAP:
+      case OPCODE_SELECT:
+      case OPCODE_COMPARE_EQ:
+      case OPCODE_COMPARE_NE:
+      case OPCODE_COMPARE_SLT:
+      case OPCODE_COMPARE_SLE:
+      case OPCODE_COMPARE_SGT:
+      case OPCODE_COMPARE_SGE:
+      case OPCODE_COMPARE_ULT:
+      case OPCODE_COMPARE_ULE:
+      case OPCODE_COMPARE_UGT:
+      case OPCODE_COMPARE_UGE:
+      case OPCODE_ADD:
+      case OPCODE_SUB:
+      case OPCODE_AND:
+      case OPCODE_AND_NOT:
+      case OPCODE_OR:
+      case OPCODE_XOR:
+      case OPCODE_NOT:
+      case OPCODE_SHL:
+      case OPCODE_SHR:
+      case OPCODE_SHA:
+      case OPCODE_ROTATE_LEFT:
+        break;
+      default:
+        return false;
+    }
+    if (++instr_count > kMaxIdleLoopInstrs) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
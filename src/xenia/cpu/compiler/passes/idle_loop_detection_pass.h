@@ -0,0 +1,48 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_IDLE_LOOP_DETECTION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_IDLE_LOOP_DETECTION_PASS_H_
+
+#include <utility>
+#include <vector>
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Finds blocks branching to themselves that only poll memory or the time base
+// and compare, such as spin-waits on a flag, and makes them delay execution on
+// every iteration so the host thread can back off while the guest waits.
+class IdleLoopDetectionPass : public CompilerPass {
+ public:
+  IdleLoopDetectionPass();
+  ~IdleLoopDetectionPass() override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+  const char* name() const override { return "IdleLoopDetection"; }
+
+ private:
+  bool IsIdleLoop(hir::Block* block);
+
+  // Context ranges stored in the block being checked.
+  std::vector<std::pair<uint32_t, uint32_t>> stored_ranges_;
+  // Context ranges loaded before being stored in the block.
+  std::vector<std::pair<uint32_t, uint32_t>> loaded_ranges_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_IDLE_LOOP_DETECTION_PASS_H_
@@ -0,0 +1,113 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/loop_analysis.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Label;
+
+void LoopAnalysis::Analyze(HIRBuilder* builder) {
+  blocks_.clear();
+  loops_.clear();
+  uint16_t block_ordinal = 0;
+  for (Block* block = builder->first_block(); block; block = block->next) {
+    block->ordinal = block_ordinal++;
+    blocks_.push_back(block);
+  }
+
+  // A branch to the same or an earlier block is a back-edge.
+  for (Block* block : blocks_) {
+    for (Instr* i = block->instr_head; i; i = i->next) {
+      Label* label = GetBranchLabel(i);
+      if (!label || label->block->ordinal > block->ordinal) {
+        continue;
+      }
+      Block* header = label->block;
+      auto it = std::find_if(
+          loops_.begin(), loops_.end(),
+          [header](const Loop& loop) { return loop.header == header; });
+      if (it != loops_.end()) {
+        it->latch = block;
+      } else {
+        loops_.push_back({header->prev, header, block});
+      }
+    }
+  }
+
+  loops_.erase(std::remove_if(loops_.begin(), loops_.end(),
+                              [this](const Loop& loop) {
+                                return !loop.preheader ||
+                                       !loop.preheader->instr_tail ||
+                                       !HasSingleEntry(loop);
+                              }),
+               loops_.end());
+  std::stable_sort(loops_.begin(), loops_.end(),
+                   [](const Loop& a, const Loop& b) {
+                     return a.latch->ordinal - a.header->ordinal <
+                            b.latch->ordinal - b.header->ordinal;
+                   });
+}
+
+bool LoopAnalysis::HasSingleEntry(const Loop& loop) const {
+  // The loop may only be entered from the end of the preheader. Passes may
+  // place instructions after a branch, such as in the preheader of another
+  // loop, so all of them are checked rather than only the ones ending blocks.
+  Instr* preheader_branches = GetTrailingBranches(loop.preheader);
+  for (Block* block : blocks_) {
+    if (loop.Contains(block)) {
+      continue;
+    }
+    bool trailing = false;
+    for (Instr* i = block->instr_head; i; i = i->next) {
+      trailing = trailing || i == preheader_branches;
+      Label* label = GetBranchLabel(i);
+      if (!label || !loop.Contains(label->block)) {
+        continue;
+      }
+      if (block != loop.preheader || !trailing ||
+          label->block != loop.header) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+Label* LoopAnalysis::GetBranchLabel(const Instr* i) {
+  if (i->opcode == &OPCODE_BRANCH_info) {
+    return i->src1.label;
+  } else if (i->opcode == &OPCODE_BRANCH_TRUE_info ||
+             i->opcode == &OPCODE_BRANCH_FALSE_info) {
+    return i->src2.label;
+  }
+  return nullptr;
+}
+
+Instr* LoopAnalysis::GetTrailingBranches(const Block* block) {
+  Instr* first = nullptr;
+  for (Instr* i = block->instr_tail; i && GetBranchLabel(i); i = i->prev) {
+    first = i;
+  }
+  return first;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,86 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_LOOP_ANALYSIS_H_
+#define XENIA_CPU_COMPILER_PASSES_LOOP_ANALYSIS_H_
+
+#include <algorithm>
+#include <vector>
+
+#include "xenia/cpu/hir/hir_builder.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Finds the loops in the function for the loop passes from the branches, so
+// it doesn't depend on the CFG being up to date.
+// A loop is all the blocks from its header to the last block branching back to
+// it in the layout. Only loops entered from their preheader - the block right
+// before the header - are found, so anything placed at the end of the
+// preheader, before its branches, runs every time the loop is entered.
+class LoopAnalysis {
+ public:
+  struct Loop {
+    hir::Block* preheader;
+    hir::Block* header;
+    // Furthest block branching back to the header.
+    hir::Block* latch;
+
+    bool Contains(const hir::Block* block) const {
+      return block->ordinal >= header->ordinal &&
+             block->ordinal <= latch->ordinal;
+    }
+  };
+
+  // Renumbers the block ordinals in the layout order.
+  void Analyze(hir::HIRBuilder* builder);
+
+  // All blocks, by ordinal.
+  const std::vector<hir::Block*>& blocks() const { return blocks_; }
+  // Innermost loops first.
+  const std::vector<Loop>& loops() const { return loops_; }
+
+  // Picks the loops the predicate is true for, innermost first, leaving out
+  // the ones sharing blocks, including the preheaders, with the loops picked
+  // before them.
+  template <typename Predicate>
+  std::vector<Loop> SelectDisjointLoops(Predicate&& predicate) const {
+    std::vector<bool> claimed(blocks_.size(), false);
+    std::vector<Loop> selected_loops;
+    for (const Loop& loop : loops_) {
+      auto first = claimed.begin() + loop.preheader->ordinal;
+      auto last = claimed.begin() + loop.latch->ordinal + 1;
+      if (std::find(first, last, true) != last || !predicate(loop)) {
+        continue;
+      }
+      std::fill(first, last, true);
+      selected_loops.push_back(loop);
+    }
+    return selected_loops;
+  }
+
+  static hir::Label* GetBranchLabel(const hir::Instr* i);
+  // First of the branches ending the block, if any.
+  static hir::Instr* GetTrailingBranches(const hir::Block* block);
+
+ private:
+  bool HasSingleEntry(const Loop& loop) const;
+
+  std::vector<hir::Block*> blocks_;
+  std::vector<Loop> loops_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_LOOP_ANALYSIS_H_
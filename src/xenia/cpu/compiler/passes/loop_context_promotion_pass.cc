@@ -0,0 +1,290 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/loop_context_promotion_pass.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#include "xenia/base/math.h"
+#include "xenia/base/cvar.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/passes/register_allocation_pass.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+
+DECLARE_bool(debug);
+DECLARE_bool(store_all_context_values);
+DECLARE_bool(full_optimization_even_with_debug);
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::backend::MachineInfo;
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Label;
+using xe::cpu::hir::TypeName;
+
+namespace {
+void SetBranchLabel(Instr* i, Label* label) {
+  if (i->opcode == &OPCODE_BRANCH_info) {
+    i->src1.label = label;
+  } else {
+    i->src2.label = label;
+  }
+}
+
+bool FallsThrough(const Block* block) {
+  return !block->instr_tail ||
+         block->instr_tail->opcode != &OPCODE_BRANCH_info;
+}
+
+bool IsPromotableRegister(uint32_t offset, TypeName type) {
+  // r1 and r13 are left in the context, loads of them are used to skip
+  // address checks when emitting memory accesses. ctr is the counter of many
+  // loops.
+  switch (type) {
+    case INT64_TYPE: {
+      if (offset == offsetof(ppc::PPCContext, ctr)) {
+        return true;
+      }
+      size_t base = offsetof(ppc::PPCContext, r);
+      return offset >= base && offset < base + sizeof(ppc::PPCContext::r) &&
+             !((offset - base) % sizeof(uint64_t)) &&
+             offset != offsetof(ppc::PPCContext, r[1]) &&
+             offset != offsetof(ppc::PPCContext, r[13]);
+    }
+    case FLOAT64_TYPE: {
+      size_t base = offsetof(ppc::PPCContext, f);
+      return offset >= base && offset < base + sizeof(ppc::PPCContext::f) &&
+             !((offset - base) % sizeof(double));
+    }
+    case VEC128_TYPE: {
+      size_t base = offsetof(ppc::PPCContext, v);
+      return offset >= base && offset < base + sizeof(ppc::PPCContext::v) &&
+             !((offset - base) % sizeof(vec128_t));
+    }
+    default:
+      return false;
+  }
+}
+}  // namespace
+
+LoopContextPromotionPass::LoopContextPromotionPass(
+    const MachineInfo* machine_info)
+    : CompilerPass(), machine_info_(machine_info) {}
+
+LoopContextPromotionPass::~LoopContextPromotionPass() {}
+
+bool LoopContextPromotionPass::Run(HIRBuilder* builder) {
+  // Like the other context passes, registers must be in the context when
+  // debugging or tracing.
+  if (!cvars::full_optimization_even_with_debug &&
+      (cvars::debug || cvars::store_all_context_values)) {
+    return true;
+  }
+  if (cvars::trace_function_data) {
+    return true;
+  }
+
+  // Loops sharing blocks with one already chosen, including the preheader,
+  // are left in the context.
+  loop_analysis_.Analyze(builder);
+  std::vector<Loop> promoted_loops = loop_analysis_.SelectDisjointLoops(
+      [this](const Loop& loop) { return IsSimpleLoop(loop); });
+
+  // All loops are chosen before changing anything, as the blocks storing the
+  // registers are not part of the ordering.
+  uint32_t promoted_count = 0;
+  for (const Loop& loop : promoted_loops) {
+    promoted_count += PromoteLoop(builder, loop);
+  }
+  COUNT_profile_add("cpu/compiler/loop_promoted_registers", promoted_count);
+
+  return true;
+}
+
+bool LoopContextPromotionPass::IsSimpleLoop(const Loop& loop) {
+  for (Block* block = loop.header; block != loop.latch->next;
+       block = block->next) {
+    for (Instr* i = block->instr_head; i; i = i->next) {
+      if (ObservesContext(i->opcode)) {
+        return false;
+      }
+    }
+  }
+
+  // Falling off the end of the function leaves no place for the stores.
+  return !FallsThrough(loop.latch) || loop.latch->next;
+}
+
+uint32_t LoopContextPromotionPass::PromoteLoop(HIRBuilder* builder,
+                                               const Loop& loop) {
+  locations_.clear();
+  for (Block* block = loop.header; block != loop.latch->next;
+       block = block->next) {
+    for (Instr* i = block->instr_head; i; i = i->next) {
+      if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+        AddAccess(uint32_t(i->src1.offset), i->dest->type, false);
+      } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+        AddAccess(uint32_t(i->src1.offset), i->src2.value->type, true);
+      }
+    }
+  }
+
+  // The most used registers get the host registers that can be spared.
+  std::stable_sort(locations_.begin(), locations_.end(),
+                   [](const Location& a, const Location& b) {
+                     return a.access_count > b.access_count;
+                   });
+  std::vector<uint32_t> set_counts(xe::countof(machine_info_->register_sets));
+  bool any_stored = false;
+  uint32_t promoted_count = 0;
+  for (Location& location : locations_) {
+    if (!location.promotable) {
+      continue;
+    }
+    auto set = RegisterAllocationPass::GetRegisterSet(*machine_info_,
+                                                      location.type);
+    if (!set || set_counts[set->id] >=
+                    RegisterAllocationPass::GetLocalRegisterLimit(*set)) {
+      location.promotable = false;
+      continue;
+    }
+    ++set_counts[set->id];
+    ++promoted_count;
+    any_stored |= location.stored;
+    location.slot = builder->AllocLocal(location.type);
+  }
+  if (!promoted_count) {
+    return 0;
+  }
+
+  // Load into the locals at the end of the preheader, before it branches.
+  Block* preheader = loop.preheader;
+  Instr* preheader_branches = LoopAnalysis::GetTrailingBranches(preheader);
+  for (const Location& location : locations_) {
+    if (!location.promotable) {
+      continue;
+    }
+    Value* value = builder->LoadContext(location.offset, location.type);
+    builder->StoreLocal(location.slot, value);
+    Instr* store = builder->last_instr();
+    if (preheader_branches) {
+      value->def->MoveBefore(preheader_branches);
+      store->MoveBefore(preheader_branches);
+    } else {
+      value->def->MoveAfter(preheader->instr_tail);
+      store->MoveAfter(value->def);
+    }
+  }
+
+  // Swap the accesses in the loop over to the locals.
+  for (Block* block = loop.header; block != loop.latch->next;
+       block = block->next) {
+    for (Instr* i = block->instr_head; i; i = i->next) {
+      bool is_load = i->opcode == &OPCODE_LOAD_CONTEXT_info;
+      if (!is_load && i->opcode != &OPCODE_STORE_CONTEXT_info) {
+        continue;
+      }
+      auto it = std::find_if(locations_.begin(), locations_.end(),
+                             [i](const Location& location) {
+                               return location.offset == i->src1.offset;
+                             });
+      if (it == locations_.end() || !it->promotable) {
+        continue;
+      }
+      i->opcode = is_load ? &OPCODE_LOAD_LOCAL_info : &OPCODE_STORE_LOCAL_info;
+      i->set_src1(it->slot);
+    }
+  }
+  if (!any_stored) {
+    return promoted_count;
+  }
+
+  // Every way out of the loop goes through a block storing the modified
+  // registers back to the context.
+  exits_.clear();
+  auto get_exit_label = [this, builder](Label* target) {
+    for (auto& exit : exits_) {
+      if (exit.first == target) {
+        return exit.second;
+      }
+    }
+    Label* label = builder->NewLabel();
+    exits_.emplace_back(target, label);
+    return label;
+  };
+  for (Block* block = loop.header; block != loop.latch->next;
+       block = block->next) {
+    for (Instr* i = block->instr_head; i; i = i->next) {
+      Label* label = LoopAnalysis::GetBranchLabel(i);
+      if (label && !loop.Contains(label->block)) {
+        SetBranchLabel(i, get_exit_label(label));
+      }
+    }
+  }
+  if (FallsThrough(loop.latch)) {
+    Block* next = loop.latch->next;
+    if (!next->label_head) {
+      builder->MarkLabel(builder->NewLabel(), next);
+    }
+    builder->Branch(get_exit_label(next->label_head));
+    builder->last_instr()->MoveAfter(loop.latch->instr_tail);
+  }
+  for (auto& exit : exits_) {
+    builder->MarkLabel(exit.second);
+    for (const Location& location : locations_) {
+      if (location.promotable && location.stored) {
+        builder->StoreContext(location.offset,
+                              builder->LoadLocal(location.slot));
+      }
+    }
+    builder->Branch(exit.first);
+  }
+
+  return promoted_count;
+}
+
+void LoopContextPromotionPass::AddAccess(uint32_t offset, TypeName type,
+                                         bool is_store) {
+  // Locations accessed with different types or partially are left alone.
+  size_t size = GetTypeSize(type);
+  Location* match = nullptr;
+  bool overlaps = false;
+  for (Location& location : locations_) {
+    if (location.offset == offset && location.type == type) {
+      match = &location;
+    } else if (offset < location.offset + GetTypeSize(location.type) &&
+               location.offset < offset + size) {
+      location.promotable = false;
+      overlaps = true;
+    }
+  }
+  if (!match) {
+    locations_.push_back({offset, type, 0, false,
+                          IsPromotableRegister(offset, type), nullptr});
+    match = &locations_.back();
+  }
+  match->promotable &= !overlaps;
+  ++match->access_count;
+  match->stored |= is_store;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
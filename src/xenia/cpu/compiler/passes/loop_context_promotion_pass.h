@@ -0,0 +1,67 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_LOOP_CONTEXT_PROMOTION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_LOOP_CONTEXT_PROMOTION_PASS_H_
+
+#include <utility>
+#include <vector>
+
+#include "xenia/cpu/backend/machine_info.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/compiler/passes/loop_analysis.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Moves the guest registers used in simple loops from the context into locals
+// for the duration of the loop, loading them before the loop and storing them
+// back on the way out. RegisterAllocationPass then keeps those locals in host
+// registers across the blocks of the loop.
+// Loops must not contain calls or anything else that needs the context to be
+// up to date.
+class LoopContextPromotionPass : public CompilerPass {
+ public:
+  explicit LoopContextPromotionPass(const backend::MachineInfo* machine_info);
+  ~LoopContextPromotionPass() override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+  const char* name() const override { return "LoopContextPromotion"; }
+
+ private:
+  using Loop = LoopAnalysis::Loop;
+  struct Location {
+    uint32_t offset;
+    hir::TypeName type;
+    uint32_t access_count;
+    bool stored;
+    bool promotable;
+    hir::Value* slot;
+  };
+
+  bool IsSimpleLoop(const Loop& loop);
+  uint32_t PromoteLoop(hir::HIRBuilder* builder, const Loop& loop);
+  void AddAccess(uint32_t offset, hir::TypeName type, bool is_store);
+
+ private:
+  const backend::MachineInfo* machine_info_;
+  LoopAnalysis loop_analysis_;
+  std::vector<Location> locations_;
+  // Original branch target -> block storing the registers before going there.
+  std::vector<std::pair<hir::Label*, hir::Label*>> exits_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_LOOP_CONTEXT_PROMOTION_PASS_H_
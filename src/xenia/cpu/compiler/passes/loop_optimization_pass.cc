@@ -0,0 +1,476 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/loop_optimization_pass.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+
+#include "xenia/base/math.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/passes/register_allocation_pass.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::backend::MachineInfo;
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::TypeName;
+using xe::cpu::hir::Value;
+
+namespace {
+bool Overlaps(const std::vector<std::pair<uint32_t, uint32_t>>& ranges,
+              uint32_t offset, uint32_t size) {
+  for (const auto& range : ranges) {
+    if (offset < range.first + range.second && range.first < offset + size) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Value* GetValueSrc(const Instr* i, uint32_t n) {
+  uint32_t signature = i->opcode->signature;
+  uint32_t types[] = {GET_OPCODE_SIG_TYPE_SRC1(signature),
+                      GET_OPCODE_SIG_TYPE_SRC2(signature),
+                      GET_OPCODE_SIG_TYPE_SRC3(signature)};
+  return types[n] == OPCODE_SIG_TYPE_V ? i->srcs[n].value : nullptr;
+}
+
+// More than the load of a local replacing it in the loop.
+bool IsExpensive(const Instr* i) {
+  switch (i->GetOpcodeNum()) {
+    case OPCODE_MUL:
+    case OPCODE_LOAD_VECTOR_SHL:
+    case OPCODE_LOAD_VECTOR_SHR:
+    case OPCODE_SPLAT:
+    case OPCODE_PERMUTE:
+    case OPCODE_SWIZZLE:
+      return true;
+    default:
+      return false;
+  }
+}
+}  // namespace
+
+LoopOptimizationPass::LoopOptimizationPass(const MachineInfo* machine_info)
+    : CompilerPass(), machine_info_(machine_info) {}
+
+LoopOptimizationPass::~LoopOptimizationPass() {}
+
+bool LoopOptimizationPass::Run(HIRBuilder* builder) {
+  // Code moved out of an inner loop stays in the outer one.
+  loop_analysis_.Analyze(builder);
+  std::vector<Loop> loops =
+      loop_analysis_.SelectDisjointLoops([](const Loop& loop) { return true; });
+
+  uint32_t hoisted_count = 0;
+  uint32_t reduced_count = 0;
+  for (const Loop& loop : loops) {
+    AnalyzeLoop(loop);
+    hoisted_count += HoistInvariants(builder, loop);
+    reduced_count += ReduceInductionVariables(builder, loop);
+  }
+  COUNT_profile_add("cpu/compiler/loop_hoisted_instrs", hoisted_count);
+  COUNT_profile_add("cpu/compiler/loop_reduced_multiplications",
+                    reduced_count);
+
+  return true;
+}
+
+void LoopOptimizationPass::AnalyzeLoop(const Loop& loop) {
+  observes_context_ = false;
+  stored_ranges_.clear();
+  invariants_.clear();
+  hoisted_.clear();
+  induction_variables_.clear();
+  reduced_values_.clear();
+  set_local_counts_.assign(xe::countof(machine_info_->register_sets), 0);
+  preheader_ = loop.preheader;
+  preheader_branches_ = LoopAnalysis::GetTrailingBranches(preheader_);
+  preheader_tail_ = preheader_->instr_tail;
+
+  for (Block* block = loop.header; block != loop.latch->next;
+       block = block->next) {
+    for (Instr* i = block->instr_head; i; i = i->next) {
+      if (ObservesContext(i->opcode)) {
+        observes_context_ = true;
+      } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+        stored_ranges_.emplace_back(
+            uint32_t(i->src1.offset),
+            uint32_t(GetTypeSize(i->src2.value->type)));
+      }
+    }
+  }
+
+  // Values don't cross blocks, so the operands are defined earlier in the same
+  // block.
+  for (Block* block = loop.header; block != loop.latch->next;
+       block = block->next) {
+    for (Instr* i = block->instr_head; i; i = i->next) {
+      if (IsInvariant(i)) {
+        invariants_.insert(i);
+      }
+    }
+  }
+
+  // Registers that are only changed by adding a constant to them once per
+  // iteration. Anything observing the context may change them as well.
+  if (observes_context_) {
+    return;
+  }
+  for (Block* block = loop.header; block != loop.latch->next;
+       block = block->next) {
+    for (Instr* i = block->instr_head; i; i = i->next) {
+      if (i->opcode != &OPCODE_STORE_CONTEXT_info ||
+          i->src2.value->type != INT64_TYPE) {
+        continue;
+      }
+      uint32_t offset = uint32_t(i->src1.offset);
+      uint32_t store_count = 0;
+      for (const auto& range : stored_ranges_) {
+        if (offset < range.first + range.second &&
+            range.first < offset + sizeof(uint64_t)) {
+          ++store_count;
+        }
+      }
+      Instr* step_def = i->src2.value->def;
+      if (store_count != 1 || !step_def ||
+          (step_def->flags & ARITHMETIC_SATURATE)) {
+        continue;
+      }
+      Value* variable = nullptr;
+      Value* step = nullptr;
+      if (step_def->opcode == &OPCODE_ADD_info) {
+        variable = step_def->src1.value;
+        step = step_def->src2.value;
+        if (variable->IsConstant()) {
+          std::swap(variable, step);
+        }
+      } else if (step_def->opcode == &OPCODE_SUB_info) {
+        variable = step_def->src1.value;
+        step = step_def->src2.value;
+      }
+      if (!variable || !step->IsConstant() || !variable->def ||
+          variable->def->opcode != &OPCODE_LOAD_CONTEXT_info ||
+          variable->def->src1.offset != offset ||
+          variable->type != INT64_TYPE) {
+        continue;
+      }
+      int64_t step_value = step->constant.i64;
+      if (step_def->opcode == &OPCODE_SUB_info) {
+        step_value = int64_t(0 - uint64_t(step_value));
+      }
+      induction_variables_.push_back({offset, i, step_value});
+    }
+  }
+}
+
+bool LoopOptimizationPass::IsInvariant(const Instr* i) const {
+  switch (i->GetOpcodeNum()) {
+    case OPCODE_LOAD_CONTEXT: {
+      // Memory accesses based on r1 and r13 skip the address checks when the
+      // base is loaded from the context right there.
+      uint32_t offset = uint32_t(i->src1.offset);
+      if (observes_context_ ||
+          offset == offsetof(ppc::PPCContext, r[1]) ||
+          offset == offsetof(ppc::PPCContext, r[13])) {
+        return false;
+      }
+      return !Overlaps(stored_ranges_, offset,
+                       uint32_t(GetTypeSize(i->dest->type)));
+    }
+    case OPCODE_ASSIGN:
+    case OPCODE_ZERO_EXTEND:
+    case OPCODE_SIGN_EXTEND:
+    case OPCODE_TRUNCATE:
+    case OPCODE_BYTE_SWAP:
+    case OPCODE_AND:
+    case OPCODE_AND_NOT:
+    case OPCODE_OR:
+    case OPCODE_XOR:
+    case OPCODE_NOT:
+    case OPCODE_LOAD_VECTOR_SHL:
+    case OPCODE_LOAD_VECTOR_SHR:
+    case OPCODE_SPLAT:
+    case OPCODE_PERMUTE:
+    case OPCODE_SWIZZLE:
+    case OPCODE_VECTOR_SHL:
+    case OPCODE_VECTOR_SHR:
+    case OPCODE_VECTOR_SHA:
+      break;
+    case OPCODE_ADD:
+    case OPCODE_SUB:
+    case OPCODE_MUL:
+    case OPCODE_SHL:
+    case OPCODE_SHR:
+    case OPCODE_SHA:
+    case OPCODE_ROTATE_LEFT:
+    case OPCODE_CNTLZ:
+      // Floating-point results depend on the rounding mode, which may be
+      // changed in the loop.
+      if (!IsScalarIntegralType(i->dest->type)) {
+        return false;
+      }
+      break;
+    default:
+      return false;
+  }
+  for (uint32_t n = 0; n < 3; ++n) {
+    Value* value = GetValueSrc(i, n);
+    if (value && !value->IsConstant() &&
+        (!value->def || !invariants_.count(value->def))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void LoopOptimizationPass::CollectHoistedTree(Instr* i) {
+  if (hoisted_.count(i) ||
+      std::find(tree_.begin(), tree_.end(), i) != tree_.end()) {
+    return;
+  }
+  for (uint32_t n = 0; n < 3; ++n) {
+    Value* value = GetValueSrc(i, n);
+    if (value && !value->IsConstant()) {
+      CollectHoistedTree(value->def);
+    }
+  }
+  tree_.push_back(i);
+}
+
+uint32_t LoopOptimizationPass::HoistInvariants(HIRBuilder* builder,
+                                               const Loop& loop) {
+  // The roots are the invariant values used by the rest of the loop, each
+  // needing a local. Moving a root alone, like a single load from the context,
+  // only replaces it with the load of the local.
+  for (Block* block = loop.header; block != loop.latch->next;
+       block = block->next) {
+    for (Instr* i = block->instr_head; i; i = i->next) {
+      if (!invariants_.count(i) || hoisted_.count(i)) {
+        continue;
+      }
+      bool is_root = false;
+      for (auto use = i->dest->use_head; use; use = use->next) {
+        is_root |= !invariants_.count(use->instr);
+      }
+      if (!is_root) {
+        continue;
+      }
+      bool has_invariant_operand = false;
+      for (uint32_t n = 0; n < 3; ++n) {
+        Value* value = GetValueSrc(i, n);
+        has_invariant_operand |= value && !value->IsConstant();
+      }
+      if (!has_invariant_operand && !IsExpensive(i)) {
+        continue;
+      }
+      // Besides the root, the operands also used by the rest of the loop need
+      // locals.
+      tree_.clear();
+      CollectHoistedTree(i);
+      std::vector<uint32_t> set_local_counts = set_local_counts_;
+      bool fits = true;
+      for (Instr* tree_i : tree_) {
+        bool used_in_loop = false;
+        for (auto use = tree_i->dest->use_head; use; use = use->next) {
+          used_in_loop |=
+              !hoisted_.count(use->instr) &&
+              std::find(tree_.begin(), tree_.end(), use->instr) == tree_.end();
+        }
+        if (used_in_loop &&
+            !ReserveLocal(set_local_counts, tree_i->dest->type)) {
+          fits = false;
+          break;
+        }
+      }
+      if (!fits) {
+        continue;
+      }
+      set_local_counts_ = std::move(set_local_counts);
+      hoisted_.insert(tree_.begin(), tree_.end());
+    }
+  }
+  if (hoisted_.empty()) {
+    return 0;
+  }
+
+  // Operands are moved before the instructions using them as the order within
+  // the blocks is kept. The uses left in the loop load the result from a local
+  // where it was computed.
+  uint32_t hoisted_count = 0;
+  std::vector<std::pair<Instr*, uint32_t>> loop_uses;
+  for (Block* block = loop.header; block != loop.latch->next;
+       block = block->next) {
+    Instr* next_i;
+    for (Instr* i = block->instr_head; i; i = next_i) {
+      next_i = i->next;
+      if (!hoisted_.count(i)) {
+        continue;
+      }
+      loop_uses.clear();
+      for (auto use = i->dest->use_head; use; use = use->next) {
+        if (hoisted_.count(use->instr)) {
+          continue;
+        }
+        for (uint32_t n = 0; n < 3; ++n) {
+          if (use->instr->srcs_use[n] == use) {
+            loop_uses.emplace_back(use->instr, n);
+          }
+        }
+      }
+      Value* slot = nullptr;
+      if (!loop_uses.empty()) {
+        slot = builder->AllocLocal(i->dest->type);
+        Value* local_value = builder->LoadLocal(slot);
+        local_value->def->MoveBefore(i);
+        for (const auto& loop_use : loop_uses) {
+          loop_use.first->set_srcN(local_value, loop_use.second);
+        }
+      }
+      AppendToPreheader(i);
+      if (slot) {
+        builder->StoreLocal(slot, i->dest);
+        AppendToPreheader(builder->last_instr());
+      }
+      ++hoisted_count;
+    }
+  }
+  return hoisted_count;
+}
+
+uint32_t LoopOptimizationPass::ReduceInductionVariables(HIRBuilder* builder,
+                                                        const Loop& loop) {
+  if (induction_variables_.empty()) {
+    return 0;
+  }
+  uint32_t reduced_count = 0;
+  for (Block* block = loop.header; block != loop.latch->next;
+       block = block->next) {
+    for (Instr* i = block->instr_head; i; i = i->next) {
+      if (i->opcode != &OPCODE_MUL_info || i->dest->type != INT64_TYPE) {
+        continue;
+      }
+      Value* variable_value = i->src1.value;
+      Value* factor_value = i->src2.value;
+      if (variable_value->IsConstant()) {
+        std::swap(variable_value, factor_value);
+      }
+      if (!factor_value->IsConstant()) {
+        continue;
+      }
+      const InductionVariable* variable =
+          FindInductionVariable(variable_value, i);
+      if (!variable) {
+        continue;
+      }
+      int64_t factor = factor_value->constant.i64;
+      Value* slot = nullptr;
+      for (const ReducedValue& reduced_value : reduced_values_) {
+        if (reduced_value.variable == variable &&
+            reduced_value.factor == factor) {
+          slot = reduced_value.slot;
+          break;
+        }
+      }
+      if (!slot) {
+        if (!ReserveLocal(set_local_counts_, INT64_TYPE)) {
+          continue;
+        }
+        slot = builder->AllocLocal(INT64_TYPE);
+        reduced_values_.push_back({variable, factor, slot});
+
+        // Computed from the register on the way into the loop.
+        Value* initial_variable =
+            builder->LoadContext(variable->offset, INT64_TYPE);
+        AppendToPreheader(initial_variable->def);
+        Value* initial_value =
+            builder->Mul(initial_variable, builder->LoadConstantInt64(factor));
+        AppendToPreheader(initial_value->def);
+        builder->StoreLocal(slot, initial_value);
+        AppendToPreheader(builder->last_instr());
+
+        // Stepped right after the register, so the local is always the
+        // product of its current value.
+        Value* value = builder->LoadLocal(slot);
+        value->def->MoveAfter(variable->store);
+        Value* stepped_value = builder->Add(
+            value, builder->LoadConstantInt64(
+                       int64_t(uint64_t(factor) * uint64_t(variable->step))));
+        stepped_value->def->MoveAfter(value->def);
+        builder->StoreLocal(slot, stepped_value);
+        builder->last_instr()->MoveAfter(stepped_value->def);
+      }
+      i->Replace(&OPCODE_LOAD_LOCAL_info, 0);
+      i->set_src1(slot);
+      ++reduced_count;
+    }
+  }
+  return reduced_count;
+}
+
+const LoopOptimizationPass::InductionVariable*
+LoopOptimizationPass::FindInductionVariable(const Value* value,
+                                            const Instr* use) const {
+  const Instr* def = value->def;
+  if (!def || def->opcode != &OPCODE_LOAD_CONTEXT_info ||
+      value->type != INT64_TYPE) {
+    return nullptr;
+  }
+  for (const InductionVariable& variable : induction_variables_) {
+    if (variable.offset != def->src1.offset) {
+      continue;
+    }
+    // The register must not be stepped between loading it and using it.
+    if (variable.store->block == use->block) {
+      for (const Instr* i = def->next; i != use; i = i->next) {
+        if (i == variable.store) {
+          return nullptr;
+        }
+      }
+    }
+    return &variable;
+  }
+  return nullptr;
+}
+
+bool LoopOptimizationPass::ReserveLocal(
+    std::vector<uint32_t>& set_local_counts, TypeName type) const {
+  auto set = RegisterAllocationPass::GetRegisterSet(*machine_info_, type);
+  if (!set || set_local_counts[set->id] >=
+                  RegisterAllocationPass::GetLocalRegisterLimit(*set)) {
+    return false;
+  }
+  ++set_local_counts[set->id];
+  return true;
+}
+
+void LoopOptimizationPass::AppendToPreheader(Instr* i) {
+  if (preheader_branches_) {
+    i->MoveBefore(preheader_branches_);
+  } else {
+    i->MoveAfter(preheader_tail_);
+    preheader_tail_ = i;
+  }
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
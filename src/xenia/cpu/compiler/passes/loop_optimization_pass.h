@@ -0,0 +1,97 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_LOOP_OPTIMIZATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_LOOP_OPTIMIZATION_PASS_H_
+
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "xenia/cpu/backend/machine_info.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/compiler/passes/loop_analysis.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Optimizes the innermost loops found by LoopAnalysis:
+// - Loop-invariant code motion: computations that give the same result on
+//   every iteration, like address calculations from registers not modified in
+//   the loop, shift tables and splats of constants, are moved to the end of the
+//   preheader, with the results the loop needs carried in locals.
+// - Strength reduction of induction variables: multiplications of a register
+//   stepped by a constant once per iteration by a constant are replaced with a
+//   local stepped along with the register.
+// Values in HIR don't cross blocks, so only computations replacing more than
+// the load of the local are moved, and the locals are limited to what
+// RegisterAllocationPass may keep in host registers.
+class LoopOptimizationPass : public CompilerPass {
+ public:
+  explicit LoopOptimizationPass(const backend::MachineInfo* machine_info);
+  ~LoopOptimizationPass() override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+  const char* name() const override { return "LoopOptimization"; }
+
+ private:
+  using Loop = LoopAnalysis::Loop;
+  struct InductionVariable {
+    uint32_t offset;
+    // The only store to the register in the loop, adding step to it.
+    hir::Instr* store;
+    int64_t step;
+  };
+  struct ReducedValue {
+    const InductionVariable* variable;
+    int64_t factor;
+    hir::Value* slot;
+  };
+
+  void AnalyzeLoop(const Loop& loop);
+  bool IsInvariant(const hir::Instr* i) const;
+  // Adds the instruction and the invariant ones it depends on that aren't
+  // hoisted yet to tree_, operands first.
+  void CollectHoistedTree(hir::Instr* i);
+  uint32_t HoistInvariants(hir::HIRBuilder* builder, const Loop& loop);
+  uint32_t ReduceInductionVariables(hir::HIRBuilder* builder,
+                                    const Loop& loop);
+  const InductionVariable* FindInductionVariable(const hir::Value* value,
+                                                 const hir::Instr* use) const;
+  // Takes a host register for a new local, if any is left for the loop.
+  bool ReserveLocal(std::vector<uint32_t>& set_local_counts,
+                    hir::TypeName type) const;
+  // Places the instruction at the end of the preheader, before its branches.
+  void AppendToPreheader(hir::Instr* i);
+
+  const backend::MachineInfo* machine_info_;
+  LoopAnalysis loop_analysis_;
+
+  // For the loop being optimized.
+  bool observes_context_;
+  std::vector<std::pair<uint32_t, uint32_t>> stored_ranges_;
+  std::unordered_set<const hir::Instr*> invariants_;
+  std::unordered_set<const hir::Instr*> hoisted_;
+  std::vector<hir::Instr*> tree_;
+  std::vector<InductionVariable> induction_variables_;
+  std::vector<ReducedValue> reduced_values_;
+  std::vector<uint32_t> set_local_counts_;
+  hir::Block* preheader_;
+  hir::Instr* preheader_branches_;
+  hir::Instr* preheader_tail_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_LOOP_OPTIMIZATION_PASS_H_
@@ -23,12 +23,83 @@ using xe::cpu::hir::HIRBuilder;
 using xe::cpu::hir::Instr;
 using xe::cpu::hir::Value;
 
+namespace {
+// Byte swapping vectors reverses the bytes in every 32-bit element, so the
+// guest byte index N comes from N ^ 3.
+constexpr uint8_t kByteSwapIndex = 0x3;
+
+// Gets the guest byte index every byte of the result of a shuffle with a
+// constant control - SWIZZLE of 32-bit elements, or PERMUTE of bytes - comes
+// from, with 16+ selecting from the second source of a PERMUTE.
+bool GetShuffleControl(const Instr* i, uint8_t control[16]) {
+  if (i->opcode == &OPCODE_SWIZZLE_info) {
+    if (i->flags != INT32_TYPE && i->flags != FLOAT32_TYPE) {
+      return false;
+    }
+    uint32_t swizzle_mask = uint32_t(i->src2.offset);
+    for (uint32_t n = 0; n < 16; ++n) {
+      control[n] =
+          uint8_t((((swizzle_mask >> ((n >> 2) * 2)) & 0x3) << 2) | (n & 0x3));
+    }
+    return true;
+  }
+  if (i->opcode == &OPCODE_PERMUTE_info && i->flags == INT8_TYPE &&
+      i->src1.value->IsConstant()) {
+    const vec128_t& permute_control = i->src1.value->constant.v128;
+    for (uint32_t n = 0; n < 16; ++n) {
+      control[n] = permute_control.u8[n ^ 0x3] & 0x1F;
+    }
+    return true;
+  }
+  return false;
+}
+
+// Makes the instruction a PERMUTE of bytes with the given control.
+void SetPermuteControl(HIRBuilder* builder, Instr* i, const uint8_t control[16],
+                       Value* value1, Value* value2) {
+  vec128_t permute_control;
+  for (uint32_t n = 0; n < 16; ++n) {
+    permute_control.u8[n ^ 0x3] = control[n];
+  }
+  i->Replace(&OPCODE_PERMUTE_info, INT8_TYPE);
+  i->set_src1(builder->LoadConstantVec128(permute_control));
+  i->set_src2(value1);
+  i->set_src3(value2);
+}
+
+// Whether the value is a byte swap only used by the instruction.
+Instr* GetOwnByteSwap(Value* value, const Instr* user) {
+  Instr* def = value->def;
+  if (!def || def->opcode != &OPCODE_BYTE_SWAP_info ||
+      def->dest->type != VEC128_TYPE) {
+    return nullptr;
+  }
+  for (auto use = value->use_head; use; use = use->next) {
+    if (use->instr != user) {
+      return nullptr;
+    }
+  }
+  return def;
+}
+}  // namespace
+
 MemorySequenceCombinationPass::MemorySequenceCombinationPass()
     : CompilerPass() {}
 
 MemorySequenceCombinationPass::~MemorySequenceCombinationPass() = default;
 
 bool MemorySequenceCombinationPass::Run(HIRBuilder* builder) {
+  // Byte swaps are merged into shuffles first, as loads and stores can't merge
+  // them anymore then.
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->opcode == &OPCODE_SWIZZLE_info ||
+          i->opcode == &OPCODE_PERMUTE_info) {
+        CombineShuffleSequence(builder, i);
+      }
+    }
+  }
+
   // Run over all loads and stores and see if we can collapse sequences into the
   // fat opcodes. See the respective utility functions for examples.
   auto block = builder->first_block();
@@ -40,7 +111,7 @@ bool MemorySequenceCombinationPass::Run(HIRBuilder* builder) {
         CombineLoadSequence(i);
       } else if (i->opcode == &OPCODE_STORE_info ||
                  i->opcode == &OPCODE_STORE_OFFSET_info) {
-        CombineStoreSequence(i);
+        CombineStoreSequence(builder, i);
       }
       i = i->next;
     }
@@ -97,7 +168,103 @@ void MemorySequenceCombinationPass::CombineLoadSequence(Instr* i) {
   // TODO(benvanik): merge in extend/truncate.
 }
 
-void MemorySequenceCombinationPass::CombineStoreSequence(Instr* i) {
+void MemorySequenceCombinationPass::CombineShuffleSequence(HIRBuilder* builder,
+                                                           Instr* i) {
+  // Byte swap and shuffle with a constant control:
+  //   v1.v128 = load v0
+  //   v2.v128 = byte_swap v1.v128
+  //   v3.v128 = swizzle v2.v128, 0b00000000
+  // becomes:
+  //   v1.v128 = load v0
+  //   v3.v128 = permute [3, 2, 1, 0, 3, 2, 1, 0, ...], v1.v128, v1.v128
+  // which is a single pshufb, instead of one for the byte swap and another
+  // instruction for the shuffle.
+
+  uint8_t control[16];
+  if (!GetShuffleControl(i, control)) {
+    return;
+  }
+  Value* value1;
+  Value* value2;
+  Instr* swap1;
+  Instr* swap2 = nullptr;
+  if (i->opcode == &OPCODE_SWIZZLE_info) {
+    swap1 = GetOwnByteSwap(i->src1.value, i);
+    if (!swap1) {
+      return;
+    }
+    value1 = swap1->src1.value;
+    value2 = value1;
+  } else {
+    swap1 = GetOwnByteSwap(i->src2.value, i);
+    if (!swap1) {
+      return;
+    }
+    value1 = swap1->src1.value;
+    if (i->src3.value == i->src2.value) {
+      value2 = value1;
+    } else if (i->src3.value->IsConstantZero()) {
+      value2 = i->src3.value;
+    } else {
+      swap2 = GetOwnByteSwap(i->src3.value, i);
+      if (!swap2) {
+        return;
+      }
+      value2 = swap2->src1.value;
+    }
+  }
+
+  // Swapping doesn't move bytes between the elements, so it doesn't change
+  // which source they are taken from.
+  for (uint32_t n = 0; n < 16; ++n) {
+    control[n] ^= kByteSwapIndex;
+  }
+  SetPermuteControl(builder, i, control, value1, value2);
+  // Not used anymore - drop them so loads don't merge them.
+  swap1->UnlinkAndNOP();
+  if (swap2) {
+    swap2->UnlinkAndNOP();
+  }
+}
+
+bool MemorySequenceCombinationPass::CombineSwappedShuffleStore(
+    HIRBuilder* builder, Instr* i, Instr* swap) {
+  // Store of a shuffle with a constant control with swap:
+  //   v2.v128 = swizzle v1.v128, 0b00011011
+  //   v3.v128 = byte_swap v2.v128
+  //   store v0, v3.v128
+  // becomes:
+  //   v2.v128 = permute [15, 14, 13, 12, 11, 10, ...], v1.v128, v1.v128
+  //   store v0, v2.v128
+
+  Value* shuffled = swap->src1.value;
+  Instr* shuffle = shuffled->def;
+  uint8_t control[16];
+  if (!shuffle || !shuffled->use_head || shuffled->use_head->next ||
+      !GetShuffleControl(shuffle, control)) {
+    return false;
+  }
+  Value* value1;
+  Value* value2;
+  if (shuffle->opcode == &OPCODE_SWIZZLE_info) {
+    value1 = shuffle->src1.value;
+    value2 = value1;
+  } else {
+    value1 = shuffle->src2.value;
+    value2 = shuffle->src3.value;
+  }
+  uint8_t swapped_control[16];
+  for (uint32_t n = 0; n < 16; ++n) {
+    swapped_control[n] = control[n ^ kByteSwapIndex];
+  }
+  SetPermuteControl(builder, shuffle, swapped_control, value1, value2);
+  i->set_src2(shuffled);
+  swap->UnlinkAndNOP();
+  return true;
+}
+
+void MemorySequenceCombinationPass::CombineStoreSequence(HIRBuilder* builder,
+                                                         Instr* i) {
   // Store with swap:
   //   v1.i32 = ...
   //   v2.i32 = byte_swap v1.i32
@@ -134,6 +301,11 @@ void MemorySequenceCombinationPass::CombineStoreSequence(Instr* i) {
     return;
   }
 
+  if (i->opcode == &OPCODE_STORE_info && def == src->def &&
+      GetOwnByteSwap(src, i) && CombineSwappedShuffleStore(builder, i, def)) {
+    return;
+  }
+
   // Merge byte swap into store.
   // Note that we may have already been a swapped operation - this inverts
   // that.
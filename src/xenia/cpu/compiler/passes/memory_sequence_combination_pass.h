@@ -23,11 +23,15 @@ class MemorySequenceCombinationPass : public CompilerPass {
   ~MemorySequenceCombinationPass() override;
 
   bool Run(hir::HIRBuilder* builder) override;
+  const char* name() const override { return "MemorySequenceCombination"; }
 
  private:
   void CombineMemorySequences(hir::HIRBuilder* builder);
   void CombineLoadSequence(hir::Instr* i);
-  void CombineStoreSequence(hir::Instr* i);
+  void CombineStoreSequence(hir::HIRBuilder* builder, hir::Instr* i);
+  void CombineShuffleSequence(hir::HIRBuilder* builder, hir::Instr* i);
+  bool CombineSwappedShuffleStore(hir::HIRBuilder* builder, hir::Instr* i,
+                                  hir::Instr* swap);
 };
 
 }  // namespace passes
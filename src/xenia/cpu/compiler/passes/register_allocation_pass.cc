@@ -15,8 +15,19 @@
 #include "xenia/base/assert.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
+#include "xenia/base/platform.h"
 #include "xenia/base/profiling.h"
 
+#if XE_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#pragma warning(disable : 4267)
+#include <llvm/ADT/BitVector.h>
+#pragma warning(pop)
+#else
+#include <llvm/ADT/BitVector.h>
+#endif  // XE_COMPILER_MSVC
+
 namespace xe {
 namespace cpu {
 namespace compiler {
@@ -36,7 +47,8 @@ using xe::cpu::hir::Value;
 #define ASSERT_NO_CYCLES 0
 
 RegisterAllocationPass::RegisterAllocationPass(const MachineInfo* machine_info)
-    : CompilerPass() {
+    : CompilerPass(),
+      supports_register_locals_(machine_info->supports_register_locals) {
   // Initialize register sets.
   // TODO(benvanik): rewrite in a way that makes sense - this is terrible.
   auto mi_sets = machine_info->register_sets;
@@ -76,6 +88,9 @@ bool RegisterAllocationPass::Run(HIRBuilder* builder) {
   // optimized with some intra-block analysis (dominators/etc).
   // Really, it'd just be nice to have someone who knew what they
   // were doing lower SSA and do this right.
+  // The exception are locals, which may be kept in registers reserved for
+  // them in every block they're live in.
+  AllocateLocalRegisters(builder);
 
   uint16_t block_ordinal = 0;
   uint32_t instr_ordinal = 0;
@@ -85,7 +100,7 @@ bool RegisterAllocationPass::Run(HIRBuilder* builder) {
     block->ordinal = block_ordinal++;
 
     // Reset all state.
-    PrepareBlockState();
+    PrepareBlockState(block->ordinal);
 
     // Renumber all instructions in the block. This is required so that
     // we can sort the usage pointers below.
@@ -173,6 +188,203 @@ bool RegisterAllocationPass::Run(HIRBuilder* builder) {
   return true;
 }
 
+const MachineInfo::RegisterSet* RegisterAllocationPass::GetRegisterSet(
+    const MachineInfo& machine_info, TypeName type) {
+  uint32_t types;
+  if (type <= INT64_TYPE) {
+    types = MachineInfo::RegisterSet::INT_TYPES;
+  } else if (type <= FLOAT64_TYPE) {
+    types = MachineInfo::RegisterSet::FLOAT_TYPES;
+  } else {
+    types = MachineInfo::RegisterSet::VEC_TYPES;
+  }
+  for (size_t n = 0; n < xe::countof(machine_info.register_sets) &&
+                     machine_info.register_sets[n].count;
+       ++n) {
+    if (machine_info.register_sets[n].types & types) {
+      return &machine_info.register_sets[n];
+    }
+  }
+  return nullptr;
+}
+
+void RegisterAllocationPass::AllocateLocalRegisters(HIRBuilder* builder) {
+  for (size_t i = 0; i < xe::countof(usage_sets_.all_sets); ++i) {
+    if (usage_sets_.all_sets[i]) {
+      usage_sets_.all_sets[i]->local_regs.clear();
+    }
+  }
+  if (!supports_register_locals_) {
+    return;
+  }
+
+  // Locals that exist before allocation carry values between blocks, the ones
+  // added for spills stay on the stack. Only some types have register forms of
+  // the local loads and stores.
+  std::vector<Value*> locals;
+  for (Value* slot : builder->locals()) {
+    if (!slot->IsConstant() && !slot->reg.set &&
+        (slot->type == INT64_TYPE || slot->type == FLOAT64_TYPE ||
+         slot->type == VEC128_TYPE)) {
+      locals.push_back(slot);
+    }
+  }
+  if (locals.empty()) {
+    return;
+  }
+  auto local_index = [&locals](const Value* slot) {
+    auto it = std::find(locals.begin(), locals.end(), slot);
+    return it != locals.end() ? int(it - locals.begin()) : -1;
+  };
+
+  std::vector<Block*> blocks;
+  uint16_t block_ordinal = 0;
+  auto block = builder->first_block();
+  while (block) {
+    block->ordinal = block_ordinal++;
+    blocks.push_back(block);
+    block = block->next;
+  }
+
+  // Backwards liveness of the locals, following the branches like
+  // DeadStoreEliminationPass. Optionally records the locals used or live at
+  // any point of the block, and those live across calls and other volatile
+  // instructions, as registers are not preserved over them.
+  std::vector<llvm::BitVector> live_in(blocks.size(),
+                                       llvm::BitVector(int(locals.size())));
+  llvm::BitVector live(int(locals.size()));
+  auto transfer = [&](Block* current, llvm::BitVector* occupied,
+                      llvm::BitVector* clobbered) {
+    auto tail = current->instr_tail;
+    if (current->next &&
+        (!tail || (tail->opcode != &OPCODE_BRANCH_info &&
+                   tail->opcode != &OPCODE_RETURN_info))) {
+      live = live_in[current->next->ordinal];
+    } else {
+      live.reset();
+    }
+    if (occupied) {
+      *occupied = live;
+    }
+    for (Instr* i = current->instr_tail; i; i = i->prev) {
+      int index = -1;
+      if (i->opcode == &OPCODE_BRANCH_info) {
+        live = live_in[i->src1.label->block->ordinal];
+      } else if (i->opcode == &OPCODE_BRANCH_TRUE_info ||
+                 i->opcode == &OPCODE_BRANCH_FALSE_info) {
+        live |= live_in[i->src2.label->block->ordinal];
+      } else if (i->opcode == &OPCODE_RETURN_info) {
+        live.reset();
+      } else if (i->opcode == &OPCODE_LOAD_LOCAL_info) {
+        index = local_index(i->src1.value);
+        if (index >= 0) {
+          live.set(index);
+        }
+      } else if (i->opcode == &OPCODE_STORE_LOCAL_info) {
+        index = local_index(i->src1.value);
+        if (index >= 0) {
+          live.reset(index);
+        }
+      }
+      if (occupied) {
+        *occupied |= live;
+        if (index >= 0) {
+          occupied->set(index);
+        }
+      }
+      if (clobbered && (i->opcode->flags & OPCODE_FLAG_VOLATILE) &&
+          i->opcode != &OPCODE_BRANCH_TRUE_info &&
+          i->opcode != &OPCODE_BRANCH_FALSE_info) {
+        *clobbered |= live;
+      }
+    }
+  };
+  bool changed;
+  do {
+    changed = false;
+    for (auto it = blocks.rbegin(); it != blocks.rend(); ++it) {
+      transfer(*it, nullptr, nullptr);
+      auto& block_live_in = live_in[(*it)->ordinal];
+      if (live != block_live_in) {
+        block_live_in = live;
+        changed = true;
+      }
+    }
+  } while (changed);
+
+  // Blocks each local needs its register in.
+  std::vector<llvm::BitVector> local_blocks(
+      locals.size(), llvm::BitVector(int(blocks.size())));
+  llvm::BitVector clobbered(int(locals.size()));
+  llvm::BitVector occupied(int(locals.size()));
+  for (Block* block : blocks) {
+    transfer(block, &occupied, &clobbered);
+    for (int index = occupied.find_first(); index != -1;
+         index = occupied.find_next(index)) {
+      local_blocks[index].set(block->ordinal);
+    }
+  }
+
+  // The most used locals first. Registers are taken from the top, the
+  // allocation in each block takes the lowest free ones.
+  std::vector<uint32_t> use_counts(locals.size());
+  std::vector<size_t> order(locals.size());
+  for (size_t n = 0; n < locals.size(); ++n) {
+    for (auto use = locals[n]->use_head; use; use = use->next) {
+      ++use_counts[n];
+    }
+    order[n] = n;
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&use_counts](size_t a, size_t b) {
+                     return use_counts[a] > use_counts[b];
+                   });
+  for (size_t i = 0; i < xe::countof(usage_sets_.all_sets); ++i) {
+    if (usage_sets_.all_sets[i]) {
+      usage_sets_.all_sets[i]->local_regs.resize(blocks.size());
+    }
+  }
+  uint32_t allocated_count = 0;
+  for (size_t n : order) {
+    if (clobbered.test(int(n)) || local_blocks[n].none()) {
+      continue;
+    }
+    Value* slot = locals[n];
+    auto usage_set = RegisterSetForValue(slot);
+    uint32_t limit = GetLocalRegisterLimit(*usage_set->set);
+    std::bitset<32> used_regs;
+    bool fits = true;
+    for (int b = local_blocks[n].find_first(); b != -1;
+         b = local_blocks[n].find_next(b)) {
+      auto& block_regs = usage_set->local_regs[b];
+      if (block_regs.count() >= limit) {
+        fits = false;
+        break;
+      }
+      used_regs |= block_regs;
+    }
+    if (!fits) {
+      continue;
+    }
+    for (int32_t r = int32_t(usage_set->count) - 1; r >= 0; --r) {
+      if (!used_regs.test(r)) {
+        slot->reg.set = usage_set->set;
+        slot->reg.index = r;
+        break;
+      }
+    }
+    if (!slot->reg.set) {
+      continue;
+    }
+    for (int b = local_blocks[n].find_first(); b != -1;
+         b = local_blocks[n].find_next(b)) {
+      usage_set->local_regs[b].set(slot->reg.index);
+    }
+    ++allocated_count;
+  }
+  COUNT_profile_add("cpu/compiler/register_locals", allocated_count);
+}
+
 void RegisterAllocationPass::DumpUsage(const char* name) {
 #if 0
   fprintf(stdout, "\n%s:\n", name);
@@ -195,11 +407,15 @@ void RegisterAllocationPass::DumpUsage(const char* name) {
 #endif
 }
 
-void RegisterAllocationPass::PrepareBlockState() {
+void RegisterAllocationPass::PrepareBlockState(uint16_t block_ordinal) {
   for (size_t i = 0; i < xe::countof(usage_sets_.all_sets); ++i) {
     auto usage_set = usage_sets_.all_sets[i];
     if (usage_set) {
       usage_set->availability.set();
+      // Blocks added by spilling are never reserved.
+      if (block_ordinal < usage_set->local_regs.size()) {
+        usage_set->availability &= ~usage_set->local_regs[block_ordinal];
+      }
       usage_set->upcoming_uses.clear();
     }
   }
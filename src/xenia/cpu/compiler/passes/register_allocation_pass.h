@@ -29,6 +29,17 @@ class RegisterAllocationPass : public CompilerPass {
   ~RegisterAllocationPass() override;
 
   bool Run(hir::HIRBuilder* builder) override;
+  const char* name() const override { return "RegisterAllocation"; }
+
+  // Number of registers in the set that may be held by locals across blocks,
+  // the rest are left for the values in each block.
+  static uint32_t GetLocalRegisterLimit(
+      const backend::MachineInfo::RegisterSet& set) {
+    return set.count / 2;
+  }
+  // Set values of the type are allocated registers from, if any.
+  static const backend::MachineInfo::RegisterSet* GetRegisterSet(
+      const backend::MachineInfo& machine_info, hir::TypeName type);
 
  private:
   // TODO(benvanik): rewrite all this set shit -- too much indirection, the
@@ -49,10 +60,13 @@ class RegisterAllocationPass : public CompilerPass {
     std::bitset<32> availability = 0;
     // TODO(benvanik): another data type.
     std::vector<RegisterUsage> upcoming_uses;
+    // Registers held by locals in each block, by block ordinal.
+    std::vector<std::bitset<32>> local_regs;
   };
 
+  void AllocateLocalRegisters(hir::HIRBuilder* builder);
   void DumpUsage(const char* name);
-  void PrepareBlockState();
+  void PrepareBlockState(uint16_t block_ordinal);
   void AdvanceUses(hir::Instr* instr);
   bool IsRegInUse(const hir::RegAssignment& reg);
   RegisterSetUsage* MarkRegUsed(const hir::RegAssignment& reg,
@@ -76,6 +90,7 @@ class RegisterAllocationPass : public CompilerPass {
     RegisterSetUsage* vec_set = nullptr;
     RegisterSetUsage* all_sets[3];
   } usage_sets_;
+  bool supports_register_locals_ = false;
 };
 
 }  // namespace passes
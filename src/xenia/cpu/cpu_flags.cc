@@ -33,6 +33,61 @@ DEFINE_bool(trace_function_data, false,
 DEFINE_bool(validate_hir, false,
             "Perform validation checks on the HIR during compilation.", "CPU");
 
+DEFINE_bool(tiered_compilation, false,
+            "Translate guest functions with a minimal set of optimization "
+            "passes first, and retranslate them with all passes in the "
+            "background once they've been called tier_up_call_count times.",
+            "CPU");
+DEFINE_uint32(tier_up_call_count, 1000,
+              "Number of calls after which a function translated with the "
+              "minimal set of optimization passes is retranslated with all of "
+              "them when tiered_compilation is enabled.",
+              "CPU");
+DEFINE_bool(hot_path_layout, false,
+            "With tiered_compilation, count how often the blocks of functions "
+            "are entered in the baseline tier, and lay out the retranslated "
+            "code with the most frequent paths through the function "
+            "contiguous and the blocks that were never entered at its end.",
+            "CPU");
+// Off by default - the PPC tests are translated with debug info, which disables
+// inlining, so nothing covers it yet.
+DEFINE_uint32(inline_max_instructions, 0,
+              "Maximum number of instructions in a small leaf guest function "
+              "for it to be inlined into its callers, such as 16. 0 to disable "
+              "inlining.",
+              "CPU");
+DEFINE_bool(global_register_allocation, true,
+            "Keep guest registers used in simple loops in host registers for "
+            "the whole loop instead of loading and storing them in every "
+            "block.",
+            "CPU");
+DEFINE_bool(loop_optimization, true,
+            "Move computations that are the same on every iteration of a loop "
+            "out of it and replace multiplications of loop counters with "
+            "additions.",
+            "CPU");
+DEFINE_bool(dead_store_elimination, true,
+            "Remove guest register stores to the context that are overwritten "
+            "before anything can read them.",
+            "CPU");
+
+DEFINE_bool(detect_idle_loops, true,
+            "Make small loops that only poll memory or the time base until a "
+            "condition is met, like spin-waits, back off the host thread while "
+            "they are waiting.",
+            "CPU");
+DEFINE_bool(jit_stats, false,
+            "Collect statistics of the translation of guest functions per "
+            "module - time spent in every stage and compiler pass, HIR "
+            "instruction counts and emitted code size - and write them on "
+            "exit.",
+            "CPU");
+DEFINE_path(jit_stats_path, "",
+            "File to write the statistics collected with jit_stats to, as JSON "
+            "if the extension is .json, or as CSV otherwise. If empty, a "
+            "summary is logged instead.",
+            "CPU");
+
 DEFINE_uint64(
     pvr, 0x710700,
     "Processor version and revision number.\nBits 0 to 15 are the version "
@@ -24,6 +24,17 @@ DECLARE_bool(trace_function_data);
 
 DECLARE_bool(validate_hir);
 
+DECLARE_bool(tiered_compilation);
+DECLARE_uint32(tier_up_call_count);
+DECLARE_bool(hot_path_layout);
+DECLARE_uint32(inline_max_instructions);
+DECLARE_bool(global_register_allocation);
+DECLARE_bool(loop_optimization);
+DECLARE_bool(dead_store_elimination);
+DECLARE_bool(detect_idle_loops);
+DECLARE_bool(jit_stats);
+DECLARE_path(jit_stats_path);
+
 DECLARE_uint64(pvr);
 
 // Breakpoints:
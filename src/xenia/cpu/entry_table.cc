@@ -26,12 +26,7 @@ EntryTable::~EntryTable() {
 }
 
 Entry* EntryTable::Get(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
-  uint32_t idx = map_.IndexForKey(address);
-  if (idx == map_.size() || *map_.KeyAt(idx) != address) {
-    return nullptr;
-  }
-  Entry* entry = *map_.ValueAt(idx);
+  Entry* entry = index_.find(address);
   if (entry) {
     // TODO(benvanik): wait if needed?
     if (entry->status != Entry::STATUS_READY) {
@@ -42,10 +37,19 @@ Entry* EntryTable::Get(uint32_t address) {
 }
 
 Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry) {
-  // TODO(benvanik): replace with a map with wait-free for find.
-  // https://github.com/facebook/folly/blob/master/folly/AtomicHashMap.h
+  // Fast path for functions that have already been resolved, without locking.
+  Entry* ready_entry = index_.find(address);
+  if (ready_entry && ready_entry->status == Entry::STATUS_READY) {
+    *out_entry = ready_entry;
+    return Entry::STATUS_READY;
+  }
 
-  auto global_lock = global_critical_region_.Acquire();
+  auto global_lock = global_critical_region_.AcquireDeferred();
+  if (!global_lock.try_lock()) {
+    COUNT_profile_add("cpu/entry_table/lock_contended", 1);
+    global_lock.lock();
+  }
+  COUNT_profile_add("cpu/entry_table/lock_acquired", 1);
 
   uint32_t idx = map_.IndexForKey(address);
 
@@ -75,7 +79,7 @@ Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry) {
     entry->status = Entry::STATUS_COMPILING;
     entry->function = 0;
     map_.InsertAt(address, entry, idx);
-    // map_[address] = entry;
+    index_.insert_or_assign(address, entry);
     status = Entry::STATUS_NEW;
   }
   global_lock.unlock();
@@ -89,6 +93,7 @@ void EntryTable::Delete(uint32_t address) {
   uint32_t idx = map_.IndexForKey(address);
   if (idx != map_.size() && *map_.KeyAt(idx) == address) {
     map_.EraseAt(idx);
+    index_.erase(address);
   }
 }
 
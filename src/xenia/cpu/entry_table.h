@@ -13,6 +13,9 @@
 #include <unordered_map>
 #include <vector>
 
+#include <atomic>
+
+#include "xenia/base/lockfree_read_map.h"
 #include "xenia/base/mutex.h"
 #include "xenia/base/split_map.h"
 namespace xe {
@@ -30,8 +33,12 @@ typedef struct Entry_t {
 
   uint32_t address;
   uint32_t end_address;
-  Status status;
+  // Read without locking, the fields must be set before it becomes ready.
+  std::atomic<Status> status;
   Function* function;
+  // Whether the guest reaching the function has been recorded in this run,
+  // which may be after it has become ready if it was compiled speculatively.
+  std::atomic<bool> resolution_recorded;
 } Entry;
 
 class EntryTable {
@@ -47,9 +54,10 @@ class EntryTable {
 
  private:
   xe::global_critical_region global_critical_region_;
-  // TODO(benvanik): replace with a better data structure.
+  // Modified with the global lock held.
   xe::split_map<uint32_t, Entry*> map_;
-  //std::unordered_map<uint32_t, Entry*> map_;
+  // Same entries as map_, for lookups of existing entries without locking.
+  xe::lockfree_read_map<Entry> index_;
 };
 
 }  // namespace cpu
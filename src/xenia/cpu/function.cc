@@ -58,7 +58,25 @@ GuestFunction::GuestFunction(Module* module, uint32_t address)
   behavior_ = Behavior::kDefault;
 }
 
-GuestFunction::~GuestFunction() = default;
+GuestFunction::~GuestFunction() {
+  const CodeVersion* version = code_version_.load(std::memory_order_relaxed);
+  while (version) {
+    const CodeVersion* previous = version->previous;
+    delete version;
+    version = previous;
+  }
+}
+
+void GuestFunction::AllocateBlockProfile() {
+  if (trace_data_.is_valid()) {
+    return;
+  }
+  size_t size = FunctionTraceData::SizeOfHeader() +
+                FunctionTraceData::SizeOfInstructionCounts(address_,
+                                                           end_address_);
+  block_profile_data_ = std::make_unique<uint8_t[]>(size);
+  trace_data_.Reset(block_profile_data_.get(), size, address_, end_address_);
+}
 
 void GuestFunction::SetupExtern(ExternHandler handler, Export* export_data) {
   behavior_ = Behavior::kExtern;
@@ -66,11 +84,33 @@ void GuestFunction::SetupExtern(ExternHandler handler, Export* export_data) {
   export_data_ = export_data;
 }
 
-const SourceMapEntry* GuestFunction::LookupGuestAddress(
+const GuestFunction::CodeVersion* GuestFunction::LookupCodeVersion(
+    uintptr_t host_address) const {
+  for (const CodeVersion* version = code_version(); version;
+       version = version->previous) {
+    if (version->ContainsMachineCode(host_address)) {
+      return version;
+    }
+  }
+  return nullptr;
+}
+
+void GuestFunction::PublishCodeVersion(
+    std::unique_ptr<CodeVersion> code_version) {
+  CodeVersion* new_version = code_version.release();
+  const CodeVersion* previous = code_version_.load(std::memory_order_relaxed);
+  do {
+    new_version->previous = previous;
+  } while (!code_version_.compare_exchange_weak(previous, new_version,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed));
+}
+
+const SourceMapEntry* GuestFunction::CodeVersion::LookupGuestAddress(
     uint32_t guest_address) const {
   // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (size_t i = 0; i < source_map_.size(); ++i) {
-    const auto& entry = source_map_[i];
+  for (size_t i = 0; i < source_map.size(); ++i) {
+    const auto& entry = source_map[i];
     if (entry.guest_address == guest_address) {
       return &entry;
     }
@@ -78,10 +118,11 @@ const SourceMapEntry* GuestFunction::LookupGuestAddress(
   return nullptr;
 }
 
-const SourceMapEntry* GuestFunction::LookupHIROffset(uint32_t offset) const {
+const SourceMapEntry* GuestFunction::CodeVersion::LookupHIROffset(
+    uint32_t offset) const {
   // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (size_t i = 0; i < source_map_.size(); ++i) {
-    const auto& entry = source_map_[i];
+  for (size_t i = 0; i < source_map.size(); ++i) {
+    const auto& entry = source_map[i];
     if (entry.hir_offset >= offset) {
       return &entry;
     }
@@ -89,16 +130,33 @@ const SourceMapEntry* GuestFunction::LookupHIROffset(uint32_t offset) const {
   return nullptr;
 }
 
-const SourceMapEntry* GuestFunction::LookupMachineCodeOffset(
+const SourceMapEntry* GuestFunction::CodeVersion::LookupMachineCodeOffset(
     uint32_t offset) const {
   // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (int64_t i = source_map_.size() - 1; i >= 0; --i) {
-    const auto& entry = source_map_[i];
+  for (int64_t i = source_map.size() - 1; i >= 0; --i) {
+    const auto& entry = source_map[i];
     if (entry.code_offset <= offset) {
       return &entry;
     }
   }
-  return source_map_.empty() ? nullptr : &source_map_[0];
+  return source_map.empty() ? nullptr : &source_map[0];
+}
+
+const SourceMapEntry* GuestFunction::LookupGuestAddress(
+    uint32_t guest_address) const {
+  const CodeVersion* version = code_version();
+  return version ? version->LookupGuestAddress(guest_address) : nullptr;
+}
+
+const SourceMapEntry* GuestFunction::LookupHIROffset(uint32_t offset) const {
+  const CodeVersion* version = code_version();
+  return version ? version->LookupHIROffset(offset) : nullptr;
+}
+
+const SourceMapEntry* GuestFunction::LookupMachineCodeOffset(
+    uint32_t offset) const {
+  const CodeVersion* version = code_version();
+  return version ? version->LookupMachineCodeOffset(offset) : nullptr;
 }
 
 uint32_t GuestFunction::MapGuestAddressToMachineCodeOffset(
@@ -109,20 +167,28 @@ uint32_t GuestFunction::MapGuestAddressToMachineCodeOffset(
 
 uintptr_t GuestFunction::MapGuestAddressToMachineCode(
     uint32_t guest_address) const {
-  auto entry = LookupGuestAddress(guest_address);
-
+  const CodeVersion* version = code_version();
+  if (!version) {
+    return 0;
+  }
+  auto entry = version->LookupGuestAddress(guest_address);
   if (entry) {
-    return reinterpret_cast<uintptr_t>(machine_code()) + entry->code_offset;
+    return reinterpret_cast<uintptr_t>(version->machine_code) +
+           entry->code_offset;
   } else {
     return 0;
-  
   }
 }
 
 uint32_t GuestFunction::MapMachineCodeToGuestAddress(
     uintptr_t host_address) const {
-  auto entry = LookupMachineCodeOffset(static_cast<uint32_t>(
-      host_address - reinterpret_cast<uintptr_t>(machine_code())));
+  // The host address may be in an older version still being executed.
+  const CodeVersion* version = LookupCodeVersion(host_address);
+  if (!version) {
+    return address();
+  }
+  auto entry = version->LookupMachineCodeOffset(static_cast<uint32_t>(
+      host_address - reinterpret_cast<uintptr_t>(version->machine_code)));
   return entry ? entry->guest_address : address();
 }
 
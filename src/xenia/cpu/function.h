@@ -10,7 +10,9 @@
 #ifndef XENIA_CPU_FUNCTION_H_
 #define XENIA_CPU_FUNCTION_H_
 
+#include <atomic>
 #include <memory>
+#include <utility>
 #include <vector>
 
 #include "xenia/cpu/function_debug_info.h"
@@ -119,6 +121,39 @@ class GuestFunction : public Function {
   typedef void (*ExternHandler)(ppc::PPCContext* ppc_context,
                                 kernel::KernelState* kernel_state);
 
+  // With tiered compilation, functions are translated with a minimal set of
+  // optimization passes first, counting the calls, and once called often
+  // enough, retranslated in the background with all passes.
+  enum class Tier : uint32_t {
+    kUntranslated,
+    kBaseline,
+    // Called often enough, waiting to be retranslated.
+    kTierUpQueued,
+    kOptimized,
+  };
+
+  // Machine code of one translation of the function, with the mapping between
+  // it and the guest code. Retranslation publishes a new version while other
+  // threads may still be executing the previous ones or mapping host PCs in
+  // them, so the previous versions are kept alive with the function, like
+  // their code in the code cache, and never modified after being published.
+  struct CodeVersion {
+    uint8_t* machine_code = nullptr;
+    size_t machine_code_length = 0;
+    std::vector<SourceMapEntry> source_map;
+    // The version replaced by this one.
+    const CodeVersion* previous = nullptr;
+
+    bool ContainsMachineCode(uintptr_t host_address) const {
+      return host_address >= reinterpret_cast<uintptr_t>(machine_code) &&
+             host_address - reinterpret_cast<uintptr_t>(machine_code) <
+                 machine_code_length;
+    }
+    const SourceMapEntry* LookupGuestAddress(uint32_t guest_address) const;
+    const SourceMapEntry* LookupHIROffset(uint32_t offset) const;
+    const SourceMapEntry* LookupMachineCodeOffset(uint32_t offset) const;
+  };
+
   GuestFunction(Module* module, uint32_t address);
   ~GuestFunction() override;
 
@@ -127,15 +162,59 @@ class GuestFunction : public Function {
   uint32_t end_address() const { return end_address_; }
   void set_end_address(uint32_t value) { end_address_ = value; }
 
-  virtual uint8_t* machine_code() const = 0;
-  virtual size_t machine_code_length() const = 0;
+  // The latest version of the code, or nullptr if not translated yet.
+  const CodeVersion* code_version() const {
+    return code_version_.load(std::memory_order_acquire);
+  }
+  // The version containing the host address, which may be an older one still
+  // being executed, or nullptr if there's none.
+  const CodeVersion* LookupCodeVersion(uintptr_t host_address) const;
+  // Makes the version the latest one, must be done after its code is placed
+  // and before it's made reachable from the guest code.
+  void PublishCodeVersion(std::unique_ptr<CodeVersion> code_version);
+  uint8_t* machine_code() const {
+    const CodeVersion* version = code_version();
+    return version ? version->machine_code : nullptr;
+  }
+  size_t machine_code_length() const {
+    const CodeVersion* version = code_version();
+    return version ? version->machine_code_length : 0;
+  }
 
   FunctionDebugInfo* debug_info() const { return debug_info_.get(); }
   void set_debug_info(std::unique_ptr<FunctionDebugInfo> debug_info) {
     debug_info_ = std::move(debug_info);
   }
   FunctionTraceData& trace_data() { return trace_data_; }
-  std::vector<SourceMapEntry>& source_map() { return source_map_; }
+  // Makes the trace data point to a buffer owned by the function if it has
+  // none, for the baseline tier code to count how often every block is
+  // entered, used to lay out the blocks of the retranslated code.
+  void AllocateBlockProfile();
+
+  Tier tier() const { return tier_.load(std::memory_order_acquire); }
+  void set_tier(Tier tier) { tier_.store(tier, std::memory_order_release); }
+  // Returns true if the caller should queue the retranslation.
+  bool BeginTierUp() {
+    Tier expected = Tier::kBaseline;
+    return tier_.compare_exchange_strong(expected, Tier::kTierUpQueued);
+  }
+  // Decremented by the baseline code on every call, the retranslation is
+  // requested when it reaches zero.
+  uint32_t* tier_up_countdown() { return &tier_up_countdown_; }
+  void set_tier_up_countdown(uint32_t value) { tier_up_countdown_ = value; }
+
+  // Address ranges of the leaf functions whose code has been inlined into this
+  // one, so it can be retranslated when they change.
+  struct InlinedFunction {
+    uint32_t address;
+    uint32_t end_address;
+  };
+  const std::vector<InlinedFunction>& inlined_functions() const {
+    return inlined_functions_;
+  }
+  void set_inlined_functions(std::vector<InlinedFunction> value) {
+    inlined_functions_ = std::move(value);
+  }
 
   ExternHandler extern_handler() const { return extern_handler_; }
   Export* export_data() const { return export_data_; }
@@ -157,9 +236,14 @@ class GuestFunction : public Function {
  protected:
   std::unique_ptr<FunctionDebugInfo> debug_info_;
   FunctionTraceData trace_data_;
-  std::vector<SourceMapEntry> source_map_;
+  std::unique_ptr<uint8_t[]> block_profile_data_;
+  // Owns the whole chain of the previous versions.
+  std::atomic<const CodeVersion*> code_version_{nullptr};
   ExternHandler extern_handler_ = nullptr;
   Export* export_data_ = nullptr;
+  std::atomic<Tier> tier_{Tier::kUntranslated};
+  uint32_t tier_up_countdown_ = 0;
+  std::vector<InlinedFunction> inlined_functions_;
 };
 
 }  // namespace cpu
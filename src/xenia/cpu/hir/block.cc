@@ -11,6 +11,7 @@
 
 #include "xenia/base/assert.h"
 #include "xenia/cpu/hir/instr.h"
+#include "xenia/cpu/hir/opcodes.h"
 
 namespace xe {
 namespace cpu {
@@ -39,6 +40,15 @@ void Block::AssertNoCycles() {
   }
 }
 
+uint32_t Block::GetSourceAddress() const {
+  for (const Instr* i = instr_head; i; i = i->next) {
+    if (i->opcode == &OPCODE_SOURCE_OFFSET_info) {
+      return static_cast<uint32_t>(i->src1.offset);
+    }
+  }
+  return 0;
+}
+
 }  // namespace hir
 }  // namespace cpu
 }  // namespace xe
@@ -64,6 +64,8 @@ class Block {
   uint16_t ordinal;
 
   void AssertNoCycles();
+  // Guest address of the first source offset in the block, 0 if it has none.
+  uint32_t GetSourceAddress() const;
 };
 
 }  // namespace hir
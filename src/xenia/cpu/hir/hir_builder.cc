@@ -576,6 +576,30 @@ void HIRBuilder::RemoveBlock(Block* block) {
   block->next = block->prev = nullptr;
 }
 
+void HIRBuilder::MoveBlockToEnd(Block* block) {
+  if (block == block_tail_) {
+    return;
+  }
+  if (block->prev) {
+    block->prev->next = block->next;
+  }
+  block->next->prev = block->prev;
+  if (block == block_head_) {
+    block_head_ = block->next;
+  }
+  block->prev = block_tail_;
+  block->next = nullptr;
+  block_tail_->next = block;
+  block_tail_ = block;
+}
+
+void HIRBuilder::AppendBranch(Block* block, Block* target) {
+  Block* current_block = current_block_;
+  current_block_ = block;
+  Branch(target);
+  current_block_ = current_block;
+}
+
 void HIRBuilder::MergeAdjacentBlocks(Block* left, Block* right) {
   assert_true(left->next == right && right->prev == left);
   assert_true(!right->incoming_edge_head ||
@@ -1356,8 +1380,8 @@ void HIRBuilder::CacheControl(Value* address, size_t cache_line_size,
 
 void HIRBuilder::MemoryBarrier() { AppendInstr(OPCODE_MEMORY_BARRIER_info, 0); }
 
-void HIRBuilder::DelayExecution() {
-  AppendInstr(OPCODE_DELAY_EXECUTION_info, 0);
+void HIRBuilder::DelayExecution(uint32_t delay_flags) {
+  AppendInstr(OPCODE_DELAY_EXECUTION_info, delay_flags);
 }
 void HIRBuilder::SetRoundingMode(Value* value) {
   ASSERT_INTEGER_TYPE(value);
@@ -76,6 +76,12 @@ class HIRBuilder {
   void RemoveEdge(Edge* edge);
   void RemoveBlock(Block* block);
   void MergeAdjacentBlocks(Block* left, Block* right);
+  // Moves the block to the end of the block list. Branches are left as they
+  // are, blocks falling through to or from it must be handled by the caller.
+  void MoveBlockToEnd(Block* block);
+  // Adds a branch to the target at the end of the block, which doesn't have to
+  // be the current one.
+  void AppendBranch(Block* block, Block* target);
 
   Instr* AllocateInstruction();
 
@@ -202,7 +208,7 @@ class HIRBuilder {
   void CacheControl(Value* address, size_t cache_line_size,
                     CacheControlType type);
   void MemoryBarrier();
-  void DelayExecution();
+  void DelayExecution(uint32_t delay_flags = 0);
   void SetRoundingMode(Value* value);
   Value* Max(Value* value1, Value* value2);
   Value* VectorMax(Value* value1, Value* value2, TypeName part_type,
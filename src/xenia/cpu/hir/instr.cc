@@ -55,6 +55,35 @@ void Instr::MoveBefore(Instr* other) {
   }
 }
 
+void Instr::MoveAfter(Instr* other) {
+  if (other == this || other->next == this) {
+    return;
+  }
+  if (other->next) {
+    MoveBefore(other->next);
+    return;
+  }
+
+  // Remove from current location.
+  if (prev) {
+    prev->next = next;
+  } else {
+    block->instr_head = next;
+  }
+  if (next) {
+    next->prev = prev;
+  } else {
+    block->instr_tail = prev;
+  }
+
+  // Append to the block of other.
+  block = other->block;
+  next = nullptr;
+  prev = other;
+  other->next = this;
+  block->instr_tail = this;
+}
+
 void Instr::Replace(const OpcodeInfo* new_opcode, uint16_t new_flags) {
   opcode = new_opcode;
   flags = new_flags;
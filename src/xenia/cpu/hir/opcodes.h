@@ -26,6 +26,11 @@ enum BranchFlags {
   BRANCH_UNLIKELY = (1 << 2),
 };
 
+enum DelayExecutionFlags {
+  // The guest is spinning in a loop waiting for a condition.
+  DELAY_EXECUTION_IDLE_LOOP = (1 << 1),
+};
+
 enum RoundMode {
   // to zero/nearest/etc
   ROUND_TO_ZERO = 0,
@@ -408,6 +413,18 @@ const char* GetOpcodeName(Opcode num);
 static inline const char* GetOpcodeName(const OpcodeInfo* info) {
   return GetOpcodeName(info->num);
 }
+
+// Whether the instruction may leave the function or otherwise observe the
+// whole context (calls, returns, traps, atomics, barriers), so context stores
+// before it can't be eliminated or sunk past it. Conditional branches are
+// volatile only to stay in place, they don't observe the context.
+inline bool ObservesContext(const OpcodeInfo* info) {
+  if (info == &OPCODE_BRANCH_TRUE_info || info == &OPCODE_BRANCH_FALSE_info) {
+    return false;
+  }
+  return (info->flags & OPCODE_FLAG_VOLATILE) ||
+         info == &OPCODE_CONTEXT_BARRIER_info;
+}
 }  // namespace hir
 }  // namespace cpu
 }  // namespace xe
@@ -28,8 +28,25 @@ Module::~Module() = default;
 
 bool Module::ContainsAddress(uint32_t address) { return true; }
 
+global_unique_lock_type Module::AcquireSymbolLock() {
+  auto global_lock = global_critical_region_.AcquireDeferred();
+  if (!global_lock.try_lock()) {
+    COUNT_profile_add("cpu/module/symbol_lock_contended", 1);
+    global_lock.lock();
+  }
+  COUNT_profile_add("cpu/module/symbol_lock_acquired", 1);
+  return global_lock;
+}
+
 Symbol* Module::LookupSymbol(uint32_t address, bool wait) {
-  auto global_lock = global_critical_region_.Acquire();
+  // Fast path for symbols that are already declared, without locking.
+  Symbol* declared_symbol = symbol_index_.find(address);
+  if (declared_symbol &&
+      declared_symbol->status() != Symbol::Status::kDeclaring) {
+    return declared_symbol;
+  }
+
+  auto global_lock = AcquireSymbolLock();
   const auto it = map_.find(address);
   Symbol* symbol = it != map_.end() ? it->second : nullptr;
   if (symbol) {
@@ -55,7 +72,18 @@ Symbol* Module::LookupSymbol(uint32_t address, bool wait) {
 Symbol::Status Module::DeclareSymbol(Symbol::Type type, uint32_t address,
                                      Symbol** out_symbol) {
   *out_symbol = nullptr;
-  auto global_lock = global_critical_region_.Acquire();
+
+  // Fast path for symbols that are already declared, without locking.
+  Symbol* declared_symbol = symbol_index_.find(address);
+  if (declared_symbol && declared_symbol->type() == type) {
+    Symbol::Status declared_status = declared_symbol->status();
+    if (declared_status != Symbol::Status::kDeclaring) {
+      *out_symbol = declared_symbol;
+      return declared_status;
+    }
+  }
+
+  auto global_lock = AcquireSymbolLock();
   auto it = map_.find(address);
   Symbol* symbol = it != map_.end() ? it->second : nullptr;
   Symbol::Status status;
@@ -87,6 +115,7 @@ Symbol::Status Module::DeclareSymbol(Symbol::Type type, uint32_t address,
         break;
     }
     map_[address] = symbol;
+    symbol_index_.insert_or_assign(address, symbol);
     list_.emplace_back(symbol);
     status = Symbol::Status::kNew;
   }
@@ -16,6 +16,7 @@
 #include <unordered_map>
 #include <vector>
 
+#include "xenia/base/lockfree_read_map.h"
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/symbol.h"
@@ -66,9 +67,14 @@ class Module {
                                Symbol** out_symbol);
   Symbol::Status DefineSymbol(Symbol* symbol);
 
+  // Acquires the global lock, counting how often it's contended.
+  global_unique_lock_type AcquireSymbolLock();
+
   xe::global_critical_region global_critical_region_;
   // TODO(benvanik): replace with a better data structure.
   std::unordered_map<uint32_t, Symbol*> map_;
+  // Same symbols as map_, for lookups of existing symbols without locking.
+  xe::lockfree_read_map<Symbol> symbol_index_;
   std::vector<std::unique_ptr<Symbol>> list_;
 };
 
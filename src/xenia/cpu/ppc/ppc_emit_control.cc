@@ -87,7 +87,7 @@ int InstrEmit_branch(PPCHIRBuilder& f, const char* src, uint64_t cia,
           cond = f.IsFalse(cond);
         }
         f.CallTrue(cond, function, call_flags);
-      } else {
+      } else if (!lk || !f.EmitInlinedCall(function)) {
         f.Call(function, call_flags);
       }
     }
@@ -134,6 +134,18 @@ int InstrEmit_branch(PPCHIRBuilder& f, const char* src, uint64_t cia,
 #endif
     // Jump to pointer.
     bool likely_return = !lk && nia_is_lr;
+    if (likely_return && f.inlined_return_label()) {
+      // Return from an inlined leaf function, which doesn't change LR.
+      if (cond) {
+        if (!expect_true) {
+          cond = f.IsFalse(cond);
+        }
+        f.BranchTrue(cond, f.inlined_return_label());
+      } else {
+        f.Branch(f.inlined_return_label());
+      }
+      return 0;
+    }
     if (likely_return) {
       call_flags |= CALL_POSSIBLE_RETURN;
     }
@@ -27,6 +27,12 @@ DEFINE_bool(no_reserved_ops, false,
             "For testing whether a game may have races with a broken reserved "
             "load/store impl",
             "CPU");
+DEFINE_bool(fast_reserved_ops, true,
+            "Translate common lwarx/stwcx. sequences - atomic exchange, atomic "
+            "add, and compare-and-store as done by spinlocks - to a single "
+            "host compare-exchange, using the reservation emulation only if "
+            "it fails.",
+            "CPU");
 
 namespace xe {
 namespace cpu {
@@ -792,6 +798,143 @@ int InstrEmit_ldarx(PPCHIRBuilder& f, const InstrData& i) {
   return 0;
 }
 
+namespace {
+
+// bne cr0 back to the lwarx, retrying if the stwcx. has failed.
+bool IsReservationRetry(const InstrData& i, uint32_t lwarx_address) {
+  return i.opcode == PPCOpcode::bcx && !i.B.LK && !i.B.AA &&
+         (i.B.BO & 0b11100) == 0b00100 && i.B.BI == 2 &&
+         uint32_t(i.address + XEEXTS16(i.B.BD << 2)) == lwarx_address;
+}
+
+bool IsReservedStoreTo(const InstrData& i, const InstrData& lwarx) {
+  return i.opcode == PPCOpcode::stwcx && i.X.RA == lwarx.X.RA &&
+         i.X.RB == lwarx.X.RB;
+}
+
+// Whether writing the register doesn't change the address of the reservation.
+bool PreservesEA(uint32_t reg, const InstrData& lwarx) {
+  return reg != lwarx.X.RB && (!lwarx.X.RA || reg != lwarx.X.RA);
+}
+
+// Translates these sequences starting with the lwarx to a compare-exchange
+// that's tried before the lwarx and the rest of the sequence are executed as
+// usual, and skips the sequence if it succeeds:
+//   lwarx rT; stwcx. rS; bne retry - exchange.
+//   lwarx rT; addi/add rD, rT, x; stwcx. rD; bne retry - atomic add.
+//   lwarx rT; cmp(l)w(i) crN, rT, x; bne crN, fail; stwcx. rS; bne retry -
+//   compare-and-store, like acquiring a spinlock.
+// The compare-exchange fails only if the memory has been modified between the
+// load and it, so the cost of the reservation emulation is paid only under
+// contention. The memory barriers are implied by the locked instruction.
+bool EmitReservationFastPath(PPCHIRBuilder& f, const InstrData& i) {
+  uint32_t rt = i.X.RT;
+  // The stwcx. must store to the address of the lwarx, which the loaded value
+  // replaces if rT is also the base or the index register.
+  if (!PreservesEA(rt, i)) {
+    return false;
+  }
+  InstrData i1, i2, i3, i4;
+  if (!f.LookupInstr(i.address + 4, &i1) ||
+      !f.LookupInstr(i.address + 8, &i2)) {
+    return false;
+  }
+
+  enum class Idiom { kExchange, kAdd, kCompareStore } idiom;
+  uint32_t end_address;
+  if (IsReservedStoreTo(i1, i) && i1.X.RT != rt &&
+      IsReservationRetry(i2, i.address)) {
+    idiom = Idiom::kExchange;
+    end_address = i2.address + 4;
+  } else if (!f.LookupInstr(i.address + 12, &i3)) {
+    return false;
+  } else if (((i1.opcode == PPCOpcode::addi && rt && i1.D.RA == rt) ||
+              (i1.opcode == PPCOpcode::addx && !i1.XO.OE && !i1.XO.Rc &&
+               i1.XO.RA == rt && i1.XO.RB != rt)) &&
+             PreservesEA(i1.D.RT, i) && IsReservedStoreTo(i2, i) &&
+             i2.X.RT == i1.D.RT && IsReservationRetry(i3, i.address)) {
+    idiom = Idiom::kAdd;
+    end_address = i3.address + 4;
+  } else if (((i1.opcode == PPCOpcode::cmpi ||
+               i1.opcode == PPCOpcode::cmpli) &&
+              !(i1.D.RT & 1) && i1.D.RA == rt) ||
+             ((i1.opcode == PPCOpcode::cmp || i1.opcode == PPCOpcode::cmpl) &&
+              !(i1.X.RT & 1) && i1.X.RA == rt && i1.X.RB != rt)) {
+    uint32_t crf = i1.X.RT >> 2;
+    if (i2.opcode != PPCOpcode::bcx || i2.B.LK ||
+        (i2.B.BO & 0b11100) != 0b00100 || i2.B.BI != crf * 4 + 2 ||
+        !IsReservedStoreTo(i3, i) || i3.X.RT == rt ||
+        !f.LookupInstr(i.address + 16, &i4) ||
+        !IsReservationRetry(i4, i.address)) {
+      return false;
+    }
+    idiom = Idiom::kCompareStore;
+    end_address = i4.address + 4;
+  } else {
+    return false;
+  }
+  Label* end_label = f.LookupLabel(end_address);
+  if (!end_label) {
+    return false;
+  }
+
+  Value* ea = CalculateEA_0(f, i.X.RA, i.X.RB);
+  Label* slow_label = f.NewLabel();
+  switch (idiom) {
+    case Idiom::kExchange: {
+      Value* old_value = f.Load(ea, INT32_TYPE);
+      Value* new_value = f.ByteSwap(f.Truncate(f.LoadGPR(i1.X.RT), INT32_TYPE));
+      f.BranchFalse(f.AtomicCompareExchange(ea, old_value, new_value),
+                    slow_label);
+      f.StoreGPR(rt, f.ZeroExtend(f.ByteSwap(old_value), INT64_TYPE));
+    } break;
+    case Idiom::kAdd: {
+      Value* old_value = f.Load(ea, INT32_TYPE);
+      Value* rt_value = f.ZeroExtend(f.ByteSwap(old_value), INT64_TYPE);
+      Value* rd_value;
+      if (i1.opcode == PPCOpcode::addi) {
+        rd_value = f.Add(rt_value, f.LoadConstantInt64(XEEXTS16(i1.D.DS)));
+      } else {
+        rd_value = f.Add(rt_value, f.LoadGPR(i1.XO.RB));
+      }
+      Value* new_value = f.ByteSwap(f.Truncate(rd_value, INT32_TYPE));
+      f.BranchFalse(f.AtomicCompareExchange(ea, old_value, new_value),
+                    slow_label);
+      f.StoreGPR(rt, rt_value);
+      f.StoreGPR(i1.D.RT, rd_value);
+    } break;
+    case Idiom::kCompareStore: {
+      Value* expected;
+      if (i1.opcode == PPCOpcode::cmpi) {
+        expected = f.LoadConstantInt32(int32_t(XEEXTS16(i1.D.DS)));
+      } else if (i1.opcode == PPCOpcode::cmpli) {
+        expected = f.LoadConstantInt32(int32_t(i1.D.DS));
+      } else {
+        expected = f.Truncate(f.LoadGPR(i1.X.RB), INT32_TYPE);
+      }
+      Value* new_value = f.ByteSwap(f.Truncate(f.LoadGPR(i3.X.RT), INT32_TYPE));
+      f.BranchFalse(
+          f.AtomicCompareExchange(ea, f.ByteSwap(expected), new_value),
+          slow_label);
+      f.StoreGPR(rt, f.ZeroExtend(expected, INT64_TYPE));
+      // The comparison was equal.
+      uint32_t crf = i1.X.RT >> 2;
+      f.StoreCRField(crf, 0, f.LoadZeroInt8());
+      f.StoreCRField(crf, 1, f.LoadZeroInt8());
+      f.StoreCRField(crf, 2, f.LoadConstantInt8(1));
+    } break;
+  }
+  // The stwcx. succeeded.
+  f.StoreContext(offsetof(PPCContext, cr0.cr0_eq), f.LoadConstantInt8(1));
+  f.StoreContext(offsetof(PPCContext, cr0.cr0_lt), f.LoadZeroInt8());
+  f.StoreContext(offsetof(PPCContext, cr0.cr0_gt), f.LoadZeroInt8());
+  f.Branch(end_label);
+  f.MarkLabel(slow_label);
+  return true;
+}
+
+}  // namespace
+
 int InstrEmit_lwarx(PPCHIRBuilder& f, const InstrData& i) {
   // if RA = 0 then
   //   b <- 0
@@ -809,6 +952,10 @@ int InstrEmit_lwarx(PPCHIRBuilder& f, const InstrData& i) {
   // always under a global lock) do that yet.
   // We issue a memory barrier here to make sure that we get good values.
 
+  if (cvars::fast_reserved_ops && !cvars::no_reserved_ops) {
+    EmitReservationFastPath(f, i);
+  }
+
   Value* ea = CalculateEA_0(f, i.X.RA, i.X.RB);
   if (cvars::no_reserved_ops) {
     f.StoreGPR(i.X.RT,
@@ -11,7 +11,9 @@
 
 #include "xenia/base/atomic.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/math.h"
 #include "xenia/base/mutex.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/ppc/ppc_context.h"
 #include "xenia/cpu/ppc/ppc_emit.h"
 #include "xenia/cpu/ppc/ppc_opcode_info.h"
@@ -45,11 +47,22 @@ void CleanupOnShutdown() {}
 
 PPCFrontend::PPCFrontend(Processor* processor) : processor_(processor) {
   InitializeIfNeeded();
+  if (cvars::jit_stats) {
+    translation_stats_ = std::make_unique<TranslationStats>();
+  }
 }
 
 PPCFrontend::~PPCFrontend() {
   // Force cleanup now before we deinit.
   translator_pool_.Reset();
+
+  if (translation_stats_) {
+    if (cvars::jit_stats_path.empty()) {
+      translation_stats_->Log();
+    } else {
+      translation_stats_->Write(cvars::jit_stats_path);
+    }
+  }
 }
 
 Memory* PPCFrontend::memory() const { return processor_->memory(); }
@@ -102,9 +115,24 @@ bool PPCFrontend::Initialize() {
       processor_->DefineBuiltin("LeaveGlobalLock", LeaveGlobalLock, arg0, arg1);
   builtins_.syscall_handler = processor_->DefineBuiltin(
       "SyscallHandler", SyscallHandler, nullptr, nullptr);
+  for (size_t i = 0; i < xe::countof(builtins_.host_routines); ++i) {
+    auto routine = PPCHostRoutine(i);
+    builtins_.host_routines[i] = processor_->DefineBuiltin(
+        GetHostRoutineName(routine), GetHostRoutineHandler(routine), memory(),
+        nullptr);
+  }
   return true;
 }
 
+Function* PPCFrontend::FindHostRoutine(uint32_t start_address,
+                                       uint32_t end_address) {
+  PPCHostRoutine routine;
+  if (!IdentifyHostRoutine(memory(), start_address, end_address, &routine)) {
+    return nullptr;
+  }
+  return builtins_.host_routines[size_t(routine)];
+}
+
 bool PPCFrontend::DeclareFunction(GuestFunction* function) {
 
 	//chrispy: make sure we aren't declaring a function that is actually padding data, this will mess up PPCScanner and is hard to debug
@@ -14,6 +14,8 @@
 
 #include "xenia/base/type_pool.h"
 #include "xenia/cpu/function.h"
+#include "xenia/cpu/ppc/ppc_host_routines.h"
+#include "xenia/cpu/translation_stats.h"
 #include "xenia/memory.h"
 
 namespace xe {
@@ -34,6 +36,7 @@ struct PPCBuiltins {
   Function* enter_global_lock;
   Function* leave_global_lock;
   Function* syscall_handler;
+  Function* host_routines[size_t(PPCHostRoutine::kCount)];
 };
 
 class PPCFrontend {
@@ -46,6 +49,14 @@ class PPCFrontend {
   Processor* processor() const { return processor_; }
   Memory* memory() const;
   PPCBuiltins* builtins() { return &builtins_; }
+  // Null unless collecting translation statistics.
+  TranslationStats* translation_stats() const {
+    return translation_stats_.get();
+  }
+
+  // Builtin to call instead of the guest code in the range if it's a known
+  // build of a C runtime routine, or null.
+  Function* FindHostRoutine(uint32_t start_address, uint32_t end_address);
 
   bool DeclareFunction(GuestFunction* function);
   bool DefineFunction(GuestFunction* function, uint32_t debug_info_flags);
@@ -53,6 +64,7 @@ class PPCFrontend {
  private:
   Processor* processor_;
   PPCBuiltins builtins_ = {0};
+  std::unique_ptr<TranslationStats> translation_stats_;
   TypePool<PPCTranslator, PPCFrontend*> translator_pool_;
 };
 // Checks the state of the global lock and sets scratch to the current MSR
@@ -26,6 +26,7 @@
 #include "xenia/cpu/ppc/ppc_decode_data.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
 #include "xenia/cpu/ppc/ppc_opcode_info.h"
+#include "xenia/cpu/ppc/ppc_scanner.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/cpu/xex_module.h"
 DEFINE_bool(
@@ -79,29 +80,58 @@ void PPCHIRBuilder::Reset() {
   instr_offset_list_ = NULL;
   label_list_ = NULL;
   with_debug_info_ = false;
+  inline_calls_ = false;
+  inlined_return_label_ = nullptr;
+  inlined_functions_.clear();
   HIRBuilder::Reset();
 }
 
 bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
   SCOPE_profile_cpu_f("cpu");
 
-  Memory* memory = frontend_->memory();
-
   function_ = function;
-  start_address_ = function_->address();
   // chrispy: i've seen this one happen, not sure why but i think from trying to
   // precompile twice i've also seen ones with a start and end address that are
   // the same...
   assert_true(function_->address() <= function_->end_address());
-  instr_count_ = (function_->end_address() - function_->address()) / 4 + 1;
 
   with_debug_info_ = (flags & EMIT_DEBUG_COMMENTS) == EMIT_DEBUG_COMMENTS;
+  inline_calls_ =
+      (flags & EMIT_INLINE_LEAF_FUNCTIONS) == EMIT_INLINE_LEAF_FUNCTIONS;
   if (with_debug_info_) {
     CommentFormat("{} fn {:08X}-{:08X} {}", function_->module()->name().c_str(),
                   function_->address(), function_->end_address(),
                   function_->name().c_str());
   }
 
+  Function* host_routine = frontend_->FindHostRoutine(
+      function_->address(), function_->end_address());
+  if (host_routine) {
+    if (function_->tier() == GuestFunction::Tier::kUntranslated) {
+      XELOGI("Calling host {} for function {:08X}", host_routine->name(),
+             function_->address());
+    }
+    // The guest code still runs if the host routine can't do the work.
+    CallExtern(host_routine);
+    ReturnTrue(LoadContext(offsetof(PPCContext, scratch), INT64_TYPE));
+  }
+
+  EmitInstructions(function_->address(), function_->end_address());
+
+  if (false) {
+    DumpAllOpcodeCounts();
+  }
+
+  return Finalize();
+}
+
+void PPCHIRBuilder::EmitInstructions(uint32_t start_address,
+                                     uint32_t end_address) {
+  Memory* memory = frontend_->memory();
+
+  start_address_ = start_address;
+  instr_count_ = (end_address - start_address) / 4 + 1;
+
   // Allocate offset list.
   // This is used to quickly map labels to instructions.
   // The list is built as the instructions are traversed, with the values
@@ -117,8 +147,6 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
   // Always mark entry with label.
   label_list_[0] = NewLabel();
 
-  uint32_t start_address = function_->address();
-  uint32_t end_address = function_->end_address();
   for (uint32_t address = start_address, offset = 0; address <= end_address;
        address += 4, offset++) {
     trace_info_.dest_count = 0;
@@ -191,12 +219,50 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
       }
     }
   }
+}
 
-  if (false) {
-    DumpAllOpcodeCounts();
+bool PPCHIRBuilder::EmitInlinedCall(Function* function) {
+  // Inlined functions are leaves, so there's no nesting.
+  if (!inline_calls_ || inlined_return_label_ || !function ||
+      !function->is_guest() ||
+      function->behavior() != Function::Behavior::kDefault) {
+    return false;
+  }
+  uint32_t address = function->address();
+  uint32_t end_address;
+  PPCScanner scanner(frontend_);
+  // Known C runtime routines are faster when called to run on the host.
+  if (!scanner.FindInlineableLeaf(address, cvars::inline_max_instructions,
+                                  &end_address) ||
+      !frontend_->processor()->CanInlineFunction(address, end_address) ||
+      frontend_->FindHostRoutine(address, end_address)) {
+    return false;
   }
 
-  return Finalize();
+  if (with_debug_info_) {
+    CommentFormat("inlined fn {:08X}-{:08X} {}", address, end_address,
+                  function->name().c_str());
+  }
+
+  // The label tables are per range of guest code, the caller's are restored
+  // to continue after the call.
+  uint64_t caller_start_address = start_address_;
+  uint64_t caller_instr_count = instr_count_;
+  Instr** caller_instr_offset_list = instr_offset_list_;
+  Label** caller_label_list = label_list_;
+
+  inlined_return_label_ = NewLabel();
+  EmitInstructions(address, end_address);
+  MarkLabel(inlined_return_label_);
+  inlined_return_label_ = nullptr;
+
+  start_address_ = caller_start_address;
+  instr_count_ = caller_instr_count;
+  instr_offset_list_ = caller_instr_offset_list;
+  label_list_ = caller_label_list;
+
+  inlined_functions_.push_back({address, end_address});
+  return true;
 }
 
 void PPCHIRBuilder::MaybeBreakOnInstruction(uint32_t address) {
@@ -294,6 +360,19 @@ Label* PPCHIRBuilder::LookupLabel(uint32_t address) {
   return label;
 }
 
+bool PPCHIRBuilder::LookupInstr(uint32_t address, InstrData* i) {
+  if (address < start_address_ ||
+      (address - start_address_) / 4 >= instr_count_) {
+    return false;
+  }
+  i->address = address;
+  i->code = xe::load_and_swap<uint32_t>(
+      frontend_->memory()->TranslateVirtual(address));
+  i->opcode = LookupOpcode(i->code);
+  i->opcode_info = &GetOpcodeInfo(i->opcode);
+  return i->opcode != PPCOpcode::kInvalid;
+}
+
 // Value* PPCHIRBuilder::LoadXER() {
 //}
 //
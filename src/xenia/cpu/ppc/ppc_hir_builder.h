@@ -10,6 +10,8 @@
 #ifndef XENIA_CPU_PPC_PPC_HIR_BUILDER_H_
 #define XENIA_CPU_PPC_PPC_HIR_BUILDER_H_
 
+#include <vector>
+
 #include "xenia/base/string_buffer.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/hir/hir_builder.h"
@@ -18,6 +20,7 @@ namespace xe {
 namespace cpu {
 namespace ppc {
 
+struct InstrData;
 struct PPCBuiltins;
 class PPCFrontend;
 
@@ -37,12 +40,27 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   enum EmitFlags {
     // Emit comment nodes.
     EMIT_DEBUG_COMMENTS = 1 << 0,
+    // Inline calls to small leaf functions.
+    EMIT_INLINE_LEAF_FUNCTIONS = 1 << 1,
   };
   bool Emit(GuestFunction* function, uint32_t flags);
 
   GuestFunction* function() const { return function_; }
   Function* LookupFunction(uint32_t address);
   Label* LookupLabel(uint32_t address);
+  // Decodes the instruction at the address if it's within the code being
+  // emitted, for recognizing sequences of instructions.
+  bool LookupInstr(uint32_t address, InstrData* i);
+
+  // Emits the body of the function in place of a call to it if it's a small
+  // leaf function. Returns false if the call must be emitted instead.
+  bool EmitInlinedCall(Function* function);
+  // Where blr branches to while emitting an inlined function, or null.
+  Label* inlined_return_label() const { return inlined_return_label_; }
+  const std::vector<GuestFunction::InlinedFunction>& inlined_functions()
+      const {
+    return inlined_functions_;
+  }
 
   Value* LoadLR();
   void StoreLR(Value* value);
@@ -83,6 +101,7 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   //calls original impl in hirbuilder, but also records the is_return_site bit into flags in the guestmodule
   void SetReturnAddress(Value* value);
  private:
+  void EmitInstructions(uint32_t start_address, uint32_t end_address);
   void MaybeBreakOnInstruction(uint32_t address);
   void AnnotateLabel(uint32_t address, Label* label);
 
@@ -98,6 +117,9 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   uint64_t instr_count_;
   Instr** instr_offset_list_;
   Label** label_list_;
+  bool inline_calls_;
+  Label* inlined_return_label_;
+  std::vector<GuestFunction::InlinedFunction> inlined_functions_;
 
   // Reset each instruction.
   struct {
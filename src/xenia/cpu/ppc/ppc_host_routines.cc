@@ -0,0 +1,263 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/ppc/ppc_host_routines.h"
+
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/byte_order.h"
+#include "xenia/base/cvar.h"
+#include "xenia/base/math.h"
+#include "xenia/base/mutex.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+
+DEFINE_bool(host_crt_routines, true,
+            "Replace known builds of C runtime routines in titles, like "
+            "memcpy, with host implementations.",
+            "CPU");
+
+namespace xe {
+namespace cpu {
+namespace ppc {
+
+namespace {
+
+// Whole functions, from the entry point to the final blr.
+const uint32_t kMemcpyBuild0[] = {
+    0x2B050000,  // cmplwi cr6, r5, 0
+    0x4D9A0020,  // beqlr cr6
+    0x7CA903A6,  // mtctr r5
+    0x7C6B1B78,  // mr r11, r3
+    0x89440000,  // lbz r10, 0(r4)
+    0x38840001,  // addi r4, r4, 1
+    0x994B0000,  // stb r10, 0(r11)
+    0x396B0001,  // addi r11, r11, 1
+    0x4200FFF0,  // bdnz -16
+    0x4E800020,  // blr
+};
+const uint32_t kMemcpyBuild1[] = {
+    0x2B050000,  // cmplwi cr6, r5, 0
+    0x4D9A0020,  // beqlr cr6
+    0x7CA903A6,  // mtctr r5
+    0x3963FFFF,  // addi r11, r3, -1
+    0x3884FFFF,  // addi r4, r4, -1
+    0x8D440001,  // lbzu r10, 1(r4)
+    0x9D4B0001,  // stbu r10, 1(r11)
+    0x4200FFF8,  // bdnz -8
+    0x4E800020,  // blr
+};
+const uint32_t kMemsetBuild0[] = {
+    0x2B050000,  // cmplwi cr6, r5, 0
+    0x4D9A0020,  // beqlr cr6
+    0x7CA903A6,  // mtctr r5
+    0x7C6B1B78,  // mr r11, r3
+    0x988B0000,  // stb r4, 0(r11)
+    0x396B0001,  // addi r11, r11, 1
+    0x4200FFF8,  // bdnz -8
+    0x4E800020,  // blr
+};
+const uint32_t kMemsetBuild1[] = {
+    0x2B050000,  // cmplwi cr6, r5, 0
+    0x4D9A0020,  // beqlr cr6
+    0x7CA903A6,  // mtctr r5
+    0x3963FFFF,  // addi r11, r3, -1
+    0x9C8B0001,  // stbu r4, 1(r11)
+    0x4200FFFC,  // bdnz -4
+    0x4E800020,  // blr
+};
+const uint32_t kStrlenBuild0[] = {
+    0x7C6B1B78,  // mr r11, r3
+    0x894B0000,  // lbz r10, 0(r11)
+    0x396B0001,  // addi r11, r11, 1
+    0x2B0A0000,  // cmplwi cr6, r10, 0
+    0x409AFFF4,  // bne cr6, -12
+    0x7C635850,  // subf r3, r3, r11
+    0x3863FFFF,  // addi r3, r3, -1
+    0x4E800020,  // blr
+};
+const uint32_t kStrlenBuild1[] = {
+    0x3963FFFF,  // addi r11, r3, -1
+    0x8D4B0001,  // lbzu r10, 1(r11)
+    0x2B0A0000,  // cmplwi cr6, r10, 0
+    0x409AFFF8,  // bne cr6, -8
+    0x7C635850,  // subf r3, r3, r11
+    0x4E800020,  // blr
+};
+
+struct HostRoutineBuild {
+  PPCHostRoutine routine;
+  const uint32_t* code;
+  size_t code_length;
+};
+#define HOST_ROUTINE_BUILD(routine, code) \
+  { routine, code, xe::countof(code) }
+const HostRoutineBuild kHostRoutineBuilds[] = {
+    HOST_ROUTINE_BUILD(PPCHostRoutine::kMemcpy, kMemcpyBuild0),
+    HOST_ROUTINE_BUILD(PPCHostRoutine::kMemcpy, kMemcpyBuild1),
+    HOST_ROUTINE_BUILD(PPCHostRoutine::kMemset, kMemsetBuild0),
+    HOST_ROUTINE_BUILD(PPCHostRoutine::kMemset, kMemsetBuild1),
+    HOST_ROUTINE_BUILD(PPCHostRoutine::kStrlen, kStrlenBuild0),
+    HOST_ROUTINE_BUILD(PPCHostRoutine::kStrlen, kStrlenBuild1),
+};
+#undef HOST_ROUTINE_BUILD
+
+// Whether the guest code can access the whole range without faulting.
+bool IsRangeAccessible(Memory* memory, uint32_t address, uint32_t length,
+                       bool is_write) {
+  if (!length) {
+    return true;
+  }
+  uint32_t high_address = address + length - 1;
+  BaseHeap* heap = memory->LookupHeap(address);
+  if (high_address < address || !heap) {
+    return false;
+  }
+  xe::memory::PageAccess access = heap->QueryRangeAccess(address, high_address);
+  return is_write ? access == xe::memory::PageAccess::kReadWrite
+                  : access != xe::memory::PageAccess::kNoAccess;
+}
+
+// Written by the host rather than the guest code, so watches of the GPU and
+// such on the pages must be triggered before writing.
+uint8_t* BeginHostWrite(Memory* memory, uint32_t address, uint32_t length) {
+  memory->TriggerPhysicalMemoryCallbacks(
+      xe::global_critical_region::AcquireDirect(), address, length, true,
+      false);
+  return memory->TranslateVirtual(address);
+}
+
+// The guest routines only leave the result in r3 for the caller - the volatile
+// registers they use otherwise are not set.
+
+void HostMemcpy(PPCContext* ppc_context, void* arg0, void* arg1) {
+  auto memory = reinterpret_cast<Memory*>(arg0);
+  uint32_t dest = uint32_t(ppc_context->r[3]);
+  uint32_t src = uint32_t(ppc_context->r[4]);
+  uint32_t length = uint32_t(ppc_context->r[5]);
+  if (!IsRangeAccessible(memory, src, length, false) ||
+      !IsRangeAccessible(memory, dest, length, true)) {
+    ppc_context->scratch = 0;
+    return;
+  }
+  if (length) {
+    uint8_t* host_dest = BeginHostWrite(memory, dest, length);
+    const uint8_t* host_src = memory->TranslateVirtual(src);
+    if (dest - src >= length) {
+      // Same as copying forward unless the destination starts in the source.
+      std::memmove(host_dest, host_src, length);
+    } else {
+      // Copying forward repeats the bytes before the destination.
+      for (uint32_t i = 0; i < length; ++i) {
+        host_dest[i] = host_src[i];
+      }
+    }
+  }
+  ppc_context->scratch = 1;
+}
+
+void HostMemset(PPCContext* ppc_context, void* arg0, void* arg1) {
+  auto memory = reinterpret_cast<Memory*>(arg0);
+  uint32_t dest = uint32_t(ppc_context->r[3]);
+  uint32_t length = uint32_t(ppc_context->r[5]);
+  if (!IsRangeAccessible(memory, dest, length, true)) {
+    ppc_context->scratch = 0;
+    return;
+  }
+  if (length) {
+    std::memset(BeginHostWrite(memory, dest, length),
+                uint8_t(ppc_context->r[4]), length);
+  }
+  ppc_context->scratch = 1;
+}
+
+void HostStrlen(PPCContext* ppc_context, void* arg0, void* arg1) {
+  auto memory = reinterpret_cast<Memory*>(arg0);
+  uint32_t address = uint32_t(ppc_context->r[3]);
+  // The length isn't known in advance, so the string is checked and searched a
+  // page at a time.
+  uint32_t length = 0;
+  while (true) {
+    uint32_t chunk_address = address + length;
+    uint32_t chunk_length = 4096 - (chunk_address & 4095);
+    if (chunk_address + chunk_length < chunk_address ||
+        !IsRangeAccessible(memory, chunk_address, chunk_length, false)) {
+      ppc_context->scratch = 0;
+      return;
+    }
+    auto host_chunk = memory->TranslateVirtual<const uint8_t*>(chunk_address);
+    auto terminator = reinterpret_cast<const uint8_t*>(
+        std::memchr(host_chunk, 0, chunk_length));
+    if (terminator) {
+      length += uint32_t(terminator - host_chunk);
+      break;
+    }
+    length += chunk_length;
+  }
+  ppc_context->r[3] = length;
+  ppc_context->scratch = 1;
+}
+
+}  // namespace
+
+const char* GetHostRoutineName(PPCHostRoutine routine) {
+  switch (routine) {
+    case PPCHostRoutine::kMemcpy:
+      return "memcpy";
+    case PPCHostRoutine::kMemset:
+      return "memset";
+    case PPCHostRoutine::kStrlen:
+      return "strlen";
+    default:
+      assert_unhandled_case(routine);
+      return "";
+  }
+}
+
+BuiltinFunction::Handler GetHostRoutineHandler(PPCHostRoutine routine) {
+  switch (routine) {
+    case PPCHostRoutine::kMemcpy:
+      return HostMemcpy;
+    case PPCHostRoutine::kMemset:
+      return HostMemset;
+    case PPCHostRoutine::kStrlen:
+      return HostStrlen;
+    default:
+      assert_unhandled_case(routine);
+      return nullptr;
+  }
+}
+
+bool IdentifyHostRoutine(Memory* memory, uint32_t start_address,
+                         uint32_t end_address, PPCHostRoutine* out_routine) {
+  if (!cvars::host_crt_routines || end_address < start_address) {
+    return false;
+  }
+  size_t instr_count = (end_address - start_address) / 4 + 1;
+  auto code = memory->TranslateVirtual<const uint32_t*>(start_address);
+  for (const HostRoutineBuild& build : kHostRoutineBuilds) {
+    if (build.code_length != instr_count) {
+      continue;
+    }
+    size_t i = 0;
+    while (i < instr_count && xe::load_and_swap<uint32_t>(code + i) ==
+                                  build.code[i]) {
+      ++i;
+    }
+    if (i == instr_count) {
+      *out_routine = build.routine;
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace ppc
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,49 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_PPC_PPC_HOST_ROUTINES_H_
+#define XENIA_CPU_PPC_PPC_HOST_ROUTINES_H_
+
+#include <cstdint>
+
+#include "xenia/cpu/function.h"
+#include "xenia/memory.h"
+
+namespace xe {
+namespace cpu {
+namespace ppc {
+
+// C runtime routines titles link statically, which are slow as guest code as
+// they work on one byte at a time, and have host implementations.
+enum class PPCHostRoutine : uint32_t {
+  kMemcpy,
+  kMemset,
+  kStrlen,
+
+  kCount,
+};
+
+const char* GetHostRoutineName(PPCHostRoutine routine);
+
+// Builtin handler doing the work of the routine, with the Memory as arg0. Sets
+// scratch to 1 if it has done the work, or to 0 if the guest code must run
+// instead, such as if it would access memory it can't, so that it faults as it
+// would without the replacement.
+BuiltinFunction::Handler GetHostRoutineHandler(PPCHostRoutine routine);
+
+// Finds whether the guest code in the range is one of the known builds of a
+// routine, by comparing the instructions.
+bool IdentifyHostRoutine(Memory* memory, uint32_t start_address,
+                         uint32_t end_address, PPCHostRoutine* out_routine);
+
+}  // namespace ppc
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_PPC_PPC_HOST_ROUTINES_H_
@@ -273,7 +273,11 @@ bool PPCScanner::Scan(GuestFunction* function, FunctionDebugInfo* debug_info) {
     LOGPPC("Function ran under: {:08X}-{:08X} ended at {:08X}", start_address,
            end_address, address + 4);
   }
-  function->set_end_address(address);
+  // Retranslation scans again while other threads may be reading the end
+  // address, which is the same unless the guest code has changed.
+  if (function->end_address() != address) {
+    function->set_end_address(address);
+  }
 
   // If there's spare bits at the end, split the function.
   // TODO(benvanik): splitting?
@@ -292,6 +296,58 @@ bool PPCScanner::Scan(GuestFunction* function, FunctionDebugInfo* debug_info) {
   return true;
 }
 
+bool PPCScanner::FindInlineableLeaf(uint32_t address,
+                                    uint32_t max_instruction_count,
+                                    uint32_t* out_end_address) {
+  Memory* memory = frontend_->memory();
+
+  uint32_t start_address = address;
+  uint32_t furthest_target = start_address;
+  for (uint32_t i = 0; i < max_instruction_count; ++i, address += 4) {
+    uint32_t code =
+        xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    auto opcode = LookupOpcode(code);
+
+    PPCDecodeData d;
+    d.address = address;
+    d.code = code;
+
+    if (!code || opcode == PPCOpcode::kInvalid || opcode == PPCOpcode::sc) {
+      return false;
+    } else if (code == 0x4E800020) {
+      // blr -- the end unless something branches over it.
+      if (furthest_target <= address) {
+        *out_end_address = address;
+        return true;
+      }
+    } else if (opcode == PPCOpcode::bx) {
+      // Calls and tail calls, or backwards branches that may be loops.
+      if (d.I.LK() || d.I.ADDR() <= address) {
+        return false;
+      }
+      furthest_target = std::max(furthest_target, d.I.ADDR());
+    } else if (opcode == PPCOpcode::bcx) {
+      if (d.B.LK() || d.B.ADDR() <= address) {
+        return false;
+      }
+      furthest_target = std::max(furthest_target, d.B.ADDR());
+    } else if (opcode == PPCOpcode::bclrx) {
+      // Conditional returns are fine.
+      if (d.XL.LK()) {
+        return false;
+      }
+    } else if (opcode == PPCOpcode::bcctrx) {
+      return false;
+    } else if (opcode == PPCOpcode::mtspr &&
+               (((d.XFX.SPR() & 0x1F) << 5) | ((d.XFX.SPR() >> 5) & 0x1F)) ==
+                   8) {
+      // mtlr -- blr wouldn't be a return anymore.
+      return false;
+    }
+  }
+  return false;
+}
+
 std::vector<BlockInfo> PPCScanner::FindBlocks(GuestFunction* function) {
   Memory* memory = frontend_->memory();
 
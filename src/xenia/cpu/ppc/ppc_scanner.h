@@ -35,6 +35,13 @@ class PPCScanner {
 
   std::vector<BlockInfo> FindBlocks(GuestFunction* function);
 
+  // Checks whether the function at the given address is a small leaf that can
+  // be inlined into its callers: it makes no calls, only branches forward
+  // within itself, doesn't change LR and ends with a blr. Returns the address
+  // of the final blr.
+  bool FindInlineableLeaf(uint32_t address, uint32_t max_instruction_count,
+                          uint32_t* out_end_address);
+
  private:
   bool IsRestGprLr(uint32_t address);
 
@@ -9,8 +9,11 @@
 
 #include "xenia/cpu/ppc/ppc_translator.h"
 
+#include <algorithm>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_order.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/cvar.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
@@ -52,6 +55,11 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
   compiler_->AddPass(std::make_unique<passes::ControlFlowSimplificationPass>());
 
+  // Looks at loops while they are still as in the guest code.
+  if (cvars::detect_idle_loops) {
+    compiler_->AddPass(std::make_unique<passes::IdleLoopDetectionPass>());
+  }
+
   // Passes are executed in the order they are added. Multiple of the same
   // pass type may be used.
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
@@ -75,18 +83,40 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
     if (validate)
       compiler_->AddPass(std::make_unique<passes::ValidationPass>());
   }
+  // Moves invariant code out of loops and reduces multiplications of loop
+  // counters. Before the cleanup passes, which remove what it leaves unused.
+  if (cvars::loop_optimization) {
+    compiler_->AddPass(std::make_unique<passes::LoopOptimizationPass>(
+        backend->machine_info()));
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
-  // if (validate)
-  // compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  if (cvars::dead_store_elimination) {
+    compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
   compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
   //// Removes all unneeded variables. Try not to add new ones after this.
+  // Not safe with the locals created by LoopContextPromotionPass and the
+  // register allocation across blocks yet.
   // compiler_->AddPass(new passes::ValueReductionPass());
   // if (validate) compiler_->AddPass(new passes::ValidationPass());
 
+  // Moves guest registers used in loops into locals that the register
+  // allocator keeps in host registers over the whole loop.
+  if (cvars::global_register_allocation &&
+      backend->machine_info()->supports_register_locals) {
+    compiler_->AddPass(std::make_unique<passes::LoopContextPromotionPass>(
+        backend->machine_info()));
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+
   // Register allocation for the target backend.
   // Will modify the HIR to add loads/stores.
   // This should be the last pass before finalization, as after this all
@@ -95,8 +125,49 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
       backend->machine_info()));
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
+  // Lays out the blocks using the entry counts from the baseline tier.
+  if (cvars::tiered_compilation && cvars::hot_path_layout) {
+    auto hot_path_layout_pass = std::make_unique<passes::HotPathLayoutPass>();
+    hot_path_layout_pass_ = hot_path_layout_pass.get();
+    compiler_->AddPass(std::move(hot_path_layout_pass));
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+
   // Must come last. The HIR is not really HIR after this.
   compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
+
+  if (frontend->translation_stats()) {
+    compiler_->set_collects_stats(true);
+  }
+
+  if (cvars::tiered_compilation) {
+    // Only what's needed to produce reasonable code quickly - most functions
+    // are called only a few times, mainly during initialization.
+    baseline_compiler_.reset(new Compiler(frontend->processor()));
+    // Functions spinning for long are not necessarily called often.
+    if (cvars::detect_idle_loops) {
+      baseline_compiler_->AddPass(
+          std::make_unique<passes::IdleLoopDetectionPass>());
+    }
+    baseline_compiler_->AddPass(
+        std::make_unique<passes::ConstantPropagationPass>());
+    baseline_compiler_->AddPass(
+        std::make_unique<passes::DeadCodeEliminationPass>());
+    if (validate) {
+      baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+    }
+    baseline_compiler_->AddPass(
+        std::make_unique<passes::RegisterAllocationPass>(
+            backend->machine_info()));
+    if (validate) {
+      baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+    }
+    baseline_compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
+    if (frontend->translation_stats()) {
+      baseline_compiler_->set_collects_stats(true);
+    }
+  }
 }
 
 PPCTranslator::~PPCTranslator() = default;
@@ -157,6 +228,7 @@ bool PPCTranslator::Translate(GuestFunction* function,
   // Reset() all caching when we leave.
   xe::make_reset_scope(builder_);
   xe::make_reset_scope(compiler_);
+  xe::make_reset_scope(baseline_compiler_);
   xe::make_reset_scope(assembler_);
   xe::make_reset_scope(&string_buffer_);
 
@@ -181,10 +253,25 @@ bool PPCTranslator::Translate(GuestFunction* function,
     debug_info.reset(new FunctionDebugInfo());
   }
 
+  TranslationStats* translation_stats = frontend_->translation_stats();
+  TranslationStats::FunctionStats function_stats = {};
+  uint64_t stage_start_ticks =
+      translation_stats ? Clock::QueryHostTickCount() : 0;
+  // Returns the ticks since the previous call.
+  auto end_stage = [&stage_start_ticks]() {
+    uint64_t ticks = Clock::QueryHostTickCount();
+    uint64_t stage_ticks = ticks - stage_start_ticks;
+    stage_start_ticks = ticks;
+    return stage_ticks;
+  };
+
   // Scan the function to find its extents and gather debug data.
   if (!scanner_->Scan(function, debug_info.get())) {
     return false;
   }
+  if (translation_stats) {
+    function_stats.scan_ticks = end_stage();
+  }
 
   // Setup trace data, if needed.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoTraceFunctions) {
@@ -214,14 +301,33 @@ bool PPCTranslator::Translate(GuestFunction* function,
     string_buffer_.Reset();
   }
 
+  // Debug info refers to the optimized HIR, so always use the full pipeline
+  // when it's requested.
+  bool baseline = baseline_compiler_ && !debug_info_flags &&
+                  function->tier() == GuestFunction::Tier::kUntranslated;
+
   // Emit function.
   uint32_t emit_flags = 0;
   if (debug_info) {
     emit_flags |= PPCHIRBuilder::EMIT_DEBUG_COMMENTS;
   }
+  // Debug info and tracing are per guest address range of the function, and
+  // inlining isn't worth its cost in the baseline tier.
+  if (cvars::inline_max_instructions && !debug_info_flags && !baseline) {
+    emit_flags |= PPCHIRBuilder::EMIT_INLINE_LEAF_FUNCTIONS;
+  }
+  if (translation_stats) {
+    end_stage();
+  }
   if (!builder_->Emit(function, emit_flags)) {
     return false;
   }
+  if (translation_stats) {
+    function_stats.emit_ticks = end_stage();
+    function_stats.instr_count_in = Compiler::CountInstrs(builder_.get());
+  }
+  frontend_->processor()->SetInlinedFunctions(function,
+                                              builder_->inlined_functions());
 
   // Stash raw HIR.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmRawHir) {
@@ -231,9 +337,31 @@ bool PPCTranslator::Translate(GuestFunction* function,
   }
 
   // Compile/optimize/etc.
-  if (!compiler_->Compile(builder_.get())) {
+  Compiler* compiler = baseline ? baseline_compiler_.get() : compiler_.get();
+  if (hot_path_layout_pass_ && !baseline) {
+    hot_path_layout_pass_->set_trace_data(
+        function->tier() == GuestFunction::Tier::kBaseline
+            ? &function->trace_data()
+            : nullptr);
+  }
+  if (translation_stats) {
+    end_stage();
+  }
+  if (!compiler->Compile(builder_.get())) {
     return false;
   }
+  if (translation_stats) {
+    function_stats.compile_ticks = end_stage();
+    function_stats.instr_count_out = Compiler::CountInstrs(builder_.get());
+  }
+  if (baseline) {
+    // Tells the backend to emit the call counting.
+    function->set_tier_up_countdown(std::max(cvars::tier_up_call_count, 1u));
+    if (cvars::hot_path_layout) {
+      function->AllocateBlockProfile();
+    }
+    function->set_tier(GuestFunction::Tier::kBaseline);
+  }
 
   // Stash optimized HIR.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmHir) {
@@ -245,10 +373,27 @@ bool PPCTranslator::Translate(GuestFunction* function,
   DumpHIR(function, builder_.get());
 
   // Assemble to backend machine code.
+  if (translation_stats) {
+    end_stage();
+  }
   if (!assembler_->Assemble(function, builder_.get(), debug_info_flags,
                             std::move(debug_info))) {
     return false;
   }
+  if (translation_stats) {
+    function_stats.assemble_ticks = end_stage();
+    function_stats.baseline = baseline;
+    function_stats.code_size = function->machine_code_length();
+    function_stats.mode_switch_count = assembler_->mode_switch_count();
+    translation_stats->AddFunction(function->module()->name(), function_stats,
+                                   compiler->pass_stats());
+  }
+
+  if (!baseline) {
+    // Only now that the final code is installed, so callers translated from
+    // now on may call it directly.
+    function->set_tier(GuestFunction::Tier::kOptimized);
+  }
 
   return true;
 }
@@ -15,6 +15,7 @@
 #include "xenia/base/string_buffer.h"
 #include "xenia/cpu/backend/assembler.h"
 #include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/compiler/passes/hot_path_layout_pass.h"
 #include "xenia/cpu/function.h"
 
 namespace xe {
@@ -41,6 +42,10 @@ class PPCTranslator {
   std::unique_ptr<PPCScanner> scanner_;
   std::unique_ptr<PPCHIRBuilder> builder_;
   std::unique_ptr<compiler::Compiler> compiler_;
+  // Minimal set of passes for the first translation with tiered compilation.
+  std::unique_ptr<compiler::Compiler> baseline_compiler_;
+  // Owned by compiler_, given the block profile of every function compiled.
+  compiler::passes::HotPathLayoutPass* hot_path_layout_pass_ = nullptr;
   std::unique_ptr<backend::Assembler> assembler_;
 
   StringBuffer string_buffer_;
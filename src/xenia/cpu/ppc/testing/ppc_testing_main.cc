@@ -182,7 +182,10 @@ class TestSuite {
 
 class TestRunner {
  public:
-  TestRunner() : memory_size_(64_MiB) {
+  // Debug info disables inlining, so it's only collected when the code is
+  // translated as it would be by default.
+  explicit TestRunner(bool inline_leaf_functions = false)
+      : memory_size_(64_MiB), inline_leaf_functions_(inline_leaf_functions) {
     memory_.reset(new Memory());
     memory_->Initialize();
   }
@@ -216,7 +219,9 @@ class TestRunner {
     // Setup a fresh processor.
     processor_.reset(new Processor(memory_.get(), nullptr));
     processor_->Setup(std::move(backend));
-    processor_->set_debug_info_flags(DebugInfoFlags::kDebugInfoAll);
+    processor_->set_debug_info_flags(inline_leaf_functions_
+                                         ? DebugInfoFlags::kDebugInfoNone
+                                         : DebugInfoFlags::kDebugInfoAll);
 
     // Load the binary module.
     auto module = std::make_unique<xe::cpu::RawModule>(processor_.get());
@@ -268,7 +273,8 @@ class TestRunner {
     bool result = CheckTestResults(test_case);
     if (!result) {
       // Also dump all disasm/etc.
-      if (fn->is_guest()) {
+      if (fn->is_guest() &&
+          static_cast<xe::cpu::GuestFunction*>(fn)->debug_info()) {
         static_cast<xe::cpu::GuestFunction*>(fn)->debug_info()->Dump();
       }
     }
@@ -369,6 +375,7 @@ class TestRunner {
   }
 
   size_t memory_size_;
+  bool inline_leaf_functions_;
   std::unique_ptr<Memory> memory_;
   std::unique_ptr<Processor> processor_;
   std::unique_ptr<ThreadState> thread_state_;
@@ -420,6 +427,21 @@ void ProtectedRunTest(TestSuite& test_suite, TestRunner& runner,
 #endif  // XE_COMPILER_MSVC
 }
 
+void RunTestSuites(std::vector<TestSuite>& test_suites, TestRunner& runner,
+                   int& failed_count, int& passed_count) {
+  for (auto& test_suite : test_suites) {
+    XELOGI("{}.s:", test_suite.name());
+
+    for (auto& test_case : test_suite.test_cases()) {
+      XELOGI("  - {}", test_case.name);
+      ProtectedRunTest(test_suite, runner, test_case, failed_count,
+                       passed_count);
+    }
+
+    XELOGI("");
+  }
+}
+
 bool RunTests(const std::string_view test_name) {
   int result_code = 1;
   int failed_count = 0;
@@ -460,17 +482,26 @@ bool RunTests(const std::string_view test_name) {
   }
 
   XELOGI("{} tests loaded.", test_suites.size());
-  TestRunner runner;
-  for (auto& test_suite : test_suites) {
-    XELOGI("{}.s:", test_suite.name());
+  {
+    TestRunner runner;
+    RunTestSuites(test_suites, runner, failed_count, passed_count);
+  }
 
-    for (auto& test_case : test_suite.test_cases()) {
-      XELOGI("  - {}", test_case.name);
-      ProtectedRunTest(test_suite, runner, test_case, failed_count,
-                       passed_count);
+  // Leaf function inlining is disabled by default and with debug info, run
+  // everything again with it forced on, in the optimized tier right away.
+  XELOGI("With leaf functions inlined:");
+  XELOGI("");
+  {
+    uint32_t old_inline_max_instructions = cvars::inline_max_instructions;
+    bool old_tiered_compilation = cvars::tiered_compilation;
+    if (!cvars::inline_max_instructions) {
+      cvars::inline_max_instructions = 16;
     }
-
-    XELOGI("");
+    cvars::tiered_compilation = false;
+    TestRunner runner(true);
+    RunTestSuites(test_suites, runner, failed_count, passed_count);
+    cvars::inline_max_instructions = old_inline_max_instructions;
+    cvars::tiered_compilation = old_tiered_compilation;
   }
 
   XELOGI("");
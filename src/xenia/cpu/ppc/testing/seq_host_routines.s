@@ -0,0 +1,103 @@
+test_host_routines_1:
+  # memcpy with pointers advanced after the accesses.
+  #_ MEMORY_IN 10001050 01 02 03 04 05 06 07 08
+  #_ MEMORY_IN 10001060 00 00 00 00 00 00 00 00
+  #_ REGISTER_IN r3 0x10001060
+  #_ REGISTER_IN r4 0x10001050
+  #_ REGISTER_IN r5 6
+  cmplwi cr6, r5, 0
+  beqlr cr6
+  mtctr r5
+  mr r11, r3
+host_routines_1_loop:
+  lbz r10, 0(r4)
+  addi r4, r4, 1
+  stb r10, 0(r11)
+  addi r11, r11, 1
+  bdnz host_routines_1_loop
+  blr
+  #_ REGISTER_OUT r3 0x10001060
+  #_ MEMORY_OUT 10001060 01 02 03 04 05 06 00 00
+
+test_host_routines_2:
+  # memcpy with update forms, to a destination overlapping the source, which
+  # repeats the first byte.
+  #_ MEMORY_IN 10001050 01 02 03 04 05 06 07 08
+  #_ REGISTER_IN r3 0x10001051
+  #_ REGISTER_IN r4 0x10001050
+  #_ REGISTER_IN r5 4
+  cmplwi cr6, r5, 0
+  beqlr cr6
+  mtctr r5
+  addi r11, r3, -1
+  addi r4, r4, -1
+host_routines_2_loop:
+  lbzu r10, 1(r4)
+  stbu r10, 1(r11)
+  bdnz host_routines_2_loop
+  blr
+  #_ REGISTER_OUT r3 0x10001051
+  #_ MEMORY_OUT 10001050 01 01 01 01 01 06 07 08
+
+test_host_routines_3:
+  # memset.
+  #_ MEMORY_IN 10001050 01 02 03 04 05 06 07 08
+  #_ REGISTER_IN r3 0x10001051
+  #_ REGISTER_IN r4 0x12345678AB
+  #_ REGISTER_IN r5 5
+  cmplwi cr6, r5, 0
+  beqlr cr6
+  mtctr r5
+  mr r11, r3
+host_routines_3_loop:
+  stb r4, 0(r11)
+  addi r11, r11, 1
+  bdnz host_routines_3_loop
+  blr
+  #_ REGISTER_OUT r3 0x10001051
+  #_ MEMORY_OUT 10001050 01 AB AB AB AB AB 07 08
+
+test_host_routines_4:
+  # memset with nothing to set.
+  #_ MEMORY_IN 10001050 01 02 03 04
+  #_ REGISTER_IN r3 0x10001050
+  #_ REGISTER_IN r4 0xFF
+  #_ REGISTER_IN r5 0
+  cmplwi cr6, r5, 0
+  beqlr cr6
+  mtctr r5
+  addi r11, r3, -1
+host_routines_4_loop:
+  stbu r4, 1(r11)
+  bdnz host_routines_4_loop
+  blr
+  #_ REGISTER_OUT r3 0x10001050
+  #_ MEMORY_OUT 10001050 01 02 03 04
+
+test_host_routines_5:
+  # strlen.
+  #_ MEMORY_IN 10001050 48 65 6C 6C 6F 00 21 00
+  #_ REGISTER_IN r3 0x10001050
+  mr r11, r3
+host_routines_5_loop:
+  lbz r10, 0(r11)
+  addi r11, r11, 1
+  cmplwi cr6, r10, 0
+  bne cr6, host_routines_5_loop
+  subf r3, r3, r11
+  addi r3, r3, -1
+  blr
+  #_ REGISTER_OUT r3 5
+
+test_host_routines_6:
+  # strlen with the update form, of an empty string.
+  #_ MEMORY_IN 10001050 00 41 00
+  #_ REGISTER_IN r3 0x10001050
+  addi r11, r3, -1
+host_routines_6_loop:
+  lbzu r10, 1(r11)
+  cmplwi cr6, r10, 0
+  bne cr6, host_routines_6_loop
+  subf r3, r3, r11
+  blr
+  #_ REGISTER_OUT r3 0
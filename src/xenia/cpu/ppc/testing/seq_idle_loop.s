@@ -0,0 +1,21 @@
+test_idle_loop_1:
+  # Spin-wait on a flag that's already set.
+  #_ MEMORY_IN 10001050 00000001
+  #_ REGISTER_IN r3 0x10001050
+idle_loop_1_wait:
+  lwz r4, 0(r3)
+  cmpwi r4, 0
+  beq idle_loop_1_wait
+  blr
+  #_ REGISTER_OUT r3 0x10001050
+  #_ REGISTER_OUT r4 1
+
+test_idle_loop_2:
+  # Counting loop, which is not idle.
+  li r3, 0
+idle_loop_2_loop:
+  addi r3, r3, 1
+  cmpwi r3, 100
+  blt idle_loop_2_loop
+  blr
+  #_ REGISTER_OUT r3 100
@@ -0,0 +1,55 @@
+leaf_add:
+  add r3, r3, r4
+  blr
+
+leaf_conditional_return:
+  cmpwi r3, 0
+  beqlr
+  addi r3, r3, 100
+  blr
+
+leaf_forward_branch:
+  cmplwi r3, 10
+  bgt leaf_forward_branch_big
+  li r5, 1
+  b leaf_forward_branch_done
+leaf_forward_branch_big:
+  li r5, 2
+leaf_forward_branch_done:
+  blr
+
+test_inline_leaf_1:
+  #_ REGISTER_IN r3 5
+  #_ REGISTER_IN r4 7
+  mfspr r12, lr
+  bl leaf_add
+  bl leaf_add
+  mtspr lr, r12
+  blr
+  #_ REGISTER_OUT r3 19
+  #_ REGISTER_OUT r4 7
+
+test_inline_leaf_2:
+  #_ REGISTER_IN r3 0
+  mfspr r12, lr
+  bl leaf_conditional_return
+  mr r6, r3
+  li r3, 5
+  bl leaf_conditional_return
+  mtspr lr, r12
+  blr
+  #_ REGISTER_OUT r3 105
+  #_ REGISTER_OUT r6 0
+
+test_inline_leaf_3:
+  #_ REGISTER_IN r3 3
+  mfspr r12, lr
+  bl leaf_forward_branch
+  mr r6, r5
+  li r3, 11
+  bl leaf_forward_branch
+  mtspr lr, r12
+  blr
+  #_ REGISTER_OUT r3 11
+  #_ REGISTER_OUT r5 2
+  #_ REGISTER_OUT r6 1
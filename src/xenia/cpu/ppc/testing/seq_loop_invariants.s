@@ -0,0 +1,58 @@
+test_loop_invariants_1:
+  # Address computed from a register not modified in the loop, and a
+  # multiplication of the index.
+  #_ MEMORY_IN 10001050 01 02 03 04
+  #_ REGISTER_IN r3 0
+  #_ REGISTER_IN r4 0x10001000
+  #_ REGISTER_IN r5 4
+  #_ REGISTER_IN r6 0
+  mtspr ctr, r5
+loop_invariants_1_loop:
+  addi r7, r4, 0x50
+  lbzx r9, r7, r6
+  add r3, r3, r9
+  mulli r8, r6, 12
+  add r3, r3, r8
+  addi r6, r6, 1
+  bdnz loop_invariants_1_loop
+  blr
+  #_ REGISTER_OUT r3 82
+  #_ REGISTER_OUT r4 0x10001000
+  #_ REGISTER_OUT r6 4
+  #_ REGISTER_OUT r7 0x10001050
+  #_ REGISTER_OUT r8 36
+  #_ REGISTER_OUT r9 4
+
+test_loop_invariants_2:
+  # Index stepped down, multiplied before and after stepping it.
+  #_ REGISTER_IN r3 0
+  #_ REGISTER_IN r6 6
+  li r9, 0
+loop_invariants_2_loop:
+  mulli r8, r6, -3
+  subi r6, r6, 2
+  mulli r9, r6, 5
+  add r3, r3, r8
+  add r3, r3, r9
+  cmpwi r6, 0
+  bgt loop_invariants_2_loop
+  blr
+  #_ REGISTER_OUT r3 0xFFFFFFFFFFFFFFFA
+  #_ REGISTER_OUT r6 0
+  #_ REGISTER_OUT r8 0xFFFFFFFFFFFFFFFA
+  #_ REGISTER_OUT r9 0
+
+test_loop_invariants_3:
+  # Splat of a vector register not modified in the loop.
+  #_ REGISTER_IN v3 [00000001, 00000002, 00000003, 00000004]
+  #_ REGISTER_IN v4 [00000000, 00000000, 00000000, 00000000]
+  li r5, 3
+  mtspr ctr, r5
+loop_invariants_3_loop:
+  vspltw v5, v3, 1
+  vadduwm v4, v4, v5
+  bdnz loop_invariants_3_loop
+  blr
+  #_ REGISTER_OUT v3 [00000001, 00000002, 00000003, 00000004]
+  #_ REGISTER_OUT v4 [00000006, 00000006, 00000006, 00000006]
+  #_ REGISTER_OUT v5 [00000002, 00000002, 00000002, 00000002]
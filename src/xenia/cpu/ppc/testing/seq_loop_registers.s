@@ -0,0 +1,97 @@
+test_loop_registers_1:
+  # Counted loop, registers carried around the back-edge.
+  #_ REGISTER_IN r3 0
+  #_ REGISTER_IN r4 1
+  li r5, 10
+  mtspr ctr, r5
+loop_registers_1_loop:
+  add r3, r3, r4
+  addi r4, r4, 1
+  bdnz loop_registers_1_loop
+  blr
+  #_ REGISTER_OUT r3 55
+  #_ REGISTER_OUT r4 11
+  #_ REGISTER_OUT r5 10
+
+test_loop_registers_2:
+  # Leaving the loop from the middle.
+  #_ REGISTER_IN r3 0
+  #_ REGISTER_IN r4 100
+  li r5, 0
+loop_registers_2_loop:
+  addi r3, r3, 3
+  cmpwi r3, 20
+  bgt loop_registers_2_done
+  addi r5, r5, 1
+  cmpw r5, r4
+  blt loop_registers_2_loop
+loop_registers_2_done:
+  blr
+  #_ REGISTER_OUT r3 21
+  #_ REGISTER_OUT r4 100
+  #_ REGISTER_OUT r5 6
+
+test_loop_registers_3:
+  # Nested loops.
+  li r3, 0
+  li r5, 4
+loop_registers_3_outer:
+  li r6, 5
+loop_registers_3_inner:
+  addi r3, r3, 2
+  addi r6, r6, -1
+  cmpwi r6, 0
+  bne loop_registers_3_inner
+  addi r5, r5, -1
+  cmpwi r5, 0
+  bne loop_registers_3_outer
+  blr
+  #_ REGISTER_OUT r3 40
+  #_ REGISTER_OUT r5 0
+  #_ REGISTER_OUT r6 0
+
+test_loop_registers_4:
+  # Register only modified on some iterations.
+  #_ REGISTER_IN r3 7
+  li r4, 0
+  li r5, 6
+loop_registers_4_loop:
+  andi. r6, r5, 1
+  beq loop_registers_4_skip
+  addi r3, r3, 10
+loop_registers_4_skip:
+  addi r4, r4, 1
+  addi r5, r5, -1
+  cmpwi r5, 0
+  bne loop_registers_4_loop
+  blr
+  #_ REGISTER_OUT r3 37
+  #_ REGISTER_OUT r4 6
+  #_ REGISTER_OUT r5 0
+  #_ REGISTER_OUT r6 1
+
+test_loop_registers_5:
+  # Floating-point accumulator.
+  #_ REGISTER_IN f1 0.0
+  #_ REGISTER_IN f2 1.5
+  li r5, 4
+  mtspr ctr, r5
+loop_registers_5_loop:
+  fadd f1, f1, f2
+  bdnz loop_registers_5_loop
+  blr
+  #_ REGISTER_OUT f1 6.0
+  #_ REGISTER_OUT f2 1.5
+
+test_loop_registers_6:
+  # Vector accumulator.
+  #_ REGISTER_IN v3 [00000001, 00000002, 00000003, 00000004]
+  #_ REGISTER_IN v4 [00000000, 00000000, 00000000, 00000000]
+  li r5, 3
+  mtspr ctr, r5
+loop_registers_6_loop:
+  vadduwm v4, v4, v3
+  bdnz loop_registers_6_loop
+  blr
+  #_ REGISTER_OUT v3 [00000001, 00000002, 00000003, 00000004]
+  #_ REGISTER_OUT v4 [00000003, 00000006, 00000009, 0000000C]
@@ -0,0 +1,78 @@
+# A float operation leaves the FPU MXCSR mode set, and the branch target needs
+# the VMX mode, which is switched to before the compare fused with the branch.
+# The switch changes the x86 flags, so the flags of the preceding compare of
+# the same values must not be reused for the unsigned branch.
+
+test_mxcsr_compare_1:
+  #_ REGISTER_IN r3 0xFFFFFFFF
+  #_ REGISTER_IN r4 2
+  #_ REGISTER_IN f1 1.0
+  #_ REGISTER_IN f2 2.0
+  #_ REGISTER_IN v3 [41200000, C1200000, 41700000, C1700000]
+  #_ REGISTER_IN v4 [C1200000, 41A00000, C1A00000, 41F00000]
+  li r5, 0
+  fadd f1, f1, f2
+  cmplw cr1, r3, r4
+  cmplw cr6, r3, r4
+  bgt cr6, mxcsr_compare_1_vmx
+  blr
+mxcsr_compare_1_vmx:
+  vaddfp v3, v3, v4
+  li r5, 1
+  blr
+  #_ REGISTER_OUT r3 0xFFFFFFFF
+  #_ REGISTER_OUT r4 2
+  #_ REGISTER_OUT r5 1
+  #_ REGISTER_OUT f1 3.0
+  #_ REGISTER_OUT f2 2.0
+  #_ REGISTER_OUT v3 [00000000, 41200000, C0A00000, 41700000]
+  #_ REGISTER_OUT v4 [C1200000, 41A00000, C1A00000, 41F00000]
+
+test_mxcsr_compare_2:
+  #_ REGISTER_IN r3 1
+  #_ REGISTER_IN r4 2
+  #_ REGISTER_IN f1 1.0
+  #_ REGISTER_IN f2 2.0
+  #_ REGISTER_IN v3 [41200000, C1200000, 41700000, C1700000]
+  #_ REGISTER_IN v4 [C1200000, 41A00000, C1A00000, 41F00000]
+  li r5, 0
+  fadd f1, f1, f2
+  cmplw cr1, r3, r4
+  cmplw cr6, r3, r4
+  bgt cr6, mxcsr_compare_2_vmx
+  blr
+mxcsr_compare_2_vmx:
+  vaddfp v3, v3, v4
+  li r5, 1
+  blr
+  #_ REGISTER_OUT r3 1
+  #_ REGISTER_OUT r4 2
+  #_ REGISTER_OUT r5 0
+  #_ REGISTER_OUT f1 3.0
+  #_ REGISTER_OUT f2 2.0
+  #_ REGISTER_OUT v3 [41200000, C1200000, 41700000, C1700000]
+  #_ REGISTER_OUT v4 [C1200000, 41A00000, C1A00000, 41F00000]
+
+test_mxcsr_compare_3:
+  #_ REGISTER_IN r3 1
+  #_ REGISTER_IN r4 0xFFFFFFFF
+  #_ REGISTER_IN f1 1.0
+  #_ REGISTER_IN f2 2.0
+  #_ REGISTER_IN v3 [41200000, C1200000, 41700000, C1700000]
+  #_ REGISTER_IN v4 [C1200000, 41A00000, C1A00000, 41F00000]
+  li r5, 0
+  fadd f1, f1, f2
+  cmplw cr6, r3, r4
+  blt cr6, mxcsr_compare_3_vmx
+  blr
+mxcsr_compare_3_vmx:
+  vaddfp v3, v3, v4
+  li r5, 1
+  blr
+  #_ REGISTER_OUT r3 1
+  #_ REGISTER_OUT r4 0xFFFFFFFF
+  #_ REGISTER_OUT r5 1
+  #_ REGISTER_OUT f1 3.0
+  #_ REGISTER_OUT f2 2.0
+  #_ REGISTER_OUT v3 [00000000, 41200000, C0A00000, 41700000]
+  #_ REGISTER_OUT v4 [C1200000, 41A00000, C1A00000, 41F00000]
@@ -0,0 +1,110 @@
+test_reserved_ops_1:
+  # Atomic increment.
+  #_ MEMORY_IN 10001050 00000005
+  #_ REGISTER_IN r3 0x10001050
+reserved_ops_1_retry:
+  lwarx r4, 0, r3
+  addi r4, r4, 1
+  stwcx. r4, 0, r3
+  bne reserved_ops_1_retry
+  blr
+  #_ REGISTER_OUT r3 0x10001050
+  #_ REGISTER_OUT r4 6
+  #_ MEMORY_OUT 10001050 00000006
+
+test_reserved_ops_2:
+  # Atomic add to another register, wrapping around.
+  #_ MEMORY_IN 10001050 00000001
+  #_ REGISTER_IN r3 0x10001050
+  #_ REGISTER_IN r6 0xFFFFFFFFFFFFFFFE
+reserved_ops_2_retry:
+  lwarx r4, 0, r3
+  add r5, r4, r6
+  stwcx. r5, 0, r3
+  bne reserved_ops_2_retry
+  blr
+  #_ REGISTER_OUT r3 0x10001050
+  #_ REGISTER_OUT r4 1
+  #_ REGISTER_OUT r5 0xFFFFFFFFFFFFFFFF
+  #_ REGISTER_OUT r6 0xFFFFFFFFFFFFFFFE
+  #_ MEMORY_OUT 10001050 FFFFFFFF
+
+test_reserved_ops_3:
+  # Atomic exchange.
+  #_ MEMORY_IN 10001050 CAFEBABE
+  #_ REGISTER_IN r3 0x10001050
+  #_ REGISTER_IN r5 0x12345678
+reserved_ops_3_retry:
+  lwarx r4, 0, r3
+  stwcx. r5, 0, r3
+  bne reserved_ops_3_retry
+  blr
+  #_ REGISTER_OUT r3 0x10001050
+  #_ REGISTER_OUT r4 0xCAFEBABE
+  #_ REGISTER_OUT r5 0x12345678
+  #_ MEMORY_OUT 10001050 12345678
+
+test_reserved_ops_4:
+  # Spinlock acquisition of a free lock.
+  #_ MEMORY_IN 10001050 00000000
+  #_ REGISTER_IN r3 0x10001050
+  li r5, 1
+  li r6, 0
+reserved_ops_4_retry:
+  lwarx r4, 0, r3
+  cmpwi r4, 0
+  bne reserved_ops_4_held
+  stwcx. r5, 0, r3
+  bne reserved_ops_4_retry
+  li r6, 1
+reserved_ops_4_held:
+  blr
+  #_ REGISTER_OUT r3 0x10001050
+  #_ REGISTER_OUT r4 0
+  #_ REGISTER_OUT r5 1
+  #_ REGISTER_OUT r6 1
+  #_ MEMORY_OUT 10001050 00000001
+
+test_reserved_ops_5:
+  # Spinlock acquisition of a held lock.
+  #_ MEMORY_IN 10001050 00000001
+  #_ REGISTER_IN r3 0x10001050
+  li r5, 1
+  li r6, 0
+reserved_ops_5_retry:
+  lwarx r4, 0, r3
+  cmpwi r4, 0
+  bne reserved_ops_5_held
+  stwcx. r5, 0, r3
+  bne reserved_ops_5_retry
+  li r6, 1
+reserved_ops_5_held:
+  blr
+  #_ REGISTER_OUT r3 0x10001050
+  #_ REGISTER_OUT r4 1
+  #_ REGISTER_OUT r5 1
+  #_ REGISTER_OUT r6 0
+  #_ MEMORY_OUT 10001050 00000001
+
+test_reserved_ops_6:
+  # Compare-and-store with the expected value in a register.
+  #_ MEMORY_IN 10001050 80000000
+  #_ REGISTER_IN r3 0x10001050
+  #_ REGISTER_IN r5 0x00000042
+  #_ REGISTER_IN r7 0x80000000
+  li r6, 0
+reserved_ops_6_retry:
+  lwarx r4, 0, r3
+  cmplw cr7, r4, r7
+  bne cr7, reserved_ops_6_changed
+  stwcx. r5, 0, r3
+  bne reserved_ops_6_retry
+  li r6, 1
+reserved_ops_6_changed:
+  blr
+  #_ REGISTER_OUT r3 0x10001050
+  #_ REGISTER_OUT r4 0x80000000
+  #_ REGISTER_OUT r5 0x00000042
+  #_ REGISTER_OUT r6 1
+  #_ REGISTER_OUT r7 0x80000000
+  #_ MEMORY_OUT 10001050 00000042
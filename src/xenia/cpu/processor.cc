@@ -9,6 +9,8 @@
 
 #include "xenia/cpu/processor.h"
 
+#include <algorithm>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/atomic.h"
 #include "xenia/base/byte_order.h"
@@ -48,6 +50,15 @@ DEFINE_path(trace_function_data_path, "", "File to write trace data to.",
             "CPU");
 DEFINE_bool(break_on_start, false, "Break into the debugger on startup.",
             "CPU");
+DEFINE_path(guest_profile_path, "",
+            "If not empty, periodically sample the call stacks of the running "
+            "guest threads, and write them on exit to this file as folded "
+            "stacks for making flame graphs.",
+            "CPU");
+DEFINE_uint32(guest_profile_interval_us, 1000,
+              "Microseconds between samples of the guest threads with "
+              "guest_profile_path.",
+              "CPU");
 
 namespace xe {
 namespace kernel {
@@ -86,9 +97,36 @@ Processor::Processor(xe::Memory* memory, ExportResolver* export_resolver)
     : memory_(memory), export_resolver_(export_resolver) {}
 
 Processor::~Processor() {
+  // The profile is symbolized with the functions, so it's written while they
+  // still exist.
+  if (sampling_profiler_thread_) {
+    {
+      std::lock_guard<xe_mutex> lock(sampling_profiler_lock_);
+      sampling_profiler_shutdown_ = true;
+    }
+    sampling_profiler_cond_.notify_all();
+    xe::threading::Wait(sampling_profiler_thread_.get(), false);
+    sampling_profiler_thread_.reset();
+    auto global_lock = global_critical_region_.Acquire();
+    sampling_profiler_->Write(cvars::guest_profile_path);
+  }
+
+  // Stop retranslating before the functions are destroyed with the modules.
+  if (tier_up_thread_) {
+    {
+      std::lock_guard<xe_mutex> lock(tier_up_lock_);
+      tier_up_shutdown_ = true;
+    }
+    tier_up_cond_.notify_all();
+    xe::threading::Wait(tier_up_thread_.get(), false);
+    tier_up_thread_.reset();
+  }
+
   {
     auto global_lock = global_critical_region_.Acquire();
     modules_.clear();
+    PublishModuleSnapshot();
+    removed_modules_.clear();
   }
 
   frontend_.reset();
@@ -112,7 +150,11 @@ bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
 
   std::unique_ptr<Module> builtin_module(new BuiltinModule(this));
   builtin_module_ = builtin_module.get();
-  modules_.push_back(std::move(builtin_module));
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    modules_.push_back(std::move(builtin_module));
+    PublishModuleSnapshot();
+  }
 
   if (frontend_ || backend_) {
     return false;
@@ -131,6 +173,16 @@ bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
   backend_ = std::move(backend);
   frontend_ = std::move(frontend);
 
+  if (cvars::tiered_compilation) {
+    xe::threading::Thread::CreationParameters tier_up_thread_params;
+    tier_up_thread_params.initial_priority =
+        xe::threading::ThreadPriority::kBelowNormal;
+    tier_up_thread_ = xe::threading::Thread::Create(
+        tier_up_thread_params, [this]() { TierUpThread(); });
+    assert_not_null(tier_up_thread_);
+    tier_up_thread_->set_name("Function Tier-Up");
+  }
+
   // Stack walker is used when profiling, debugging, and dumping.
   // Note that creation may fail, in which case we'll have to disable those
   // features.
@@ -147,6 +199,23 @@ bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
     }
   }
 
+  if (!cvars::guest_profile_path.empty()) {
+    if (stack_walker_) {
+      sampling_profiler_ = std::make_unique<SamplingProfiler>(code_cache);
+      // Above the guest threads, so the samples are taken on time.
+      xe::threading::Thread::CreationParameters sampling_profiler_thread_params;
+      sampling_profiler_thread_params.initial_priority =
+          xe::threading::ThreadPriority::kAboveNormal;
+      sampling_profiler_thread_ = xe::threading::Thread::Create(
+          sampling_profiler_thread_params,
+          [this]() { SamplingProfilerThread(); });
+      assert_not_null(sampling_profiler_thread_);
+      sampling_profiler_thread_->set_name("Guest Sampling Profiler");
+    } else {
+      XELOGW("Disabling guest profiling due to lack of stack walker");
+    }
+  }
+
   // Open the trace data path, if requested.
   functions_trace_path_ = cvars::trace_function_data_path;
   if (!functions_trace_path_.empty()) {
@@ -172,23 +241,38 @@ void Processor::PreLaunch() {
 bool Processor::AddModule(std::unique_ptr<Module> module) {
   auto global_lock = global_critical_region_.Acquire();
   modules_.push_back(std::move(module));
+  PublishModuleSnapshot();
   return true;
 }
 
+void Processor::PublishModuleSnapshot() {
+  auto snapshot = std::make_unique<std::vector<Module*>>();
+  snapshot->reserve(modules_.size());
+  for (const auto& module : modules_) {
+    snapshot->push_back(module.get());
+  }
+  module_snapshot_.store(snapshot.get(), std::memory_order_release);
+  module_snapshots_.push_back(std::move(snapshot));
+}
+
 void Processor::RemoveModule(const std::string_view name) {
   auto global_lock = global_critical_region_.Acquire();
 
   auto itr =
-      std::find_if(modules_.cbegin(), modules_.cend(),
+      std::find_if(modules_.begin(), modules_.end(),
                    [name](std::unique_ptr<xe::cpu::Module> const& module) {
                      return module->name() == name;
                    });
 
-  if (itr != modules_.cend()) {
+  if (itr != modules_.end()) {
     const std::vector<uint32_t> addressed_functions =
         (*itr)->GetAddressedFunctions();
 
+    // LookupModule may still be accessing the module without locking, so
+    // keep it alive.
+    removed_modules_.push_back(std::move(*itr));
     modules_.erase(itr);
+    PublishModuleSnapshot();
 
     for (const uint32_t entry : addressed_functions) {
       RemoveFunctionByAddress(entry);
@@ -247,9 +331,11 @@ std::vector<Function*> Processor::FindFunctionsWithAddress(uint32_t address) {
 
 void Processor::RemoveFunctionByAddress(uint32_t address) {
   entry_table_.Delete(address);
+  backend_->UnlinkGuestFunction(address);
 }
 
-Function* Processor::ResolveFunction(uint32_t address) {
+Function* Processor::ResolveFunction(uint32_t address,
+                                     bool record_resolution) {
   Entry* entry;
   Entry::Status status = entry_table_.GetOrCreate(address, &entry);
   if (status == Entry::STATUS_NEW) {
@@ -267,22 +353,21 @@ Function* Processor::ResolveFunction(uint32_t address) {
       entry->status = Entry::STATUS_FAILED;
       return nullptr;
     }
-    //only add it to the list of resolved functions if resolving succeeded
-    auto module_for = function->module();
-
-    auto xexmod = dynamic_cast<XexModule*>(module_for);
-    if (xexmod) {
-      auto addr_flags = xexmod->GetInstructionAddressFlags(address);
-      if (addr_flags) {
-        addr_flags->was_resolved = 1;
-      }
-    }
-
     entry->function = function;
     entry->end_address = function->end_address();
+    // Only add it to the list of resolved functions if resolving succeeded.
+    if (record_resolution) {
+      RecordFunctionResolution(entry);
+    }
     status = entry->status = Entry::STATUS_READY;
   }
   if (status == Entry::STATUS_READY) {
+    // Functions precompiled speculatively are already ready when the guest
+    // first reaches them.
+    if (record_resolution &&
+        !entry->resolution_recorded.load(std::memory_order_relaxed)) {
+      RecordFunctionResolution(entry);
+    }
     // Ready to use.
     return entry->function;
   } else {
@@ -290,13 +375,214 @@ Function* Processor::ResolveFunction(uint32_t address) {
     return nullptr;
   }
 }
-Module* Processor::LookupModule(uint32_t address) {
+void Processor::RecordFunctionResolution(Entry* entry) {
+  if (entry->resolution_recorded.exchange(true, std::memory_order_relaxed)) {
+    return;
+  }
+  auto xexmod = dynamic_cast<XexModule*>(entry->function->module());
+  if (!xexmod) {
+    return;
+  }
+  auto addr_flags = xexmod->GetInstructionAddressFlags(entry->address);
+  if (addr_flags) {
+    addr_flags->was_resolved = 1;
+    if (addr_flags->resolve_count != 0xFF) {
+      ++addr_flags->resolve_count;
+    }
+  }
+}
+
+void Processor::RequestFunctionTierUp(GuestFunction* function) {
+  // Calls from the guest code linked to a precompiled function don't go
+  // through ResolveFunction, but being called often enough to be retranslated
+  // means the guest has reached it.
+  Entry* entry = entry_table_.Get(function->address());
+  if (entry && !entry->resolution_recorded.load(std::memory_order_relaxed)) {
+    RecordFunctionResolution(entry);
+  }
+  if (!tier_up_thread_ || !function->BeginTierUp()) {
+    return;
+  }
+  {
+    std::lock_guard<xe_mutex> lock(tier_up_lock_);
+    tier_up_queue_.push_back(function);
+  }
+  tier_up_cond_.notify_one();
+}
+
+void Processor::TierUpThread() {
+  while (true) {
+    GuestFunction* function;
+    {
+      std::unique_lock<xe_mutex> lock(tier_up_lock_);
+      tier_up_cond_.wait(lock, [this]() {
+        return tier_up_shutdown_ || !tier_up_queue_.empty();
+      });
+      if (tier_up_shutdown_) {
+        return;
+      }
+      function = tier_up_queue_.front();
+      tier_up_queue_.pop_front();
+    }
+    // Guest threads keep running the baseline code until the new code is
+    // placed in the indirection table. The new code and its source map are
+    // published as a new version of the function's code, and the baseline one
+    // stays valid for the threads still executing it.
+    if (!frontend_->DefineFunction(function, debug_info_flags_)) {
+      XELOGE("Failed to retranslate hot function {:08X}", function->address());
+    }
+  }
+}
+
+void Processor::SamplingProfilerThread() {
+  auto interval = std::chrono::microseconds(
+      std::max(cvars::guest_profile_interval_us, uint32_t(1)));
+  while (true) {
+    {
+      std::unique_lock<xe_mutex> lock(sampling_profiler_lock_);
+      if (sampling_profiler_cond_.wait_for(lock, interval, [this]() {
+            return sampling_profiler_shutdown_;
+          })) {
+        return;
+      }
+    }
+    SampleGuestThreads();
+  }
+}
+
+void Processor::SampleGuestThreads() {
+  size_t sampled_thread_count = 0;
+  std::unique_lock<xe_mutex> sampled_threads_lock(sampled_threads_lock_);
+  {
+    // Skipping a sample is better than adding to the contention of the global
+    // lock at the sampling rate.
+    auto global_lock = global_critical_region_.TryAcquire();
+    if (!global_lock.owns_lock()) {
+      return;
+    }
+    for (auto& it : thread_debug_infos_) {
+      auto thread_info = it.second.get();
+      auto thread = thread_info->thread;
+      // Threads waiting aren't using the CPU, and the ones suspended by the
+      // debugger must stay where they are.
+      if (!thread || thread_info->state != ThreadDebugInfo::State::kAlive ||
+          thread_info->suspended || !thread->can_debugger_suspend()) {
+        continue;
+      }
+      if (sampled_thread_count >= sampled_threads_.size()) {
+        sampled_threads_.emplace_back();
+        sampled_threads_.back().stack_snapshot.stack.resize(64 * 1024);
+      }
+      SampledThread& sampled_thread = sampled_threads_[sampled_thread_count++];
+      sampled_thread.thread = thread;
+      sampled_thread.thread_name = thread->thread_name();
+    }
+  }
+
+  // Only copying the registers and the stack while the thread is suspended, so
+  // nothing that may need a lock held by the thread is done before resuming.
+  for (size_t i = 0; i < sampled_thread_count; ++i) {
+    SampledThread& sampled_thread = sampled_threads_[i];
+    xe::threading::Thread* host_thread = sampled_thread.thread->thread();
+    sampled_thread.captured = false;
+    if (!host_thread->Suspend(nullptr)) {
+      continue;
+    }
+    sampled_thread.captured = stack_walker_->CaptureStackSnapshot(
+        host_thread->native_handle(), &sampled_thread.stack_snapshot);
+    host_thread->Resume();
+  }
+  sampled_threads_lock.unlock();
+  if (!sampled_thread_count) {
+    return;
+  }
+
+  for (size_t i = 0; i < sampled_thread_count; ++i) {
+    SampledThread& sampled_thread = sampled_threads_[i];
+    sampled_thread.frame_count =
+        sampled_thread.captured
+            ? stack_walker_->WalkStackSnapshot(
+                  sampled_thread.stack_snapshot, sampled_thread.frame_host_pcs,
+                  xe::countof(sampled_thread.frame_host_pcs))
+            : 0;
+  }
+
+  // Once for all the threads, the code cache must not change while the host
+  // PCs are being resolved.
   auto global_lock = global_critical_region_.Acquire();
+  for (size_t i = 0; i < sampled_thread_count; ++i) {
+    const SampledThread& sampled_thread = sampled_threads_[i];
+    if (sampled_thread.frame_count) {
+      sampling_profiler_->AddSample(sampled_thread.thread_name,
+                                    sampled_thread.frame_host_pcs,
+                                    sampled_thread.frame_count);
+    }
+  }
+}
+
+bool Processor::CanInlineFunction(uint32_t address, uint32_t end_address) {
+  if (!guest_breakpoint_count_.load(std::memory_order_acquire)) {
+    return true;
+  }
+  auto global_lock = global_critical_region_.Acquire();
+  for (auto breakpoint : breakpoints_) {
+    if (breakpoint->address_type() == Breakpoint::AddressType::kGuest &&
+        breakpoint->guest_address() >= address &&
+        breakpoint->guest_address() <= end_address) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Processor::SetInlinedFunctions(
+    GuestFunction* function,
+    const std::vector<GuestFunction::InlinedFunction>& inlined_functions) {
+  std::lock_guard<xe_mutex> lock(inlining_lock_);
+  if (inlined_functions.empty()) {
+    inlining_functions_.erase(function);
+  } else {
+    inlining_functions_.insert(function);
+  }
+  function->set_inlined_functions(inlined_functions);
+}
+
+void Processor::InvalidateInlinedCode(uint32_t address) {
+  std::vector<GuestFunction*> functions;
+  {
+    std::lock_guard<xe_mutex> lock(inlining_lock_);
+    for (GuestFunction* function : inlining_functions_) {
+      for (const auto& inlined_function : function->inlined_functions()) {
+        if (address >= inlined_function.address &&
+            address <= inlined_function.end_address) {
+          functions.push_back(function);
+          break;
+        }
+      }
+    }
+  }
+  // Threads already running the old code finish with it, new calls go through
+  // the indirection table to the new code.
+  for (GuestFunction* function : functions) {
+    if (!frontend_->DefineFunction(function, debug_info_flags_)) {
+      XELOGE(
+          "Failed to retranslate function {:08X} with inlined code at {:08X}",
+          function->address(), address);
+    }
+  }
+}
+
+Module* Processor::LookupModule(uint32_t address) {
+  const std::vector<Module*>* modules =
+      module_snapshot_.load(std::memory_order_acquire);
+  if (!modules) {
+    return nullptr;
+  }
   // TODO(benvanik): sort by code address (if contiguous) so can bsearch.
   // TODO(benvanik): cache last module low/high, as likely to be in there.
-  for (const auto& module : modules_) {
+  for (Module* module : *modules) {
     if (module->ContainsAddress(address)) {
-      return module.get();
+      return module;
     }
   }
   return nullptr;
@@ -340,8 +626,13 @@ bool Processor::DemandFunction(Function* function) {
   if (symbol_status == Symbol::Status::kNew) {
     // Symbol is undefined, so define now.
     assert_true(function->is_guest());
-    if (!frontend_->DefineFunction(static_cast<GuestFunction*>(function),
-                                   debug_info_flags_)) {
+    auto guest_function = static_cast<GuestFunction*>(function);
+    // Reuse code stored by a previous run if possible, only translating when
+    // there's none.
+    bool loaded_stored =
+        !debug_info_flags_ && backend_->LoadStoredFunction(guest_function);
+    if (!loaded_stored &&
+        !frontend_->DefineFunction(guest_function, debug_info_flags_)) {
       function->set_status(Symbol::Status::kFailed);
       return false;
     }
@@ -498,10 +789,14 @@ void Processor::OnThreadExit(uint32_t thread_id) {
 }
 
 void Processor::OnThreadDestroyed(uint32_t thread_id) {
-  auto global_lock = global_critical_region_.Acquire();
-  auto it = thread_debug_infos_.find(thread_id);
-  assert_true(it != thread_debug_infos_.end());
-  thread_debug_infos_.erase(it);
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    auto it = thread_debug_infos_.find(thread_id);
+    assert_true(it != thread_debug_infos_.end());
+    thread_debug_infos_.erase(it);
+  }
+  // The sampling profiler may have taken the thread before it was removed.
+  std::lock_guard<xe_mutex> sampled_threads_lock(sampled_threads_lock_);
 }
 
 void Processor::OnThreadEnteringWait(uint32_t thread_id) {
@@ -546,6 +841,13 @@ void Processor::AddBreakpoint(Breakpoint* breakpoint) {
   // Add to breakpoints map.
   breakpoints_.push_back(breakpoint);
 
+  // Inlined copies of the code aren't covered by the breakpoint, so the
+  // functions containing them are retranslated without inlining.
+  if (breakpoint->address_type() == Breakpoint::AddressType::kGuest) {
+    ++guest_breakpoint_count_;
+    InvalidateInlinedCode(breakpoint->guest_address());
+  }
+
   if (execution_state_ == ExecutionState::kRunning) {
     breakpoint->Resume();
   }
@@ -562,6 +864,10 @@ void Processor::RemoveBreakpoint(Breakpoint* breakpoint) {
   // Remove from breakpoint map.
   auto it = std::find(breakpoints_.begin(), breakpoints_.end(), breakpoint);
   breakpoints_.erase(it);
+
+  if (breakpoint->address_type() == Breakpoint::AddressType::kGuest) {
+    --guest_breakpoint_count_;
+  }
 }
 
 Breakpoint* Processor::FindBreakpoint(uint32_t address) {
@@ -10,14 +10,19 @@
 #ifndef XENIA_CPU_PROCESSOR_H_
 #define XENIA_CPU_PROCESSOR_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <map>
 #include <memory>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 #include "xenia/base/cvar.h"
 #include "xenia/base/mapped_memory.h"
 #include "xenia/base/mutex.h"
+#include "xenia/base/threading.h"
 #include "xenia/cpu/backend/backend.h"
 #include "xenia/cpu/debug_listener.h"
 #include "xenia/cpu/entry_table.h"
@@ -25,6 +30,8 @@
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/module.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
+#include "xenia/cpu/sampling_profiler.h"
+#include "xenia/cpu/stack_walker.h"
 #include "xenia/cpu/thread_debug_info.h"
 #include "xenia/cpu/thread_state.h"
 #include "xenia/memory.h"
@@ -117,7 +124,23 @@ class Processor {
   Function* LookupFunction(uint32_t address);
   Module* LookupModule(uint32_t address);
   Function* LookupFunction(Module* module, uint32_t address);
-  Function* ResolveFunction(uint32_t address);
+  // record_resolution is whether to remember that the function was needed in
+  // the info cache of the module, false when it's resolved speculatively rather
+  // than because the guest has reached it.
+  Function* ResolveFunction(uint32_t address, bool record_resolution = true);
+  // Queues retranslation of a baseline tier function with all optimizations.
+  void RequestFunctionTierUp(GuestFunction* function);
+
+  // Whether the guest function in the given range may be inlined into its
+  // callers, which is not the case while a breakpoint is set in it.
+  bool CanInlineFunction(uint32_t address, uint32_t end_address);
+  // Records the functions inlined into a function that has been translated.
+  void SetInlinedFunctions(
+      GuestFunction* function,
+      const std::vector<GuestFunction::InlinedFunction>& inlined_functions);
+  // Retranslates the functions containing inlined copies of the guest code at
+  // the given address, so changes to it, such as breakpoints, are picked up.
+  void InvalidateInlinedCode(uint32_t address);
 
   bool Execute(ThreadState* thread_state, uint32_t address);
   bool ExecuteRaw(ThreadState* thread_state, uint32_t address);
@@ -248,6 +271,18 @@ class Processor {
                                          uint32_t current_pc);
 
   bool DemandFunction(Function* function);
+  // Records in the info cache of the module that the guest has reached the
+  // function, once per run.
+  void RecordFunctionResolution(Entry* entry);
+
+  void TierUpThread();
+
+  void SamplingProfilerThread();
+  // Captures the call stacks of the guest threads that are running.
+  void SampleGuestThreads();
+
+  // Must be called with the global lock held whenever modules_ changes.
+  void PublishModuleSnapshot();
 
   Memory* memory_ = nullptr;
   std::unique_ptr<StackWalker> stack_walker_;
@@ -266,9 +301,51 @@ class Processor {
   ExportResolver* export_resolver_ = nullptr;
 
   EntryTable entry_table_;
+
+  // Functions to retranslate with all optimizations with tiered compilation.
+  xe_mutex tier_up_lock_;
+  std::condition_variable_any tier_up_cond_;
+  // Protected with tier_up_lock_, notify_one tier_up_cond_ when changed.
+  std::deque<GuestFunction*> tier_up_queue_;
+  bool tier_up_shutdown_ = false;
+  std::unique_ptr<xe::threading::Thread> tier_up_thread_;
+
+  // Samples the call stacks of the guest threads periodically when profiling.
+  std::unique_ptr<SamplingProfiler> sampling_profiler_;
+  xe_mutex sampling_profiler_lock_;
+  std::condition_variable_any sampling_profiler_cond_;
+  // Protected with sampling_profiler_lock_.
+  bool sampling_profiler_shutdown_ = false;
+  std::unique_ptr<xe::threading::Thread> sampling_profiler_thread_;
+  // Held while the sampled threads are being suspended, so they aren't
+  // destroyed before that's done. Only try-locking the global lock while this
+  // is held, as the threads may be destroyed with it held.
+  xe_mutex sampled_threads_lock_;
+  // Only accessed by the sampling profiler thread, reused between the samples.
+  struct SampledThread {
+    Thread* thread;
+    std::string thread_name;
+    bool captured;
+    StackSnapshot stack_snapshot;
+    size_t frame_count;
+    uint64_t frame_host_pcs[64];
+  };
+  std::vector<SampledThread> sampled_threads_;
+
+  // Functions that have other functions inlined into them.
+  xe_mutex inlining_lock_;
+  std::unordered_set<GuestFunction*> inlining_functions_;
+  // Inlining is disabled for the functions containing these.
+  std::atomic<uint32_t> guest_breakpoint_count_{0};
+
   xe::global_critical_region global_critical_region_;
   ExecutionState execution_state_ = ExecutionState::kPaused;
   std::vector<std::unique_ptr<Module>> modules_;
+  // Copy of modules_ for LookupModule, which doesn't take the global lock.
+  // Replaced copies are kept alive, as lookups may still be iterating them.
+  std::atomic<const std::vector<Module*>*> module_snapshot_{nullptr};
+  std::vector<std::unique_ptr<const std::vector<Module*>>> module_snapshots_;
+  std::vector<std::unique_ptr<Module>> removed_modules_;
   Module* builtin_module_ = nullptr;
   uint32_t next_builtin_address_ = 0xFFFF0000u;
 
@@ -0,0 +1,130 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/sampling_profiler.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "third_party/fmt/include/fmt/format.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/cpu/function.h"
+
+namespace xe {
+namespace cpu {
+
+namespace {
+
+// Semicolons separate the frames and the last space separates the count, and
+// thread names may contain both.
+void AppendFrame(std::string& folded_stack, std::string_view name) {
+  if (!folded_stack.empty()) {
+    folded_stack.push_back(';');
+  }
+  for (char c : name) {
+    folded_stack.push_back((c == ';' || c == '\n') ? '_' : c);
+  }
+}
+
+}  // namespace
+
+SamplingProfiler::SamplingProfiler(backend::CodeCache* code_cache)
+    : code_cache_(code_cache),
+      code_cache_min_(code_cache->execute_base_address()),
+      code_cache_max_(code_cache->execute_base_address() +
+                      code_cache->total_size()) {}
+
+void SamplingProfiler::AddSample(const std::string& thread_name,
+                                 const uint64_t* frame_host_pcs,
+                                 size_t frame_count) {
+  folded_stack_.clear();
+  AppendFrame(folded_stack_, thread_name);
+  GuestFunction* innermost_function = nullptr;
+  uint64_t innermost_host_pc = 0;
+  bool in_host_code = false;
+  for (size_t i = frame_count; i-- > 0;) {
+    uint64_t host_pc = frame_host_pcs[i];
+    GuestFunction* function = nullptr;
+    if (host_pc >= code_cache_min_ && host_pc < code_cache_max_) {
+      function = code_cache_->LookupFunction(host_pc);
+    }
+    if (!function) {
+      // Host frames are not symbolized, as that is too slow to do for every
+      // sample - consecutive ones, like a kernel call, are shown as one frame.
+      // The ones below the first guest frame only start the thread, and the
+      // thunks between the guest and the host code are in the code cache, but
+      // aren't functions.
+      if (innermost_function && !in_host_code &&
+          (host_pc < code_cache_min_ || host_pc >= code_cache_max_)) {
+        AppendFrame(folded_stack_, "[host]");
+        in_host_code = true;
+      }
+      continue;
+    }
+    in_host_code = false;
+    if (function->name().empty()) {
+      AppendFrame(folded_stack_,
+                  fmt::format("sub_{:08X}", function->address()));
+    } else {
+      AppendFrame(folded_stack_, function->name());
+    }
+    innermost_function = function;
+    // The PC is after the call in the outer frames, so go back into it.
+    innermost_host_pc = i ? host_pc - 1 : host_pc;
+  }
+  if (!innermost_function) {
+    // Not running guest code at all, such as before the thread starts.
+    return;
+  }
+  // The instruction being executed in the innermost guest function is the
+  // topmost frame, so the hottest instructions can be told apart in wide leaf
+  // functions.
+  if (!in_host_code) {
+    uint32_t guest_pc = innermost_function->MapMachineCodeToGuestAddress(
+        uintptr_t(innermost_host_pc));
+    AppendFrame(folded_stack_, fmt::format("{:08X}", guest_pc));
+  }
+  ++folded_stacks_[folded_stack_];
+  ++sample_count_;
+}
+
+bool SamplingProfiler::Write(const std::filesystem::path& path) const {
+  std::vector<std::pair<const std::string*, uint64_t>> stacks;
+  stacks.reserve(folded_stacks_.size());
+  for (const auto& it : folded_stacks_) {
+    stacks.emplace_back(&it.first, it.second);
+  }
+  std::sort(stacks.begin(), stacks.end(),
+            [](const auto& a, const auto& b) { return *a.first < *b.first; });
+  std::string text;
+  for (const auto& stack : stacks) {
+    text += fmt::format("{} {}\n", *stack.first, stack.second);
+  }
+
+  FILE* file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    XELOGE("Failed to open {} for writing the guest profile",
+           xe::path_to_utf8(path));
+    return false;
+  }
+  bool written = std::fwrite(text.data(), 1, text.size(), file) == text.size();
+  std::fclose(file);
+  if (!written) {
+    XELOGE("Failed to write the guest profile to {}", xe::path_to_utf8(path));
+    return false;
+  }
+  XELOGI("Wrote {} guest profile samples in {} distinct stacks to {}",
+         sample_count_, stacks.size(), xe::path_to_utf8(path));
+  return true;
+}
+
+}  // namespace cpu
+}  // namespace xe
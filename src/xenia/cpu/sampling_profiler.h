@@ -0,0 +1,56 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_SAMPLING_PROFILER_H_
+#define XENIA_CPU_SAMPLING_PROFILER_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+
+#include "xenia/cpu/backend/code_cache.h"
+
+namespace xe {
+namespace cpu {
+
+// Aggregates call stacks of guest threads sampled periodically by the
+// Processor into folded stacks - one line per distinct stack, with the frames
+// from the outermost separated by semicolons, followed by the number of
+// samples - which flame graph tools take as input.
+//
+// Must be accessed with the global lock held, which is also what keeps the
+// code cache from changing while the host PCs are being resolved.
+class SamplingProfiler {
+ public:
+  explicit SamplingProfiler(backend::CodeCache* code_cache);
+
+  // Adds a stack captured by the StackWalker, with the innermost frame first.
+  void AddSample(const std::string& thread_name, const uint64_t* frame_host_pcs,
+                 size_t frame_count);
+
+  uint64_t sample_count() const { return sample_count_; }
+
+  bool Write(const std::filesystem::path& path) const;
+
+ private:
+  backend::CodeCache* code_cache_;
+  uintptr_t code_cache_min_;
+  uintptr_t code_cache_max_;
+
+  std::unordered_map<std::string, uint64_t> folded_stacks_;
+  uint64_t sample_count_ = 0;
+  // Reused to build the folded stack of every sample.
+  std::string folded_stack_;
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_SAMPLING_PROFILER_H_
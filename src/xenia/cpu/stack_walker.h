@@ -12,6 +12,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "xenia/base/host_thread_context.h"
 #include "xenia/cpu/function.h"
@@ -55,6 +56,21 @@ struct StackFrame {
   };
 };
 
+// Registers and a copy of the top of the stack of a thread, for walking the
+// stack after the thread has been resumed.
+struct StackSnapshot {
+  HostThreadContext host_context;
+  // Host address of the beginning of the copy, the stack pointer.
+  uint64_t stack_address;
+  // Number of bytes copied, up to the size of stack.
+  size_t stack_size;
+  // Host address of the end of the stack, which may be beyond the copy.
+  uint64_t stack_end;
+  // Allocated by the caller, as nothing must be allocated while the thread is
+  // suspended - it may be holding the heap lock.
+  std::vector<uint8_t> stack;
+};
+
 class StackWalker {
  public:
   // Creates a stack walker. Only one should exist within a process.
@@ -87,6 +103,22 @@ class StackWalker {
                                    HostThreadContext* out_host_context,
                                    uint64_t* out_stack_hash = nullptr) = 0;
 
+  // Copies the registers of the given thread, referenced by native thread
+  // handle, and as much of its stack as fits in the snapshot's stack buffer.
+  // The thread must be suspended, and it can be resumed right after this, as
+  // nothing that may need a lock held by the thread is done here.
+  // Returns false if an error occurred.
+  virtual bool CaptureStackSnapshot(void* thread_handle,
+                                    StackSnapshot* snapshot) = 0;
+
+  // Captures up to the given number of stack frames from a snapshot taken with
+  // CaptureStackSnapshot, stopping where the copy of the stack ends.
+  // This does not populate any information other than host_pc.
+  // Returns the number of frames captured, or 0 if an error occurred.
+  virtual size_t WalkStackSnapshot(const StackSnapshot& snapshot,
+                                   uint64_t* frame_host_pcs,
+                                   size_t frame_count) = 0;
+
   // Resolves symbol information for the given stack frames.
   // Each frame provided must have host_pc set, and all other fields will be
   // populated.
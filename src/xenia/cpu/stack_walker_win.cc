@@ -218,6 +218,73 @@ class Win32StackWalker : public StackWalker {
     return frame_index - frame_offset;
   }
 
+  bool CaptureStackSnapshot(void* thread_handle,
+                            StackSnapshot* snapshot) override {
+    CONTEXT thread_context;
+    thread_context.ContextFlags = CONTEXT_CONTROL | CONTEXT_INTEGER;
+    if (!GetThreadContext(thread_handle, &thread_context)) {
+      return false;
+    }
+    snapshot->host_context.rip = thread_context.Rip;
+    snapshot->host_context.eflags = thread_context.EFlags;
+    std::memcpy(snapshot->host_context.int_registers, &thread_context.Rax,
+                sizeof(snapshot->host_context.int_registers));
+
+    // Only the committed part of the stack above the stack pointer can be
+    // read, it's a single region up to the base of the stack.
+    MEMORY_BASIC_INFORMATION stack_memory_info;
+    if (!VirtualQuery(reinterpret_cast<LPCVOID>(thread_context.Rsp),
+                      &stack_memory_info, sizeof(stack_memory_info)) ||
+        stack_memory_info.State != MEM_COMMIT) {
+      return false;
+    }
+    uint64_t stack_region_end =
+        reinterpret_cast<uint64_t>(stack_memory_info.BaseAddress) +
+        stack_memory_info.RegionSize;
+    snapshot->stack_address = thread_context.Rsp;
+    snapshot->stack_end = stack_region_end;
+    snapshot->stack_size =
+        size_t(std::min(stack_region_end - thread_context.Rsp,
+                        uint64_t(snapshot->stack.size())));
+    std::memcpy(snapshot->stack.data(),
+                reinterpret_cast<const void*>(thread_context.Rsp),
+                snapshot->stack_size);
+    return true;
+  }
+
+  size_t WalkStackSnapshot(const StackSnapshot& snapshot,
+                           uint64_t* frame_host_pcs,
+                           size_t frame_count) override {
+    CONTEXT thread_context = {};
+    thread_context.ContextFlags = CONTEXT_CONTROL | CONTEXT_INTEGER;
+    thread_context.Rip = snapshot.host_context.rip;
+    thread_context.EFlags = snapshot.host_context.eflags;
+    std::memcpy(&thread_context.Rax, snapshot.host_context.int_registers,
+                sizeof(snapshot.host_context.int_registers));
+
+    STACKFRAME64 stack_frame = {0};
+    stack_frame.AddrPC.Mode = AddrModeFlat;
+    stack_frame.AddrPC.Offset = thread_context.Rip;
+    stack_frame.AddrFrame.Mode = AddrModeFlat;
+    stack_frame.AddrFrame.Offset = thread_context.Rbp;
+    stack_frame.AddrStack.Mode = AddrModeFlat;
+    stack_frame.AddrStack.Offset = thread_context.Rsp;
+
+    // The thread is running again, so the stack is read from the copy. The
+    // context is provided, so the thread handle is not used on x86-64.
+    walked_stack_snapshot_ = &snapshot;
+    size_t frame_index = 0;
+    while (frame_index < frame_count &&
+           stack_walk_64_(IMAGE_FILE_MACHINE_AMD64, GetCurrentProcess(),
+                          GetCurrentThread(), &stack_frame, &thread_context,
+                          ReadStackSnapshotMemory, XSymFunctionTableAccess64,
+                          XSymGetModuleBase64, nullptr) == TRUE) {
+      frame_host_pcs[frame_index++] = stack_frame.AddrPC.Offset;
+    }
+    walked_stack_snapshot_ = nullptr;
+    return frame_index;
+  }
+
   bool ResolveStack(uint64_t* frame_host_pcs, StackFrame* frames,
                     size_t frame_count) override {
     // TODO(benvanik): collect symbols to resolve with dbghelp and resolve
@@ -284,6 +351,30 @@ class Win32StackWalker : public StackWalker {
     return sym_function_table_access_64_(hProcess, AddrBase);
   }
 
+  static BOOL WINAPI ReadStackSnapshotMemory(
+      _In_ HANDLE hProcess, _In_ DWORD64 qwBaseAddress, _Out_ PVOID lpBuffer,
+      _In_ DWORD nSize, _Out_ LPDWORD lpNumberOfBytesRead) {
+    const StackSnapshot& snapshot = *walked_stack_snapshot_;
+    if (qwBaseAddress >= snapshot.stack_address &&
+        qwBaseAddress < snapshot.stack_end) {
+      // Not reading the stack beyond the copy, as the thread is modifying it.
+      uint64_t offset = qwBaseAddress - snapshot.stack_address;
+      if (offset + nSize > snapshot.stack_size) {
+        return FALSE;
+      }
+      std::memcpy(lpBuffer, snapshot.stack.data() + offset, nSize);
+      *lpNumberOfBytesRead = nSize;
+      return TRUE;
+    }
+    // Code and unwind information of the host modules.
+    SIZE_T bytes_read = 0;
+    BOOL result = ReadProcessMemory(hProcess,
+                                    reinterpret_cast<LPCVOID>(qwBaseAddress),
+                                    lpBuffer, nSize, &bytes_read);
+    *lpNumberOfBytesRead = DWORD(bytes_read);
+    return result;
+  }
+
   static DWORD64 WINAPI XSymGetModuleBase64(_In_ HANDLE hProcess,
                                             _In_ DWORD64 dwAddr) {
     if (dwAddr >= code_cache_min_ && dwAddr < code_cache_max_) {
@@ -300,11 +391,14 @@ class Win32StackWalker : public StackWalker {
   static xe::cpu::backend::CodeCache* code_cache_;
   static uintptr_t code_cache_min_;
   static uintptr_t code_cache_max_;
+  static thread_local const StackSnapshot* walked_stack_snapshot_;
 };
 
 xe::cpu::backend::CodeCache* Win32StackWalker::code_cache_ = nullptr;
 uintptr_t Win32StackWalker::code_cache_min_ = 0;
 uintptr_t Win32StackWalker::code_cache_max_ = 0;
+thread_local const StackSnapshot* Win32StackWalker::walked_stack_snapshot_ =
+    nullptr;
 
 std::unique_ptr<StackWalker> StackWalker::Create(
     backend::CodeCache* code_cache) {
@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_SYMBOL_H_
 #define XENIA_CPU_SYMBOL_H_
 
+#include <atomic>
 #include <cstdint>
 #include <string>
 
@@ -40,8 +41,10 @@ class Symbol {
 
   Type type() const { return type_; }
   Module* module() const { return module_; }
-  Status status() const { return status_; }
-  void set_status(Status value) { status_ = value; }
+  Status status() const { return status_.load(std::memory_order_acquire); }
+  void set_status(Status value) {
+    status_.store(value, std::memory_order_release);
+  }
   uint32_t address() const { return address_; }
 
   const std::string& name() const { return name_; }
@@ -50,7 +53,8 @@ class Symbol {
  protected:
   Type type_ = Type::kVariable;
   Module* module_ = nullptr;
-  Status status_ = Status::kDefining;
+  // Read without locking on the lookup paths.
+  std::atomic<Status> status_{Status::kDefining};
   uint32_t address_ = 0;
 
   std::string name_;
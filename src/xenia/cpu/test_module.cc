@@ -47,6 +47,8 @@ TestModule::TestModule(Processor* processor, const std::string_view name,
   compiler_->AddPass(std::make_unique<passes::ContextPromotionPass>());
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
   compiler_->AddPass(std::make_unique<passes::ConstantPropagationPass>());
+  compiler_->AddPass(
+      std::make_unique<passes::MemorySequenceCombinationPass>());
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
   // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
   compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
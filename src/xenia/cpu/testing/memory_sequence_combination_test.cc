@@ -0,0 +1,153 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/memory_sequence_combination_pass.h"
+#include "xenia/cpu/testing/util.h"
+
+using namespace xe;
+using namespace xe::cpu;
+using namespace xe::cpu::hir;
+using namespace xe::cpu::testing;
+using xe::cpu::compiler::passes::MemorySequenceCombinationPass;
+using xe::cpu::ppc::PPCContext;
+
+namespace {
+
+// Runs the pass alone over the HIR and counts the instructions left with the
+// opcode, with the flags if not 0.
+class CombinedSequence {
+ public:
+  explicit CombinedSequence(std::function<void(HIRBuilder& b)> generator) {
+    builder_.MakeCurrent();
+    generator(builder_);
+    MemorySequenceCombinationPass pass;
+    pass.Run(&builder_);
+  }
+  ~CombinedSequence() { builder_.RemoveCurrent(); }
+
+  uint32_t Count(const OpcodeInfo& opcode, uint16_t flags = 0) const {
+    uint32_t count = 0;
+    for (Block* block = builder_.first_block(); block; block = block->next) {
+      for (Instr* i = block->instr_head; i; i = i->next) {
+        if (i->opcode == &opcode && (i->flags & flags) == flags) {
+          ++count;
+        }
+      }
+    }
+    return count;
+  }
+
+ private:
+  HIRBuilder builder_;
+};
+
+}  // namespace
+
+TEST_CASE("MEMORY_SEQUENCE_LOAD_SWAP_SWIZZLE", "[instr]") {
+  CombinedSequence sequence([](HIRBuilder& b) {
+    Value* v = b.ByteSwap(b.Load(b.LoadConstantUint64(0x1000), VEC128_TYPE));
+    StoreVR(b, 3, b.Swizzle(v, INT32_TYPE, MakeSwizzleMask(0, 0, 0, 0)));
+    b.Return();
+  });
+  REQUIRE(sequence.Count(OPCODE_LOAD_info) == 1);
+  REQUIRE(sequence.Count(OPCODE_LOAD_info, LOAD_STORE_BYTE_SWAP) == 0);
+  REQUIRE(sequence.Count(OPCODE_BYTE_SWAP_info) == 0);
+  REQUIRE(sequence.Count(OPCODE_SWIZZLE_info) == 0);
+  REQUIRE(sequence.Count(OPCODE_PERMUTE_info) == 1);
+}
+
+TEST_CASE("MEMORY_SEQUENCE_LOAD_SWAP_SHARED", "[instr]") {
+  // The swapped value is used elsewhere, so the swap must stay in the load.
+  CombinedSequence sequence([](HIRBuilder& b) {
+    Value* v = b.ByteSwap(b.Load(b.LoadConstantUint64(0x1000), VEC128_TYPE));
+    StoreVR(b, 3, b.Swizzle(v, INT32_TYPE, MakeSwizzleMask(0, 0, 0, 0)));
+    StoreVR(b, 4, v);
+    b.Return();
+  });
+  REQUIRE(sequence.Count(OPCODE_LOAD_info, LOAD_STORE_BYTE_SWAP) == 1);
+  REQUIRE(sequence.Count(OPCODE_SWIZZLE_info) == 1);
+  REQUIRE(sequence.Count(OPCODE_PERMUTE_info) == 0);
+}
+
+TEST_CASE("MEMORY_SEQUENCE_STORE_SWIZZLE_SWAP", "[instr]") {
+  CombinedSequence sequence([](HIRBuilder& b) {
+    Value* v = b.Swizzle(LoadVR(b, 4), INT32_TYPE, MakeSwizzleMask(3, 2, 1, 0));
+    b.Store(b.LoadConstantUint64(0x1000), b.ByteSwap(v));
+    b.Return();
+  });
+  REQUIRE(sequence.Count(OPCODE_STORE_info) == 1);
+  REQUIRE(sequence.Count(OPCODE_STORE_info, LOAD_STORE_BYTE_SWAP) == 0);
+  REQUIRE(sequence.Count(OPCODE_BYTE_SWAP_info) == 0);
+  REQUIRE(sequence.Count(OPCODE_SWIZZLE_info) == 0);
+  REQUIRE(sequence.Count(OPCODE_PERMUTE_info) == 1);
+}
+
+TEST_CASE("MEMORY_SEQUENCE_SWAP_SWIZZLE", "[instr]") {
+  TestFunction([](HIRBuilder& b) {
+    StoreVR(b, 3,
+            b.Swizzle(b.ByteSwap(LoadVR(b, 4)), INT32_TYPE,
+                      MakeSwizzleMask(2, 0, 3, 0)));
+    b.Return();
+  })
+      .Run(
+          [](PPCContext* ctx) {
+            ctx->v[4] =
+                vec128b(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+          },
+          [](PPCContext* ctx) {
+            auto result = ctx->v[3];
+            REQUIRE(result == vec128b(11, 10, 9, 8, 3, 2, 1, 0, 15, 14, 13, 12,
+                                      3, 2, 1, 0));
+          });
+}
+
+TEST_CASE("MEMORY_SEQUENCE_SWAP_PERMUTE_ZERO", "[instr]") {
+  TestFunction([](HIRBuilder& b) {
+    StoreVR(b, 3,
+            b.Permute(b.LoadConstantVec128(vec128b(0, 1, 2, 3, 16, 17, 18, 19,
+                                                   4, 5, 6, 7, 20, 21, 22, 23)),
+                      b.ByteSwap(LoadVR(b, 4)), b.LoadZeroVec128(),
+                      INT8_TYPE));
+    b.Return();
+  })
+      .Run(
+          [](PPCContext* ctx) {
+            ctx->v[4] =
+                vec128b(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+          },
+          [](PPCContext* ctx) {
+            auto result = ctx->v[3];
+            REQUIRE(result ==
+                    vec128b(3, 2, 1, 0, 0, 0, 0, 0, 7, 6, 5, 4, 0, 0, 0, 0));
+          });
+}
+
+TEST_CASE("MEMORY_SEQUENCE_SWAP_PERMUTE_TWO_SOURCES", "[instr]") {
+  TestFunction([](HIRBuilder& b) {
+    StoreVR(b, 3,
+            b.Permute(b.LoadConstantVec128(vec128b(0, 17, 2, 19, 4, 21, 6, 23,
+                                                   8, 25, 10, 27, 12, 29, 14,
+                                                   31)),
+                      b.ByteSwap(LoadVR(b, 4)), b.ByteSwap(LoadVR(b, 5)),
+                      INT8_TYPE));
+    b.Return();
+  })
+      .Run(
+          [](PPCContext* ctx) {
+            ctx->v[4] =
+                vec128b(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+            ctx->v[5] = vec128b(16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27,
+                                28, 29, 30, 31);
+          },
+          [](PPCContext* ctx) {
+            auto result = ctx->v[3];
+            REQUIRE(result == vec128b(3, 18, 1, 16, 7, 22, 5, 20, 11, 26, 9,
+                                      24, 15, 30, 13, 28));
+          });
+}
@@ -0,0 +1,237 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/translation_stats.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "third_party/fmt/include/fmt/format.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/utf8.h"
+
+namespace xe {
+namespace cpu {
+
+namespace {
+
+uint64_t TicksToMicroseconds(uint64_t ticks) {
+  return uint64_t(double(ticks) * 1000000.0 /
+                  double(Clock::QueryHostTickFrequency()));
+}
+
+double TicksToMilliseconds(uint64_t ticks) {
+  return double(ticks) * 1000.0 / double(Clock::QueryHostTickFrequency());
+}
+
+std::string EscapeJsonString(const std::string& value) {
+  std::string escaped;
+  escaped.reserve(value.size());
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      escaped.push_back('\\');
+      escaped.push_back(c);
+    } else if (uint8_t(c) < 0x20) {
+      escaped += fmt::format("\\u{:04x}", uint8_t(c));
+    } else {
+      escaped.push_back(c);
+    }
+  }
+  return escaped;
+}
+
+}  // namespace
+
+void TranslationStats::AddFunction(
+    const std::string& module_name, const FunctionStats& function_stats,
+    const std::vector<compiler::Compiler::PassStats>& pass_stats) {
+  std::lock_guard<xe_mutex> lock(mutex_);
+  ModuleStats& module = modules_[module_name];
+  ++module.function_count;
+  if (function_stats.baseline) {
+    ++module.baseline_function_count;
+  }
+  module.scan_ticks += function_stats.scan_ticks;
+  module.emit_ticks += function_stats.emit_ticks;
+  module.compile_ticks += function_stats.compile_ticks;
+  module.assemble_ticks += function_stats.assemble_ticks;
+  module.instr_count_in += function_stats.instr_count_in;
+  module.instr_count_out += function_stats.instr_count_out;
+  module.code_size += function_stats.code_size;
+  module.mode_switch_count += function_stats.mode_switch_count;
+  if (function_stats.mode_switch_count) {
+    ++module.mode_switching_function_count;
+  }
+
+  for (const auto& pass : pass_stats) {
+    auto it = std::find_if(
+        module.passes.begin(), module.passes.end(),
+        [&pass](const auto& totals) { return totals.first == pass.name; });
+    if (it == module.passes.end()) {
+      module.passes.emplace_back(pass.name, PassTotals());
+      it = std::prev(module.passes.end());
+    }
+    PassTotals& totals = it->second;
+    ++totals.run_count;
+    totals.ticks += pass.ticks;
+    totals.instr_count_in += pass.instr_count_in;
+    totals.instr_count_out += pass.instr_count_out;
+  }
+}
+
+bool TranslationStats::Write(const std::filesystem::path& path) {
+  std::string text;
+  {
+    std::lock_guard<xe_mutex> lock(mutex_);
+    if (xe::utf8::lower_ascii(xe::path_to_utf8(path.extension())) ==
+        ".json") {
+      text = FormatJson();
+    } else {
+      text = FormatCsv();
+    }
+  }
+  FILE* file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    XELOGE("Failed to open {} for writing JIT statistics",
+           xe::path_to_utf8(path));
+    return false;
+  }
+  bool written = std::fwrite(text.data(), 1, text.size(), file) == text.size();
+  std::fclose(file);
+  if (!written) {
+    XELOGE("Failed to write JIT statistics to {}", xe::path_to_utf8(path));
+    return false;
+  }
+  XELOGI("Wrote JIT statistics to {}", xe::path_to_utf8(path));
+  return true;
+}
+
+void TranslationStats::Log() {
+  std::lock_guard<xe_mutex> lock(mutex_);
+  for (const auto& module_it : modules_) {
+    const ModuleStats& module = module_it.second;
+    XELOGI(
+        "JIT statistics for {}: {} functions ({} baseline), {:.3f} ms scan, "
+        "{:.3f} ms HIR emission, {:.3f} ms passes, {:.3f} ms assembly, "
+        "{} -> {} HIR instructions, {} bytes of code, {} FPU/VMX mode switches "
+        "in {} functions",
+        module_it.first, module.function_count, module.baseline_function_count,
+        TicksToMilliseconds(module.scan_ticks),
+        TicksToMilliseconds(module.emit_ticks),
+        TicksToMilliseconds(module.compile_ticks),
+        TicksToMilliseconds(module.assemble_ticks), module.instr_count_in,
+        module.instr_count_out, module.code_size, module.mode_switch_count,
+        module.mode_switching_function_count);
+    // Most expensive first.
+    std::vector<const std::pair<std::string, PassTotals>*> passes;
+    for (const auto& pass : module.passes) {
+      passes.push_back(&pass);
+    }
+    std::sort(passes.begin(), passes.end(), [](auto a, auto b) {
+      return a->second.ticks > b->second.ticks;
+    });
+    for (const auto* pass : passes) {
+      XELOGI("  {}: {:.3f} ms in {} runs, {} -> {} HIR instructions",
+             pass->first, TicksToMilliseconds(pass->second.ticks),
+             pass->second.run_count, pass->second.instr_count_in,
+             pass->second.instr_count_out);
+    }
+  }
+}
+
+std::string TranslationStats::FormatCsv() const {
+  std::string csv =
+      "module,stage,runs,time_us,hir_instrs_in,hir_instrs_out,code_bytes,"
+      "mode_switches\n";
+  for (const auto& module_it : modules_) {
+    const std::string& name = module_it.first;
+    const ModuleStats& module = module_it.second;
+    uint64_t total_ticks = module.scan_ticks + module.emit_ticks +
+                           module.compile_ticks + module.assemble_ticks;
+    csv += fmt::format("{},total,{},{},{},{},{},{}\n", name,
+                       module.function_count, TicksToMicroseconds(total_ticks),
+                       module.instr_count_in, module.instr_count_out,
+                       module.code_size, module.mode_switch_count);
+    csv += fmt::format("{},baseline,{},,,,,\n", name,
+                       module.baseline_function_count);
+    csv += fmt::format("{},scan,{},{},,,,\n", name, module.function_count,
+                       TicksToMicroseconds(module.scan_ticks));
+    csv += fmt::format("{},emit,{},{},,{},,\n", name, module.function_count,
+                       TicksToMicroseconds(module.emit_ticks),
+                       module.instr_count_in);
+    csv += fmt::format("{},compile,{},{},{},{},,\n", name,
+                       module.function_count,
+                       TicksToMicroseconds(module.compile_ticks),
+                       module.instr_count_in, module.instr_count_out);
+    csv += fmt::format("{},assemble,{},{},{},,{},\n", name,
+                       module.function_count,
+                       TicksToMicroseconds(module.assemble_ticks),
+                       module.instr_count_out, module.code_size);
+    csv += fmt::format("{},mode_switching,{},,,,,{}\n", name,
+                       module.mode_switching_function_count,
+                       module.mode_switch_count);
+    for (const auto& pass : module.passes) {
+      csv += fmt::format("{},pass:{},{},{},{},{},,\n", name, pass.first,
+                         pass.second.run_count,
+                         TicksToMicroseconds(pass.second.ticks),
+                         pass.second.instr_count_in,
+                         pass.second.instr_count_out);
+    }
+  }
+  return csv;
+}
+
+std::string TranslationStats::FormatJson() const {
+  std::string json = "{\n  \"modules\": [";
+  bool first_module = true;
+  for (const auto& module_it : modules_) {
+    const ModuleStats& module = module_it.second;
+    json += first_module ? "\n" : ",\n";
+    first_module = false;
+    json += fmt::format(
+        "    {{\n"
+        "      \"name\": \"{}\",\n"
+        "      \"functions\": {},\n"
+        "      \"baseline_functions\": {},\n"
+        "      \"time_us\": {{\"scan\": {}, \"emit\": {}, \"compile\": {}, "
+        "\"assemble\": {}}},\n"
+        "      \"hir_instrs_in\": {},\n"
+        "      \"hir_instrs_out\": {},\n"
+        "      \"code_bytes\": {},\n"
+        "      \"mode_switches\": {},\n"
+        "      \"mode_switching_functions\": {},\n"
+        "      \"passes\": [",
+        EscapeJsonString(module_it.first), module.function_count,
+        module.baseline_function_count, TicksToMicroseconds(module.scan_ticks),
+        TicksToMicroseconds(module.emit_ticks),
+        TicksToMicroseconds(module.compile_ticks),
+        TicksToMicroseconds(module.assemble_ticks), module.instr_count_in,
+        module.instr_count_out, module.code_size, module.mode_switch_count,
+        module.mode_switching_function_count);
+    bool first_pass = true;
+    for (const auto& pass : module.passes) {
+      json += first_pass ? "\n" : ",\n";
+      first_pass = false;
+      json += fmt::format(
+          "        {{\"name\": \"{}\", \"runs\": {}, \"time_us\": {}, "
+          "\"hir_instrs_in\": {}, \"hir_instrs_out\": {}}}",
+          EscapeJsonString(pass.first), pass.second.run_count,
+          TicksToMicroseconds(pass.second.ticks), pass.second.instr_count_in,
+          pass.second.instr_count_out);
+    }
+    json += "\n      ]\n    }";
+  }
+  json += "\n  ]\n}\n";
+  return json;
+}
+
+}  // namespace cpu
+}  // namespace xe
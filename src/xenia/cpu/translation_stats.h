@@ -0,0 +1,88 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_TRANSLATION_STATS_H_
+#define XENIA_CPU_TRANSLATION_STATS_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "xenia/base/mutex.h"
+#include "xenia/cpu/compiler/compiler.h"
+
+namespace xe {
+namespace cpu {
+
+// Where the time translating guest functions goes, aggregated per module.
+// Functions may be translated on multiple threads at once.
+class TranslationStats {
+ public:
+  struct FunctionStats {
+    // Translated with the baseline tier passes.
+    bool baseline;
+    // Host ticks spent in every stage of the translation.
+    uint64_t scan_ticks;
+    uint64_t emit_ticks;
+    uint64_t compile_ticks;
+    uint64_t assemble_ticks;
+    // HIR instructions emitted from the guest code, and left after the passes.
+    uint32_t instr_count_in;
+    uint32_t instr_count_out;
+    size_t code_size;
+    // Switches between the FPU and VMX floating-point modes in the code.
+    uint32_t mode_switch_count;
+  };
+
+  void AddFunction(
+      const std::string& module_name, const FunctionStats& function_stats,
+      const std::vector<compiler::Compiler::PassStats>& pass_stats);
+
+  // Writes the statistics as JSON if the extension of the path is .json, or as
+  // CSV otherwise.
+  bool Write(const std::filesystem::path& path);
+  void Log();
+
+ private:
+  struct PassTotals {
+    uint64_t run_count = 0;
+    uint64_t ticks = 0;
+    uint64_t instr_count_in = 0;
+    uint64_t instr_count_out = 0;
+  };
+  struct ModuleStats {
+    uint64_t function_count = 0;
+    uint64_t baseline_function_count = 0;
+    uint64_t scan_ticks = 0;
+    uint64_t emit_ticks = 0;
+    uint64_t compile_ticks = 0;
+    uint64_t assemble_ticks = 0;
+    uint64_t instr_count_in = 0;
+    uint64_t instr_count_out = 0;
+    uint64_t code_size = 0;
+    uint64_t mode_switch_count = 0;
+    uint64_t mode_switching_function_count = 0;
+    // In the order they've been run first.
+    std::vector<std::pair<std::string, PassTotals>> passes;
+  };
+
+  std::string FormatCsv() const;
+  std::string FormatJson() const;
+
+  xe_mutex mutex_;
+  std::map<std::string, ModuleStats> modules_;
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_TRANSLATION_STATS_H_
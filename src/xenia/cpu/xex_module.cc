@@ -14,6 +14,7 @@
 #include "third_party/fmt/include/fmt/format.h"
 
 #include "xenia/base/byte_order.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/cvar.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
@@ -48,6 +49,15 @@ DEFINE_bool(
     "finding/stress testing with the JIT",
     "CPU");
 
+DEFINE_int32(
+    precompilation_threads, -1,
+    "Number of background threads translating guest functions with "
+    "enable_early_precompilation while the title is running. Functions "
+    "resolved in more of the previous runs are translated first. 0 to "
+    "precompile everything on the loading thread before starting the title, "
+    "-1 to use a quarter of the logical processors.",
+    "CPU");
+
 DECLARE_bool(allow_plugins);
 
 static const uint8_t xe_xex2_retail_key[16] = {
@@ -85,7 +95,7 @@ using xe::kernel::KernelState;
 XexModule::XexModule(Processor* processor, KernelState* kernel_state)
     : Module(processor), processor_(processor), kernel_state_(kernel_state) {}
 
-XexModule::~XexModule() {}
+XexModule::~XexModule() { ShutdownPrecompilation(); }
 
 bool XexModule::GetOptHeader(const xex2_header* header, xex2_header_keys key,
                              void** out_ptr) {
@@ -1132,7 +1142,12 @@ void XexModule::Precompile() {
   }
 
   info_cache_.Init(this);
+  processor_->backend()->InitializeModuleCodeStorage(
+      this, kernel_state_->emulator()->cache_root() / "modules" /
+                image_sha_str_);
+  PrecompileKnownFunctions();
   PrecompileDiscoveredFunctions();
+  StartPrecompilation();
 }
 bool XexModule::Unload() {
   if (!loaded_) {
@@ -1140,6 +1155,8 @@ bool XexModule::Unload() {
   }
   loaded_ = false;
 
+  ShutdownPrecompilation();
+
   // If this isn't a patch, just deallocate the memory occupied by the exe
   if (!is_patch()) {
     assert_not_zero(base_address_);
@@ -1409,33 +1426,137 @@ void XexModule::PrecompileDiscoveredFunctions() {
     if (other < low_address_ || other >= high_address_) {
       continue;
     }
-    auto sym = processor_->LookupFunction(other);
-
-    if (!sym || sym->status() != Symbol::Status::kDefined) {
-      processor_->ResolveFunction(other);
+    // Already queued by PrecompileKnownFunctions.
+    auto flags = GetInstructionAddressFlags(other);
+    if (flags && flags->was_resolved) {
+      continue;
     }
+    precompile_queue_.push_back(other);
   }
 }
 void XexModule::PrecompileKnownFunctions() {
   if (!cvars::enable_early_precompilation) {
     return;
   }
-  uint32_t start = 0;
   uint32_t end = (high_address_ - low_address_) / 4;
   auto flags = info_cache_.LookupFlags(0);
   if (!flags) {
     return;
   }
-  // maybe should pre-acquire global crit?
+  size_t known_start = precompile_queue_.size();
   for (uint32_t i = 0; i < end; i++) {
     if (flags[i].was_resolved) {
-      uint32_t addr = low_address_ + (i * 4);
-      auto sym = processor_->LookupFunction(addr);
+      precompile_queue_.push_back(low_address_ + (i * 4));
+    }
+  }
+  // Functions needed in most runs first, so the title is less likely to reach
+  // a function that's still being translated.
+  std::stable_sort(precompile_queue_.begin() + known_start,
+                   precompile_queue_.end(), [&](uint32_t a, uint32_t b) {
+                     return flags[(a - low_address_) / 4].resolve_count >
+                            flags[(b - low_address_) / 4].resolve_count;
+                   });
+}
+
+void XexModule::StartPrecompilation() {
+  if (precompile_queue_.empty()) {
+    return;
+  }
+  precompile_start_tick_ = xe::Clock::QueryHostTickCount();
+
+  size_t thread_count;
+  if (cvars::precompilation_threads < 0) {
+    thread_count =
+        std::max(xe::threading::logical_processor_count() / 4, uint32_t(1));
+  } else {
+    thread_count = std::min(uint32_t(cvars::precompilation_threads),
+                            xe::threading::logical_processor_count());
+  }
+  thread_count = std::min(thread_count, precompile_queue_.size());
+
+  if (!thread_count) {
+    for (uint32_t address : precompile_queue_) {
+      PrecompileQueuedFunction(address);
+    }
+    XELOGI("Precompiled {} functions on the loading thread in {} ms",
+           precompile_queue_.size(),
+           (xe::Clock::QueryHostTickCount() - precompile_start_tick_) * 1000 /
+               xe::Clock::QueryHostTickFrequency());
+    precompile_queue_.clear();
+    return;
+  }
 
-      if (!sym || sym->status() != Symbol::Status::kDefined) {
-        processor_->ResolveFunction(addr);
+  XELOGI("Precompiling {} functions on {} background threads",
+         precompile_queue_.size(), thread_count);
+  for (size_t i = 0; i < thread_count; ++i) {
+    xe::threading::Thread::CreationParameters params;
+    params.initial_priority = xe::threading::ThreadPriority::kBelowNormal;
+    std::unique_ptr<xe::threading::Thread> thread =
+        xe::threading::Thread::Create(params,
+                                      [this]() { PrecompilationThread(); });
+    assert_not_null(thread);
+    thread->set_name("Guest Function Precompilation");
+    precompile_threads_.push_back(std::move(thread));
+  }
+}
+
+void XexModule::ShutdownPrecompilation() {
+  if (precompile_threads_.empty()) {
+    return;
+  }
+  {
+    std::lock_guard<xe_mutex> lock(precompile_lock_);
+    precompile_threads_shutdown_ = true;
+  }
+  for (auto& thread : precompile_threads_) {
+    xe::threading::Wait(thread.get(), false);
+  }
+  precompile_threads_.clear();
+  precompile_queue_.clear();
+  precompile_queue_.shrink_to_fit();
+}
+
+void XexModule::PrecompilationThread() {
+  while (true) {
+    uint32_t address;
+    {
+      std::lock_guard<xe_mutex> lock(precompile_lock_);
+      if (precompile_threads_shutdown_) {
+        return;
+      }
+      if (precompile_queue_next_ >= precompile_queue_.size()) {
+        if (precompile_threads_busy_ == 0 &&
+            precompile_queue_next_ != SIZE_MAX) {
+          // The last function translated - report how long it took.
+          XELOGI("Precompiled {} functions in the background in {} ms",
+                 precompile_queue_.size(),
+                 (xe::Clock::QueryHostTickCount() - precompile_start_tick_) *
+                     1000 / xe::Clock::QueryHostTickFrequency());
+          precompile_queue_next_ = SIZE_MAX;
+        }
+        return;
       }
+      address = precompile_queue_[precompile_queue_next_++];
+      ++precompile_threads_busy_;
     }
+
+    PrecompileQueuedFunction(address);
+
+    {
+      std::lock_guard<xe_mutex> lock(precompile_lock_);
+      --precompile_threads_busy_;
+    }
+  }
+}
+
+void XexModule::PrecompileQueuedFunction(uint32_t address) {
+  // If the guest has already reached the function, it's either translated or
+  // being translated by the guest thread, and ResolveFunction will wait for it.
+  auto sym = processor_->LookupFunction(address);
+  if (!sym || sym->status() != Symbol::Status::kDefined) {
+    // Not recording the resolution - only the functions the guest actually
+    // needs should be prioritized in subsequent runs.
+    processor_->ResolveFunction(address, false);
   }
 }
 
@@ -1948,7 +2069,7 @@ bool XexModule::FindSaveRest() {
       // any other functions are compiled for code generation purposes but we do
       // it outside of our loops, because we also want to make sure we've marked
       // up the symbol with info about it being save/rest and whatnot
-      processor_->ResolveFunction(to_ensure_precompiled);
+      processor_->ResolveFunction(to_ensure_precompiled, false);
     }
   }
   return true;
@@ -10,9 +10,12 @@
 #ifndef XENIA_CPU_XEX_MODULE_H_
 #define XENIA_CPU_XEX_MODULE_H_
 
+#include <memory>
 #include <string>
 #include <vector>
 #include "xenia/base/mapped_memory.h"
+#include "xenia/base/mutex.h"
+#include "xenia/base/threading.h"
 #include "xenia/cpu/module.h"
 #include "xenia/kernel/util/xex2_info.h"
 
@@ -37,14 +40,17 @@ struct InfoCacheFlags {
   uint32_t is_syscall_func : 1;
   uint32_t is_return_site : 1;  // address can be reached from another function
                                 // by returning
-  uint32_t reserved : 28;
+  // saturating count of the runs in which the function was resolved by the
+  // guest, used to precompile the most commonly needed functions first
+  uint32_t resolve_count : 8;
+  uint32_t reserved : 20;
 };
 static_assert(sizeof(InfoCacheFlags) == 4,
               "InfoCacheFlags size should be equal to sizeof ppc instruction.");
 
 struct XexInfoCache {
   // increment this to invalidate all user infocaches
-  static constexpr uint32_t CURRENT_INFOCACHE_VERSION = 4;
+  static constexpr uint32_t CURRENT_INFOCACHE_VERSION = 5;
 
   struct InfoCacheFlagsHeader {
     uint32_t version;
@@ -241,6 +247,12 @@ class XexModule : public xe::cpu::Module {
   void PrecompileKnownFunctions();
   void PrecompileDiscoveredFunctions();
   std::vector<uint32_t> PreanalyzeCode();
+  // Translates the queued functions, in the background if precompilation
+  // threads are enabled.
+  void StartPrecompilation();
+  void ShutdownPrecompilation();
+  void PrecompilationThread();
+  void PrecompileQueuedFunction(uint32_t address);
   friend struct XexInfoCache;
   void ReadSecurityInfo();
 
@@ -285,6 +297,16 @@ class XexModule : public xe::cpu::Module {
   uint8_t image_sha_bytes_[20];
   std::string image_sha_str_;
   XexInfoCache info_cache_;
+
+  // Guest addresses of the functions to precompile, in the order of priority.
+  std::vector<uint32_t> precompile_queue_;
+  xe_mutex precompile_lock_;
+  // Protected with precompile_lock_.
+  size_t precompile_queue_next_ = 0;
+  size_t precompile_threads_busy_ = 0;
+  bool precompile_threads_shutdown_ = false;
+  uint64_t precompile_start_tick_ = 0;
+  std::vector<std::unique_ptr<xe::threading::Thread>> precompile_threads_;
 };
 
 }  // namespace cpu
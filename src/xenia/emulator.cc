@@ -11,9 +11,11 @@
 
 #include <algorithm>
 #include <cinttypes>
+#include <cstring>
 
 #include "config.h"
 #include "third_party/fmt/include/fmt/format.h"
+#include "third_party/snappy/snappy.h"
 #include "xenia/apu/audio_system.h"
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_stream.h"
@@ -21,6 +23,7 @@
 #include "xenia/base/cvar.h"
 #include "xenia/base/debugging.h"
 #include "xenia/base/exception_handler.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/literals.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/mapped_memory.h"
@@ -77,6 +80,13 @@ DEFINE_bool(allow_game_relative_writes, false,
             "generating test data to compare with original hardware. ",
             "General");
 
+DEFINE_uint32(
+    save_state_chain_length, 8,
+    "Maximum number of save states in a row containing only the guest memory "
+    "changed since the previous save, which is needed to restore them. 0 to "
+    "save all memory every time.",
+    "General");
+
 DECLARE_int32(user_language);
 
 DECLARE_bool(allow_plugins);
@@ -146,6 +156,10 @@ Emulator::Emulator(const std::filesystem::path& command_line,
 Emulator::~Emulator() {
   // Note that we delete things in the reverse order they were initialized.
 
+  if (save_state_thread_.joinable()) {
+    save_state_thread_.join();
+  }
+
   // Give the systems time to shutdown before we delete them.
   if (graphics_system_) {
     graphics_system_->Shutdown();
@@ -310,6 +324,11 @@ X_STATUS Emulator::TerminateTitle() {
   title_id_ = std::nullopt;
   title_name_ = "";
   title_version_ = "";
+  // The memory will be reused by another title.
+  if (save_state_thread_.joinable()) {
+    save_state_thread_.join();
+  }
+  save_state_chain_.clear();
   on_terminate();
   return X_STATUS_SUCCESS;
 }
@@ -581,18 +600,142 @@ void Emulator::Resume() {
   }
 }
 
-bool Emulator::SaveToFile(const std::filesystem::path& path) {
-  Pause();
+namespace {
+// Followed by the path of the save state this one is made on top of, and the
+// data compressed with Snappy in chunks.
+struct SaveStateHeader {
+  fourcc_t signature;
+  uint32_t version;
+  // Identifies the save for the ones made on top of it.
+  uint64_t id;
+  // 0 if not made on top of another save.
+  uint64_t parent_id;
+  uint64_t data_size;
+  // Where the memory begins in the data.
+  uint64_t memory_offset;
+};
+
+constexpr size_t kSaveStateChunkSize = 4_MiB;
+// Everything but the memory.
+constexpr size_t kSaveStateSystemsSizeMax = 64_MiB;
+
+bool WriteSaveState(const std::filesystem::path& path,
+                    const SaveStateHeader& header,
+                    const std::string& parent_path,
+                    const std::vector<uint8_t>& data) {
+  FILE* file = filesystem::OpenFile(path, "wb");
+  if (!file) {
+    return false;
+  }
+  uint32_t parent_path_length = uint32_t(parent_path.size());
+  bool written =
+      std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+      std::fwrite(&parent_path_length, sizeof(parent_path_length), 1, file) ==
+          1 &&
+      std::fwrite(parent_path.data(), 1, parent_path.size(), file) ==
+          parent_path.size();
+  std::vector<char> compressed(
+      snappy::MaxCompressedLength(kSaveStateChunkSize));
+  for (size_t offset = 0; written && offset < data.size();
+       offset += kSaveStateChunkSize) {
+    size_t compressed_length;
+    snappy::RawCompress(reinterpret_cast<const char*>(data.data() + offset),
+                        std::min(kSaveStateChunkSize, data.size() - offset),
+                        compressed.data(), &compressed_length);
+    uint32_t chunk_size = uint32_t(compressed_length);
+    written = std::fwrite(&chunk_size, sizeof(chunk_size), 1, file) == 1 &&
+              std::fwrite(compressed.data(), 1, compressed_length, file) ==
+                  compressed_length;
+  }
+  return (std::fclose(file) == 0) && written;
+}
 
-  filesystem::CreateEmptyFile(path);
-  auto map = MappedMemory::Open(path, MappedMemory::Mode::kReadWrite, 0, 2_GiB);
+bool ReadSaveState(const std::filesystem::path& path, SaveStateHeader& header,
+                   std::string& parent_path, std::vector<uint8_t>& data) {
+  auto map = MappedMemory::Open(path, MappedMemory::Mode::kRead);
   if (!map) {
     return false;
   }
+  const uint8_t* map_data = map->data();
+  size_t map_size = map->size();
+  size_t map_offset = 0;
+  auto read = [&](void* out, size_t size) {
+    if (map_size - map_offset < size) {
+      return false;
+    }
+    std::memcpy(out, map_data + map_offset, size);
+    map_offset += size;
+    return true;
+  };
 
-  // Save the emulator state to a file
-  ByteStream stream(map->data(), map->size());
-  stream.Write(kEmulatorSaveSignature);
+  uint32_t parent_path_length;
+  if (!read(&header, sizeof(header)) ||
+      header.signature != kEmulatorSaveSignature ||
+      header.version != kEmulatorSaveVersion ||
+      header.memory_offset > header.data_size ||
+      !read(&parent_path_length, sizeof(parent_path_length))) {
+    return false;
+  }
+  parent_path.resize(parent_path_length);
+  if (!read(parent_path.data(), parent_path_length)) {
+    return false;
+  }
+  // Snappy stores at most 64 bytes with 3 (as a copy of earlier data), so the
+  // rest of the file can't contain more - don't allocate the buffer for a
+  // corrupted size.
+  if (header.data_size > uint64_t(map_size - map_offset) * 64 / 3) {
+    return false;
+  }
+  data.resize(size_t(header.data_size));
+  for (size_t offset = 0; offset < data.size(); offset += kSaveStateChunkSize) {
+    uint32_t chunk_size;
+    size_t uncompressed_length;
+    if (!read(&chunk_size, sizeof(chunk_size)) ||
+        map_size - map_offset < chunk_size) {
+      return false;
+    }
+    const char* chunk = reinterpret_cast<const char*>(map_data + map_offset);
+    if (!snappy::GetUncompressedLength(chunk, chunk_size,
+                                       &uncompressed_length) ||
+        uncompressed_length !=
+            std::min(kSaveStateChunkSize, data.size() - offset) ||
+        !snappy::RawUncompress(chunk, chunk_size,
+                               reinterpret_cast<char*>(data.data() + offset))) {
+      return false;
+    }
+    map_offset += chunk_size;
+  }
+  return true;
+}
+}  // namespace
+
+bool Emulator::SaveToFile(const std::filesystem::path& path) {
+  // The files of the chain must be complete.
+  if (save_state_thread_.joinable()) {
+    save_state_thread_.join();
+  }
+  if (save_state_write_failed_) {
+    // The saves made on top of the one not written couldn't be restored.
+    XELOGW(
+        "Making a full save state as the previous one could not be written to "
+        "{}",
+        xe::path_to_utf8(save_state_chain_.back()));
+    save_state_chain_.clear();
+    save_state_write_failed_ = false;
+  }
+  bool incremental =
+      !save_state_chain_.empty() &&
+      save_state_chain_.size() <= cvars::save_state_chain_length &&
+      std::find(save_state_chain_.begin(), save_state_chain_.end(), path) ==
+          save_state_chain_.end();
+
+  Pause();
+  uint64_t capture_start_time = Clock::QueryHostUptimeMillis();
+
+  // Save the emulator state to memory, to be written to the file while the
+  // emulator is running.
+  std::vector<uint8_t> data(kSaveStateSystemsSizeMax);
+  ByteStream stream(data.data(), data.size());
   stream.Write(title_id_.has_value());
   if (title_id_.has_value()) {
     stream.Write(title_id_.value());
@@ -604,18 +747,77 @@ bool Emulator::SaveToFile(const std::filesystem::path& path) {
   graphics_system_->Save(&stream);
   audio_system_->Save(&stream);
   kernel_state_->Save(&stream);
-  memory_->Save(&stream);
-  map->Close(stream.offset());
+  data.resize(stream.offset());
+  size_t memory_offset = data.size();
+  memory_->Save(data, incremental);
 
   Resume();
+  XELOGI("Captured {} save state in {} ms, {} MB",
+         incremental ? "an incremental" : "a full",
+         Clock::QueryHostUptimeMillis() - capture_start_time,
+         data.size() / 1_MiB);
+
+  SaveStateHeader header = {};
+  header.signature = kEmulatorSaveSignature;
+  header.version = kEmulatorSaveVersion;
+  header.id = std::max(Clock::QueryHostSystemTime(),
+                       save_state_chain_last_id_ + 1);
+  header.parent_id = incremental ? save_state_chain_last_id_ : 0;
+  header.data_size = data.size();
+  header.memory_offset = memory_offset;
+  std::string parent_path;
+  if (incremental) {
+    parent_path = xe::path_to_utf8(save_state_chain_.back());
+  } else {
+    save_state_chain_.clear();
+  }
+  save_state_chain_.push_back(path);
+  save_state_chain_last_id_ = header.id;
+
+  save_state_thread_ = std::thread([this, path, header,
+                                    parent_path = std::move(parent_path),
+                                    data = std::move(data)]() {
+    xe::threading::set_name("Save State Writer");
+    uint64_t write_start_time = Clock::QueryHostUptimeMillis();
+    if (!WriteSaveState(path, header, parent_path, data)) {
+      XELOGE("Failed to write the save state to {}", xe::path_to_utf8(path));
+      save_state_write_failed_ = true;
+      return;
+    }
+    XELOGI("Wrote the save state to {} in {} ms", xe::path_to_utf8(path),
+           Clock::QueryHostUptimeMillis() - write_start_time);
+  });
   return true;
 }
 
 bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
-  // Restore the emulator state from a file
-  auto map = MappedMemory::Open(path, MappedMemory::Mode::kReadWrite);
-  if (!map) {
-    return false;
+  if (save_state_thread_.joinable()) {
+    save_state_thread_.join();
+  }
+  uint64_t restore_start_time = Clock::QueryHostUptimeMillis();
+
+  // Read the chain of saves the one being restored is made on top of, from the
+  // last one.
+  std::vector<std::vector<uint8_t>> chain_data;
+  std::vector<size_t> chain_memory_offsets;
+  std::filesystem::path chain_path = path;
+  uint64_t chain_id = 0;
+  while (true) {
+    SaveStateHeader header;
+    std::string parent_path;
+    std::vector<uint8_t> data;
+    if (!ReadSaveState(chain_path, header, parent_path, data) ||
+        (chain_id && header.id != chain_id)) {
+      XELOGE("Could not read the save state {}", xe::path_to_utf8(chain_path));
+      return false;
+    }
+    chain_data.push_back(std::move(data));
+    chain_memory_offsets.push_back(size_t(header.memory_offset));
+    if (!header.parent_id) {
+      break;
+    }
+    chain_path = xe::to_path(parent_path);
+    chain_id = header.parent_id;
   }
 
   restoring_ = true;
@@ -623,12 +825,10 @@ bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
   // Terminate any loaded titles.
   Pause();
   kernel_state_->TerminateTitle();
+  save_state_chain_.clear();
 
   auto lock = global_critical_region::AcquireDirect();
-  ByteStream stream(map->data(), map->size());
-  if (stream.Read<uint32_t>() != kEmulatorSaveSignature) {
-    return false;
-  }
+  ByteStream stream(chain_data.front().data(), chain_data.front().size());
 
   auto has_title_id = stream.Read<bool>();
   std::optional<uint32_t> title_id;
@@ -660,7 +860,17 @@ bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
     XELOGE("Could not restore kernel state!");
     return false;
   }
-  if (!memory_->Restore(&stream)) {
+  // The memory of every save is restored on top of the one before it.
+  std::vector<ByteStream> memory_streams;
+  std::vector<ByteStream*> memory_stream_pointers;
+  memory_streams.reserve(chain_data.size());
+  for (size_t i = chain_data.size(); i-- > 0;) {
+    memory_streams.emplace_back(chain_data[i].data(), chain_data[i].size(),
+                                chain_memory_offsets[i]);
+    memory_stream_pointers.push_back(&memory_streams.back());
+  }
+  if (!memory_->Restore(memory_stream_pointers.data(),
+                        memory_stream_pointers.size())) {
     XELOGE("Could not restore memory!");
     return false;
   }
@@ -680,6 +890,9 @@ bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
   restore_fence_.Signal();
   restoring_ = false;
 
+  XELOGI("Restored the save state {} from {} files in {} ms",
+         xe::path_to_utf8(path), chain_data.size(),
+         Clock::QueryHostUptimeMillis() - restore_start_time);
   return true;
 }
 
@@ -15,6 +15,7 @@
 #include <functional>
 #include <optional>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "xenia/base/delegate.h"
@@ -52,6 +53,7 @@ class Window;
 namespace xe {
 
 constexpr fourcc_t kEmulatorSaveSignature = make_fourcc("XSAV");
+constexpr uint32_t kEmulatorSaveVersion = 2;
 
 // The main type that runs the whole emulator.
 // This is responsible for initializing and managing all the various subsystems.
@@ -210,6 +212,12 @@ class Emulator {
   void Pause();
   void Resume();
   bool is_paused() const { return paused_; }
+  // Captures the state while paused, then compresses and writes it on a
+  // background thread. Unless overwriting a file it depends on, the save only
+  // contains the guest memory changed since the previous one, and restoring it
+  // requires the previous files.
+  // Returns before the file is written, and if writing fails, the error is
+  // logged, and the next save is a full one.
   bool SaveToFile(const std::filesystem::path& path);
   bool RestoreFromFile(const std::filesystem::path& path);
 
@@ -287,6 +295,14 @@ class Emulator {
   bool paused_;
   bool restoring_;
   threading::Fence restore_fence_;  // Fired on restore finish.
+
+  // Writes the last save state, must be joined before accessing the members
+  // below or the files of the chain.
+  std::thread save_state_thread_;
+  // Files of the last full save state and the ones made on top of it.
+  std::vector<std::filesystem::path> save_state_chain_;
+  uint64_t save_state_chain_last_id_ = 0;
+  bool save_state_write_failed_ = false;
 };
 
 }  // namespace xe
@@ -0,0 +1,792 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/batched_shader_interpreter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/math.h"
+#include "xenia/base/platform.h"
+#include "xenia/gpu/registers.h"
+#include "xenia/gpu/shader_interpreter.h"
+
+namespace xe {
+namespace gpu {
+
+BatchedShaderInterpreter::State::State() {
+  for (uint32_t i = 0; i < kLaneCount; ++i) {
+    sign_mask[i] = UINT32_C(0x80000000);
+    abs_mask[i] = UINT32_C(0x7FFFFFFF);
+    exponent_mask[i] = UINT32_C(0x7F800000);
+    all_ones[i] = UINT32_MAX;
+    one[i] = 1.0f;
+  }
+}
+
+#if !XE_ARCH_AMD64
+// The code generator is only implemented for x86-64, the constructor and the
+// destructor need the complete Emitter type, so they're defined along with it.
+class BatchedShaderInterpreter::Emitter {};
+
+bool BatchedShaderInterpreter::GenerateCode() { return false; }
+
+BatchedShaderInterpreter::BatchedShaderInterpreter(const Shader& shader)
+    : ucode_(shader.ucode_dwords(),
+             shader.ucode_dwords() + shader.ucode_dword_count()) {}
+
+BatchedShaderInterpreter::~BatchedShaderInterpreter() = default;
+#endif  // !XE_ARCH_AMD64
+
+namespace {
+// a0 is not tracked, as it's only needed for addressing constants relatively
+// to it.
+bool IsAluInstructionSupported(const ucode::AluInstruction& instr) {
+  if (!instr.is_const_address_register_relative()) {
+    return true;
+  }
+  const ucode::AluVectorOpcodeInfo& vector_opcode_info =
+      ucode::GetAluVectorOpcodeInfo(instr.vector_opcode());
+  if (instr.GetVectorOpResultWriteMask() || vector_opcode_info.changed_state) {
+    for (uint32_t i = 0; i < 3; ++i) {
+      if (vector_opcode_info.operand_components_used[i] &&
+          !instr.src_is_temp(1 + i) && instr.src_const_is_addressed(1 + i)) {
+        return false;
+      }
+    }
+  }
+  switch (ucode::GetAluScalarOpcodeInfo(instr.scalar_opcode()).operand_count) {
+    case 1:
+      return instr.src_is_temp(3) || !instr.src_const_is_addressed(3);
+    case 2:
+      return !instr.src_const_is_addressed(3);
+    default:
+      return true;
+  }
+}
+}  // namespace
+
+std::unique_ptr<BatchedShaderInterpreter> BatchedShaderInterpreter::Compile(
+    const Shader& shader, bool generate_code) {
+  assert_true(shader.is_ucode_analyzed());
+  if (shader.type() != xenos::ShaderType::kVertex ||
+      !ShaderInterpreter::CanInterpretShader(shader)) {
+    return nullptr;
+  }
+  std::unique_ptr<BatchedShaderInterpreter> interpreter(
+      new BatchedShaderInterpreter(shader));
+  if (!interpreter->AnalyzeShader(shader.cf_pair_index_bound() * 2)) {
+    return nullptr;
+  }
+  if (generate_code) {
+    interpreter->GenerateCode();
+  }
+  return interpreter;
+}
+
+bool BatchedShaderInterpreter::AnalyzeShader(uint32_t cf_count) {
+  const uint32_t* ucode = ucode_.data();
+  uint32_t ucode_dword_count = uint32_t(ucode_.size());
+  if (3 * (cf_count >> 1) > ucode_dword_count) {
+    return false;
+  }
+  cf_instructions_.resize(cf_count);
+  for (uint32_t i = 0; i + 1 < cf_count; i += 2) {
+    ucode::UnpackControlFlowInstructions(ucode + 3 * (i >> 1),
+                                         &cf_instructions_[i]);
+  }
+
+  // Loops must be properly nested and jumps must not cross loop boundaries, so
+  // aL and the loop depth are known statically.
+  constexpr uint32_t kNoLoop = UINT32_MAX;
+  // For the end (cf_count), kNoLoop.
+  std::vector<uint32_t> cf_innermost_loops(cf_count + 1, kNoLoop);
+  cf_loop_depths_.clear();
+  cf_loop_depths_.resize(cf_count, 0);
+  uint32_t loop_stack[4];
+  uint32_t loop_stack_depth = 0;
+  for (uint32_t i = 0; i < cf_count; ++i) {
+    const ucode::ControlFlowInstruction& cf_instr = cf_instructions_[i];
+    cf_innermost_loops[i] =
+        loop_stack_depth ? loop_stack[loop_stack_depth - 1] : kNoLoop;
+    cf_loop_depths_[i] = loop_stack_depth;
+    switch (cf_instr.opcode()) {
+      case ucode::ControlFlowOpcode::kNop:
+      case ucode::ControlFlowOpcode::kReturn:
+      case ucode::ControlFlowOpcode::kAlloc:
+      case ucode::ControlFlowOpcode::kMarkVsFetchDone:
+        break;
+      case ucode::ControlFlowOpcode::kExec:
+      case ucode::ControlFlowOpcode::kExecEnd:
+      case ucode::ControlFlowOpcode::kCondExec:
+      case ucode::ControlFlowOpcode::kCondExecEnd:
+      case ucode::ControlFlowOpcode::kCondExecPred:
+      case ucode::ControlFlowOpcode::kCondExecPredClean:
+      case ucode::ControlFlowOpcode::kCondExecPredCleanEnd: {
+        const ucode::ControlFlowExecInstruction& cf_exec =
+            *reinterpret_cast<const ucode::ControlFlowExecInstruction*>(
+                &cf_instr);
+        if (3 * (cf_exec.address() + cf_exec.count()) > ucode_dword_count) {
+          return false;
+        }
+        for (uint32_t exec_index = 0; exec_index < cf_exec.count();
+             ++exec_index) {
+          if (!((cf_exec.sequence() >> (exec_index << 1)) & 0b01) &&
+              !IsAluInstructionSupported(
+                  *reinterpret_cast<const ucode::AluInstruction*>(
+                      ucode + 3 * (cf_exec.address() + exec_index)))) {
+            return false;
+          }
+        }
+      } break;
+      case ucode::ControlFlowOpcode::kLoopStart: {
+        if (loop_stack_depth >= 4) {
+          return false;
+        }
+        loop_stack[loop_stack_depth++] = i;
+      } break;
+      case ucode::ControlFlowOpcode::kLoopEnd: {
+        if (!loop_stack_depth) {
+          return false;
+        }
+        uint32_t loop_start_index = loop_stack[--loop_stack_depth];
+        const ucode::ControlFlowLoopStartInstruction& cf_loop_start =
+            *reinterpret_cast<const ucode::ControlFlowLoopStartInstruction*>(
+                &cf_instructions_[loop_start_index]);
+        const ucode::ControlFlowLoopEndInstruction& cf_loop_end =
+            *reinterpret_cast<const ucode::ControlFlowLoopEndInstruction*>(
+                &cf_instr);
+        if (cf_loop_end.is_predicated_break() ||
+            cf_loop_end.loop_id() != cf_loop_start.loop_id() ||
+            cf_loop_end.address() != loop_start_index + 1 ||
+            cf_loop_start.address() != i + 1) {
+          return false;
+        }
+      } break;
+      case ucode::ControlFlowOpcode::kCondJmp: {
+        const ucode::ControlFlowCondJmpInstruction& cf_cond_jmp =
+            *reinterpret_cast<const ucode::ControlFlowCondJmpInstruction*>(
+                &cf_instr);
+        if ((!cf_cond_jmp.is_unconditional() && cf_cond_jmp.is_predicated()) ||
+            cf_cond_jmp.address() > cf_count) {
+          return false;
+        }
+      } break;
+      default:
+        // Calls and predicated ends may diverge between the lanes.
+        return false;
+    }
+  }
+  if (loop_stack_depth) {
+    return false;
+  }
+  for (uint32_t i = 0; i < cf_count; ++i) {
+    if (cf_instructions_[i].opcode() != ucode::ControlFlowOpcode::kCondJmp) {
+      continue;
+    }
+    const ucode::ControlFlowCondJmpInstruction& cf_cond_jmp =
+        *reinterpret_cast<const ucode::ControlFlowCondJmpInstruction*>(
+            &cf_instructions_[i]);
+    if (cf_innermost_loops[cf_cond_jmp.address()] != cf_innermost_loops[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void BatchedShaderInterpreter::LoadConstants(State& state,
+                                             const RegisterFile& register_file,
+                                             const Memory& memory,
+                                             TraceWriter* trace_writer) {
+  state.register_file = &register_file;
+  state.memory = &memory;
+  state.trace_writer = trace_writer;
+
+  std::memcpy(state.bool_constants,
+              &register_file[XE_GPU_REG_SHADER_CONSTANT_BOOL_000_031].u32,
+              sizeof(state.bool_constants));
+  std::memcpy(state.loop_constants,
+              &register_file[XE_GPU_REG_SHADER_CONSTANT_LOOP_00].u32,
+              sizeof(state.loop_constants));
+
+  // The same bounds as in ShaderInterpreter::GetFloatConstant.
+  std::memset(state.float_constants, 0, sizeof(state.float_constants));
+  auto sq_vs_const = register_file.Get<reg::SQ_VS_CONST>();
+  for (uint32_t i = 0; i <= sq_vs_const.size && sq_vs_const.base + i < 512;
+       ++i) {
+    const float* constant =
+        &register_file[XE_GPU_REG_SHADER_CONSTANT_000_X +
+                       4 * (sq_vs_const.base + i)]
+             .f32;
+    float* row = state.float_constants[kFloatConstantRowOffset + i];
+    for (uint32_t j = 0; j < 4; ++j) {
+      row[j] = ShaderInterpreter::FlushDenormal(constant[j]);
+    }
+  }
+}
+
+void BatchedShaderInterpreter::Execute(State& state) const {
+  state.ucode = ucode_.data();
+  std::memset(state.exports, 0, sizeof(state.exports));
+  std::memset(state.exports_written, 0, sizeof(state.exports_written));
+  std::memset(state.previous_scalar, 0, sizeof(state.previous_scalar));
+  std::memset(state.predicate, 0, sizeof(state.predicate));
+  std::memset(state.vfetch_address_dwords, 0,
+              sizeof(state.vfetch_address_dwords));
+  std::memset(state.vfetch_full_last, 0, sizeof(state.vfetch_full_last));
+  std::memset(state.loop_iterators, 0, sizeof(state.loop_iterators));
+  std::memset(state.loop_addresses, 0, sizeof(state.loop_addresses));
+  state.loop_address = 0;
+  if (function_) {
+    function_(&state);
+  } else {
+    ExecuteInterpreted(state);
+  }
+}
+
+namespace {
+constexpr uint32_t kLaneCount = BatchedShaderInterpreter::kLaneCount;
+
+bool TestBoolConstant(const BatchedShaderInterpreter::State& state,
+                      uint32_t bool_address) {
+  return (state.bool_constants[bool_address >> 5] &
+          (UINT32_C(1) << (bool_address & 31))) != 0;
+}
+
+// Same as ShaderInterpreter::State::GetLoopAddress, for the iterator at the
+// depth.
+void SetLoopAddress(BatchedShaderInterpreter::State& state, uint32_t depth,
+                    uint32_t loop_id) {
+  xenos::LoopConstant loop_constant = state.loop_constants[loop_id];
+  int32_t loop_address = std::min(
+      INT32_C(256),
+      std::max(INT32_C(-256), int32_t(int32_t(state.loop_iterators[depth]) *
+                                          loop_constant.step +
+                                      loop_constant.start)));
+  state.loop_addresses[depth] = loop_address;
+  state.loop_address = loop_address;
+}
+
+bool IsAnyLaneSet(const uint32_t* mask) {
+  uint32_t any_lane = 0;
+  for (uint32_t lane = 0; lane < kLaneCount; ++lane) {
+    any_lane |= mask[lane];
+  }
+  return any_lane != 0;
+}
+
+// Stores the value for the lanes in instruction_mask if is_masked, or for all
+// lanes otherwise.
+void StoreMasked(const BatchedShaderInterpreter::State& state, bool is_masked,
+                 const float* value, float* dest) {
+  if (!is_masked) {
+    std::memcpy(dest, value, sizeof(float) * kLaneCount);
+    return;
+  }
+  for (uint32_t lane = 0; lane < kLaneCount; ++lane) {
+    dest[lane] = state.instruction_mask[lane] ? value[lane] : dest[lane];
+  }
+}
+void StoreMasked(const BatchedShaderInterpreter::State& state, bool is_masked,
+                 const uint32_t* value, uint32_t* dest) {
+  for (uint32_t lane = 0; lane < kLaneCount; ++lane) {
+    dest[lane] = (!is_masked || state.instruction_mask[lane]) ? value[lane]
+                                                              : dest[lane];
+  }
+}
+
+// Loads the component of an r# or a c# operand for all lanes with the
+// modifiers applied like ShaderInterpreter::ExecuteAluInstruction.
+void LoadAluOperandComponent(const BatchedShaderInterpreter::State& state,
+                             bool is_temp, uint32_t reg, bool is_relative,
+                             uint32_t component, bool absolute, bool negate,
+                             float* dest) {
+  uint32_t absolute_mask = ~(uint32_t(absolute) << 31);
+  uint32_t negate_bit = uint32_t(negate) << 31;
+  int32_t relative_offset = is_relative ? state.loop_address : 0;
+  if (is_temp) {
+    const float* src =
+        state.temps[uint32_t(int32_t(reg) + relative_offset) &
+                    (xenos::kMaxShaderTempRegisters - 1)][component];
+    for (uint32_t lane = 0; lane < kLaneCount; ++lane) {
+      float value = ShaderInterpreter::FlushDenormal(src[lane]);
+      uint32_t value_bits;
+      std::memcpy(&value_bits, &value, sizeof(value_bits));
+      value_bits = (value_bits & absolute_mask) ^ negate_bit;
+      std::memcpy(&dest[lane], &value_bits, sizeof(value_bits));
+    }
+  } else {
+    // Flushed in LoadConstants, and the absolute value modifier is not applied
+    // to constants.
+    int32_t row =
+        int32_t(BatchedShaderInterpreter::kFloatConstantRowOffset + reg) +
+        relative_offset;
+    float value = state.float_constants[row][component];
+    uint32_t value_bits;
+    std::memcpy(&value_bits, &value, sizeof(value_bits));
+    value_bits ^= negate_bit;
+    std::memcpy(&value, &value_bits, sizeof(value_bits));
+    for (uint32_t lane = 0; lane < kLaneCount; ++lane) {
+      dest[lane] = value;
+    }
+  }
+}
+}  // namespace
+
+void BatchedShaderInterpreter::ExecuteInterpreted(State& state) const {
+  const uint32_t* ucode = ucode_.data();
+  uint32_t cf_count = uint32_t(cf_instructions_.size());
+  uint32_t cf_index_next = 1;
+  for (uint32_t cf_index = 0; cf_index < cf_count; cf_index = cf_index_next) {
+    cf_index_next = cf_index + 1;
+    const ucode::ControlFlowInstruction& cf_instr = cf_instructions_[cf_index];
+    ucode::ControlFlowOpcode cf_opcode = cf_instr.opcode();
+    switch (cf_opcode) {
+      case ucode::ControlFlowOpcode::kExec:
+      case ucode::ControlFlowOpcode::kExecEnd:
+      case ucode::ControlFlowOpcode::kCondExec:
+      case ucode::ControlFlowOpcode::kCondExecEnd:
+      case ucode::ControlFlowOpcode::kCondExecPred:
+      case ucode::ControlFlowOpcode::kCondExecPredClean:
+      case ucode::ControlFlowOpcode::kCondExecPredCleanEnd: {
+        const ucode::ControlFlowExecInstruction& cf_exec =
+            *reinterpret_cast<const ucode::ControlFlowExecInstruction*>(
+                &cf_instr);
+        bool exec_is_predicated = false;
+        switch (cf_opcode) {
+          case ucode::ControlFlowOpcode::kCondExec:
+          case ucode::ControlFlowOpcode::kCondExecEnd:
+          case ucode::ControlFlowOpcode::kCondExecPredClean:
+          case ucode::ControlFlowOpcode::kCondExecPredCleanEnd: {
+            const ucode::ControlFlowCondExecInstruction& cf_cond_exec =
+                *reinterpret_cast<const ucode::ControlFlowCondExecInstruction*>(
+                    &cf_exec);
+            if (cf_cond_exec.condition() !=
+                TestBoolConstant(state, cf_cond_exec.bool_address())) {
+              continue;
+            }
+          } break;
+          case ucode::ControlFlowOpcode::kCondExecPred: {
+            const ucode::ControlFlowCondExecPredInstruction& cf_cond_exec_pred =
+                *reinterpret_cast<
+                    const ucode::ControlFlowCondExecPredInstruction*>(&cf_exec);
+            uint32_t exec_mask_invert =
+                cf_cond_exec_pred.condition() ? 0 : UINT32_MAX;
+            for (uint32_t lane = 0; lane < kLaneCount; ++lane) {
+              state.exec_mask[lane] = state.predicate[lane] ^ exec_mask_invert;
+            }
+            if (!IsAnyLaneSet(state.exec_mask)) {
+              continue;
+            }
+            exec_is_predicated = true;
+          } break;
+          default:
+            break;
+        }
+
+        for (uint32_t exec_index = 0; exec_index < cf_exec.count();
+             ++exec_index) {
+          uint32_t instruction_address = cf_exec.address() + exec_index;
+          const uint32_t* exec_instruction = ucode + 3 * instruction_address;
+          bool is_fetch = (cf_exec.sequence() >> (exec_index << 1)) & 0b01;
+          // The predication bits are the same in fetch and ALU instructions.
+          bool is_predicated, predicate_condition;
+          if (is_fetch) {
+            const ucode::FetchInstruction& fetch_instr =
+                *reinterpret_cast<const ucode::FetchInstruction*>(
+                    exec_instruction);
+            is_predicated = fetch_instr.is_predicated();
+            predicate_condition = fetch_instr.predicate_condition();
+          } else {
+            const ucode::AluInstruction& alu_instr =
+                *reinterpret_cast<const ucode::AluInstruction*>(
+                    exec_instruction);
+            is_predicated = alu_instr.is_predicated();
+            predicate_condition = alu_instr.predicate_condition();
+          }
+          bool is_masked = is_predicated || exec_is_predicated;
+          if (is_predicated) {
+            uint32_t predicate_invert = predicate_condition ? 0 : UINT32_MAX;
+            for (uint32_t lane = 0; lane < kLaneCount; ++lane) {
+              state.instruction_mask[lane] =
+                  (state.predicate[lane] ^ predicate_invert) &
+                  (exec_is_predicated ? state.exec_mask[lane] : UINT32_MAX);
+            }
+          } else if (exec_is_predicated) {
+            std::memcpy(state.instruction_mask, state.exec_mask,
+                        sizeof(state.instruction_mask));
+          } else {
+            std::memcpy(state.instruction_mask, state.all_ones,
+                        sizeof(state.instruction_mask));
+          }
+          if (is_masked && !IsAnyLaneSet(state.instruction_mask)) {
+            continue;
+          }
+          if (is_fetch) {
+            ExecuteFetchInstruction(&state, instruction_address);
+          } else {
+            ExecuteAluInstructionInterpreted(
+                state,
+                *reinterpret_cast<const ucode::AluInstruction*>(
+                    exec_instruction),
+                is_masked);
+          }
+        }
+
+        if (ucode::DoesControlFlowOpcodeEndShader(cf_opcode)) {
+          return;
+        }
+      } break;
+
+      case ucode::ControlFlowOpcode::kLoopStart: {
+        const ucode::ControlFlowLoopStartInstruction& cf_loop_start =
+            *reinterpret_cast<const ucode::ControlFlowLoopStartInstruction*>(
+                &cf_instr);
+        uint32_t depth = cf_loop_depths_[cf_index];
+        if (!cf_loop_start.is_repeat()) {
+          state.loop_iterators[depth] = 0;
+        }
+        if (state.loop_iterators[depth] >=
+            state.loop_constants[cf_loop_start.loop_id()].count) {
+          cf_index_next = cf_loop_start.address();
+          continue;
+        }
+        SetLoopAddress(state, depth, cf_loop_start.loop_id());
+      } break;
+
+      case ucode::ControlFlowOpcode::kLoopEnd: {
+        const ucode::ControlFlowLoopEndInstruction& cf_loop_end =
+            *reinterpret_cast<const ucode::ControlFlowLoopEndInstruction*>(
+                &cf_instr);
+        // The depth of the loop itself, not of the instructions inside it.
+        uint32_t depth = cf_loop_depths_[cf_index] - 1;
+        if (++state.loop_iterators[depth] <
+            state.loop_constants[cf_loop_end.loop_id()].count) {
+          SetLoopAddress(state, depth, cf_loop_end.loop_id());
+          cf_index_next = cf_loop_end.address();
+          continue;
+        }
+        state.loop_address = depth ? state.loop_addresses[depth - 1] : 0;
+      } break;
+
+      case ucode::ControlFlowOpcode::kCondJmp: {
+        const ucode::ControlFlowCondJmpInstruction& cf_cond_jmp =
+            *reinterpret_cast<const ucode::ControlFlowCondJmpInstruction*>(
+                &cf_instr);
+        if (cf_cond_jmp.is_unconditional() ||
+            cf_cond_jmp.condition() ==
+                TestBoolConstant(state, cf_cond_jmp.bool_address())) {
+          cf_index_next = cf_cond_jmp.address();
+        }
+      } break;
+
+      default:
+        break;
+    }
+  }
+}
+
+void BatchedShaderInterpreter::ExecuteAluInstructionInterpreted(
+    State& state, const ucode::AluInstruction& instr, bool is_masked) {
+  // Vector operation.
+  ucode::AluVectorOpcode vector_opcode = instr.vector_opcode();
+  const ucode::AluVectorOpcodeInfo& vector_opcode_info =
+      ucode::GetAluVectorOpcodeInfo(vector_opcode);
+  uint32_t vector_result_write_mask = instr.GetVectorOpResultWriteMask();
+  if (vector_result_write_mask || vector_opcode_info.changed_state) {
+    for (uint32_t i = 0; i < 3; ++i) {
+      if (!vector_opcode_info.operand_components_used[i]) {
+        continue;
+      }
+      uint32_t src_register = instr.src_reg(1 + i);
+      bool src_is_temp = instr.src_is_temp(1 + i);
+      uint32_t src_reg = src_is_temp
+                             ? ucode::AluInstruction::src_temp_reg(src_register)
+                             : src_register;
+      bool src_is_relative =
+          src_is_temp
+              ? ucode::AluInstruction::is_src_temp_relative(src_register)
+              : instr.src_const_is_addressed(1 + i);
+      bool src_absolute =
+          src_is_temp &&
+          ucode::AluInstruction::is_src_temp_value_absolute(src_register);
+      uint32_t src_swizzle = instr.src_swizzle(1 + i);
+      for (uint32_t j = 0; j < 4; ++j) {
+        LoadAluOperandComponent(
+            state, src_is_temp, src_reg, src_is_relative,
+            ucode::AluInstruction::GetSwizzledComponentIndex(src_swizzle, j),
+            src_absolute, instr.src_negate(1 + i), state.vector_operands[i][j]);
+      }
+    }
+
+    ExecuteAluVectorOperation(&state, uint32_t(vector_opcode));
+    if (vector_opcode_info.changed_state &
+        ucode::kAluOpChangedStatePredicate) {
+      StoreMasked(state, is_masked, state.operation_predicate,
+                  state.predicate);
+    }
+  }
+
+  // Scalar operation.
+  ucode::AluScalarOpcode scalar_opcode = instr.scalar_opcode();
+  const ucode::AluScalarOpcodeInfo& scalar_opcode_info =
+      ucode::GetAluScalarOpcodeInfo(scalar_opcode);
+  uint32_t scalar_src_swizzle = instr.src_swizzle(3);
+  bool scalar_src_negate = instr.src_negate(3);
+  switch (scalar_opcode_info.operand_count) {
+    case 1: {
+      // r#/c#.w or r#/c#.wx.
+      uint32_t src_register = instr.src_reg(3);
+      bool src_is_temp = instr.src_is_temp(3);
+      uint32_t src_reg = src_is_temp
+                             ? ucode::AluInstruction::src_temp_reg(src_register)
+                             : src_register;
+      bool src_is_relative =
+          src_is_temp
+              ? ucode::AluInstruction::is_src_temp_relative(src_register)
+              : instr.src_const_is_addressed(3);
+      bool src_absolute =
+          src_is_temp &&
+          ucode::AluInstruction::is_src_temp_value_absolute(src_register);
+      uint32_t component_count =
+          scalar_opcode_info.single_operand_is_two_component ? 2 : 1;
+      for (uint32_t i = 0; i < component_count; ++i) {
+        LoadAluOperandComponent(
+            state, src_is_temp, src_reg, src_is_relative,
+            ucode::AluInstruction::GetSwizzledComponentIndex(scalar_src_swizzle,
+                                                             (3 + i) & 3),
+            src_absolute, scalar_src_negate, state.scalar_operands[i]);
+      }
+    } break;
+    case 2:
+      // c#.w.
+      LoadAluOperandComponent(
+          state, false, instr.src_reg(3), instr.src_const_is_addressed(3),
+          ucode::AluInstruction::GetSwizzledComponentIndex(scalar_src_swizzle,
+                                                           3),
+          false, scalar_src_negate, state.scalar_operands[0]);
+      // r#.x.
+      LoadAluOperandComponent(
+          state, true, instr.scalar_const_reg_op_src_temp_reg(), false,
+          ucode::AluInstruction::GetSwizzledComponentIndex(scalar_src_swizzle,
+                                                           0),
+          false, scalar_src_negate, state.scalar_operands[1]);
+      break;
+  }
+
+  ExecuteAluScalarOperation(&state, uint32_t(scalar_opcode));
+  if (scalar_opcode != ucode::AluScalarOpcode::kRetainPrev) {
+    StoreMasked(state, is_masked, state.scalar_result, state.previous_scalar);
+  }
+  if (scalar_opcode_info.changed_state & ucode::kAluOpChangedStatePredicate) {
+    StoreMasked(state, is_masked, state.operation_predicate, state.predicate);
+  }
+
+  // Results.
+  float vector_result[4][kLaneCount];
+  for (uint32_t i = 0; i < 4; ++i) {
+    for (uint32_t lane = 0; lane < kLaneCount; ++lane) {
+      vector_result[i][lane] =
+          instr.vector_clamp()
+              ? xe::saturate_unsigned(state.vector_result[i][lane])
+              : state.vector_result[i][lane];
+    }
+  }
+  float scalar_result[kLaneCount];
+  for (uint32_t lane = 0; lane < kLaneCount; ++lane) {
+    scalar_result[lane] = instr.scalar_clamp()
+                              ? xe::saturate_unsigned(state.scalar_result[lane])
+                              : state.scalar_result[lane];
+  }
+  uint32_t scalar_result_write_mask = instr.GetScalarOpResultWriteMask();
+  if (instr.is_export()) {
+    uint32_t export_index;
+    switch (ucode::ExportRegister(instr.vector_dest())) {
+      case ucode::ExportRegister::kVSPosition:
+        export_index = kExportPosition;
+        break;
+      case ucode::ExportRegister::kVSPointSizeEdgeFlagKillVertex:
+        export_index = kExportPointSizeEdgeFlagKillVertex;
+        break;
+      default:
+        // Not needed for the draw extent.
+        return;
+    }
+    uint32_t export_constant_1_mask = instr.GetConstant1WriteMask();
+    uint32_t export_mask = vector_result_write_mask | scalar_result_write_mask |
+                           instr.GetConstant0WriteMask() |
+                           export_constant_1_mask;
+    for (uint32_t i = 0; i < 4; ++i) {
+      uint32_t export_component_bit = UINT32_C(1) << i;
+      if (!(export_mask & export_component_bit)) {
+        continue;
+      }
+      const float* export_component;
+      if (vector_result_write_mask & export_component_bit) {
+        export_component = vector_result[i];
+      } else if (scalar_result_write_mask & export_component_bit) {
+        export_component = scalar_result;
+      } else if (export_constant_1_mask & export_component_bit) {
+        export_component = state.one;
+      } else {
+        static const float zero[kLaneCount] = {};
+        export_component = zero;
+      }
+      StoreMasked(state, is_masked, export_component,
+                  state.exports[export_index][i]);
+      StoreMasked(state, is_masked, state.all_ones,
+                  state.exports_written[export_index][i]);
+    }
+  } else {
+    uint32_t temp_index_mask = xenos::kMaxShaderTempRegisters - 1;
+    if (vector_result_write_mask) {
+      auto& vector_dest =
+          state.temps[uint32_t(int32_t(instr.vector_dest()) +
+                               (instr.is_vector_dest_relative()
+                                    ? state.loop_address
+                                    : 0)) &
+                      temp_index_mask];
+      for (uint32_t i = 0; i < 4; ++i) {
+        if (vector_result_write_mask & (UINT32_C(1) << i)) {
+          StoreMasked(state, is_masked, vector_result[i], vector_dest[i]);
+        }
+      }
+    }
+    if (scalar_result_write_mask) {
+      auto& scalar_dest =
+          state.temps[uint32_t(int32_t(instr.scalar_dest()) +
+                               (instr.is_scalar_dest_relative()
+                                    ? state.loop_address
+                                    : 0)) &
+                      temp_index_mask];
+      for (uint32_t i = 0; i < 4; ++i) {
+        if (scalar_result_write_mask & (UINT32_C(1) << i)) {
+          StoreMasked(state, is_masked, scalar_result, scalar_dest[i]);
+        }
+      }
+    }
+  }
+}
+
+void BatchedShaderInterpreter::ExecuteAluVectorOperation(State* state,
+                                                         uint32_t opcode) {
+  for (uint32_t lane = 0; lane < kLaneCount; ++lane) {
+    float operands[3][4];
+    for (uint32_t i = 0; i < 3; ++i) {
+      for (uint32_t j = 0; j < 4; ++j) {
+        operands[i][j] = state->vector_operands[i][j][lane];
+      }
+    }
+    float result[4] = {};
+    bool predicate = state->predicate[lane] != 0;
+    // a0-relative addressing is not supported by the compiler, no need to
+    // store the address register.
+    int32_t address_register = 0;
+    ShaderInterpreter::ExecuteAluVectorOperation(
+        ucode::AluVectorOpcode(opcode), operands, result, predicate,
+        address_register);
+    for (uint32_t i = 0; i < 4; ++i) {
+      state->vector_result[i][lane] = result[i];
+    }
+    state->operation_predicate[lane] = predicate ? UINT32_MAX : 0;
+  }
+}
+
+void BatchedShaderInterpreter::ExecuteAluScalarOperation(State* state,
+                                                         uint32_t opcode) {
+  for (uint32_t lane = 0; lane < kLaneCount; ++lane) {
+    float operands[2] = {state->scalar_operands[0][lane],
+                         state->scalar_operands[1][lane]};
+    bool predicate = state->predicate[lane] != 0;
+    int32_t address_register = 0;
+    state->scalar_result[lane] = ShaderInterpreter::ExecuteAluScalarOperation(
+        ucode::AluScalarOpcode(opcode), operands,
+        state->previous_scalar[lane], predicate, address_register);
+    state->operation_predicate[lane] = predicate ? UINT32_MAX : 0;
+  }
+}
+
+void BatchedShaderInterpreter::ExecuteFetchInstruction(
+    State* state, uint32_t instruction_address) {
+  const ucode::FetchInstruction& fetch_instr =
+      *reinterpret_cast<const ucode::FetchInstruction*>(
+          state->ucode + 3 * instruction_address);
+  const RegisterFile& register_file = *state->register_file;
+  uint32_t temp_index_mask = xenos::kMaxShaderTempRegisters - 1;
+  uint32_t dest =
+      (fetch_instr.dest() +
+       (fetch_instr.is_dest_relative() ? state->loop_address : 0)) &
+      temp_index_mask;
+  uint32_t dest_swizzle = fetch_instr.dest_swizzle();
+  for (uint32_t lane = 0; lane < kLaneCount; ++lane) {
+    if (!state->instruction_mask[lane]) {
+      continue;
+    }
+    // Not supporting texture fetching (very complex), like the interpreter.
+    float result[4] = {};
+    if (fetch_instr.opcode() == ucode::FetchOpcode::kVertexFetch) {
+      const ucode::VertexFetchInstruction& instr = fetch_instr.vertex_fetch();
+      ucode::VertexFetchInstruction& vfetch_full_last =
+          state->vfetch_full_last[lane];
+      if (!instr.is_mini_fetch()) {
+        vfetch_full_last = instr;
+      }
+      xenos::xe_gpu_vertex_fetch_t fetch_constant =
+          *reinterpret_cast<const xenos::xe_gpu_vertex_fetch_t*>(
+              &register_file[XE_GPU_REG_SHADER_CONSTANT_FETCH_00_0 +
+                             vfetch_full_last.fetch_constant_index()]);
+      if (!instr.is_mini_fetch()) {
+        uint32_t src =
+            (instr.src() +
+             (instr.is_src_relative() ? state->loop_address : 0)) &
+            temp_index_mask;
+        uint32_t vertex_index = uint32_t(
+            std::floor(state->temps[src][instr.src_swizzle()][lane] +
+                       (instr.is_index_rounded() ? 0.5f : 0.0f)));
+        state->vfetch_address_dwords[lane] =
+            instr.stride() * vertex_index + fetch_constant.address;
+      }
+      ShaderInterpreter::FetchVertexData(
+          *state->memory, state->trace_writer, instr, fetch_constant,
+          state->vfetch_address_dwords[lane], result);
+    }
+    for (uint32_t i = 0; i < 4; ++i) {
+      ucode::FetchDestinationSwizzle component_swizzle =
+          ucode::GetFetchDestinationComponentSwizzle(dest_swizzle, i);
+      float& dest_component = state->temps[dest][i][lane];
+      switch (component_swizzle) {
+        case ucode::FetchDestinationSwizzle::kX:
+          dest_component = result[0];
+          break;
+        case ucode::FetchDestinationSwizzle::kY:
+          dest_component = result[1];
+          break;
+        case ucode::FetchDestinationSwizzle::kZ:
+          dest_component = result[2];
+          break;
+        case ucode::FetchDestinationSwizzle::kW:
+          dest_component = result[3];
+          break;
+        case ucode::FetchDestinationSwizzle::k1:
+          dest_component = 1.0f;
+          break;
+        case ucode::FetchDestinationSwizzle::kKeep:
+          break;
+        default:
+          dest_component = 0.0f;
+          break;
+      }
+    }
+  }
+}
+
+}  // namespace gpu
+}  // namespace xe
@@ -0,0 +1,177 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_BATCHED_SHADER_INTERPRETER_H_
+#define XENIA_GPU_BATCHED_SHADER_INTERPRETER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "xenia/gpu/register_file.h"
+#include "xenia/gpu/shader.h"
+#include "xenia/gpu/trace_writer.h"
+#include "xenia/gpu/ucode.h"
+#include "xenia/gpu/xenos.h"
+#include "xenia/memory.h"
+
+namespace xe {
+namespace gpu {
+
+// Executes vertex shaders for kLaneCount vertices at once, with the same
+// results as ShaderInterpreter. The vertices are processed in lanes of host
+// vectors, with control flow depending on the per-vertex predicate (conditional
+// execs and instruction predication) handled via lane masks.
+// Where supported, the shaders are compiled to host SIMD code, otherwise the
+// instructions are interpreted for all lanes at once. Without generated code,
+// the ALU operations are done by ShaderInterpreter's functions for each lane,
+// and with it, the less common ones are. Vertex fetching is always done by the
+// interpreter's functions.
+// Shaders with control flow that may diverge between the vertices in other
+// ways (predicated jumps, calls and loop breaks, and predicated execs ending
+// the shader), or with constants addressed relatively to a0, are not supported
+// - the interpreter needs to be used for them.
+class BatchedShaderInterpreter {
+ public:
+  static constexpr uint32_t kLaneCountLog2 = 3;
+  static constexpr uint32_t kLaneCount = UINT32_C(1) << kLaneCountLog2;
+
+  enum : uint32_t {
+    kExportPosition,
+    kExportPointSizeEdgeFlagKillVertex,
+
+    kExportCount,
+  };
+
+  // Float constant rows are offset so aL-relative indices from -256 can be used
+  // directly.
+  static constexpr uint32_t kFloatConstantRowOffset = 256;
+  static constexpr uint32_t kFloatConstantRowCount =
+      kFloatConstantRowOffset + 512;
+
+  // Structure of arrays with a value for each lane, accessed by the generated
+  // code by offsets. Boolean values are stored as ~0 or 0.
+  struct alignas(32) State {
+    // For both inputs (the vertex index in r0.x) and locals.
+    float temps[xenos::kMaxShaderTempRegisters][4][kLaneCount] = {};
+
+    // Exports of the registers needed for estimating the draw extent, and
+    // whether each component has been written.
+    float exports[kExportCount][4][kLaneCount] = {};
+    uint32_t exports_written[kExportCount][4][kLaneCount] = {};
+
+    float previous_scalar[kLaneCount] = {};
+    uint32_t predicate[kLaneCount] = {};
+    // The lanes for which the current exec and the current instruction are
+    // executed.
+    uint32_t exec_mask[kLaneCount] = {};
+    uint32_t instruction_mask[kLaneCount] = {};
+
+    // Operands and results of the operations, for passing between the
+    // generated code and the interpreter's functions called from it.
+    float vector_operands[3][4][kLaneCount] = {};
+    float vector_result[4][kLaneCount] = {};
+    float scalar_operands[2][kLaneCount] = {};
+    float scalar_result[kLaneCount] = {};
+    uint32_t operation_predicate[kLaneCount] = {};
+
+    // Constants used by the generated code.
+    uint32_t sign_mask[kLaneCount] = {};
+    uint32_t abs_mask[kLaneCount] = {};
+    uint32_t exponent_mask[kLaneCount] = {};
+    uint32_t all_ones[kLaneCount] = {};
+    float one[kLaneCount] = {};
+
+    uint32_t vfetch_address_dwords[kLaneCount] = {};
+    ucode::VertexFetchInstruction vfetch_full_last[kLaneCount] = {};
+
+    // Uniform control flow state.
+    uint32_t loop_iterators[4] = {};
+    int32_t loop_addresses[4] = {};
+    // aL of the innermost loop, or 0 outside loops.
+    int32_t loop_address = 0;
+
+    // Copied from the registers by LoadConstants. Float constants are flushed,
+    // and the rows outside the range available to the shader are zero.
+    uint32_t bool_constants[256 / 32] = {};
+    xenos::LoopConstant loop_constants[32] = {};
+    float float_constants[kFloatConstantRowCount][4] = {};
+
+    const uint32_t* ucode = nullptr;
+    const RegisterFile* register_file = nullptr;
+    const Memory* memory = nullptr;
+    TraceWriter* trace_writer = nullptr;
+
+    State();
+  };
+
+  // Returns nullptr if the shader is not supported. If generate_code is false,
+  // or code generation is not supported on the host, the shader will be
+  // interpreted.
+  static std::unique_ptr<BatchedShaderInterpreter> Compile(
+      const Shader& shader, bool generate_code = true);
+
+  BatchedShaderInterpreter(const BatchedShaderInterpreter& interpreter) =
+      delete;
+  BatchedShaderInterpreter& operator=(
+      const BatchedShaderInterpreter& interpreter) = delete;
+  ~BatchedShaderInterpreter();
+
+  // Copies the vertex shader constants and sets up vertex fetching, needs to be
+  // done before executing shaders for a draw.
+  static void LoadConstants(State& state, const RegisterFile& register_file,
+                            const Memory& memory, TraceWriter* trace_writer);
+
+  // Executes the shader for kLaneCount vertices with the vertex indices in
+  // temps[0][0], resetting the exports and the rest of the per-invocation
+  // state like ShaderInterpreter::Execute.
+  void Execute(State& state) const;
+
+  bool is_code_generated() const { return function_ != nullptr; }
+
+ private:
+  // Xbyak code generator, only defined for the supported hosts.
+  class Emitter;
+
+  explicit BatchedShaderInterpreter(const Shader& shader);
+
+  // Validates the control flow and the ALU instructions, and finds the loop
+  // depths of the control flow instructions, which are known statically for
+  // the supported shaders.
+  bool AnalyzeShader(uint32_t cf_count);
+  // Returns false if code generation is not supported on the host.
+  bool GenerateCode();
+
+  // Execution of the batch without generated code.
+  void ExecuteInterpreted(State& state) const;
+  static void ExecuteAluInstructionInterpreted(
+      State& state, const ucode::AluInstruction& instr, bool is_masked);
+
+  // Functions called for all lanes from the generated code and the
+  // interpreted execution, reading the operands from and writing the results
+  // to the State.
+  static void ExecuteAluVectorOperation(State* state, uint32_t opcode);
+  static void ExecuteAluScalarOperation(State* state, uint32_t opcode);
+  // For the lanes in instruction_mask.
+  static void ExecuteFetchInstruction(State* state,
+                                      uint32_t instruction_address);
+
+  std::vector<uint32_t> ucode_;
+  std::vector<ucode::ControlFlowInstruction> cf_instructions_;
+  // The number of loops containing each control flow instruction.
+  std::vector<uint32_t> cf_loop_depths_;
+  std::unique_ptr<Emitter> emitter_;
+  void (*function_)(State* state) = nullptr;
+};
+
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_BATCHED_SHADER_INTERPRETER_H_
@@ -0,0 +1,961 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/batched_shader_interpreter.h"
+
+#include "xenia/base/platform.h"
+
+#if XE_ARCH_AMD64
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "xenia/base/assert.h"
+#include "xenia/gpu/shader_interpreter.h"
+
+#define XBYAK_NO_OP_NAMES
+#include "third_party/xbyak/xbyak/xbyak.h"
+#include "third_party/xbyak/xbyak/xbyak_util.h"
+
+namespace xe {
+namespace gpu {
+
+class BatchedShaderInterpreter::Emitter : public Xbyak::CodeGenerator {
+ public:
+  Emitter()
+      : Xbyak::CodeGenerator(Xbyak::DEFAULT_MAX_CODE_SIZE, Xbyak::AutoGrow) {}
+
+  // The control flow must be validated by AnalyzeShader. Returns false if the
+  // shader can't be compiled.
+  bool Emit(const uint32_t* ucode,
+            const ucode::ControlFlowInstruction* cf_instructions,
+            const uint32_t* cf_loop_depths, uint32_t cf_count);
+
+ private:
+  // _CMP_ predicates.
+  static constexpr uint8_t kCmpEqOq = 0x00;
+  static constexpr uint8_t kCmpNeqUq = 0x04;
+  static constexpr uint8_t kCmpGeOq = 0x1D;
+  static constexpr uint8_t kCmpGtOq = 0x1E;
+  // _MM_FROUND_ modes.
+  static constexpr uint8_t kRoundFloor = 0x1;
+  static constexpr uint8_t kRoundTrunc = 0x3;
+
+  static_assert(sizeof(State::temps[0]) == UINT32_C(1) << 7,
+                "Relative temporary register offsets are calculated with a "
+                "shift by 7");
+
+  Xbyak::Address StateVector(size_t offset) { return ptr[rbx + offset]; }
+  Xbyak::Address StateDword(size_t offset) { return dword[rbx + offset]; }
+
+  // For relative addressing of temporary registers, rax must be set up by
+  // CalculateRelativeTempOffset.
+  void CalculateRelativeTempOffset(uint32_t reg) {
+    mov(eax, StateDword(offsetof(State, loop_address)));
+    add(eax, reg);
+    and_(eax, xenos::kMaxShaderTempRegisters - 1);
+    shl(eax, 7);
+  }
+  Xbyak::Address TempComponent(uint32_t reg, bool is_relative,
+                               uint32_t component) {
+    size_t offset =
+        offsetof(State, temps) + sizeof(State::temps[0][0]) * component;
+    if (is_relative) {
+      return ptr[rbx + rax + offset];
+    }
+    return ptr[rbx + offset + sizeof(State::temps[0]) * reg];
+  }
+  // For relative addressing of float constants, rax must be set up by
+  // CalculateRelativeConstantOffset.
+  void CalculateRelativeConstantOffset(uint32_t address) {
+    mov(eax, StateDword(offsetof(State, loop_address)));
+    add(eax, kFloatConstantRowOffset + address);
+    shl(eax, 4);
+  }
+  Xbyak::Address ConstantComponent(uint32_t address, bool is_relative,
+                                   uint32_t component) {
+    size_t offset =
+        offsetof(State, float_constants) + sizeof(float) * component;
+    if (is_relative) {
+      return dword[rbx + rax + offset];
+    }
+    return dword[rbx + offset +
+                 sizeof(State::float_constants[0]) *
+                     (kFloatConstantRowOffset + address)];
+  }
+  Xbyak::Address VectorOperand(uint32_t operand, uint32_t component) {
+    return StateVector(offsetof(State, vector_operands) +
+                       sizeof(State::vector_operands[0]) * operand +
+                       sizeof(State::vector_operands[0][0]) * component);
+  }
+  Xbyak::Address VectorResult(uint32_t component) {
+    return StateVector(offsetof(State, vector_result) +
+                       sizeof(State::vector_result[0]) * component);
+  }
+  Xbyak::Address ScalarOperand(uint32_t operand) {
+    return StateVector(offsetof(State, scalar_operands) +
+                       sizeof(State::scalar_operands[0]) * operand);
+  }
+
+  // Takes the value in ymm0, applies the flushing of denormals and the
+  // modifiers like ShaderInterpreter::ExecuteAluInstruction, clobbers ymm1,
+  // ymm2 and ymm4.
+  void ModifyAluOperand(bool flush, bool absolute, bool negate);
+  // ymm0 = a * b with the Direct3D 9 0 * anything = +0 rule, clobbers ymm1 to
+  // ymm4.
+  void MultiplyD3D9(const Xbyak::Address& a, const Xbyak::Address& b);
+  // ymm0 = a >= b ? a : b, clobbers ymm1 and ymm2.
+  void MaxGe(const Xbyak::Address& a, const Xbyak::Address& b);
+  // ymm0 = float(a <comparison> 0).
+  void CompareWithZero(const Xbyak::Address& a, uint8_t comparison);
+  // Applies saturate_unsigned to ymm0, clobbers ymm4.
+  void Saturate();
+
+  // Writes instruction_mask and jumps to skip_label if no lanes execute the
+  // instruction.
+  void EmitInstructionMask(bool is_predicated, bool predicate_condition,
+                           Xbyak::Label& skip_label);
+  // Stores ymm0 for the lanes in instruction_mask, clobbers ymm5.
+  void StoreMasked(const Xbyak::Address& address);
+  void CallOut(const void* function, uint32_t argument);
+
+  // Loads the component of an r# or a c# operand to ymm0 with the modifiers
+  // applied. For relative addressing, rax must be set up.
+  void LoadAluOperandComponent(bool is_temp, uint32_t reg, bool is_relative,
+                               uint32_t component, bool absolute,
+                               bool negate);
+  // Sets up rax for the operand if it's addressed relatively, returns false if
+  // it's addressed relatively to a0.
+  bool CalculateAluOperandOffset(const ucode::AluInstruction& instr,
+                                 uint32_t src_index, uint32_t& reg_out,
+                                 bool& is_relative_out);
+
+  bool EmitAluInstruction(const ucode::AluInstruction& instr);
+  // Returns false if a0-relative addressing is used.
+  bool EmitLoadVectorOperands(const ucode::AluInstruction& instr);
+  bool EmitLoadScalarOperands(const ucode::AluInstruction& instr);
+  void EmitVectorOperation(ucode::AluVectorOpcode opcode);
+  void EmitScalarOperation(ucode::AluScalarOpcode opcode);
+
+  // Sets loop_addresses[depth] and loop_address from the iterator in eax.
+  void EmitLoopAddress(uint32_t depth, uint32_t loop_id);
+  void EmitBoolConstantTest(uint32_t bool_address);
+
+  // Whether the current exec is predicated, so the instructions are executed
+  // only for the lanes in exec_mask.
+  bool exec_is_predicated_ = false;
+  // Whether the current instruction is executed only for some lanes.
+  bool instruction_is_masked_ = false;
+};
+
+void BatchedShaderInterpreter::Emitter::ModifyAluOperand(bool flush,
+                                                         bool absolute,
+                                                         bool negate) {
+  if (flush) {
+    vxorps(ymm4, ymm4, ymm4);
+    vandps(ymm1, ymm0, StateVector(offsetof(State, exponent_mask)));
+    vcmpps(ymm1, ymm1, ymm4, kCmpNeqUq);
+    vandps(ymm2, ymm0, StateVector(offsetof(State, sign_mask)));
+    vblendvps(ymm0, ymm2, ymm0, ymm1);
+  }
+  if (absolute) {
+    vandps(ymm0, ymm0, StateVector(offsetof(State, abs_mask)));
+  }
+  if (negate) {
+    vxorps(ymm0, ymm0, StateVector(offsetof(State, sign_mask)));
+  }
+}
+
+void BatchedShaderInterpreter::Emitter::MultiplyD3D9(const Xbyak::Address& a,
+                                                     const Xbyak::Address& b) {
+  vmovups(ymm0, a);
+  vmovups(ymm1, b);
+  vxorps(ymm4, ymm4, ymm4);
+  vcmpps(ymm2, ymm0, ymm4, kCmpNeqUq);
+  vcmpps(ymm3, ymm1, ymm4, kCmpNeqUq);
+  vandps(ymm2, ymm2, ymm3);
+  vmulps(ymm0, ymm0, ymm1);
+  vandps(ymm0, ymm0, ymm2);
+}
+
+void BatchedShaderInterpreter::Emitter::MaxGe(const Xbyak::Address& a,
+                                              const Xbyak::Address& b) {
+  vmovups(ymm0, a);
+  vmovups(ymm1, b);
+  vcmpps(ymm2, ymm0, ymm1, kCmpGeOq);
+  vblendvps(ymm0, ymm1, ymm0, ymm2);
+}
+
+void BatchedShaderInterpreter::Emitter::CompareWithZero(const Xbyak::Address& a,
+                                                        uint8_t comparison) {
+  vxorps(ymm4, ymm4, ymm4);
+  vmovups(ymm0, a);
+  vcmpps(ymm0, ymm0, ymm4, comparison);
+  vandps(ymm0, ymm0, StateVector(offsetof(State, one)));
+}
+
+void BatchedShaderInterpreter::Emitter::Saturate() {
+  // vmaxps and vminps return the second operand for NaN and equal values,
+  // like std::max(0.0f, value) and std::min(1.0f, value).
+  vxorps(ymm4, ymm4, ymm4);
+  vmaxps(ymm0, ymm0, ymm4);
+  vminps(ymm0, ymm0, StateVector(offsetof(State, one)));
+}
+
+void BatchedShaderInterpreter::Emitter::EmitInstructionMask(
+    bool is_predicated, bool predicate_condition, Xbyak::Label& skip_label) {
+  instruction_is_masked_ = is_predicated || exec_is_predicated_;
+  if (!instruction_is_masked_) {
+    vmovups(ymm5, StateVector(offsetof(State, all_ones)));
+    vmovups(StateVector(offsetof(State, instruction_mask)), ymm5);
+    return;
+  }
+  if (is_predicated) {
+    vmovups(ymm5, StateVector(offsetof(State, predicate)));
+    if (!predicate_condition) {
+      vxorps(ymm5, ymm5, StateVector(offsetof(State, all_ones)));
+    }
+    if (exec_is_predicated_) {
+      vandps(ymm5, ymm5, StateVector(offsetof(State, exec_mask)));
+    }
+  } else {
+    vmovups(ymm5, StateVector(offsetof(State, exec_mask)));
+  }
+  vmovups(StateVector(offsetof(State, instruction_mask)), ymm5);
+  vtestps(ymm5, ymm5);
+  jz(skip_label, T_NEAR);
+}
+
+void BatchedShaderInterpreter::Emitter::StoreMasked(
+    const Xbyak::Address& address) {
+  if (!instruction_is_masked_) {
+    vmovups(address, ymm0);
+    return;
+  }
+  vmovups(ymm5, StateVector(offsetof(State, instruction_mask)));
+  vmaskmovps(address, ymm5, ymm0);
+}
+
+void BatchedShaderInterpreter::Emitter::CallOut(const void* function,
+                                                uint32_t argument) {
+#if XE_PLATFORM_WIN32
+  mov(rcx, rbx);
+  mov(edx, argument);
+#else
+  mov(rdi, rbx);
+  mov(esi, argument);
+#endif
+  mov(rax, size_t(function));
+  vzeroupper();
+  call(rax);
+}
+
+void BatchedShaderInterpreter::Emitter::LoadAluOperandComponent(
+    bool is_temp, uint32_t reg, bool is_relative, uint32_t component,
+    bool absolute, bool negate) {
+  if (is_temp) {
+    vmovups(ymm0, TempComponent(reg, is_relative, component));
+    ModifyAluOperand(true, absolute, negate);
+  } else {
+    // Flushed in LoadConstants.
+    vbroadcastss(ymm0, ConstantComponent(reg, is_relative, component));
+    ModifyAluOperand(false, false, negate);
+  }
+}
+
+bool BatchedShaderInterpreter::Emitter::CalculateAluOperandOffset(
+    const ucode::AluInstruction& instr, uint32_t src_index, uint32_t& reg_out,
+    bool& is_relative_out) {
+  uint32_t src_register = instr.src_reg(src_index);
+  if (instr.src_is_temp(src_index)) {
+    reg_out = ucode::AluInstruction::src_temp_reg(src_register);
+    is_relative_out = ucode::AluInstruction::is_src_temp_relative(src_register);
+    if (is_relative_out) {
+      CalculateRelativeTempOffset(reg_out);
+    }
+  } else {
+    reg_out = src_register;
+    is_relative_out = instr.src_const_is_addressed(src_index);
+    if (is_relative_out) {
+      if (instr.is_const_address_register_relative()) {
+        return false;
+      }
+      CalculateRelativeConstantOffset(reg_out);
+    }
+  }
+  return true;
+}
+
+bool BatchedShaderInterpreter::Emitter::EmitLoadVectorOperands(
+    const ucode::AluInstruction& instr) {
+  const ucode::AluVectorOpcodeInfo& opcode_info =
+      ucode::GetAluVectorOpcodeInfo(instr.vector_opcode());
+  for (uint32_t i = 0; i < 3; ++i) {
+    if (!opcode_info.operand_components_used[i]) {
+      continue;
+    }
+    uint32_t src_reg;
+    bool src_is_relative;
+    if (!CalculateAluOperandOffset(instr, 1 + i, src_reg, src_is_relative)) {
+      return false;
+    }
+    bool src_is_temp = instr.src_is_temp(1 + i);
+    bool src_absolute =
+        src_is_temp && ucode::AluInstruction::is_src_temp_value_absolute(
+                           instr.src_reg(1 + i));
+    uint32_t src_swizzle = instr.src_swizzle(1 + i);
+    for (uint32_t j = 0; j < 4; ++j) {
+      LoadAluOperandComponent(
+          src_is_temp, src_reg, src_is_relative,
+          ucode::AluInstruction::GetSwizzledComponentIndex(src_swizzle, j),
+          src_absolute, instr.src_negate(1 + i));
+      vmovups(VectorOperand(i, j), ymm0);
+    }
+  }
+  return true;
+}
+
+bool BatchedShaderInterpreter::Emitter::EmitLoadScalarOperands(
+    const ucode::AluInstruction& instr) {
+  const ucode::AluScalarOpcodeInfo& opcode_info =
+      ucode::GetAluScalarOpcodeInfo(instr.scalar_opcode());
+  uint32_t src_swizzle = instr.src_swizzle(3);
+  bool src_negate = instr.src_negate(3);
+  switch (opcode_info.operand_count) {
+    case 1: {
+      // r#/c#.w or r#/c#.wx.
+      uint32_t src_reg;
+      bool src_is_relative;
+      if (!CalculateAluOperandOffset(instr, 3, src_reg, src_is_relative)) {
+        return false;
+      }
+      bool src_is_temp = instr.src_is_temp(3);
+      bool src_absolute =
+          src_is_temp &&
+          ucode::AluInstruction::is_src_temp_value_absolute(instr.src_reg(3));
+      uint32_t component_count =
+          opcode_info.single_operand_is_two_component ? 2 : 1;
+      for (uint32_t i = 0; i < component_count; ++i) {
+        LoadAluOperandComponent(
+            src_is_temp, src_reg, src_is_relative,
+            ucode::AluInstruction::GetSwizzledComponentIndex(src_swizzle,
+                                                             (3 + i) & 3),
+            src_absolute, src_negate);
+        vmovups(ScalarOperand(i), ymm0);
+      }
+    } break;
+    case 2: {
+      // c#.w.
+      bool constant_is_relative = instr.src_const_is_addressed(3);
+      if (constant_is_relative) {
+        if (instr.is_const_address_register_relative()) {
+          return false;
+        }
+        CalculateRelativeConstantOffset(instr.src_reg(3));
+      }
+      LoadAluOperandComponent(
+          false, instr.src_reg(3), constant_is_relative,
+          ucode::AluInstruction::GetSwizzledComponentIndex(src_swizzle, 3),
+          false, src_negate);
+      vmovups(ScalarOperand(0), ymm0);
+      // r#.x.
+      LoadAluOperandComponent(
+          true, instr.scalar_const_reg_op_src_temp_reg(), false,
+          ucode::AluInstruction::GetSwizzledComponentIndex(src_swizzle, 0),
+          false, src_negate);
+      vmovups(ScalarOperand(1), ymm0);
+    } break;
+  }
+  return true;
+}
+
+void BatchedShaderInterpreter::Emitter::EmitVectorOperation(
+    ucode::AluVectorOpcode opcode) {
+  switch (opcode) {
+    case ucode::AluVectorOpcode::kAdd:
+    case ucode::AluVectorOpcode::kMul:
+    case ucode::AluVectorOpcode::kMax:
+    case ucode::AluVectorOpcode::kMaxA:
+    case ucode::AluVectorOpcode::kMin:
+    case ucode::AluVectorOpcode::kSeq:
+    case ucode::AluVectorOpcode::kSgt:
+    case ucode::AluVectorOpcode::kSge:
+    case ucode::AluVectorOpcode::kSne:
+    case ucode::AluVectorOpcode::kFrc:
+    case ucode::AluVectorOpcode::kTrunc:
+    case ucode::AluVectorOpcode::kFloor:
+    case ucode::AluVectorOpcode::kMad:
+    case ucode::AluVectorOpcode::kCndEq:
+    case ucode::AluVectorOpcode::kCndGe:
+    case ucode::AluVectorOpcode::kCndGt: {
+      // Per-component operations.
+      for (uint32_t i = 0; i < 4; ++i) {
+        switch (opcode) {
+          case ucode::AluVectorOpcode::kAdd:
+            vmovups(ymm0, VectorOperand(0, i));
+            vaddps(ymm0, ymm0, VectorOperand(1, i));
+            break;
+          case ucode::AluVectorOpcode::kMul:
+            MultiplyD3D9(VectorOperand(0, i), VectorOperand(1, i));
+            break;
+          case ucode::AluVectorOpcode::kMax:
+          case ucode::AluVectorOpcode::kMaxA:
+            // a0 is not needed as a0-relative addressing is not supported.
+            MaxGe(VectorOperand(0, i), VectorOperand(1, i));
+            break;
+          case ucode::AluVectorOpcode::kMin:
+            // a < b ? a : b.
+            vmovups(ymm0, VectorOperand(0, i));
+            vminps(ymm0, ymm0, VectorOperand(1, i));
+            break;
+          case ucode::AluVectorOpcode::kSeq:
+          case ucode::AluVectorOpcode::kSgt:
+          case ucode::AluVectorOpcode::kSge:
+          case ucode::AluVectorOpcode::kSne: {
+            uint8_t comparison;
+            switch (opcode) {
+              case ucode::AluVectorOpcode::kSeq:
+                comparison = kCmpEqOq;
+                break;
+              case ucode::AluVectorOpcode::kSgt:
+                comparison = kCmpGtOq;
+                break;
+              case ucode::AluVectorOpcode::kSge:
+                comparison = kCmpGeOq;
+                break;
+              default:
+                comparison = kCmpNeqUq;
+                break;
+            }
+            vmovups(ymm0, VectorOperand(0, i));
+            vcmpps(ymm0, ymm0, VectorOperand(1, i), comparison);
+            vandps(ymm0, ymm0, StateVector(offsetof(State, one)));
+          } break;
+          case ucode::AluVectorOpcode::kFrc:
+            vmovups(ymm0, VectorOperand(0, i));
+            vroundps(ymm1, ymm0, kRoundFloor);
+            vsubps(ymm0, ymm0, ymm1);
+            break;
+          case ucode::AluVectorOpcode::kTrunc:
+            vroundps(ymm0, VectorOperand(0, i), kRoundTrunc);
+            break;
+          case ucode::AluVectorOpcode::kFloor:
+            vroundps(ymm0, VectorOperand(0, i), kRoundFloor);
+            break;
+          case ucode::AluVectorOpcode::kMad:
+            MultiplyD3D9(VectorOperand(0, i), VectorOperand(1, i));
+            vaddps(ymm0, ymm0, VectorOperand(2, i));
+            break;
+          default: {
+            // cnd*: operand 0 compared with 0 ? operand 1 : operand 2.
+            uint8_t comparison;
+            switch (opcode) {
+              case ucode::AluVectorOpcode::kCndEq:
+                comparison = kCmpEqOq;
+                break;
+              case ucode::AluVectorOpcode::kCndGe:
+                comparison = kCmpGeOq;
+                break;
+              default:
+                comparison = kCmpGtOq;
+                break;
+            }
+            vxorps(ymm4, ymm4, ymm4);
+            vmovups(ymm1, VectorOperand(0, i));
+            vcmpps(ymm1, ymm1, ymm4, comparison);
+            vmovups(ymm0, VectorOperand(2, i));
+            vblendvps(ymm0, ymm0, VectorOperand(1, i), ymm1);
+          } break;
+        }
+        vmovups(VectorResult(i), ymm0);
+      }
+    } break;
+
+    case ucode::AluVectorOpcode::kDp4:
+    case ucode::AluVectorOpcode::kDp3:
+    case ucode::AluVectorOpcode::kDp2Add: {
+      uint32_t component_count;
+      switch (opcode) {
+        case ucode::AluVectorOpcode::kDp4:
+          component_count = 4;
+          break;
+        case ucode::AluVectorOpcode::kDp3:
+          component_count = 3;
+          break;
+        default:
+          component_count = 2;
+          break;
+      }
+      // Adding in the same order as the interpreter, starting from +0 because
+      // +0 + -0 must be +0.
+      vxorps(ymm5, ymm5, ymm5);
+      for (uint32_t i = 0; i < component_count; ++i) {
+        MultiplyD3D9(VectorOperand(0, i), VectorOperand(1, i));
+        vaddps(ymm5, ymm5, ymm0);
+      }
+      if (opcode == ucode::AluVectorOpcode::kDp2Add) {
+        vaddps(ymm5, ymm5, VectorOperand(2, 0));
+      }
+      for (uint32_t i = 0; i < 4; ++i) {
+        vmovups(VectorResult(i), ymm5);
+      }
+    } break;
+
+    default:
+      CallOut(reinterpret_cast<const void*>(
+                  &BatchedShaderInterpreter::ExecuteAluVectorOperation),
+              uint32_t(opcode));
+      break;
+  }
+}
+
+void BatchedShaderInterpreter::Emitter::EmitScalarOperation(
+    ucode::AluScalarOpcode opcode) {
+  Xbyak::Address previous_scalar =
+      StateVector(offsetof(State, previous_scalar));
+  switch (opcode) {
+    case ucode::AluScalarOpcode::kAdds:
+    case ucode::AluScalarOpcode::kAddsc0:
+    case ucode::AluScalarOpcode::kAddsc1:
+      vmovups(ymm0, ScalarOperand(0));
+      vaddps(ymm0, ymm0, ScalarOperand(1));
+      break;
+    case ucode::AluScalarOpcode::kAddsPrev:
+      vmovups(ymm0, ScalarOperand(0));
+      vaddps(ymm0, ymm0, previous_scalar);
+      break;
+    case ucode::AluScalarOpcode::kMuls:
+    case ucode::AluScalarOpcode::kMulsc0:
+    case ucode::AluScalarOpcode::kMulsc1:
+      MultiplyD3D9(ScalarOperand(0), ScalarOperand(1));
+      break;
+    case ucode::AluScalarOpcode::kMulsPrev:
+      MultiplyD3D9(ScalarOperand(0), previous_scalar);
+      break;
+    case ucode::AluScalarOpcode::kMaxs:
+    case ucode::AluScalarOpcode::kMaxAs:
+    case ucode::AluScalarOpcode::kMaxAsf:
+      MaxGe(ScalarOperand(0), ScalarOperand(1));
+      break;
+    case ucode::AluScalarOpcode::kMins:
+      vmovups(ymm0, ScalarOperand(0));
+      vminps(ymm0, ymm0, ScalarOperand(1));
+      break;
+    case ucode::AluScalarOpcode::kSeqs:
+      CompareWithZero(ScalarOperand(0), kCmpEqOq);
+      break;
+    case ucode::AluScalarOpcode::kSgts:
+      CompareWithZero(ScalarOperand(0), kCmpGtOq);
+      break;
+    case ucode::AluScalarOpcode::kSges:
+      CompareWithZero(ScalarOperand(0), kCmpGeOq);
+      break;
+    case ucode::AluScalarOpcode::kSnes:
+      CompareWithZero(ScalarOperand(0), kCmpNeqUq);
+      break;
+    case ucode::AluScalarOpcode::kFrcs:
+      vmovups(ymm0, ScalarOperand(0));
+      vroundps(ymm1, ymm0, kRoundFloor);
+      vsubps(ymm0, ymm0, ymm1);
+      break;
+    case ucode::AluScalarOpcode::kTruncs:
+      vroundps(ymm0, ScalarOperand(0), kRoundTrunc);
+      break;
+    case ucode::AluScalarOpcode::kFloors:
+      vroundps(ymm0, ScalarOperand(0), kRoundFloor);
+      break;
+    case ucode::AluScalarOpcode::kRcp:
+      vmovups(ymm0, StateVector(offsetof(State, one)));
+      vdivps(ymm0, ymm0, ScalarOperand(0));
+      break;
+    case ucode::AluScalarOpcode::kRsq:
+      vsqrtps(ymm1, ScalarOperand(0));
+      vmovups(ymm0, StateVector(offsetof(State, one)));
+      vdivps(ymm0, ymm0, ymm1);
+      break;
+    case ucode::AluScalarOpcode::kSqrt:
+      vsqrtps(ymm0, ScalarOperand(0));
+      break;
+    case ucode::AluScalarOpcode::kSubs:
+    case ucode::AluScalarOpcode::kSubsc0:
+    case ucode::AluScalarOpcode::kSubsc1:
+      vmovups(ymm0, ScalarOperand(0));
+      vsubps(ymm0, ymm0, ScalarOperand(1));
+      break;
+    case ucode::AluScalarOpcode::kSubsPrev:
+      vmovups(ymm0, ScalarOperand(0));
+      vsubps(ymm0, ymm0, previous_scalar);
+      break;
+    case ucode::AluScalarOpcode::kRetainPrev:
+      vmovups(ymm0, previous_scalar);
+      break;
+    default:
+      CallOut(reinterpret_cast<const void*>(
+                  &BatchedShaderInterpreter::ExecuteAluScalarOperation),
+              uint32_t(opcode));
+      return;
+  }
+  vmovups(StateVector(offsetof(State, scalar_result)), ymm0);
+}
+
+bool BatchedShaderInterpreter::Emitter::EmitAluInstruction(
+    const ucode::AluInstruction& instr) {
+  // Vector operation.
+  ucode::AluVectorOpcode vector_opcode = instr.vector_opcode();
+  const ucode::AluVectorOpcodeInfo& vector_opcode_info =
+      ucode::GetAluVectorOpcodeInfo(vector_opcode);
+  uint32_t vector_result_write_mask = instr.GetVectorOpResultWriteMask();
+  if (vector_result_write_mask || vector_opcode_info.changed_state) {
+    if (!EmitLoadVectorOperands(instr)) {
+      return false;
+    }
+    EmitVectorOperation(vector_opcode);
+    if (vector_opcode_info.changed_state &
+        ucode::kAluOpChangedStatePredicate) {
+      vmovups(ymm0, StateVector(offsetof(State, operation_predicate)));
+      StoreMasked(StateVector(offsetof(State, predicate)));
+    }
+  }
+
+  // Scalar operation.
+  ucode::AluScalarOpcode scalar_opcode = instr.scalar_opcode();
+  const ucode::AluScalarOpcodeInfo& scalar_opcode_info =
+      ucode::GetAluScalarOpcodeInfo(scalar_opcode);
+  if (!EmitLoadScalarOperands(instr)) {
+    return false;
+  }
+  EmitScalarOperation(scalar_opcode);
+  if (scalar_opcode != ucode::AluScalarOpcode::kRetainPrev) {
+    vmovups(ymm0, StateVector(offsetof(State, scalar_result)));
+    StoreMasked(StateVector(offsetof(State, previous_scalar)));
+  }
+  if (scalar_opcode_info.changed_state & ucode::kAluOpChangedStatePredicate) {
+    vmovups(ymm0, StateVector(offsetof(State, operation_predicate)));
+    StoreMasked(StateVector(offsetof(State, predicate)));
+  }
+
+  uint32_t scalar_result_write_mask = instr.GetScalarOpResultWriteMask();
+  if (instr.is_export()) {
+    uint32_t export_index;
+    switch (ucode::ExportRegister(instr.vector_dest())) {
+      case ucode::ExportRegister::kVSPosition:
+        export_index = kExportPosition;
+        break;
+      case ucode::ExportRegister::kVSPointSizeEdgeFlagKillVertex:
+        export_index = kExportPointSizeEdgeFlagKillVertex;
+        break;
+      default:
+        // Not needed for the draw extent.
+        return true;
+    }
+    uint32_t export_constant_1_mask = instr.GetConstant1WriteMask();
+    uint32_t export_mask = vector_result_write_mask | scalar_result_write_mask |
+                           instr.GetConstant0WriteMask() |
+                           export_constant_1_mask;
+    for (uint32_t i = 0; i < 4; ++i) {
+      uint32_t export_component_bit = UINT32_C(1) << i;
+      if (!(export_mask & export_component_bit)) {
+        continue;
+      }
+      if (vector_result_write_mask & export_component_bit) {
+        vmovups(ymm0, VectorResult(i));
+        if (instr.vector_clamp()) {
+          Saturate();
+        }
+      } else if (scalar_result_write_mask & export_component_bit) {
+        vmovups(ymm0, StateVector(offsetof(State, scalar_result)));
+        if (instr.scalar_clamp()) {
+          Saturate();
+        }
+      } else if (export_constant_1_mask & export_component_bit) {
+        vmovups(ymm0, StateVector(offsetof(State, one)));
+      } else {
+        vxorps(ymm0, ymm0, ymm0);
+      }
+      StoreMasked(StateVector(offsetof(State, exports) +
+                              sizeof(State::exports[0]) * export_index +
+                              sizeof(State::exports[0][0]) * i));
+      vmovups(ymm0, StateVector(offsetof(State, all_ones)));
+      StoreMasked(StateVector(offsetof(State, exports_written) +
+                              sizeof(State::exports_written[0]) * export_index +
+                              sizeof(State::exports_written[0][0]) * i));
+    }
+  } else {
+    if (vector_result_write_mask) {
+      uint32_t vector_dest = instr.vector_dest();
+      bool vector_dest_is_relative = instr.is_vector_dest_relative();
+      if (vector_dest_is_relative) {
+        CalculateRelativeTempOffset(vector_dest);
+      }
+      for (uint32_t i = 0; i < 4; ++i) {
+        if (!(vector_result_write_mask & (UINT32_C(1) << i))) {
+          continue;
+        }
+        vmovups(ymm0, VectorResult(i));
+        if (instr.vector_clamp()) {
+          Saturate();
+        }
+        StoreMasked(TempComponent(vector_dest, vector_dest_is_relative, i));
+      }
+    }
+    if (scalar_result_write_mask) {
+      uint32_t scalar_dest = instr.scalar_dest();
+      bool scalar_dest_is_relative = instr.is_scalar_dest_relative();
+      if (scalar_dest_is_relative) {
+        CalculateRelativeTempOffset(scalar_dest);
+      }
+      vmovups(ymm0, StateVector(offsetof(State, scalar_result)));
+      if (instr.scalar_clamp()) {
+        Saturate();
+      }
+      for (uint32_t i = 0; i < 4; ++i) {
+        if (scalar_result_write_mask & (UINT32_C(1) << i)) {
+          StoreMasked(TempComponent(scalar_dest, scalar_dest_is_relative, i));
+        }
+      }
+    }
+  }
+  return true;
+}
+
+void BatchedShaderInterpreter::Emitter::EmitLoopAddress(uint32_t depth,
+                                                        uint32_t loop_id) {
+  // Same as ShaderInterpreter::State::GetLoopAddress.
+  size_t loop_constant_offset =
+      offsetof(State, loop_constants) + sizeof(xenos::LoopConstant) * loop_id;
+  movsx(ecx, byte[rbx + loop_constant_offset + 2]);
+  imul(ecx, eax);
+  movzx(edx, byte[rbx + loop_constant_offset + 1]);
+  add(ecx, edx);
+  mov(edx, -256);
+  cmp(ecx, edx);
+  cmovl(ecx, edx);
+  mov(edx, 256);
+  cmp(ecx, edx);
+  cmovg(ecx, edx);
+  mov(StateDword(offsetof(State, loop_addresses) + sizeof(int32_t) * depth),
+      ecx);
+  mov(StateDword(offsetof(State, loop_address)), ecx);
+}
+
+void BatchedShaderInterpreter::Emitter::EmitBoolConstantTest(
+    uint32_t bool_address) {
+  test(StateDword(offsetof(State, bool_constants) +
+                  sizeof(uint32_t) * (bool_address >> 5)),
+       UINT32_C(1) << (bool_address & 31));
+}
+
+bool BatchedShaderInterpreter::Emitter::Emit(
+    const uint32_t* ucode,
+    const ucode::ControlFlowInstruction* cf_instructions,
+    const uint32_t* cf_loop_depths, uint32_t cf_count) {
+  // Prologue, with 32 bytes of the Windows x64 home space for the calls and
+  // the stack aligned to 16 bytes.
+  push(rbx);
+  sub(rsp, 32);
+#if XE_PLATFORM_WIN32
+  mov(rbx, rcx);
+#else
+  mov(rbx, rdi);
+#endif
+
+  Xbyak::Label end_label;
+  std::vector<Xbyak::Label> cf_labels(cf_count);
+  for (uint32_t i = 0; i < cf_count; ++i) {
+    L(cf_labels[i]);
+    const ucode::ControlFlowInstruction& cf_instr = cf_instructions[i];
+    ucode::ControlFlowOpcode cf_opcode = cf_instr.opcode();
+    Xbyak::Label& next_label =
+        i + 1 < cf_count ? cf_labels[i + 1] : end_label;
+    switch (cf_opcode) {
+      case ucode::ControlFlowOpcode::kExec:
+      case ucode::ControlFlowOpcode::kExecEnd:
+      case ucode::ControlFlowOpcode::kCondExec:
+      case ucode::ControlFlowOpcode::kCondExecEnd:
+      case ucode::ControlFlowOpcode::kCondExecPred:
+      case ucode::ControlFlowOpcode::kCondExecPredClean:
+      case ucode::ControlFlowOpcode::kCondExecPredCleanEnd: {
+        const ucode::ControlFlowExecInstruction& cf_exec =
+            *reinterpret_cast<const ucode::ControlFlowExecInstruction*>(
+                &cf_instr);
+        exec_is_predicated_ = false;
+        switch (cf_opcode) {
+          case ucode::ControlFlowOpcode::kCondExec:
+          case ucode::ControlFlowOpcode::kCondExecEnd:
+          case ucode::ControlFlowOpcode::kCondExecPredClean:
+          case ucode::ControlFlowOpcode::kCondExecPredCleanEnd: {
+            const ucode::ControlFlowCondExecInstruction& cf_cond_exec =
+                *reinterpret_cast<const ucode::ControlFlowCondExecInstruction*>(
+                    &cf_exec);
+            EmitBoolConstantTest(cf_cond_exec.bool_address());
+            if (cf_cond_exec.condition()) {
+              jz(next_label, T_NEAR);
+            } else {
+              jnz(next_label, T_NEAR);
+            }
+          } break;
+          case ucode::ControlFlowOpcode::kCondExecPred: {
+            const ucode::ControlFlowCondExecPredInstruction& cf_cond_exec_pred =
+                *reinterpret_cast<
+                    const ucode::ControlFlowCondExecPredInstruction*>(&cf_exec);
+            vmovups(ymm5, StateVector(offsetof(State, predicate)));
+            if (!cf_cond_exec_pred.condition()) {
+              vxorps(ymm5, ymm5, StateVector(offsetof(State, all_ones)));
+            }
+            vmovups(StateVector(offsetof(State, exec_mask)), ymm5);
+            vtestps(ymm5, ymm5);
+            jz(next_label, T_NEAR);
+            exec_is_predicated_ = true;
+          } break;
+          default:
+            break;
+        }
+
+        for (uint32_t exec_index = 0; exec_index < cf_exec.count();
+             ++exec_index) {
+          uint32_t instruction_address = cf_exec.address() + exec_index;
+          const uint32_t* exec_instruction = ucode + 3 * instruction_address;
+          Xbyak::Label skip_label;
+          if ((cf_exec.sequence() >> (exec_index << 1)) & 0b01) {
+            const ucode::FetchInstruction& fetch_instr =
+                *reinterpret_cast<const ucode::FetchInstruction*>(
+                    exec_instruction);
+            EmitInstructionMask(fetch_instr.is_predicated(),
+                                fetch_instr.predicate_condition(), skip_label);
+            CallOut(reinterpret_cast<const void*>(
+                        &BatchedShaderInterpreter::ExecuteFetchInstruction),
+                    instruction_address);
+          } else {
+            const ucode::AluInstruction& alu_instr =
+                *reinterpret_cast<const ucode::AluInstruction*>(
+                    exec_instruction);
+            EmitInstructionMask(alu_instr.is_predicated(),
+                                alu_instr.predicate_condition(), skip_label);
+            if (!EmitAluInstruction(alu_instr)) {
+              return false;
+            }
+          }
+          L(skip_label);
+        }
+
+        if (ucode::DoesControlFlowOpcodeEndShader(cf_opcode)) {
+          jmp(end_label, T_NEAR);
+        }
+      } break;
+
+      case ucode::ControlFlowOpcode::kLoopStart: {
+        const ucode::ControlFlowLoopStartInstruction& cf_loop_start =
+            *reinterpret_cast<const ucode::ControlFlowLoopStartInstruction*>(
+                &cf_instr);
+        uint32_t depth = cf_loop_depths[i];
+        size_t iterator_offset =
+            offsetof(State, loop_iterators) + sizeof(uint32_t) * depth;
+        if (!cf_loop_start.is_repeat()) {
+          mov(StateDword(iterator_offset), 0);
+        }
+        mov(eax, StateDword(iterator_offset));
+        movzx(ecx, byte[rbx + offsetof(State, loop_constants) +
+                        sizeof(xenos::LoopConstant) * cf_loop_start.loop_id()]);
+        cmp(eax, ecx);
+        Xbyak::Label& skip_label = cf_loop_start.address() < cf_count
+                                       ? cf_labels[cf_loop_start.address()]
+                                       : end_label;
+        jae(skip_label, T_NEAR);
+        EmitLoopAddress(depth, cf_loop_start.loop_id());
+      } break;
+
+      case ucode::ControlFlowOpcode::kLoopEnd: {
+        const ucode::ControlFlowLoopEndInstruction& cf_loop_end =
+            *reinterpret_cast<const ucode::ControlFlowLoopEndInstruction*>(
+                &cf_instr);
+        // The depth of the loop itself, not of the instructions inside it.
+        uint32_t depth = cf_loop_depths[i] - 1;
+        size_t iterator_offset =
+            offsetof(State, loop_iterators) + sizeof(uint32_t) * depth;
+        mov(eax, StateDword(iterator_offset));
+        inc(eax);
+        mov(StateDword(iterator_offset), eax);
+        movzx(ecx, byte[rbx + offsetof(State, loop_constants) +
+                        sizeof(xenos::LoopConstant) * cf_loop_end.loop_id()]);
+        cmp(eax, ecx);
+        Xbyak::Label exit_label;
+        jae(exit_label, T_NEAR);
+        EmitLoopAddress(depth, cf_loop_end.loop_id());
+        jmp(cf_labels[cf_loop_end.address()], T_NEAR);
+        L(exit_label);
+        if (depth) {
+          mov(eax, StateDword(offsetof(State, loop_addresses) +
+                              sizeof(int32_t) * (depth - 1)));
+          mov(StateDword(offsetof(State, loop_address)), eax);
+        } else {
+          mov(StateDword(offsetof(State, loop_address)), 0);
+        }
+      } break;
+
+      case ucode::ControlFlowOpcode::kCondJmp: {
+        const ucode::ControlFlowCondJmpInstruction& cf_cond_jmp =
+            *reinterpret_cast<const ucode::ControlFlowCondJmpInstruction*>(
+                &cf_instr);
+        Xbyak::Label& target_label = cf_cond_jmp.address() < cf_count
+                                         ? cf_labels[cf_cond_jmp.address()]
+                                         : end_label;
+        if (cf_cond_jmp.is_unconditional()) {
+          jmp(target_label, T_NEAR);
+        } else {
+          EmitBoolConstantTest(cf_cond_jmp.bool_address());
+          if (cf_cond_jmp.condition()) {
+            jnz(target_label, T_NEAR);
+          } else {
+            jz(target_label, T_NEAR);
+          }
+        }
+      } break;
+
+      default:
+        break;
+    }
+  }
+
+  L(end_label);
+  vzeroupper();
+  add(rsp, 32);
+  pop(rbx);
+  ret();
+  return true;
+}
+
+BatchedShaderInterpreter::BatchedShaderInterpreter(const Shader& shader)
+    : ucode_(shader.ucode_dwords(),
+             shader.ucode_dwords() + shader.ucode_dword_count()) {}
+
+BatchedShaderInterpreter::~BatchedShaderInterpreter() = default;
+
+bool BatchedShaderInterpreter::GenerateCode() {
+  Xbyak::util::Cpu cpu;
+  if (!cpu.has(Xbyak::util::Cpu::tAVX)) {
+    return false;
+  }
+  auto emitter = std::make_unique<Emitter>();
+  if (!emitter->Emit(ucode_.data(), cf_instructions_.data(),
+                     cf_loop_depths_.data(),
+                     uint32_t(cf_instructions_.size()))) {
+    return false;
+  }
+  emitter->ready();
+  function_ = emitter->getCode<void (*)(State*)>();
+  emitter_ = std::move(emitter);
+  return true;
+}
+
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XE_ARCH_AMD64
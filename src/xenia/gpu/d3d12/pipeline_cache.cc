@@ -40,6 +40,7 @@
 #include "xenia/gpu/dxbc_shader_translator.h"
 #include "xenia/gpu/gpu_flags.h"
 #include "xenia/gpu/registers.h"
+#include "xenia/gpu/shader_translation_jobs.h"
 #include "xenia/gpu/xenos.h"
 #include "xenia/ui/d3d12/d3d12_util.h"
 
@@ -250,89 +251,61 @@ void PipelineCache::InitializeShaderStorage(
   bool edram_rov_used = render_target_cache_.GetPath() ==
                         RenderTargetCache::Path::kPixelShaderInterlock;
 
-  // Initialize the pipeline storage stream - read pipeline descriptions and
-  // collect used shader modifications to translate.
-  std::vector<PipelineStoredDescription> pipeline_stored_descriptions;
-  // <Shader hash, modification bits>.
-  std::set<std::pair<uint64_t, uint64_t>> shader_translations_needed;
-  auto pipeline_storage_file_path =
-      shader_storage_shareable_root /
-      fmt::format("{:08X}.{}.d3d12.xpso", title_id,
-                  edram_rov_used ? "rov" : "rtv");
-  pipeline_storage_file_ =
-      xe::filesystem::OpenFile(pipeline_storage_file_path, "a+b");
-  if (!pipeline_storage_file_) {
-    XELOGE(
-        "Failed to open the Direct3D 12 pipeline description storage file for "
-        "writing, persistent shader storage will be disabled: {}",
-        xe::path_to_utf8(pipeline_storage_file_path));
-    return;
-  }
-  pipeline_storage_file_flush_needed_ = false;
-  // 'XEPS'.
-  const uint32_t pipeline_storage_magic = 0x53504558;
+  // Load the guest shaders (shared with the other backends) and the pipeline
+  // descriptions, which specify the shader modifications to translate.
+  uint64_t shader_storage_initialization_start =
+      xe::Clock::QueryHostTickCount();
+  ++shader_storage_index_;
+  shader_storage_flush_needed_ = false;
+  std::vector<D3D12Shader*> shaders_to_translate;
+  std::vector<uint8_t> pipeline_description_data;
   // 'DXRO' or 'DXRT'.
   const uint32_t pipeline_storage_magic_api =
       edram_rov_used ? 0x4F525844 : 0x54525844;
-  const uint32_t pipeline_storage_version_swapped =
-      xe::byte_swap(std::max(PipelineDescription::kVersion,
-                             DxbcShaderTranslator::Modification::kVersion));
-  struct {
-    uint32_t magic;
-    uint32_t magic_api;
-    uint32_t version_swapped;
-  } pipeline_storage_file_header;
-  if (fread(&pipeline_storage_file_header, sizeof(pipeline_storage_file_header),
-            1, pipeline_storage_file_) &&
-      pipeline_storage_file_header.magic == pipeline_storage_magic &&
-      pipeline_storage_file_header.magic_api == pipeline_storage_magic_api &&
-      pipeline_storage_file_header.version_swapped ==
-          pipeline_storage_version_swapped) {
-    xe::filesystem::Seek(pipeline_storage_file_, 0, SEEK_END);
-    int64_t pipeline_storage_told_end =
-        xe::filesystem::Tell(pipeline_storage_file_);
-    size_t pipeline_storage_told_count =
-        size_t(pipeline_storage_told_end >=
-                       int64_t(sizeof(pipeline_storage_file_header))
-                   ? (uint64_t(pipeline_storage_told_end) -
-                      sizeof(pipeline_storage_file_header)) /
-                         sizeof(PipelineStoredDescription)
-                   : 0);
-    if (pipeline_storage_told_count &&
-        xe::filesystem::Seek(pipeline_storage_file_,
-                             int64_t(sizeof(pipeline_storage_file_header)),
-                             SEEK_SET)) {
-      pipeline_stored_descriptions.resize(pipeline_storage_told_count);
-      pipeline_stored_descriptions.resize(
-          fread(pipeline_stored_descriptions.data(),
-                sizeof(PipelineStoredDescription), pipeline_storage_told_count,
-                pipeline_storage_file_));
-      size_t pipeline_storage_read_count = pipeline_stored_descriptions.size();
-      for (size_t i = 0; i < pipeline_storage_read_count; ++i) {
-        const PipelineStoredDescription& pipeline_stored_description =
-            pipeline_stored_descriptions[i];
-        // Validate file integrity, stop and truncate the stream if data is
-        // corrupted.
-        if (XXH3_64bits(&pipeline_stored_description.description,
-                        sizeof(pipeline_stored_description.description)) !=
-            pipeline_stored_description.description_hash) {
-          pipeline_stored_descriptions.resize(i);
-          break;
-        }
-        // TODO(Triang3l): On Vulkan, skip pipelines requiring unsupported
-        // device features (to keep the cache files mostly shareable across
-        // devices).
-        // Mark the shader modifications as needed for translation.
-        shader_translations_needed.emplace(
-            pipeline_stored_description.description.vertex_shader_hash,
-            pipeline_stored_description.description.vertex_shader_modification);
-        if (pipeline_stored_description.description.pixel_shader_hash) {
-          shader_translations_needed.emplace(
-              pipeline_stored_description.description.pixel_shader_hash,
-              pipeline_stored_description.description
-                  .pixel_shader_modification);
-        }
-      }
+  if (!shader_storage_.Open(
+          shader_storage_shareable_root / fmt::format("{:08X}.xsh", title_id),
+          shader_storage_shareable_root /
+              fmt::format("{:08X}.{}.d3d12.xpso", title_id,
+                          edram_rov_used ? "rov" : "rtv"),
+          pipeline_storage_magic_api, PipelineDescription::kVersion,
+          DxbcShaderTranslator::Modification::kVersion,
+          sizeof(PipelineDescription),
+          [this, &shaders_to_translate](
+              xenos::ShaderType type, const uint32_t* ucode_dwords,
+              uint32_t ucode_dword_count, uint64_t ucode_data_hash) {
+            D3D12Shader* shader = LoadShader(type, ucode_dwords,
+                                             ucode_dword_count,
+                                             ucode_data_hash);
+            if (shader->ucode_storage_index() == shader_storage_index_) {
+              // Appeared twice in the file for some reason - skip, otherwise
+              // it would be translated twice in parallel.
+              return;
+            }
+            // Loaded from the current storage - don't write again.
+            shader->set_ucode_storage_index(shader_storage_index_);
+            shaders_to_translate.push_back(shader);
+          },
+          pipeline_description_data)) {
+    XELOGE(
+        "Failed to open the Direct3D 12 shader storage, persistent shader "
+        "storage will be disabled");
+    return;
+  }
+  std::vector<PipelineDescription> pipeline_descriptions(
+      pipeline_description_data.size() / sizeof(PipelineDescription));
+  std::memcpy(pipeline_descriptions.data(), pipeline_description_data.data(),
+              sizeof(PipelineDescription) * pipeline_descriptions.size());
+  // <Shader hash, modification bits>.
+  std::set<std::pair<uint64_t, uint64_t>> shader_translations_needed;
+  for (const PipelineDescription& pipeline_description :
+       pipeline_descriptions) {
+    shader_translations_needed.emplace(
+        pipeline_description.vertex_shader_hash,
+        pipeline_description.vertex_shader_modification);
+    if (pipeline_description.pixel_shader_hash) {
+      shader_translations_needed.emplace(
+          pipeline_description.pixel_shader_hash,
+          pipeline_description.pixel_shader_modification);
     }
   }
 
@@ -342,238 +315,103 @@ void PipelineCache::InitializeShaderStorage(
     logical_processor_count = 6;
   }
 
-  // Initialize the Xenos shader storage stream.
-  uint64_t shader_storage_initialization_start =
-      xe::Clock::QueryHostTickCount();
-  auto shader_storage_file_path =
-      shader_storage_shareable_root / fmt::format("{:08X}.xsh", title_id);
-  shader_storage_file_ =
-      xe::filesystem::OpenFile(shader_storage_file_path, "a+b");
-  if (!shader_storage_file_) {
-    XELOGE(
-        "Failed to open the guest shader storage file for writing, persistent "
-        "shader storage will be disabled: {}",
-        xe::path_to_utf8(shader_storage_file_path));
-    fclose(pipeline_storage_file_);
-    pipeline_storage_file_ = nullptr;
-    return;
-  }
-  ++shader_storage_index_;
-  shader_storage_file_flush_needed_ = false;
-  struct {
-    uint32_t magic;
-    uint32_t version_swapped;
-  } shader_storage_file_header;
-  // 'XESH'.
-  const uint32_t shader_storage_magic = 0x48534558;
-  if (fread(&shader_storage_file_header, sizeof(shader_storage_file_header), 1,
-            shader_storage_file_) &&
-      shader_storage_file_header.magic == shader_storage_magic &&
-      xe::byte_swap(shader_storage_file_header.version_swapped) ==
-          ShaderStoredHeader::kVersion) {
-    uint64_t shader_storage_valid_bytes = sizeof(shader_storage_file_header);
-    // Load and translate shaders written by previous Xenia executions until the
-    // end of the file or until a corrupted one is detected.
-    ShaderStoredHeader shader_header;
-    std::vector<uint32_t> ucode_dwords;
-    ucode_dwords.reserve(0xFFFF);
-    size_t shaders_translated = 0;
-
-    // Threads overlapping file reading.
-    std::mutex shaders_translation_thread_mutex;
-    std::condition_variable shaders_translation_thread_cond;
-    std::deque<D3D12Shader*> shaders_to_translate;
-    size_t shader_translation_threads_busy = 0;
-    bool shader_translation_threads_shutdown = false;
-    std::mutex shaders_failed_to_translate_mutex;
-    std::vector<D3D12Shader::D3D12Translation*> shaders_failed_to_translate;
-    auto shader_translation_thread_function = [&]() {
-      const ui::d3d12::D3D12Provider& provider =
-          command_processor_.GetD3D12Provider();
-      StringBuffer ucode_disasm_buffer;
-      DxbcShaderTranslator translator(
-          provider.GetAdapterVendorID(), bindless_resources_used_,
-          edram_rov_used, render_target_cache_.gamma_render_target_as_srgb(),
-          render_target_cache_.msaa_2x_supported(),
-          render_target_cache_.draw_resolution_scale_x(),
-          render_target_cache_.draw_resolution_scale_y(),
-          provider.GetGraphicsAnalysis() != nullptr);
-      // If needed and possible, create objects needed for DXIL conversion and
-      // disassembly on this thread.
-      IDxbcConverter* dxbc_converter = nullptr;
-      IDxcUtils* dxc_utils = nullptr;
-      IDxcCompiler* dxc_compiler = nullptr;
-      if (cvars::d3d12_dxbc_disasm_dxilconv && dxbc_converter_ && dxc_utils_ &&
-          dxc_compiler_) {
-        provider.DxbcConverterCreateInstance(CLSID_DxbcConverter,
-                                             IID_PPV_ARGS(&dxbc_converter));
-        provider.DxcCreateInstance(CLSID_DxcUtils, IID_PPV_ARGS(&dxc_utils));
-        provider.DxcCreateInstance(CLSID_DxcCompiler,
-                                   IID_PPV_ARGS(&dxc_compiler));
-      }
-      for (;;) {
-        D3D12Shader* shader_to_translate;
-        for (;;) {
-          std::unique_lock<std::mutex> lock(shaders_translation_thread_mutex);
-          if (shaders_to_translate.empty()) {
-            if (shader_translation_threads_shutdown) {
-              return;
-            }
-            shaders_translation_thread_cond.wait(lock);
-            continue;
-          }
-          shader_to_translate = shaders_to_translate.front();
-          shaders_to_translate.pop_front();
-          ++shader_translation_threads_busy;
-          break;
-        }
-        if (!shader_to_translate->is_ucode_analyzed()) {
-          shader_to_translate->AnalyzeUcode(ucode_disasm_buffer);
-        }
-        // Translate each needed modification on this thread after performing
-        // modification-independent analysis of the whole shader.
-        uint64_t ucode_data_hash = shader_to_translate->ucode_data_hash();
-        for (auto modification_it = shader_translations_needed.lower_bound(
-                 std::make_pair(ucode_data_hash, uint64_t(0)));
-             modification_it != shader_translations_needed.end() &&
-             modification_it->first == ucode_data_hash;
-             ++modification_it) {
-          D3D12Shader::D3D12Translation* translation =
-              static_cast<D3D12Shader::D3D12Translation*>(
-                  shader_to_translate->GetOrCreateTranslation(
-                      modification_it->second));
-          // Only try (and delete in case of failure) if it's a new translation.
-          // If it's a shader previously encountered in the game, translation of
-          // which has failed, and the shader storage is loaded later, keep it
-          // this way not to try to translate it again.
-          if (!translation->is_translated() &&
-              !TranslateAnalyzedShader(translator, *translation, dxbc_converter,
-                                       dxc_utils, dxc_compiler)) {
-            std::lock_guard<std::mutex> lock(shaders_failed_to_translate_mutex);
-            shaders_failed_to_translate.push_back(translation);
-          }
-        }
-        {
-          std::lock_guard<std::mutex> lock(shaders_translation_thread_mutex);
-          --shader_translation_threads_busy;
+  // Request ucode information gathering and translation of all the needed
+  // shaders on all cores, each shader on one thread. The failures are
+  // handled in the order of the shaders in the file.
+  std::vector<std::vector<D3D12Shader::D3D12Translation*>>
+      shaders_failed_to_translate(shaders_to_translate.size());
+  ShaderTranslationJobs shader_translation_jobs(shaders_to_translate.size());
+  shader_translation_jobs.Run("Shader Translation", [&](size_t worker_index) {
+    const ui::d3d12::D3D12Provider& provider =
+        command_processor_.GetD3D12Provider();
+    StringBuffer ucode_disasm_buffer;
+    DxbcShaderTranslator translator(
+        provider.GetAdapterVendorID(), bindless_resources_used_, edram_rov_used,
+        render_target_cache_.gamma_render_target_as_srgb(),
+        render_target_cache_.msaa_2x_supported(),
+        render_target_cache_.draw_resolution_scale_x(),
+        render_target_cache_.draw_resolution_scale_y(),
+        provider.GetGraphicsAnalysis() != nullptr);
+    // If needed and possible, create objects needed for DXIL conversion and
+    // disassembly on this thread.
+    IDxbcConverter* dxbc_converter = nullptr;
+    IDxcUtils* dxc_utils = nullptr;
+    IDxcCompiler* dxc_compiler = nullptr;
+    if (cvars::d3d12_dxbc_disasm_dxilconv && dxbc_converter_ && dxc_utils_ &&
+        dxc_compiler_) {
+      provider.DxbcConverterCreateInstance(CLSID_DxbcConverter,
+                                           IID_PPV_ARGS(&dxbc_converter));
+      provider.DxcCreateInstance(CLSID_DxcUtils, IID_PPV_ARGS(&dxc_utils));
+      provider.DxcCreateInstance(CLSID_DxcCompiler,
+                                 IID_PPV_ARGS(&dxc_compiler));
+    }
+    for (size_t i;
+         (i = shader_translation_jobs.AcquireJob(worker_index)) !=
+         ShaderTranslationJobs::kNoJob;) {
+      D3D12Shader* shader_to_translate = shaders_to_translate[i];
+      if (!shader_to_translate->is_ucode_analyzed()) {
+        shader_to_translate->AnalyzeUcode(ucode_disasm_buffer);
+      }
+      // Translate each needed modification on this thread after performing
+      // modification-independent analysis of the whole shader.
+      uint64_t ucode_data_hash = shader_to_translate->ucode_data_hash();
+      for (auto modification_it = shader_translations_needed.lower_bound(
+               std::make_pair(ucode_data_hash, uint64_t(0)));
+           modification_it != shader_translations_needed.end() &&
+           modification_it->first == ucode_data_hash;
+           ++modification_it) {
+        D3D12Shader::D3D12Translation* translation =
+            static_cast<D3D12Shader::D3D12Translation*>(
+                shader_to_translate->GetOrCreateTranslation(
+                    modification_it->second));
+        // Only try (and delete in case of failure) if it's a new translation.
+        // If it's a shader previously encountered in the game, translation of
+        // which has failed, and the shader storage is loaded later, keep it
+        // this way not to try to translate it again.
+        if (!translation->is_translated() &&
+            !TranslateAnalyzedShader(translator, *translation, dxbc_converter,
+                                     dxc_utils, dxc_compiler)) {
+          shaders_failed_to_translate[i].push_back(translation);
         }
       }
-      if (dxc_compiler) {
-        dxc_compiler->Release();
-      }
-      if (dxc_utils) {
-        dxc_utils->Release();
-      }
-      if (dxbc_converter) {
-        dxbc_converter->Release();
-      }
-    };
-    std::vector<std::unique_ptr<xe::threading::Thread>>
-        shader_translation_threads;
-
-    while (true) {
-      if (!fread(&shader_header, sizeof(shader_header), 1,
-                 shader_storage_file_)) {
-        break;
-      }
-      size_t ucode_byte_count =
-          shader_header.ucode_dword_count * sizeof(uint32_t);
-      ucode_dwords.resize(shader_header.ucode_dword_count);
-      if (shader_header.ucode_dword_count &&
-          !fread(ucode_dwords.data(), ucode_byte_count, 1,
-                 shader_storage_file_)) {
-        break;
-      }
-      uint64_t ucode_data_hash =
-          XXH3_64bits(ucode_dwords.data(), ucode_byte_count);
-      if (shader_header.ucode_data_hash != ucode_data_hash) {
-        // Validation failed.
-        break;
-      }
-      shader_storage_valid_bytes += sizeof(shader_header) + ucode_byte_count;
-      D3D12Shader* shader =
-          LoadShader(shader_header.type, ucode_dwords.data(),
-                     shader_header.ucode_dword_count, ucode_data_hash);
-      if (shader->ucode_storage_index() == shader_storage_index_) {
-        // Appeared twice in this file for some reason - skip, otherwise race
-        // condition will be caused by translating twice in parallel.
-        continue;
-      }
-      // Loaded from the current storage - don't write again.
-      shader->set_ucode_storage_index(shader_storage_index_);
-      // Create new threads if the currently existing threads can't keep up
-      // with file reading, but not more than the number of logical processors
-      // minus one.
-      size_t shader_translation_threads_needed;
-      {
-        std::lock_guard<std::mutex> lock(shaders_translation_thread_mutex);
-        shader_translation_threads_needed =
-            std::min(shader_translation_threads_busy +
-                         shaders_to_translate.size() + size_t(1),
-                     logical_processor_count - size_t(1));
-      }
-      while (shader_translation_threads.size() <
-             shader_translation_threads_needed) {
-        auto thread = xe::threading::Thread::Create(
-            {}, shader_translation_thread_function);
-        assert_not_null(thread);
-        thread->set_name("Shader Translation");
-        shader_translation_threads.push_back(std::move(thread));
-      }
-      // Request ucode information gathering and translation of all the needed
-      // shaders.
-      {
-        std::lock_guard<std::mutex> lock(shaders_translation_thread_mutex);
-        shaders_to_translate.push_back(shader);
-      }
-      shaders_translation_thread_cond.notify_one();
-      ++shaders_translated;
     }
-    if (!shader_translation_threads.empty()) {
-      {
-        std::lock_guard<std::mutex> lock(shaders_translation_thread_mutex);
-        shader_translation_threads_shutdown = true;
-      }
-      shaders_translation_thread_cond.notify_all();
-      for (auto& shader_translation_thread : shader_translation_threads) {
-        xe::threading::Wait(shader_translation_thread.get(), false);
-      }
-      shader_translation_threads.clear();
-      for (D3D12Shader::D3D12Translation* translation :
-           shaders_failed_to_translate) {
-        D3D12Shader* shader = static_cast<D3D12Shader*>(&translation->shader());
-        shader->DestroyTranslation(translation->modification());
-        if (shader->translations().empty()) {
-          shaders_.erase(shader->ucode_data_hash());
-          delete shader;
-        }
-      }
+    if (dxc_compiler) {
+      dxc_compiler->Release();
+    }
+    if (dxc_utils) {
+      dxc_utils->Release();
+    }
+    if (dxbc_converter) {
+      dxbc_converter->Release();
+    }
+  });
+  for (size_t i = 0; i < shaders_to_translate.size(); ++i) {
+    D3D12Shader* shader = shaders_to_translate[i];
+    for (D3D12Shader::D3D12Translation* translation :
+         shaders_failed_to_translate[i]) {
+      shader->DestroyTranslation(translation->modification());
+    }
+    if (!shaders_failed_to_translate[i].empty() &&
+        shader->translations().empty()) {
+      shaders_.erase(shader->ucode_data_hash());
+      delete shader;
     }
-    XELOGGPU("Translated {} shaders from the storage in {} milliseconds",
-             shaders_translated,
-             (xe::Clock::QueryHostTickCount() -
-              shader_storage_initialization_start) *
-                 1000 / xe::Clock::QueryHostTickFrequency());
-    xe::filesystem::TruncateStdioFile(shader_storage_file_,
-                                      shader_storage_valid_bytes);
-  } else {
-    xe::filesystem::TruncateStdioFile(shader_storage_file_, 0);
-    shader_storage_file_header.magic = shader_storage_magic;
-    shader_storage_file_header.version_swapped =
-        xe::byte_swap(ShaderStoredHeader::kVersion);
-    fwrite(&shader_storage_file_header, sizeof(shader_storage_file_header), 1,
-           shader_storage_file_);
   }
+  XELOGGPU("Translated {} shaders from the storage in {} milliseconds",
+           shaders_to_translate.size(),
+           (xe::Clock::QueryHostTickCount() -
+            shader_storage_initialization_start) *
+               1000 / xe::Clock::QueryHostTickFrequency());
 
   // Create the pipelines.
-  if (!pipeline_stored_descriptions.empty()) {
+  if (!pipeline_descriptions.empty()) {
     uint64_t pipeline_creation_start_ = xe::Clock::QueryHostTickCount();
 
     // Launch additional creation threads to use all cores to create
     // pipelines faster. Will also be using the main thread, so minus 1.
     size_t creation_thread_original_count = creation_threads_.size();
     size_t creation_thread_needed_count = std::max(
-        std::min(pipeline_stored_descriptions.size(), logical_processor_count) -
+        std::min(pipeline_descriptions.size(), logical_processor_count) -
             size_t(1),
         creation_thread_original_count);
     while (creation_threads_.size() < creation_thread_original_count) {
@@ -588,15 +426,12 @@ void PipelineCache::InitializeShaderStorage(
     }
 
     size_t pipelines_created = 0;
-    for (const PipelineStoredDescription& pipeline_stored_description :
-         pipeline_stored_descriptions) {
-      const PipelineDescription& pipeline_description =
-          pipeline_stored_description.description;
-      // TODO(Triang3l): On Vulkan, skip pipelines requiring unsupported device
-      // features (to keep the cache files mostly shareable across devices).
+    for (const PipelineDescription& pipeline_description :
+         pipeline_descriptions) {
       // Skip already known pipelines - those have already been enqueued.
-      auto found_range =
-          pipelines_.equal_range(pipeline_stored_description.description_hash);
+      uint64_t pipeline_description_hash =
+          XXH3_64bits(&pipeline_description, sizeof(pipeline_description));
+      auto found_range = pipelines_.equal_range(pipeline_description_hash);
       bool pipeline_found = false;
       for (auto it = found_range.first; it != found_range.second; ++it) {
         Pipeline* found_pipeline = it->second;
@@ -675,8 +510,7 @@ void PipelineCache::InitializeShaderStorage(
       new_pipeline->state = nullptr;
       std::memcpy(&new_pipeline->description, &pipeline_runtime_description,
                   sizeof(pipeline_runtime_description));
-      pipelines_.emplace(pipeline_stored_description.description_hash,
-                         new_pipeline);
+      pipelines_.emplace(pipeline_description_hash, new_pipeline);
       COUNT_profile_set("gpu/pipeline_cache/pipelines", pipelines_.size());
       if (!creation_threads_.empty()) {
         // Submit the pipeline for creation to any available thread.
@@ -733,80 +567,24 @@ void PipelineCache::InitializeShaderStorage(
         pipelines_created,
         (xe::Clock::QueryHostTickCount() - pipeline_creation_start_) * 1000 /
             xe::Clock::QueryHostTickFrequency());
-    // If any pipeline descriptions were corrupted (or the whole file has excess
-    // bytes in the end), truncate to the last valid pipeline description.
-    xe::filesystem::TruncateStdioFile(
-        pipeline_storage_file_,
-        uint64_t(sizeof(pipeline_storage_file_header) +
-                 sizeof(PipelineStoredDescription) *
-                     pipeline_stored_descriptions.size()));
-  } else {
-    xe::filesystem::TruncateStdioFile(pipeline_storage_file_, 0);
-    pipeline_storage_file_header.magic = pipeline_storage_magic;
-    pipeline_storage_file_header.magic_api = pipeline_storage_magic_api;
-    pipeline_storage_file_header.version_swapped =
-        pipeline_storage_version_swapped;
-    fwrite(&pipeline_storage_file_header, sizeof(pipeline_storage_file_header),
-           1, pipeline_storage_file_);
   }
 
   shader_storage_cache_root_ = cache_root;
   shader_storage_title_id_ = title_id;
-
-  // Start the storage writing thread.
-  storage_write_flush_shaders_ = false;
-  storage_write_flush_pipelines_ = false;
-  storage_write_thread_shutdown_ = false;
-  storage_write_thread_ =
-      xe::threading::Thread::Create({}, [this]() { StorageWriteThread(); });
-  assert_not_null(storage_write_thread_);
-  storage_write_thread_->set_name("D3D12 Storage writer");
 }
 
 void PipelineCache::ShutdownShaderStorage() {
-  if (storage_write_thread_) {
-    {
-      std::lock_guard<std::mutex> lock(storage_write_request_lock_);
-      storage_write_thread_shutdown_ = true;
-    }
-    storage_write_request_cond_.notify_all();
-    xe::threading::Wait(storage_write_thread_.get(), false);
-    storage_write_thread_.reset();
-  }
-  storage_write_shader_queue_.clear();
-  storage_write_pipeline_queue_.clear();
-
-  if (pipeline_storage_file_) {
-    fclose(pipeline_storage_file_);
-    pipeline_storage_file_ = nullptr;
-    pipeline_storage_file_flush_needed_ = false;
-  }
-
-  if (shader_storage_file_) {
-    fclose(shader_storage_file_);
-    shader_storage_file_ = nullptr;
-    shader_storage_file_flush_needed_ = false;
-  }
+  shader_storage_.Close();
+  shader_storage_flush_needed_ = false;
 
   shader_storage_cache_root_.clear();
   shader_storage_title_id_ = 0;
 }
 
 void PipelineCache::EndSubmission() {
-  if (shader_storage_file_flush_needed_ ||
-      pipeline_storage_file_flush_needed_) {
-    {
-      std::lock_guard<std::mutex> lock(storage_write_request_lock_);
-      if (shader_storage_file_flush_needed_) {
-        storage_write_flush_shaders_ = true;
-      }
-      if (pipeline_storage_file_flush_needed_) {
-        storage_write_flush_pipelines_ = true;
-      }
-    }
-    storage_write_request_cond_.notify_one();
-    shader_storage_file_flush_needed_ = false;
-    pipeline_storage_file_flush_needed_ = false;
+  if (shader_storage_flush_needed_) {
+    shader_storage_flush_needed_ = false;
+    shader_storage_.Flush();
   }
   if (!creation_threads_.empty()) {
     CreateQueuedPipelinesOnProcessorThread();
@@ -990,17 +768,7 @@ bool PipelineCache::ConfigurePipeline(
       XELOGE("Failed to translate the vertex shader!");
       return false;
     }
-    if (shader_storage_file_ && vertex_shader->shader().ucode_storage_index() !=
-                                    shader_storage_index_) {
-      vertex_shader->shader().set_ucode_storage_index(shader_storage_index_);
-      assert_not_null(storage_write_thread_);
-      shader_storage_file_flush_needed_ = true;
-      {
-        std::lock_guard<std::mutex> lock(storage_write_request_lock_);
-        storage_write_shader_queue_.push_back(&vertex_shader->shader());
-      }
-      storage_write_request_cond_.notify_all();
-    }
+    StoreShader(vertex_shader->shader());
   }
   if (!vertex_shader->is_valid()) {
     // Translation attempted previously, but not valid.
@@ -1017,18 +785,7 @@ bool PipelineCache::ConfigurePipeline(
         XELOGE("Failed to translate the pixel shader!");
         return false;
       }
-      if (shader_storage_file_ &&
-          pixel_shader->shader().ucode_storage_index() !=
-              shader_storage_index_) {
-        pixel_shader->shader().set_ucode_storage_index(shader_storage_index_);
-        assert_not_null(storage_write_thread_);
-        shader_storage_file_flush_needed_ = true;
-        {
-          std::lock_guard<std::mutex> lock(storage_write_request_lock_);
-          storage_write_shader_queue_.push_back(&pixel_shader->shader());
-        }
-        storage_write_request_cond_.notify_all();
-      }
+      StoreShader(pixel_shader->shader());
     }
     if (!pixel_shader->is_valid()) {
       // Translation attempted previously, but not valid.
@@ -1084,19 +841,9 @@ bool PipelineCache::ConfigurePipeline(
     new_pipeline->state = CreateD3D12Pipeline(runtime_description);
   }
 
-  if (pipeline_storage_file_) {
-    assert_not_null(storage_write_thread_);
-    pipeline_storage_file_flush_needed_ = true;
-    {
-      std::lock_guard<std::mutex> lock(storage_write_request_lock_);
-      storage_write_pipeline_queue_.emplace_back();
-      PipelineStoredDescription& stored_description =
-          storage_write_pipeline_queue_.back();
-      stored_description.description_hash = hash;
-      std::memcpy(&stored_description.description, &description,
-                  sizeof(description));
-    }
-    storage_write_request_cond_.notify_all();
+  if (shader_storage_.is_open()) {
+    shader_storage_.AppendPipeline(&description);
+    shader_storage_flush_needed_ = true;
   }
 
   current_pipeline_ = new_pipeline;
@@ -1302,6 +1049,16 @@ bool PipelineCache::TranslateAnalyzedShader(
   return translation.is_valid();
 }
 
+void PipelineCache::StoreShader(Shader& shader) {
+  if (!shader_storage_.is_open() ||
+      shader.ucode_storage_index() == shader_storage_index_) {
+    return;
+  }
+  shader.set_ucode_storage_index(shader_storage_index_);
+  shader_storage_.AppendShader(shader);
+  shader_storage_flush_needed_ = true;
+}
+
 bool PipelineCache::GetCurrentStateDescription(
     D3D12Shader::D3D12Translation* vertex_shader,
     D3D12Shader::D3D12Translation* pixel_shader,
@@ -3228,86 +2985,6 @@ ID3D12PipelineState* PipelineCache::CreateD3D12Pipeline(
   return state;
 }
 
-void PipelineCache::StorageWriteThread() {
-  ShaderStoredHeader shader_header;
-  // Don't leak anything in unused bits.
-  std::memset(&shader_header, 0, sizeof(shader_header));
-
-  std::vector<uint32_t> ucode_guest_endian;
-  ucode_guest_endian.reserve(0xFFFF);
-
-  bool flush_shaders = false;
-  bool flush_pipelines = false;
-
-  while (true) {
-    if (flush_shaders) {
-      flush_shaders = false;
-      assert_not_null(shader_storage_file_);
-      fflush(shader_storage_file_);
-    }
-    if (flush_pipelines) {
-      flush_pipelines = false;
-      assert_not_null(pipeline_storage_file_);
-      fflush(pipeline_storage_file_);
-    }
-
-    const Shader* shader = nullptr;
-    PipelineStoredDescription pipeline_description;
-    bool write_pipeline = false;
-    {
-      std::unique_lock<std::mutex> lock(storage_write_request_lock_);
-      if (storage_write_thread_shutdown_) {
-        return;
-      }
-      if (!storage_write_shader_queue_.empty()) {
-        shader = storage_write_shader_queue_.front();
-        storage_write_shader_queue_.pop_front();
-      } else if (storage_write_flush_shaders_) {
-        storage_write_flush_shaders_ = false;
-        flush_shaders = true;
-      }
-      if (!storage_write_pipeline_queue_.empty()) {
-        std::memcpy(&pipeline_description,
-                    &storage_write_pipeline_queue_.front(),
-                    sizeof(pipeline_description));
-        storage_write_pipeline_queue_.pop_front();
-        write_pipeline = true;
-      } else if (storage_write_flush_pipelines_) {
-        storage_write_flush_pipelines_ = false;
-        flush_pipelines = true;
-      }
-      if (!shader && !write_pipeline) {
-        storage_write_request_cond_.wait(lock);
-        continue;
-      }
-    }
-
-    if (shader) {
-      shader_header.ucode_data_hash = shader->ucode_data_hash();
-      shader_header.ucode_dword_count = shader->ucode_dword_count();
-      shader_header.type = shader->type();
-      assert_not_null(shader_storage_file_);
-      fwrite(&shader_header, sizeof(shader_header), 1, shader_storage_file_);
-      if (shader_header.ucode_dword_count) {
-        ucode_guest_endian.resize(shader_header.ucode_dword_count);
-        // Need to swap because the hash is calculated for the shader with guest
-        // endianness.
-        xe::copy_and_swap(ucode_guest_endian.data(), shader->ucode_dwords(),
-                          shader_header.ucode_dword_count);
-        fwrite(ucode_guest_endian.data(),
-               shader_header.ucode_dword_count * sizeof(uint32_t), 1,
-               shader_storage_file_);
-      }
-    }
-
-    if (write_pipeline) {
-      assert_not_null(pipeline_storage_file_);
-      fwrite(&pipeline_description, sizeof(pipeline_description), 1,
-             pipeline_storage_file_);
-    }
-  }
-}
-
 void PipelineCache::CreationThread(size_t thread_index) {
   while (true) {
     Pipeline* pipeline_to_create = nullptr;
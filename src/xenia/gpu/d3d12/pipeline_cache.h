@@ -34,6 +34,7 @@
 #include "xenia/gpu/primitive_processor.h"
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/registers.h"
+#include "xenia/gpu/shader_storage.h"
 #include "xenia/gpu/xenos.h"
 #include "xenia/ui/d3d12/d3d12_api.h"
 
@@ -105,15 +106,6 @@ class PipelineCache {
   }
 
  private:
-  XEPACKEDSTRUCT(ShaderStoredHeader, {
-    uint64_t ucode_data_hash;
-
-    uint32_t ucode_dword_count : 31;
-    xenos::ShaderType type : 1;
-
-    static constexpr uint32_t kVersion = 0x20201219;
-  });
-
   // Update PipelineDescription::kVersion if any of the Pipeline* enums are
   // changed!
 
@@ -230,11 +222,6 @@ class PipelineCache {
     static constexpr uint32_t kVersion = 0x20210425;
   });
 
-  XEPACKEDSTRUCT(PipelineStoredDescription, {
-    uint64_t description_hash;
-    PipelineDescription description;
-  });
-
   struct PipelineRuntimeDescription {
     ID3D12RootSignature* root_signature;
     D3D12Shader::D3D12Translation* vertex_shader;
@@ -281,6 +268,9 @@ class PipelineCache {
                                IDxcUtils* dxc_utils = nullptr,
                                IDxcCompiler* dxc_compiler = nullptr);
 
+  // Appends the shader to the storage if it's not there yet.
+  void StoreShader(Shader& shader);
+
   // If draw_util::IsRasterizationPotentiallyDone is false, the pixel shader
   // MUST be made nullptr BEFORE calling this! The shaders must be translated
   // and valid.
@@ -376,29 +366,13 @@ class PipelineCache {
   std::filesystem::path shader_storage_cache_root_;
   uint32_t shader_storage_title_id_ = 0;
 
-  // Shader storage output stream, for preload in the next emulator runs.
-  FILE* shader_storage_file_ = nullptr;
+  // Storage of the guest shaders and the pipeline descriptions, for preload in
+  // the next emulator runs.
+  ShaderStorage shader_storage_;
   // For only writing shaders to the currently open storage once, incremented
   // when switching the storage.
   uint32_t shader_storage_index_ = 0;
-  bool shader_storage_file_flush_needed_ = false;
-
-  // Pipeline storage output stream, for preload in the next emulator runs.
-  FILE* pipeline_storage_file_ = nullptr;
-  bool pipeline_storage_file_flush_needed_ = false;
-
-  // Thread for asynchronous writing to the storage streams.
-  void StorageWriteThread();
-  std::mutex storage_write_request_lock_;
-  std::condition_variable storage_write_request_cond_;
-  // Storage thread input is protected with storage_write_request_lock_, and the
-  // thread is notified about its change via storage_write_request_cond_.
-  std::deque<const Shader*> storage_write_shader_queue_;
-  std::deque<PipelineStoredDescription> storage_write_pipeline_queue_;
-  bool storage_write_flush_shaders_ = false;
-  bool storage_write_flush_pipelines_ = false;
-  bool storage_write_thread_shutdown_ = false;
-  std::unique_ptr<xe::threading::Thread> storage_write_thread_;
+  bool shader_storage_flush_needed_ = false;
 
   // Pipeline creation threads.
   void CreationThread(size_t thread_index);
@@ -12,6 +12,7 @@
 #include <algorithm>
 #include <cfloat>
 #include <cstdint>
+#include <iterator>
 
 #include "xenia/base/assert.h"
 #include "xenia/base/cvar.h"
@@ -47,6 +48,18 @@ DEFINE_bool(
     "some games draw rectangles (for their UI, for instance) without clipping, "
     "but with a proper scissor rectangle.",
     "GPU");
+DEFINE_bool(
+    execute_unclipped_draw_vs_on_cpu_batched, true,
+    "For execute_unclipped_draw_vs_on_cpu, process multiple vertices at once "
+    "instead of interpreting the vertex shader for every vertex, where "
+    "supported by the shader.",
+    "GPU");
+DEFINE_bool(
+    execute_unclipped_draw_vs_on_cpu_jit, true,
+    "For execute_unclipped_draw_vs_on_cpu_batched, compile the vertex shaders "
+    "to host code, where supported by the host, instead of interpreting the "
+    "instructions for the whole batch of vertices.",
+    "GPU");
 
 namespace xe {
 namespace gpu {
@@ -102,11 +115,7 @@ uint32_t DrawExtentEstimator::EstimateVertexMaxY(const Shader& vertex_shader) {
   }
 
   auto vgt_dma_size = regs.Get<reg::VGT_DMA_SIZE>();
-  union {
-    const void* index_buffer;
-    const uint16_t* index_buffer_16;
-    const uint32_t* index_buffer_32;
-  };
+  const void* index_buffer = nullptr;
   xenos::Endian index_endian = vgt_dma_size.swap_mode;
   if (vgt_draw_initiator.source_select == xenos::SourceSelect::kDMA) {
     xenos::IndexFormat index_format = vgt_draw_initiator.index_size;
@@ -166,18 +175,15 @@ uint32_t DrawExtentEstimator::EstimateVertexMaxY(const Shader& vertex_shader) {
 
   float max_y = -FLT_MAX;
 
-  shader_interpreter_.SetShader(vertex_shader);
-
-  PositionYExportSink position_y_export_sink;
-  shader_interpreter_.SetExportSink(&position_y_export_sink);
-  for (uint32_t i = 0; i < vgt_draw_initiator.num_indices; ++i) {
+  // Returns false if the vertex is skipped as a primitive reset index.
+  auto get_vertex_index = [&](uint32_t i, uint32_t& vertex_index_out) {
     uint32_t vertex_index;
     if (vgt_draw_initiator.source_select == xenos::SourceSelect::kDMA) {
       if (i < vgt_dma_size.num_words) {
         if (vgt_draw_initiator.index_size == xenos::IndexFormat::kInt16) {
-          vertex_index = index_buffer_16[i];
+          vertex_index = static_cast<const uint16_t*>(index_buffer)[i];
         } else {
-          vertex_index = index_buffer_32[i];
+          vertex_index = static_cast<const uint32_t*>(index_buffer)[i];
         }
         // The Xenos only uses 24 bits of the index (reset_indx is 24-bit).
         vertex_index = xenos::GpuSwap(vertex_index, index_endian) & 0xFFFFFF;
@@ -185,33 +191,34 @@ uint32_t DrawExtentEstimator::EstimateVertexMaxY(const Shader& vertex_shader) {
         vertex_index = 0;
       }
       if (pa_su_sc_mode_cntl.multi_prim_ib_ena && vertex_index == reset_index) {
-        continue;
+        return false;
       }
     } else {
       assert_true(vgt_draw_initiator.source_select ==
                   xenos::SourceSelect::kAutoIndex);
       vertex_index = i;
     }
-    vertex_index =
+    vertex_index_out =
         std::min(max_index,
                  std::max(min_index, (vertex_index + index_offset) & 0xFFFFFF));
+    return true;
+  };
 
-    position_y_export_sink.Reset();
-
-    shader_interpreter_.temp_registers()[0] = float(vertex_index);
-    shader_interpreter_.Execute();
+  PositionYExportSink position_y_export_sink;
 
+  // Updates max_y with the exports of a vertex in position_y_export_sink.
+  auto add_vertex = [&]() {
     if (position_y_export_sink.vertex_kill().has_value() &&
         (position_y_export_sink.vertex_kill().value() & ~(UINT32_C(1) << 31))) {
-      continue;
+      return;
     }
     if (!position_y_export_sink.position_y().has_value()) {
-      continue;
+      return;
     }
     float vertex_y = position_y_export_sink.position_y().value();
     if (!pa_cl_vte_cntl.vtx_xy_fmt) {
       if (!position_y_export_sink.position_w().has_value()) {
-        continue;
+        return;
       }
       vertex_y /= position_y_export_sink.position_w().value();
     }
@@ -240,8 +247,102 @@ uint32_t DrawExtentEstimator::EstimateVertexMaxY(const Shader& vertex_shader) {
     // std::max is `a < b ? b : a`, thus in case of NaN, the first argument is
     // always returned - max_y, which is initialized to a normalized value.
     max_y = std::max(max_y, vertex_y);
+  };
+
+  BatchedShaderInterpreter* batch_interpreter = nullptr;
+  if (cvars::execute_unclipped_draw_vs_on_cpu_batched) {
+    uint64_t ucode_data_hash = vertex_shader.ucode_data_hash();
+    auto batch_interpreter_it = batch_interpreters_.find(ucode_data_hash);
+    if (batch_interpreter_it != batch_interpreters_.end()) {
+      batch_interpreters_used_.splice(batch_interpreters_used_.end(),
+                                      batch_interpreters_used_,
+                                      batch_interpreter_it->second.used_it);
+    } else {
+      if (batch_interpreters_.size() >= kMaxBatchInterpreters) {
+        batch_interpreters_.erase(batch_interpreters_used_.front());
+        batch_interpreters_used_.pop_front();
+      }
+      batch_interpreters_used_.push_back(ucode_data_hash);
+      batch_interpreter_it =
+          batch_interpreters_
+              .emplace(ucode_data_hash,
+                       BatchInterpreter{
+                           BatchedShaderInterpreter::Compile(
+                               vertex_shader,
+                               cvars::execute_unclipped_draw_vs_on_cpu_jit),
+                           std::prev(batch_interpreters_used_.end())})
+              .first;
+    }
+    batch_interpreter = batch_interpreter_it->second.interpreter.get();
+  }
+
+  if (batch_interpreter) {
+    if (!batch_interpreter_state_) {
+      batch_interpreter_state_ =
+          std::make_unique<BatchedShaderInterpreter::State>();
+    }
+    BatchedShaderInterpreter::State& batch_state = *batch_interpreter_state_;
+    BatchedShaderInterpreter::LoadConstants(batch_state, register_file_,
+                                            memory_, trace_writer_);
+    uint32_t lane_count = 0;
+    auto execute_lanes = [&]() {
+      // Fill the unused lanes with the last vertex, their exports are dropped.
+      for (uint32_t i = lane_count; i < BatchedShaderInterpreter::kLaneCount;
+           ++i) {
+        batch_state.temps[0][0][i] = batch_state.temps[0][0][lane_count - 1];
+      }
+      batch_interpreter->Execute(batch_state);
+      for (uint32_t i = 0; i < lane_count; ++i) {
+        position_y_export_sink.Reset();
+        for (uint32_t j = 0; j < BatchedShaderInterpreter::kExportCount; ++j) {
+          float export_value[4];
+          uint32_t export_mask = 0;
+          for (uint32_t k = 0; k < 4; ++k) {
+            export_value[k] = batch_state.exports[j][k][i];
+            if (batch_state.exports_written[j][k][i]) {
+              export_mask |= UINT32_C(1) << k;
+            }
+          }
+          if (export_mask) {
+            position_y_export_sink.Export(
+                j == BatchedShaderInterpreter::kExportPosition
+                    ? ucode::ExportRegister::kVSPosition
+                    : ucode::ExportRegister::kVSPointSizeEdgeFlagKillVertex,
+                export_value, export_mask);
+          }
+        }
+        add_vertex();
+      }
+      lane_count = 0;
+    };
+    for (uint32_t i = 0; i < vgt_draw_initiator.num_indices; ++i) {
+      uint32_t vertex_index;
+      if (!get_vertex_index(i, vertex_index)) {
+        continue;
+      }
+      batch_state.temps[0][0][lane_count++] = float(vertex_index);
+      if (lane_count >= BatchedShaderInterpreter::kLaneCount) {
+        execute_lanes();
+      }
+    }
+    if (lane_count) {
+      execute_lanes();
+    }
+  } else {
+    shader_interpreter_.SetShader(vertex_shader);
+    shader_interpreter_.SetExportSink(&position_y_export_sink);
+    for (uint32_t i = 0; i < vgt_draw_initiator.num_indices; ++i) {
+      uint32_t vertex_index;
+      if (!get_vertex_index(i, vertex_index)) {
+        continue;
+      }
+      position_y_export_sink.Reset();
+      shader_interpreter_.temp_registers()[0] = float(vertex_index);
+      shader_interpreter_.Execute();
+      add_vertex();
+    }
+    shader_interpreter_.SetExportSink(nullptr);
   }
-  shader_interpreter_.SetExportSink(nullptr);
 
   int32_t max_y_24p8 = ui::FloatToD3D11Fixed16p8(max_y);
   // 16p8 range is -32768 to 32767+255/256, but it's stored as uint32_t here,
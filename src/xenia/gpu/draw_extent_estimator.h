@@ -11,8 +11,12 @@
 #define XENIA_GPU_DRAW_EXTENT_ESTIMATOR_H_
 
 #include <cstdint>
+#include <list>
+#include <memory>
 #include <optional>
+#include <unordered_map>
 
+#include "xenia/gpu/batched_shader_interpreter.h"
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/shader.h"
 #include "xenia/gpu/shader_interpreter.h"
@@ -38,6 +42,12 @@ class DrawExtentEstimator {
   uint32_t EstimateMaxY(bool try_to_estimate_vertex_max_y,
                         const Shader& vertex_shader);
 
+  // Releases the shaders prepared for batched execution.
+  void ClearCache() {
+    batch_interpreters_.clear();
+    batch_interpreters_used_.clear();
+  }
+
  private:
   class PositionYExportSink : public ShaderInterpreter::ExportSink {
    public:
@@ -68,6 +78,22 @@ class DrawExtentEstimator {
   TraceWriter* trace_writer_;
 
   ShaderInterpreter shader_interpreter_;
+
+  struct BatchInterpreter {
+    // nullptr if the shader is not supported (so the interpreter is used).
+    std::unique_ptr<BatchedShaderInterpreter> interpreter;
+    std::list<uint64_t>::iterator used_it;
+  };
+  // Vertex shaders prepared for execution of multiple vertices at once by their
+  // ucode_data_hash. The least recently used ones are released when there are
+  // too many of them, as games may generate a lot of shaders, and most are used
+  // only in a few frames.
+  static constexpr size_t kMaxBatchInterpreters = 1024;
+  std::unordered_map<uint64_t, BatchInterpreter> batch_interpreters_;
+  // ucode_data_hash of batch_interpreters_ from the least recently used.
+  std::list<uint64_t> batch_interpreters_used_;
+  // Created on the first usage of a batched shader.
+  std::unique_ptr<BatchedShaderInterpreter::State> batch_interpreter_state_;
 };
 
 }  // namespace gpu
@@ -9,6 +9,9 @@
 
 #include "xenia/gpu/null/null_command_processor.h"
 
+#include "xenia/gpu/draw_util.h"
+#include "xenia/gpu/registers.h"
+
 namespace xe {
 namespace gpu {
 namespace null {
@@ -46,10 +49,36 @@ bool NullCommandProcessor::IssueDraw(xenos::PrimitiveType prim_type,
                                      uint32_t index_count,
                                      IndexBufferInfo* index_buffer_info,
                                      bool major_mode_explicit) {
+  const RegisterFile& regs = *register_file_;
+  if (regs.Get<reg::RB_MODECONTROL>().edram_mode ==
+      xenos::ModeControl::kCopy) {
+    return IssueCopy();
+  }
+  // The fixed-function state derived from the registers by every host backend
+  // for every draw. The shaders aren't loaded, and the vertex and index data
+  // isn't processed, as SharedMemory and PrimitiveProcessor only exist as
+  // host graphics API implementations.
+  bool primitive_polygonal = draw_util::IsPrimitivePolygonal(regs);
+  if (!draw_util::IsRasterizationPotentiallyDone(regs, primitive_polygonal)) {
+    return true;
+  }
+  reg::RB_DEPTHCONTROL normalized_depth_control =
+      draw_util::GetNormalizedDepthControl(regs);
+  draw_util::GetViewportInfoArgs viewport_info_args{};
+  viewport_info_args.Setup(1, 1, divisors::MagicDiv{1}, divisors::MagicDiv{1},
+                           false, 8192, 8192, true, normalized_depth_control,
+                           false, true, false);
+  viewport_info_args.SetupRegisterValues(regs);
+  draw_util::GetHostViewportInfo(&viewport_info_args, viewport_info_);
+  draw_util::GetScissor(regs, scissor_);
   return true;
 }
 
-bool NullCommandProcessor::IssueCopy() { return true; }
+bool NullCommandProcessor::IssueCopy() {
+  draw_util::ResolveInfo resolve_info;
+  return draw_util::GetResolveInfo(*register_file_, *memory_, trace_writer_, 1,
+                                   1, false, false, resolve_info);
+}
 
 void NullCommandProcessor::InitializeTrace() {}
 
@@ -11,6 +11,7 @@
 #define XENIA_GPU_NULL_NULL_COMMAND_PROCESSOR_H_
 
 #include "xenia/gpu/command_processor.h"
+#include "xenia/gpu/draw_util.h"
 #include "xenia/gpu/null/null_graphics_system.h"
 #include "xenia/gpu/xenos.h"
 #include "xenia/kernel/kernel_state.h"
@@ -46,6 +47,10 @@ class NullCommandProcessor : public CommandProcessor {
   bool IssueCopy() override;
 
   void InitializeTrace() override;
+
+  // Results of the last draw, written so the computations are not skipped.
+  draw_util::ViewportInfo viewport_info_;
+  draw_util::Scissor scissor_;
 };
 
 }  // namespace null
@@ -0,0 +1,188 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/console_app_main.h"
+#include "xenia/base/cvar.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/memory.h"
+#include "xenia/base/string.h"
+#include "xenia/emulator.h"
+#include "xenia/gpu/graphics_system.h"
+#include "xenia/gpu/null/null_graphics_system.h"
+#include "xenia/gpu/packet_disassembler.h"
+#include "xenia/gpu/trace_player.h"
+#include "xenia/gpu/xenos.h"
+
+DECLARE_path(target_trace_file);
+
+DEFINE_int32(trace_bench_playback_count, 10,
+             "Number of times to play the trace back for measuring the command "
+             "processing performance, after one playback for warming up.",
+             "GPU");
+
+namespace xe {
+namespace gpu {
+namespace null {
+
+namespace {
+// Type 0, 1 and 2 packets, then type 3 packets by the opcode.
+constexpr uint32_t kPacketKindCount = 3 + 128;
+
+uint32_t GetPacketKind(uint32_t packet) {
+  uint32_t packet_type = packet >> 30;
+  return packet_type < 3 ? packet_type : 3 + ((packet >> 8) & 0x7F);
+}
+
+struct PacketKindStatistics {
+  uint64_t count = 0;
+  uint64_t host_ticks = 0;
+  // For getting the name from the disassembler.
+  const uint8_t* first_packet_data = nullptr;
+};
+}  // namespace
+
+// Plays a trace back on the null backend, reporting the packet processing rate
+// and the time taken by each packet type. The PM4 packets are executed and the
+// registers are written, and draws and copies derive the viewport, the scissor
+// and the resolve parameters from the registers. There's no host GPU work, and
+// no shader, vertex, index or texture processing, as that's done by the host
+// graphics API implementations of the caches.
+int trace_bench_main(const std::vector<std::string>& args) {
+  std::filesystem::path path;
+  if (!cvars::target_trace_file.empty()) {
+    path = cvars::target_trace_file;
+  } else if (args.size() >= 2) {
+    path = xe::to_path(args[1]);
+  }
+  if (path.empty()) {
+    XELOGE("No trace file specified");
+    return 5;
+  }
+  auto abs_path = std::filesystem::absolute(path);
+  XELOGI("Loading trace file {}...", xe::path_to_utf8(abs_path));
+
+  auto emulator = std::make_unique<Emulator>("", "", "", "");
+  X_STATUS result = emulator->Setup(
+      nullptr, nullptr, false, nullptr,
+      []() -> std::unique_ptr<GraphicsSystem> {
+        return std::make_unique<NullGraphicsSystem>();
+      },
+      nullptr);
+  if (XFAILED(result)) {
+    XELOGE("Failed to setup emulator: {:08X}", result);
+    return 4;
+  }
+  auto player = std::make_unique<TracePlayer>(emulator->graphics_system());
+  if (!player->Open(xe::path_to_utf8(abs_path))) {
+    XELOGE("Could not load trace file");
+    return 5;
+  }
+
+  // Warm up the host caches and the allocations.
+  player->PlayAllFrames();
+  player->WaitOnPlayback();
+
+  std::array<PacketKindStatistics, kPacketKindCount> packet_kinds;
+  player->SetPacketExecutedCallback([&packet_kinds](const uint8_t* packet_data,
+                                                    uint32_t dword_count,
+                                                    uint64_t host_ticks) {
+    PacketKindStatistics& packet_kind =
+        packet_kinds[GetPacketKind(xe::load_and_swap<uint32_t>(packet_data))];
+    ++packet_kind.count;
+    packet_kind.host_ticks += host_ticks;
+    if (!packet_kind.first_packet_data) {
+      packet_kind.first_packet_data = packet_data;
+    }
+  });
+  uint32_t playback_count =
+      uint32_t(std::max(cvars::trace_bench_playback_count, int32_t(1)));
+  uint64_t playback_start = xe::Clock::QueryHostTickCount();
+  for (uint32_t i = 0; i < playback_count; ++i) {
+    player->PlayAllFrames();
+    player->WaitOnPlayback();
+  }
+  uint64_t playback_ticks = xe::Clock::QueryHostTickCount() - playback_start;
+  player->SetPacketExecutedCallback(nullptr);
+
+  double tick_frequency = double(xe::Clock::QueryHostTickFrequency());
+  double playback_seconds = double(playback_ticks) / tick_frequency;
+  uint64_t packet_count = 0, packet_ticks = 0;
+  for (const PacketKindStatistics& packet_kind : packet_kinds) {
+    packet_count += packet_kind.count;
+    packet_ticks += packet_kind.host_ticks;
+  }
+  // The playback time also includes loading the frames, dispatching to the
+  // command processor thread and the timing itself, so the rates are of the
+  // time spent executing the packets only.
+  double packet_seconds = double(packet_ticks) / tick_frequency;
+  uint64_t draw_count =
+      packet_kinds[GetPacketKind((UINT32_C(3) << 30) |
+                                 (xenos::PM4_DRAW_INDX << 8))]
+          .count +
+      packet_kinds[GetPacketKind((UINT32_C(3) << 30) |
+                                 (xenos::PM4_DRAW_INDX_2 << 8))]
+          .count;
+  XELOGI("Played {} frames back {} times in {:.3f} milliseconds:",
+         player->frame_count(), playback_count, playback_seconds * 1000.0);
+  XELOGI("  {:.3f} milliseconds executing the packets",
+         packet_seconds * 1000.0);
+  XELOGI("  {} packets, {:.0f} packets per second", packet_count,
+         packet_seconds ? double(packet_count) / packet_seconds : 0.0);
+  XELOGI("  {} draws, {:.0f} draws per second", draw_count,
+         packet_seconds ? double(draw_count) / packet_seconds : 0.0);
+
+  std::vector<uint32_t> packet_kinds_by_time;
+  for (uint32_t i = 0; i < kPacketKindCount; ++i) {
+    if (packet_kinds[i].count) {
+      packet_kinds_by_time.push_back(i);
+    }
+  }
+  std::sort(packet_kinds_by_time.begin(), packet_kinds_by_time.end(),
+            [&packet_kinds](uint32_t a, uint32_t b) {
+              return packet_kinds[a].host_ticks > packet_kinds[b].host_ticks;
+            });
+  for (uint32_t i : packet_kinds_by_time) {
+    const PacketKindStatistics& packet_kind = packet_kinds[i];
+    PacketInfo packet_info;
+    const char* name = "?";
+    if (PacketDisassembler::DisasmPacket(packet_kind.first_packet_data,
+                                         &packet_info)) {
+      name = packet_info.type_info->name;
+    }
+    double milliseconds =
+        double(packet_kind.host_ticks) * 1000.0 / tick_frequency;
+    XELOGI(
+        "  {} (type {}, opcode {:02X}): {} packets, {:.3f} milliseconds, "
+        "{:.0f} nanoseconds per packet, {:.1f}%",
+        name, std::min(i, UINT32_C(3)), i >= 3 ? i - 3 : 0, packet_kind.count,
+        milliseconds, milliseconds * 1000000.0 / double(packet_kind.count),
+        packet_ticks ? double(packet_kind.host_ticks) * 100.0 /
+                           double(packet_ticks)
+                     : 0.0);
+  }
+
+  player.reset();
+  emulator.reset();
+  return 0;
+}
+
+}  // namespace null
+}  // namespace gpu
+}  // namespace xe
+
+XE_DEFINE_CONSOLE_APP("xenia-gpu-null-trace-bench",
+                      xe::gpu::null::trace_bench_main, "some.trace",
+                      "target_trace_file");
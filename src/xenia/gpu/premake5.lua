@@ -20,6 +20,8 @@ project("xenia-gpu")
   })
   local_platform_files()
 
+include("testing")
+
 group("src")
 project("xenia-gpu-shader-compiler")
   uuid("ad76d3e4-4c62-439b-a0f6-f83fcf0e83c5")
@@ -34,6 +36,7 @@ project("xenia-gpu-shader-compiler")
     "xenia-gpu",
     "xenia-ui",
     "xenia-ui-vulkan",
+    "xxhash",
   })
   includedirs({
     project_root.."/third_party/Vulkan-Headers/include",
@@ -53,3 +56,42 @@ project("xenia-gpu-shader-compiler")
         "1>scratch/stdout-shader-compiler.txt",
       })
     end
+
+group("src")
+project("xenia-gpu-shader-interpreter-bench")
+  uuid("5c0f2e7a-3b8d-4e61-9a4c-d17f6b2e8a93")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "capstone",
+    "dxbc",
+    "fmt",
+    "glslang-spirv",
+    "imgui",
+    "snappy",
+    "xenia-base",
+    "xenia-core",
+    "xenia-cpu",
+    "xenia-gpu",
+    "xenia-ui",
+    "xxhash",
+
+    -- Needed by xenia-core for Memory.
+    "xenia-kernel",
+    "xenia-patcher",
+  })
+  files({
+    "shader_interpreter_bench_main.cc",
+    "../base/console_app_main_"..platform_suffix..".cc",
+  })
+
+  filter("platforms:Windows")
+    -- Only create the .user file if it doesn't already exist.
+    local user_file = project_root.."/build/xenia-gpu-shader-interpreter-bench.vcxproj.user"
+    if not os.isfile(user_file) then
+      debugdir(project_root)
+      debugargs({
+        "2>&1",
+        "1>scratch/stdout-shader-interpreter-bench.txt",
+      })
+    end
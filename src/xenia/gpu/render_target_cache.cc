@@ -567,6 +567,8 @@ void RenderTargetCache::ClearCache() {
       }
     }
   }
+
+  draw_extent_estimator_.ClearCache();
 }
 
 void RenderTargetCache::BeginFrame() { ResetAccumulatedRenderTargets(); }
@@ -7,8 +7,10 @@
  ******************************************************************************
  */
 
+#include <algorithm>
 #include <cinttypes>
 #include <cstring>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <utility>
@@ -16,13 +18,17 @@
 
 #include "third_party/glslang/SPIRV/disassemble.h"
 #include "xenia/base/assert.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/console_app_main.h"
 #include "xenia/base/cvar.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/platform.h"
 #include "xenia/base/string.h"
 #include "xenia/base/string_buffer.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/gpu/dxbc_shader_translator.h"
+#include "xenia/gpu/shader_translation_jobs.h"
 #include "xenia/gpu/shader_translator.h"
 #include "xenia/gpu/spirv_shader_translator.h"
 #include "xenia/gpu/xenos.h"
@@ -59,11 +65,189 @@ DEFINE_bool(
     "Output host shader with a render backend implementation based on pixel "
     "shader interlock.",
     "GPU");
+DEFINE_path(
+    shader_benchmark_directory, "",
+    "Directory with shader binaries (.vs and .ps, or .bin.vert and .bin.frag "
+    "as dumped with --dump_shaders, which also needs "
+    "--shader_input_little_endian on little-endian hosts) to translate to "
+    "--shader_output_type in parallel, reporting the time taken, instead of "
+    "translating --shader_input.",
+    "GPU");
+DEFINE_int32(shader_benchmark_threads, 0,
+             "Number of threads for --shader_benchmark_directory, or 0 to use "
+             "all logical processors.",
+             "GPU");
 
 namespace xe {
 namespace gpu {
 
+namespace {
+bool GetShaderTypeFromExtension(const std::filesystem::path& path,
+                                xenos::ShaderType& shader_type_out) {
+  if (!path.has_extension()) {
+    return false;
+  }
+  auto extension = path.extension();
+  // Shader::DumpUcode writes the microcode as .bin.vert or .bin.frag, and the
+  // disassembly as .vert or .frag.
+  bool dumped_binary = path.stem().extension() == ".bin";
+  if (extension == ".vs" || (dumped_binary && extension == ".vert")) {
+    shader_type_out = xenos::ShaderType::kVertex;
+    return true;
+  }
+  if (extension == ".ps" || (dumped_binary && extension == ".frag")) {
+    shader_type_out = xenos::ShaderType::kPixel;
+    return true;
+  }
+  return false;
+}
+
+// Returns nullptr for microcode disassembly output.
+std::unique_ptr<ShaderTranslator> CreateTranslator(
+    const SpirvShaderTranslator::Features& spirv_features) {
+  if (cvars::shader_output_type == "spirv" ||
+      cvars::shader_output_type == "spirvtext") {
+    return std::make_unique<SpirvShaderTranslator>(
+        spirv_features, true, true,
+        cvars::shader_output_pixel_shader_interlock);
+  }
+  if (cvars::shader_output_type == "dxbc" ||
+      cvars::shader_output_type == "dxbctext") {
+    return std::make_unique<DxbcShaderTranslator>(
+        ui::GraphicsProvider::GpuVendorID(0),
+        cvars::shader_output_bindless_resources,
+        cvars::shader_output_pixel_shader_interlock);
+  }
+  return nullptr;
+}
+
+uint64_t GetDefaultModification(ShaderTranslator& translator,
+                                xenos::ShaderType shader_type) {
+  if (shader_type == xenos::ShaderType::kPixel) {
+    return translator.GetDefaultPixelShaderModification(
+        xenos::kMaxShaderTempRegisters);
+  }
+  Shader::HostVertexShaderType host_vertex_shader_type =
+      Shader::HostVertexShaderType::kVertex;
+  if (cvars::vertex_shader_output_type == "linedomaincp") {
+    host_vertex_shader_type =
+        Shader::HostVertexShaderType::kLineDomainCPIndexed;
+  } else if (cvars::vertex_shader_output_type == "linedomainpatch") {
+    host_vertex_shader_type =
+        Shader::HostVertexShaderType::kLineDomainPatchIndexed;
+  } else if (cvars::vertex_shader_output_type == "triangledomaincp") {
+    host_vertex_shader_type =
+        Shader::HostVertexShaderType::kTriangleDomainCPIndexed;
+  } else if (cvars::vertex_shader_output_type == "triangledomainpatch") {
+    host_vertex_shader_type =
+        Shader::HostVertexShaderType::kTriangleDomainPatchIndexed;
+  } else if (cvars::vertex_shader_output_type == "quaddomaincp") {
+    host_vertex_shader_type =
+        Shader::HostVertexShaderType::kQuadDomainCPIndexed;
+  } else if (cvars::vertex_shader_output_type == "quaddomainpatch") {
+    host_vertex_shader_type =
+        Shader::HostVertexShaderType::kQuadDomainPatchIndexed;
+  }
+  return translator.GetDefaultVertexShaderModification(
+      xenos::kMaxShaderTempRegisters, host_vertex_shader_type);
+}
+
+// Translates all the shaders in the directory like they're translated when
+// loaded from the persistent shader storage.
+int RunTranslationBenchmark() {
+  std::vector<xe::filesystem::FileInfo> files =
+      xe::filesystem::ListFiles(cvars::shader_benchmark_directory);
+  // Sorted for the same job order and the same output hash in every run.
+  std::sort(files.begin(), files.end(),
+            [](const xe::filesystem::FileInfo& a,
+               const xe::filesystem::FileInfo& b) { return a.name < b.name; });
+  std::vector<std::unique_ptr<Shader>> shaders;
+  std::vector<uint32_t> ucode_dwords;
+  for (const xe::filesystem::FileInfo& file_info : files) {
+    xenos::ShaderType shader_type;
+    if (file_info.type != xe::filesystem::FileInfo::Type::kFile ||
+        !GetShaderTypeFromExtension(file_info.name, shader_type)) {
+      continue;
+    }
+    FILE* file = filesystem::OpenFile(file_info.path / file_info.name, "rb");
+    if (!file) {
+      continue;
+    }
+    ucode_dwords.resize(file_info.total_size / sizeof(uint32_t));
+    if (ucode_dwords.empty() ||
+        !fread(ucode_dwords.data(), sizeof(uint32_t) * ucode_dwords.size(), 1,
+               file)) {
+      fclose(file);
+      continue;
+    }
+    fclose(file);
+    shaders.push_back(std::make_unique<Shader>(
+        shader_type,
+        XXH3_64bits(ucode_dwords.data(),
+                    sizeof(uint32_t) * ucode_dwords.size()),
+        ucode_dwords.data(), ucode_dwords.size(),
+        cvars::shader_input_little_endian ? std::endian::little
+                                          : std::endian::big));
+  }
+  if (shaders.empty()) {
+    XELOGE("No shader binaries found in {}",
+           xe::path_to_utf8(cvars::shader_benchmark_directory));
+    return 1;
+  }
+
+  SpirvShaderTranslator::Features spirv_features(true);
+  std::vector<uint64_t> output_hashes(shaders.size());
+  std::vector<uint8_t> output_valid(shaders.size());
+  ShaderTranslationJobs jobs(
+      shaders.size(), size_t(std::max(cvars::shader_benchmark_threads, 0)));
+  uint64_t start_time = xe::Clock::QueryHostTickCount();
+  jobs.Run("Shader Translation", [&](size_t worker_index) {
+    StringBuffer ucode_disasm_buffer;
+    std::unique_ptr<ShaderTranslator> translator =
+        CreateTranslator(spirv_features);
+    for (size_t i; (i = jobs.AcquireJob(worker_index)) !=
+                   ShaderTranslationJobs::kNoJob;) {
+      Shader& shader = *shaders[i];
+      shader.AnalyzeUcode(ucode_disasm_buffer);
+      if (!translator) {
+        output_hashes[i] = XXH3_64bits(shader.ucode_disassembly().data(),
+                                       shader.ucode_disassembly().size());
+        output_valid[i] = 1;
+        continue;
+      }
+      Shader::Translation* translation = shader.GetOrCreateTranslation(
+          GetDefaultModification(*translator, shader.type()));
+      output_valid[i] = translator->TranslateAnalyzedShader(*translation) &&
+                        translation->is_valid();
+      output_hashes[i] = XXH3_64bits(translation->translated_binary().data(),
+                                     translation->translated_binary().size());
+    }
+  });
+  uint64_t time_taken = xe::Clock::QueryHostTickCount() - start_time;
+
+  // Combined in the order of the files, so it must be the same with any number
+  // of threads.
+  size_t shaders_failed = 0;
+  for (uint8_t valid : output_valid) {
+    shaders_failed += size_t(!valid);
+  }
+  XELOGI(
+      "Translated {} shaders ({} failed) to {} on {} threads in {} "
+      "milliseconds, output hash {:016X}",
+      shaders.size(), shaders_failed, cvars::shader_output_type,
+      jobs.worker_count(),
+      time_taken * 1000 / xe::Clock::QueryHostTickFrequency(),
+      XXH3_64bits(output_hashes.data(),
+                  sizeof(uint64_t) * output_hashes.size()));
+  return shaders_failed ? 1 : 0;
+}
+}  // namespace
+
 int shader_compiler_main(const std::vector<std::string>& args) {
+  if (!cvars::shader_benchmark_directory.empty()) {
+    return RunTranslationBenchmark();
+  }
+
   xenos::ShaderType shader_type;
   if (!cvars::shader_input_type.empty()) {
     if (cvars::shader_input_type == "vs") {
@@ -75,17 +259,8 @@ int shader_compiler_main(const std::vector<std::string>& args) {
       return 1;
     }
   } else {
-    bool valid_type = false;
-    if (cvars::shader_input.has_extension()) {
-      auto extension = cvars::shader_input.extension();
-      if (extension == ".vs") {
-        shader_type = xenos::ShaderType::kVertex;
-        valid_type = true;
-      } else if (extension == ".ps") {
-        shader_type = xenos::ShaderType::kPixel;
-        valid_type = true;
-      }
-    }
+    bool valid_type =
+        GetShaderTypeFromExtension(cvars::shader_input, shader_type);
     if (!valid_type) {
       XELOGE(
           "File type not recognized (use .vs, .ps or "
@@ -122,20 +297,10 @@ int shader_compiler_main(const std::vector<std::string>& args) {
   StringBuffer ucode_disasm_buffer;
   shader->AnalyzeUcode(ucode_disasm_buffer);
 
-  std::unique_ptr<ShaderTranslator> translator;
   SpirvShaderTranslator::Features spirv_features(true);
-  if (cvars::shader_output_type == "spirv" ||
-      cvars::shader_output_type == "spirvtext") {
-    translator = std::make_unique<SpirvShaderTranslator>(
-        spirv_features, true, true,
-        cvars::shader_output_pixel_shader_interlock);
-  } else if (cvars::shader_output_type == "dxbc" ||
-             cvars::shader_output_type == "dxbctext") {
-    translator = std::make_unique<DxbcShaderTranslator>(
-        ui::GraphicsProvider::GpuVendorID(0),
-        cvars::shader_output_bindless_resources,
-        cvars::shader_output_pixel_shader_interlock);
-  } else {
+  std::unique_ptr<ShaderTranslator> translator =
+      CreateTranslator(spirv_features);
+  if (!translator) {
     // Just output microcode disassembly generated during microcode information
     // gathering.
     if (!cvars::shader_output.empty()) {
@@ -147,43 +312,7 @@ int shader_compiler_main(const std::vector<std::string>& args) {
     return 0;
   }
 
-  Shader::HostVertexShaderType host_vertex_shader_type =
-      Shader::HostVertexShaderType::kVertex;
-  if (shader_type == xenos::ShaderType::kVertex) {
-    if (cvars::vertex_shader_output_type == "linedomaincp") {
-      host_vertex_shader_type =
-          Shader::HostVertexShaderType::kLineDomainCPIndexed;
-    } else if (cvars::vertex_shader_output_type == "linedomainpatch") {
-      host_vertex_shader_type =
-          Shader::HostVertexShaderType::kLineDomainPatchIndexed;
-    } else if (cvars::vertex_shader_output_type == "triangledomaincp") {
-      host_vertex_shader_type =
-          Shader::HostVertexShaderType::kTriangleDomainCPIndexed;
-    } else if (cvars::vertex_shader_output_type == "triangledomainpatch") {
-      host_vertex_shader_type =
-          Shader::HostVertexShaderType::kTriangleDomainPatchIndexed;
-    } else if (cvars::vertex_shader_output_type == "quaddomaincp") {
-      host_vertex_shader_type =
-          Shader::HostVertexShaderType::kQuadDomainCPIndexed;
-    } else if (cvars::vertex_shader_output_type == "quaddomainpatch") {
-      host_vertex_shader_type =
-          Shader::HostVertexShaderType::kQuadDomainPatchIndexed;
-    }
-  }
-  uint64_t modification;
-  switch (shader_type) {
-    case xenos::ShaderType::kVertex:
-      modification = translator->GetDefaultVertexShaderModification(
-          xenos::kMaxShaderTempRegisters, host_vertex_shader_type);
-      break;
-    case xenos::ShaderType::kPixel:
-      modification = translator->GetDefaultPixelShaderModification(
-          xenos::kMaxShaderTempRegisters);
-      break;
-    default:
-      assert_unhandled_case(shader_type);
-      return 1;
-  }
+  uint64_t modification = GetDefaultModification(*translator, shader_type);
 
   Shader::Translation* translation =
       shader->GetOrCreateTranslation(modification);
@@ -68,6 +68,32 @@ class ShaderInterpreter {
 
   void Execute();
 
+  // Parts of the execution shared with BatchedShaderInterpreter, which executes
+  // the ALU operations and vertex fetching for each lane using them.
+  static float FlushDenormal(float value) {
+    uint32_t bits = *reinterpret_cast<const uint32_t*>(&value);
+    bits &= (bits & UINT32_C(0x7F800000)) ? ~UINT32_C(0) : (UINT32_C(1) << 31);
+    return *reinterpret_cast<const float*>(&bits);
+  }
+  // The operands are flushed, swizzled and modified (absolute value, negation),
+  // the result is replicated if the operation returns one component.
+  static void ExecuteAluVectorOperation(ucode::AluVectorOpcode opcode,
+                                        const float operands[3][4],
+                                        float* result, bool& predicate,
+                                        int32_t& address_register);
+  // Returns the new previous scalar value.
+  static float ExecuteAluScalarOperation(ucode::AluScalarOpcode opcode,
+                                         const float* operands,
+                                         float previous_scalar, bool& predicate,
+                                         int32_t& address_register);
+  // Loads and unpacks the 4 components of the vertex at the address calculated
+  // by the last full fetch, without the destination swizzle applied.
+  static void FetchVertexData(
+      const Memory& memory, TraceWriter* trace_writer,
+      ucode::VertexFetchInstruction instr,
+      const xenos::xe_gpu_vertex_fetch_t& fetch_constant,
+      uint32_t address_dwords, float* result);
+
  private:
   struct State {
     ucode::VertexFetchInstruction vfetch_full_last;
@@ -84,29 +110,23 @@ class ShaderInterpreter {
     void Reset() { std::memset(this, 0, sizeof(*this)); }
 
     int32_t GetLoopAddress() const {
-      assert_true(loop_stack_depth && loop_stack_depth < 4);
-      if (!loop_stack_depth || loop_stack_depth >= 4) {
+      assert_true(loop_stack_depth && loop_stack_depth <= 4);
+      if (!loop_stack_depth || loop_stack_depth > 4) {
         return 0;
       }
-      xenos::LoopConstant loop_constant = loop_constants[loop_stack_depth];
+      xenos::LoopConstant loop_constant = loop_constants[loop_stack_depth - 1];
       // Clamp to the real range specified in the IPR2015-00325 sequencer
       // specification.
       // https://portal.unifiedpatents.com/ptab/case/IPR2015-00325
       return std::min(
           INT32_C(256),
           std::max(INT32_C(-256),
-                   int32_t(int32_t(loop_iterators[loop_stack_depth]) *
+                   int32_t(int32_t(loop_iterators[loop_stack_depth - 1]) *
                                loop_constant.step +
                            loop_constant.start)));
     }
   };
 
-  static float FlushDenormal(float value) {
-    uint32_t bits = *reinterpret_cast<const uint32_t*>(&value);
-    bits &= (bits & UINT32_C(0x7F800000)) ? ~UINT32_C(0) : (UINT32_C(1) << 31);
-    return *reinterpret_cast<const float*>(&bits);
-  }
-
   uint32_t GetTempRegisterIndex(uint32_t address, bool is_relative) const {
     return (int32_t(address) + (is_relative ? state_.GetLoopAddress() : 0)) &
            ((UINT32_C(1) << xenos::kMaxShaderTempRegistersLog2) - 1);
@@ -0,0 +1,260 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/console_app_main.h"
+#include "xenia/base/cvar.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/string_buffer.h"
+#include "xenia/base/xxhash.h"
+#include "xenia/gpu/batched_shader_interpreter.h"
+#include "xenia/gpu/register_file.h"
+#include "xenia/gpu/registers.h"
+#include "xenia/gpu/shader.h"
+#include "xenia/gpu/shader_interpreter.h"
+#include "xenia/gpu/xenos.h"
+#include "xenia/memory.h"
+
+DEFINE_path(shader_interpreter_benchmark_directory, "",
+            "Directory with vertex shader binaries (.vs, or .bin.vert as "
+            "dumped with --dump_shaders, which also needs "
+            "--shader_interpreter_benchmark_little_endian on little-endian "
+            "hosts) to execute on the CPU.",
+            "GPU");
+DEFINE_bool(shader_interpreter_benchmark_little_endian, false,
+            "Whether the shader binaries are little-endian.", "GPU");
+DEFINE_int32(shader_interpreter_benchmark_vertex_count, 65536,
+             "Number of vertices to execute every shader for.", "GPU");
+
+namespace xe {
+namespace gpu {
+
+namespace {
+class PositionExportSink : public ShaderInterpreter::ExportSink {
+ public:
+  void Export(ucode::ExportRegister export_register, const float* value,
+              uint32_t value_mask) override {
+    if (export_register != ucode::ExportRegister::kVSPosition) {
+      return;
+    }
+    for (uint32_t i = 0; i < 4; ++i) {
+      if (value_mask & (UINT32_C(1) << i)) {
+        position[i] = value[i];
+      }
+    }
+  }
+
+  float position[4];
+};
+
+// Constants giving non-trivial results for most shaders. No vertex buffers
+// are bound (the fetch constants have zero size), so vertex fetches return
+// zeros without accessing the guest memory.
+void SetUpRegisters(RegisterFile& regs) {
+  for (uint32_t i = 0; i < 512 * 4; ++i) {
+    regs[XE_GPU_REG_SHADER_CONSTANT_000_X + i].f32 =
+        float(int32_t(i % 17) - 8) * 0.125f;
+  }
+  regs.Get<reg::SQ_VS_CONST>().size = 255;
+  // A single iteration of every loop.
+  for (uint32_t i = 0; i < 32; ++i) {
+    regs[XE_GPU_REG_SHADER_CONSTANT_LOOP_00 + i].u32 = 1 | (1 << 16);
+  }
+}
+
+double TicksToMilliseconds(uint64_t ticks) {
+  return double(ticks) * 1000.0 / double(xe::Clock::QueryHostTickFrequency());
+}
+}  // namespace
+
+// Executes the vertex shaders in the directory for the same vertices with
+// ShaderInterpreter, and with BatchedShaderInterpreter both interpreting the
+// batches and with the generated code, reporting the time taken by each.
+int shader_interpreter_bench_main(const std::vector<std::string>& args) {
+  if (cvars::shader_interpreter_benchmark_directory.empty()) {
+    XELOGE("No --shader_interpreter_benchmark_directory specified");
+    return 1;
+  }
+  uint32_t vertex_count = uint32_t(
+      std::max(cvars::shader_interpreter_benchmark_vertex_count, int32_t(1)));
+
+  std::vector<xe::filesystem::FileInfo> files = xe::filesystem::ListFiles(
+      cvars::shader_interpreter_benchmark_directory);
+  std::sort(files.begin(), files.end(),
+            [](const xe::filesystem::FileInfo& a,
+               const xe::filesystem::FileInfo& b) { return a.name < b.name; });
+  std::vector<std::unique_ptr<Shader>> shaders;
+  std::vector<uint32_t> ucode_dwords;
+  StringBuffer ucode_disasm_buffer;
+  for (const xe::filesystem::FileInfo& file_info : files) {
+    if (file_info.type != xe::filesystem::FileInfo::Type::kFile) {
+      continue;
+    }
+    // Shader::DumpUcode writes the microcode as .bin.vert.
+    if (file_info.name.extension() != ".vs" &&
+        (file_info.name.extension() != ".vert" ||
+         file_info.name.stem().extension() != ".bin")) {
+      continue;
+    }
+    FILE* file = filesystem::OpenFile(file_info.path / file_info.name, "rb");
+    if (!file) {
+      continue;
+    }
+    ucode_dwords.resize(file_info.total_size / sizeof(uint32_t));
+    if (ucode_dwords.empty() ||
+        !fread(ucode_dwords.data(), sizeof(uint32_t) * ucode_dwords.size(), 1,
+               file)) {
+      fclose(file);
+      continue;
+    }
+    fclose(file);
+    auto shader = std::make_unique<Shader>(
+        xenos::ShaderType::kVertex,
+        XXH3_64bits(ucode_dwords.data(),
+                    sizeof(uint32_t) * ucode_dwords.size()),
+        ucode_dwords.data(), ucode_dwords.size(),
+        cvars::shader_interpreter_benchmark_little_endian ? std::endian::little
+                                                          : std::endian::big);
+    shader->AnalyzeUcode(ucode_disasm_buffer);
+    if (ShaderInterpreter::CanInterpretShader(*shader)) {
+      shaders.push_back(std::move(shader));
+    }
+  }
+  if (shaders.empty()) {
+    XELOGE("No interpretable vertex shader binaries found in {}",
+           xe::path_to_utf8(cvars::shader_interpreter_benchmark_directory));
+    return 1;
+  }
+
+  auto register_file = std::make_unique<RegisterFile>();
+  SetUpRegisters(*register_file);
+  // Not initialized, vertex fetching doesn't access the memory with no vertex
+  // buffers bound.
+  Memory memory;
+
+  ShaderInterpreter interpreter(*register_file, memory);
+  PositionExportSink export_sink;
+  interpreter.SetExportSink(&export_sink);
+  auto batch_state = std::make_unique<BatchedShaderInterpreter::State>();
+  BatchedShaderInterpreter::LoadConstants(*batch_state, *register_file, memory,
+                                          nullptr);
+
+  std::vector<float> interpreter_positions(4 * vertex_count);
+  uint64_t interpreter_ticks = 0;
+  uint32_t batched_shader_count = 0, code_generated_shader_count = 0;
+  uint64_t batched_interpreter_ticks = 0;
+  uint64_t batched_interpreted_ticks = 0;
+  uint64_t code_generated_interpreter_ticks = 0;
+  uint64_t code_generated_ticks = 0;
+  uint64_t mismatching_vertex_count = 0;
+
+  for (const std::unique_ptr<Shader>& shader : shaders) {
+    interpreter.SetShader(*shader);
+    std::memset(interpreter.temp_registers(), 0,
+                sizeof(float) * 4 * xenos::kMaxShaderTempRegisters);
+    uint64_t shader_interpreter_start = xe::Clock::QueryHostTickCount();
+    for (uint32_t i = 0; i < vertex_count; ++i) {
+      std::memset(export_sink.position, 0, sizeof(export_sink.position));
+      interpreter.temp_registers()[0] = float(i);
+      interpreter.Execute();
+      std::memcpy(&interpreter_positions[4 * i], export_sink.position,
+                  sizeof(export_sink.position));
+    }
+    uint64_t shader_interpreter_ticks =
+        xe::Clock::QueryHostTickCount() - shader_interpreter_start;
+    interpreter_ticks += shader_interpreter_ticks;
+
+    for (bool generate_code : {false, true}) {
+      std::unique_ptr<BatchedShaderInterpreter> batch_interpreter =
+          BatchedShaderInterpreter::Compile(*shader, generate_code);
+      if (!batch_interpreter ||
+          batch_interpreter->is_code_generated() != generate_code) {
+        continue;
+      }
+      std::memset(batch_state->temps, 0, sizeof(batch_state->temps));
+      const auto& batch_position =
+          batch_state->exports[BatchedShaderInterpreter::kExportPosition];
+      const auto& batch_position_written = batch_state->exports_written
+          [BatchedShaderInterpreter::kExportPosition];
+      uint64_t shader_batch_start = xe::Clock::QueryHostTickCount();
+      for (uint32_t i = 0; i < vertex_count;
+           i += BatchedShaderInterpreter::kLaneCount) {
+        for (uint32_t j = 0; j < BatchedShaderInterpreter::kLaneCount; ++j) {
+          batch_state->temps[0][0][j] =
+              float(std::min(i + j, vertex_count - 1));
+        }
+        batch_interpreter->Execute(*batch_state);
+        for (uint32_t j = 0; j < BatchedShaderInterpreter::kLaneCount &&
+                             i + j < vertex_count;
+             ++j) {
+          float position[4];
+          for (uint32_t k = 0; k < 4; ++k) {
+            position[k] =
+                batch_position_written[k][j] ? batch_position[k][j] : 0.0f;
+          }
+          // May be different if the shader reads uninitialized registers.
+          if (std::memcmp(position, &interpreter_positions[4 * (i + j)],
+                          sizeof(position))) {
+            ++mismatching_vertex_count;
+          }
+        }
+      }
+      uint64_t shader_batch_ticks =
+          xe::Clock::QueryHostTickCount() - shader_batch_start;
+      if (generate_code) {
+        ++code_generated_shader_count;
+        code_generated_interpreter_ticks += shader_interpreter_ticks;
+        code_generated_ticks += shader_batch_ticks;
+      } else {
+        ++batched_shader_count;
+        batched_interpreter_ticks += shader_interpreter_ticks;
+        batched_interpreted_ticks += shader_batch_ticks;
+      }
+    }
+  }
+
+  XELOGI("Executed {} vertex shaders for {} vertices each:", shaders.size(),
+         vertex_count);
+  XELOGI("  Interpreted for every vertex: {:.3f} milliseconds",
+         TicksToMilliseconds(interpreter_ticks));
+  XELOGI(
+      "  {} shaders interpreted for {} vertices at once: {:.3f} milliseconds, "
+      "{:.3f} for every vertex",
+      batched_shader_count, BatchedShaderInterpreter::kLaneCount,
+      TicksToMilliseconds(batched_interpreted_ticks),
+      TicksToMilliseconds(batched_interpreter_ticks));
+  XELOGI(
+      "  {} shaders with generated code for {} vertices at once: {:.3f} "
+      "milliseconds, {:.3f} for every vertex",
+      code_generated_shader_count, BatchedShaderInterpreter::kLaneCount,
+      TicksToMilliseconds(code_generated_ticks),
+      TicksToMilliseconds(code_generated_interpreter_ticks));
+  if (mismatching_vertex_count) {
+    XELOGW(
+        "  {} vertices with positions different from the interpreter, the "
+        "shaders may be reading uninitialized registers",
+        mismatching_vertex_count);
+  }
+  return 0;
+}
+
+}  // namespace gpu
+}  // namespace xe
+
+XE_DEFINE_CONSOLE_APP("xenia-gpu-shader-interpreter-bench",
+                      xe::gpu::shader_interpreter_bench_main,
+                      "shader_directory",
+                      "shader_interpreter_benchmark_directory");
@@ -0,0 +1,298 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/shader_storage.h"
+
+#include <cstring>
+#include <utility>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/byte_order.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/memory.h"
+#include "xenia/base/string.h"
+#include "xenia/base/xxhash.h"
+
+namespace xe {
+namespace gpu {
+
+namespace {
+// 'XESH'.
+constexpr uint32_t kShaderFileMagic = 0x48534558;
+// 'XEPS'.
+constexpr uint32_t kPipelineFileMagic = 0x53504558;
+
+struct ShaderFileHeader {
+  uint32_t magic;
+  uint32_t version_swapped;
+};
+
+struct PipelineFileHeader {
+  uint32_t magic;
+  uint32_t magic_api;
+  uint32_t description_version_swapped;
+  uint32_t modification_version_swapped;
+};
+}  // namespace
+
+bool ShaderStorage::Open(const std::filesystem::path& shader_file_path,
+                         const std::filesystem::path& pipeline_file_path,
+                         uint32_t pipeline_magic_api,
+                         uint32_t pipeline_description_version,
+                         uint32_t shader_modification_version,
+                         size_t pipeline_description_size,
+                         const ShaderCallback& shader_callback,
+                         std::vector<uint8_t>& pipeline_descriptions_out) {
+  Close();
+
+  // Read the pipeline descriptions, each preceded by its hash for validation.
+  pipeline_file_ = xe::filesystem::OpenFile(pipeline_file_path, "a+b");
+  if (!pipeline_file_) {
+    XELOGE(
+        "Failed to open the pipeline description storage file for writing: {}",
+        xe::path_to_utf8(pipeline_file_path));
+    return false;
+  }
+  pipeline_description_size_ = pipeline_description_size;
+  size_t pipeline_record_size = sizeof(uint64_t) + pipeline_description_size;
+  PipelineFileHeader pipeline_header;
+  uint32_t description_version_swapped =
+      xe::byte_swap(pipeline_description_version);
+  uint32_t modification_version_swapped =
+      xe::byte_swap(shader_modification_version);
+  if (fread(&pipeline_header, sizeof(pipeline_header), 1, pipeline_file_) &&
+      pipeline_header.magic == kPipelineFileMagic &&
+      pipeline_header.magic_api == pipeline_magic_api &&
+      pipeline_header.description_version_swapped ==
+          description_version_swapped &&
+      pipeline_header.modification_version_swapped ==
+          modification_version_swapped) {
+    xe::filesystem::Seek(pipeline_file_, 0, SEEK_END);
+    int64_t pipeline_told_end = xe::filesystem::Tell(pipeline_file_);
+    size_t pipeline_told_count =
+        pipeline_told_end >= int64_t(sizeof(pipeline_header))
+            ? size_t(uint64_t(pipeline_told_end) - sizeof(pipeline_header)) /
+                  pipeline_record_size
+            : 0;
+    size_t pipeline_count = 0;
+    if (pipeline_told_count &&
+        xe::filesystem::Seek(pipeline_file_, int64_t(sizeof(pipeline_header)),
+                             SEEK_SET)) {
+      std::vector<uint8_t> record(pipeline_record_size);
+      for (; pipeline_count < pipeline_told_count; ++pipeline_count) {
+        if (!fread(record.data(), pipeline_record_size, 1, pipeline_file_)) {
+          break;
+        }
+        uint64_t description_hash;
+        std::memcpy(&description_hash, record.data(), sizeof(uint64_t));
+        if (XXH3_64bits(record.data() + sizeof(uint64_t),
+                        pipeline_description_size) != description_hash) {
+          break;
+        }
+        pipeline_descriptions_out.insert(pipeline_descriptions_out.end(),
+                                         record.cbegin() + sizeof(uint64_t),
+                                         record.cend());
+      }
+    }
+    // Drop the corrupted descriptions and the excess bytes in the end.
+    xe::filesystem::TruncateStdioFile(
+        pipeline_file_,
+        uint64_t(sizeof(pipeline_header) +
+                 pipeline_record_size * pipeline_count));
+  } else {
+    xe::filesystem::TruncateStdioFile(pipeline_file_, 0);
+    pipeline_header.magic = kPipelineFileMagic;
+    pipeline_header.magic_api = pipeline_magic_api;
+    pipeline_header.description_version_swapped = description_version_swapped;
+    pipeline_header.modification_version_swapped =
+        modification_version_swapped;
+    fwrite(&pipeline_header, sizeof(pipeline_header), 1, pipeline_file_);
+  }
+
+  // Read the guest shaders until the end of the file or until a corrupted one.
+  shader_file_ = xe::filesystem::OpenFile(shader_file_path, "a+b");
+  if (!shader_file_) {
+    XELOGE("Failed to open the guest shader storage file for writing: {}",
+           xe::path_to_utf8(shader_file_path));
+    fclose(pipeline_file_);
+    pipeline_file_ = nullptr;
+    return false;
+  }
+  ShaderFileHeader shader_file_header;
+  if (fread(&shader_file_header, sizeof(shader_file_header), 1,
+            shader_file_) &&
+      shader_file_header.magic == kShaderFileMagic &&
+      xe::byte_swap(shader_file_header.version_swapped) ==
+          ShaderHeader::kVersion) {
+    uint64_t shader_valid_bytes = sizeof(shader_file_header);
+    ShaderHeader shader_header;
+    std::vector<uint32_t> ucode_dwords;
+    ucode_dwords.reserve(0xFFFF);
+    while (fread(&shader_header, sizeof(shader_header), 1, shader_file_)) {
+      size_t ucode_byte_count =
+          shader_header.ucode_dword_count * sizeof(uint32_t);
+      ucode_dwords.resize(shader_header.ucode_dword_count);
+      if (shader_header.ucode_dword_count &&
+          !fread(ucode_dwords.data(), ucode_byte_count, 1, shader_file_)) {
+        break;
+      }
+      if (XXH3_64bits(ucode_dwords.data(), ucode_byte_count) !=
+          shader_header.ucode_data_hash) {
+        break;
+      }
+      shader_valid_bytes += sizeof(shader_header) + ucode_byte_count;
+      shader_callback(shader_header.type, ucode_dwords.data(),
+                      shader_header.ucode_dword_count,
+                      shader_header.ucode_data_hash);
+    }
+    xe::filesystem::TruncateStdioFile(shader_file_, shader_valid_bytes);
+  } else {
+    xe::filesystem::TruncateStdioFile(shader_file_, 0);
+    shader_file_header.magic = kShaderFileMagic;
+    shader_file_header.version_swapped = xe::byte_swap(ShaderHeader::kVersion);
+    fwrite(&shader_file_header, sizeof(shader_file_header), 1, shader_file_);
+  }
+
+  // Start the writing thread.
+  write_flush_ = false;
+  write_thread_shutdown_ = false;
+  write_thread_ =
+      xe::threading::Thread::Create({}, [this]() { WriteThread(); });
+  assert_not_null(write_thread_);
+  write_thread_->set_name("GPU Storage Writer");
+  return true;
+}
+
+void ShaderStorage::Close() {
+  if (write_thread_) {
+    {
+      std::lock_guard<std::mutex> lock(write_request_lock_);
+      write_thread_shutdown_ = true;
+    }
+    write_request_cond_.notify_all();
+    xe::threading::Wait(write_thread_.get(), false);
+    write_thread_.reset();
+  }
+  write_shader_queue_.clear();
+  write_pipeline_queue_.clear();
+
+  if (pipeline_file_) {
+    fclose(pipeline_file_);
+    pipeline_file_ = nullptr;
+  }
+  if (shader_file_) {
+    fclose(shader_file_);
+    shader_file_ = nullptr;
+  }
+}
+
+void ShaderStorage::AppendShader(const Shader& shader) {
+  assert_not_null(write_thread_);
+  {
+    std::lock_guard<std::mutex> lock(write_request_lock_);
+    write_shader_queue_.push_back(&shader);
+  }
+  write_request_cond_.notify_all();
+}
+
+void ShaderStorage::AppendPipeline(const void* description) {
+  assert_not_null(write_thread_);
+  std::vector<uint8_t> record(sizeof(uint64_t) + pipeline_description_size_);
+  uint64_t description_hash =
+      XXH3_64bits(description, pipeline_description_size_);
+  std::memcpy(record.data(), &description_hash, sizeof(uint64_t));
+  std::memcpy(record.data() + sizeof(uint64_t), description,
+              pipeline_description_size_);
+  {
+    std::lock_guard<std::mutex> lock(write_request_lock_);
+    write_pipeline_queue_.push_back(std::move(record));
+  }
+  write_request_cond_.notify_all();
+}
+
+void ShaderStorage::Flush() {
+  if (!write_thread_) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(write_request_lock_);
+    write_flush_ = true;
+  }
+  write_request_cond_.notify_all();
+}
+
+void ShaderStorage::WriteThread() {
+  ShaderHeader shader_header;
+  // Don't leak anything in unused bits.
+  std::memset(&shader_header, 0, sizeof(shader_header));
+
+  std::vector<uint32_t> ucode_guest_endian;
+  ucode_guest_endian.reserve(0xFFFF);
+
+  while (true) {
+    const Shader* shader = nullptr;
+    std::vector<uint8_t> pipeline_record;
+    bool flush = false;
+    {
+      std::unique_lock<std::mutex> lock(write_request_lock_);
+      write_request_cond_.wait(lock, [this]() {
+        return !write_shader_queue_.empty() ||
+               !write_pipeline_queue_.empty() || write_flush_ ||
+               write_thread_shutdown_;
+      });
+      if (!write_shader_queue_.empty()) {
+        shader = write_shader_queue_.front();
+        write_shader_queue_.pop_front();
+      }
+      if (!write_pipeline_queue_.empty()) {
+        pipeline_record = std::move(write_pipeline_queue_.front());
+        write_pipeline_queue_.pop_front();
+      }
+      if (!shader && pipeline_record.empty()) {
+        // Everything has been written, the files are flushed when closed.
+        if (write_thread_shutdown_) {
+          return;
+        }
+        write_flush_ = false;
+        flush = true;
+      }
+    }
+
+    if (shader) {
+      shader_header.ucode_data_hash = shader->ucode_data_hash();
+      shader_header.ucode_dword_count = uint32_t(shader->ucode_dword_count());
+      shader_header.type = shader->type();
+      fwrite(&shader_header, sizeof(shader_header), 1, shader_file_);
+      if (shader_header.ucode_dword_count) {
+        ucode_guest_endian.resize(shader_header.ucode_dword_count);
+        // Need to swap because the hash is calculated for the shader with guest
+        // endianness.
+        xe::copy_and_swap(ucode_guest_endian.data(), shader->ucode_dwords(),
+                          shader_header.ucode_dword_count);
+        fwrite(ucode_guest_endian.data(),
+               shader_header.ucode_dword_count * sizeof(uint32_t), 1,
+               shader_file_);
+      }
+    }
+
+    if (!pipeline_record.empty()) {
+      fwrite(pipeline_record.data(), pipeline_record.size(), 1,
+             pipeline_file_);
+    }
+
+    if (flush) {
+      fflush(shader_file_);
+      fflush(pipeline_file_);
+    }
+  }
+}
+
+}  // namespace gpu
+}  // namespace xe
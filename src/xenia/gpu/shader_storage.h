@@ -0,0 +1,109 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_SHADER_STORAGE_H_
+#define XENIA_GPU_SHADER_STORAGE_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "xenia/base/platform.h"
+#include "xenia/base/threading.h"
+#include "xenia/gpu/shader.h"
+#include "xenia/gpu/xenos.h"
+
+namespace xe {
+namespace gpu {
+
+// Persistent storage of the guest shaders and the host pipeline descriptions
+// used by a title, for translating the shaders and creating the pipelines
+// before they're first drawn with in the next emulator runs.
+// The guest shader file is independent of the host and shareable between the
+// backends, while the format of the pipeline descriptions is defined by the
+// backend, and they're stored as opaque fixed-size records identified by
+// a magic number, the version of the description structure, and the version of
+// the shader modifications it contains.
+// Entries are appended on a separate thread. When opening, everything after
+// the first corrupted entry is dropped, and files of another format are
+// started anew.
+class ShaderStorage {
+ public:
+  XEPACKEDSTRUCT(ShaderHeader, {
+    uint64_t ucode_data_hash;
+
+    uint32_t ucode_dword_count : 31;
+    xenos::ShaderType type : 1;
+
+    static constexpr uint32_t kVersion = 0x20201219;
+  });
+
+  // Called for each stored shader when opening, with the microcode in the guest
+  // byte order.
+  using ShaderCallback = std::function<void(
+      xenos::ShaderType type, const uint32_t* ucode_dwords,
+      uint32_t ucode_dword_count, uint64_t ucode_data_hash)>;
+
+  ShaderStorage() = default;
+  ShaderStorage(const ShaderStorage& storage) = delete;
+  ShaderStorage& operator=(const ShaderStorage& storage) = delete;
+  ~ShaderStorage() { Close(); }
+
+  // Opens the storage, calling shader_callback for the stored shaders and
+  // appending the stored pipeline descriptions to pipeline_descriptions_out,
+  // each pipeline_description_size bytes long.
+  bool Open(const std::filesystem::path& shader_file_path,
+            const std::filesystem::path& pipeline_file_path,
+            uint32_t pipeline_magic_api,
+            uint32_t pipeline_description_version,
+            uint32_t shader_modification_version,
+            size_t pipeline_description_size,
+            const ShaderCallback& shader_callback,
+            std::vector<uint8_t>& pipeline_descriptions_out);
+  // Writes everything appended, and closes the files.
+  void Close();
+  bool is_open() const { return shader_file_ != nullptr; }
+
+  // The shader must stay alive while the storage is open.
+  void AppendShader(const Shader& shader);
+  void AppendPipeline(const void* description);
+  // Makes the entries appended until now written to the files on the storage
+  // thread, for instance, at the end of a submission.
+  void Flush();
+
+ private:
+  void WriteThread();
+
+  FILE* shader_file_ = nullptr;
+  FILE* pipeline_file_ = nullptr;
+  size_t pipeline_description_size_ = 0;
+
+  std::mutex write_request_lock_;
+  std::condition_variable write_request_cond_;
+  // Protected with write_request_lock_, and the thread is notified about their
+  // changes via write_request_cond_.
+  std::deque<const Shader*> write_shader_queue_;
+  // Hashes followed by descriptions.
+  std::deque<std::vector<uint8_t>> write_pipeline_queue_;
+  bool write_flush_ = false;
+  bool write_thread_shutdown_ = false;
+  std::unique_ptr<xe::threading::Thread> write_thread_;
+};
+
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_SHADER_STORAGE_H_
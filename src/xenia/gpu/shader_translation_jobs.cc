@@ -0,0 +1,117 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/shader_translation_jobs.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace gpu {
+
+ShaderTranslationJobs::ShaderTranslationJobs(size_t job_count,
+                                             size_t max_worker_count)
+    : job_count_(job_count) {
+  if (!max_worker_count) {
+    max_worker_count = xe::threading::logical_processor_count();
+    if (!max_worker_count) {
+      // Pick some reasonable amount if couldn't determine the number of cores.
+      max_worker_count = 6;
+    }
+  }
+  worker_count_ = std::min(job_count, max_worker_count);
+  if (!worker_count_) {
+    return;
+  }
+  worker_ranges_ = std::make_unique<WorkerRange[]>(worker_count_);
+  for (size_t i = 0; i < worker_count_; ++i) {
+    WorkerRange& range = worker_ranges_[i];
+    range.begin = job_count * i / worker_count_;
+    range.end = job_count * (i + 1) / worker_count_;
+  }
+}
+
+void ShaderTranslationJobs::Run(
+    const char* thread_name,
+    const std::function<void(size_t worker_index)>& worker_function) {
+  if (!worker_count_) {
+    return;
+  }
+  std::vector<std::unique_ptr<xe::threading::Thread>> threads;
+  threads.reserve(worker_count_ - 1);
+  for (size_t i = 1; i < worker_count_; ++i) {
+    auto thread = xe::threading::Thread::Create(
+        {}, [&worker_function, i]() { worker_function(i); });
+    assert_not_null(thread);
+    thread->set_name(thread_name);
+    threads.push_back(std::move(thread));
+  }
+  worker_function(0);
+  for (auto& thread : threads) {
+    xe::threading::Wait(thread.get(), false);
+  }
+}
+
+size_t ShaderTranslationJobs::AcquireJob(size_t worker_index) {
+  assert_true(worker_index < worker_count_);
+  WorkerRange& own_range = worker_ranges_[worker_index];
+  {
+    std::lock_guard<std::mutex> lock(own_range.mutex);
+    if (own_range.begin < own_range.end) {
+      return own_range.begin++;
+    }
+  }
+  // Only this worker adds jobs to its own range, so it stays empty while
+  // stealing.
+  while (true) {
+    size_t victim_index = SIZE_MAX;
+    size_t victim_remaining = 0;
+    for (size_t i = 0; i < worker_count_; ++i) {
+      if (i == worker_index) {
+        continue;
+      }
+      WorkerRange& range = worker_ranges_[i];
+      std::lock_guard<std::mutex> lock(range.mutex);
+      size_t remaining = range.end - range.begin;
+      if (remaining > victim_remaining) {
+        victim_index = i;
+        victim_remaining = remaining;
+      }
+    }
+    if (victim_index == SIZE_MAX) {
+      return kNoJob;
+    }
+    size_t stolen_begin, stolen_end;
+    {
+      WorkerRange& victim_range = worker_ranges_[victim_index];
+      std::lock_guard<std::mutex> lock(victim_range.mutex);
+      size_t remaining = victim_range.end - victim_range.begin;
+      if (!remaining) {
+        // Taken by the owner or by another thief meanwhile - look again.
+        continue;
+      }
+      stolen_end = victim_range.end;
+      victim_range.end = victim_range.begin + remaining / 2;
+      stolen_begin = victim_range.end;
+    }
+    {
+      std::lock_guard<std::mutex> lock(own_range.mutex);
+      own_range.begin = stolen_begin + 1;
+      own_range.end = stolen_end;
+    }
+    return stolen_begin;
+  }
+}
+
+}  // namespace gpu
+}  // namespace xe
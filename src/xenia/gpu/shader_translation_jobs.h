@@ -0,0 +1,72 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_SHADER_TRANSLATION_JOBS_H_
+#define XENIA_GPU_SHADER_TRANSLATION_JOBS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace xe {
+namespace gpu {
+
+// Executes a fixed number of independent jobs, such as translations of the
+// shaders loaded from the storage, on all host cores.
+// Each worker starts with an even contiguous range of the job indices, and
+// after finishing its own jobs, takes the second half of the remaining range
+// of the worker with the most jobs left, so translation of a few huge shaders
+// doesn't leave the other cores idle.
+// Which worker executes which job is not deterministic, so jobs must only write
+// their results to locations owned by their index, and everything depending on
+// the order of the results (such as destruction of the failed translations)
+// must be done after Run, in the order of the job indices.
+class ShaderTranslationJobs {
+ public:
+  static constexpr size_t kNoJob = SIZE_MAX;
+
+  // Up to one worker per logical processor if max_worker_count is 0.
+  explicit ShaderTranslationJobs(size_t job_count, size_t max_worker_count = 0);
+  ShaderTranslationJobs(const ShaderTranslationJobs& jobs) = delete;
+  ShaderTranslationJobs& operator=(const ShaderTranslationJobs& jobs) = delete;
+
+  size_t job_count() const { return job_count_; }
+  // 0 if there are no jobs.
+  size_t worker_count() const { return worker_count_; }
+
+  // Calls worker_function on the calling thread as worker 0 and on
+  // worker_count - 1 new threads, returning when all of them have returned.
+  // The worker function creates its per-thread objects (the translator, for
+  // instance) and executes the jobs while AcquireJob returns them.
+  void Run(const char* thread_name,
+           const std::function<void(size_t worker_index)>& worker_function);
+
+  // Returns the index of the next job to execute on the worker, or kNoJob if
+  // all the jobs have been acquired.
+  size_t AcquireJob(size_t worker_index);
+
+ private:
+  struct WorkerRange {
+    std::mutex mutex;
+    // The owner takes jobs from the beginning, thieves from the end.
+    size_t begin;
+    size_t end;
+  };
+
+  size_t job_count_;
+  size_t worker_count_;
+  std::unique_ptr<WorkerRange[]> worker_ranges_;
+};
+
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_SHADER_TRANSLATION_JOBS_H_
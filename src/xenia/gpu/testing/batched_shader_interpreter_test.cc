@@ -0,0 +1,463 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/batched_shader_interpreter.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+
+#include "xenia/base/filesystem.h"
+#include "xenia/base/string.h"
+#include "xenia/base/string_buffer.h"
+#include "xenia/gpu/register_file.h"
+#include "xenia/gpu/registers.h"
+#include "xenia/gpu/shader_interpreter.h"
+
+namespace xe::gpu::test {
+
+namespace {
+// Component-relative ALU swizzle.
+constexpr uint32_t Swizzle(uint32_t x, uint32_t y, uint32_t z, uint32_t w) {
+  return ((x - 0) & 3) | (((y - 1) & 3) << 2) | (((z - 2) & 3) << 4) |
+         (((w - 3) & 3) << 6);
+}
+constexpr uint32_t kSwizzleXYZW = Swizzle(0, 1, 2, 3);
+constexpr uint32_t kSwizzleXXXX = Swizzle(0, 0, 0, 0);
+// For the scalar operand (.w, or .wx for two-component operands).
+constexpr uint32_t kSwizzleScalarX = Swizzle(0, 0, 0, 0);
+constexpr uint32_t kSwizzleScalarY = Swizzle(0, 0, 0, 1);
+constexpr uint32_t kSwizzleScalarWX = Swizzle(0, 0, 0, 3);
+
+constexpr uint32_t kExportRegisterPosition = 62;
+constexpr uint32_t kExportRegisterPointSize = 63;
+
+struct AluOperand {
+  bool is_temp;
+  uint32_t reg;
+  uint32_t swizzle;
+  bool negate = false;
+  bool absolute = false;
+  bool relative = false;
+};
+
+struct AluDesc {
+  ucode::AluVectorOpcode vector_opcode;
+  uint32_t vector_dest;
+  uint32_t vector_write_mask;
+  ucode::AluScalarOpcode scalar_opcode;
+  uint32_t scalar_dest;
+  uint32_t scalar_write_mask;
+  AluOperand src[3];
+  bool is_export = false;
+  bool vector_clamp = false;
+  bool scalar_clamp = false;
+  bool is_predicated = false;
+  bool predicate_condition = false;
+};
+
+void AppendAlu(std::vector<uint32_t>& ucode, const AluDesc& desc) {
+  uint32_t dword_0 = desc.vector_dest | (desc.scalar_dest << 8) |
+                     (uint32_t(desc.is_export) << 15) |
+                     (desc.vector_write_mask << 16) |
+                     (desc.scalar_write_mask << 20) |
+                     (uint32_t(desc.vector_clamp) << 24) |
+                     (uint32_t(desc.scalar_clamp) << 25) |
+                     (uint32_t(desc.scalar_opcode) << 26);
+  uint32_t dword_1 = (uint32_t(desc.is_predicated) << 28) |
+                     (uint32_t(desc.predicate_condition) << 27);
+  uint32_t dword_2 = uint32_t(desc.vector_opcode) << 24;
+  bool constant_relative[2] = {};
+  uint32_t constant_count = 0;
+  for (uint32_t i = 0; i < 3; ++i) {
+    const AluOperand& src = desc.src[i];
+    uint32_t src_reg = src.reg;
+    if (src.is_temp) {
+      src_reg |= (uint32_t(src.relative) << 6) | (uint32_t(src.absolute) << 7);
+    } else {
+      constant_relative[std::min(constant_count++, UINT32_C(1))] |=
+          src.relative;
+    }
+    dword_1 |= (src.swizzle << (8 * (2 - i))) |
+               (uint32_t(src.negate) << (26 - i));
+    dword_2 |= (src_reg << (8 * (2 - i))) | (uint32_t(src.is_temp) << (31 - i));
+  }
+  dword_1 |= (uint32_t(constant_relative[1]) << 30) |
+             (uint32_t(constant_relative[0]) << 31);
+  ucode.push_back(dword_0);
+  ucode.push_back(dword_1);
+  ucode.push_back(dword_2);
+}
+
+// Control flow instructions in the lower 48 bits.
+uint64_t CfExec(ucode::ControlFlowOpcode opcode, uint32_t address,
+                uint32_t count, bool condition = false,
+                uint32_t bool_address = 0) {
+  return address | (count << 12) | (uint64_t(bool_address) << 34) |
+         (uint64_t(condition) << 42) | (uint64_t(opcode) << 44);
+}
+uint64_t CfLoopStart(uint32_t address, uint32_t loop_id) {
+  return address | (loop_id << 16) |
+         (uint64_t(ucode::ControlFlowOpcode::kLoopStart) << 44);
+}
+uint64_t CfLoopEnd(uint32_t address, uint32_t loop_id) {
+  return address | (loop_id << 16) |
+         (uint64_t(ucode::ControlFlowOpcode::kLoopEnd) << 44);
+}
+uint64_t CfCondJmp(uint32_t address, uint32_t bool_address, bool condition) {
+  return address | (uint64_t(bool_address) << 34) |
+         (uint64_t(condition) << 42) |
+         (uint64_t(ucode::ControlFlowOpcode::kCondJmp) << 44);
+}
+void AppendCfPair(std::vector<uint32_t>& ucode, uint64_t a, uint64_t b) {
+  ucode.push_back(uint32_t(a));
+  ucode.push_back(uint32_t(a >> 32) | (uint32_t(b) << 16));
+  ucode.push_back(uint32_t(b >> 16));
+}
+
+struct Exports {
+  std::optional<float> values[2][4];
+
+  bool operator==(const Exports& other) const {
+    for (uint32_t i = 0; i < 2; ++i) {
+      for (uint32_t j = 0; j < 4; ++j) {
+        if (values[i][j].has_value() != other.values[i][j].has_value() ||
+            (values[i][j].has_value() &&
+             std::memcmp(&*values[i][j], &*other.values[i][j],
+                         sizeof(float)))) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+};
+
+class ExportCollector : public ShaderInterpreter::ExportSink {
+ public:
+  void Export(ucode::ExportRegister export_register, const float* value,
+              uint32_t value_mask) override {
+    uint32_t index;
+    if (export_register == ucode::ExportRegister::kVSPosition) {
+      index = 0;
+    } else if (export_register ==
+               ucode::ExportRegister::kVSPointSizeEdgeFlagKillVertex) {
+      index = 1;
+    } else {
+      return;
+    }
+    for (uint32_t i = 0; i < 4; ++i) {
+      if (value_mask & (UINT32_C(1) << i)) {
+        exports.values[index][i] = value[i];
+      }
+    }
+  }
+
+  Exports exports;
+};
+
+// Relative to the repository root, which the tests are run from.
+const char* const kDumpedShaderDirectory = "src/xenia/gpu/testing/shaders";
+
+// Executes the shader for vertices with r0.x from first_vertex_value, and
+// requires BatchedShaderInterpreter to export the same values as
+// ShaderInterpreter.
+void RequireSameExportsAsInterpreter(
+    const std::vector<uint32_t>& ucode, const RegisterFile& regs,
+    float first_vertex_value, std::endian ucode_endian = std::endian::native) {
+  Shader shader(xenos::ShaderType::kVertex, 0, ucode.data(), ucode.size(),
+                ucode_endian);
+  StringBuffer ucode_disasm_buffer;
+  shader.AnalyzeUcode(ucode_disasm_buffer);
+
+  // Not initialized, the shaders don't fetch vertices.
+  Memory memory;
+
+  const uint32_t vertex_count = BatchedShaderInterpreter::kLaneCount + 5;
+  std::vector<Exports> interpreter_exports(vertex_count);
+  ShaderInterpreter interpreter(regs, memory);
+  interpreter.SetShader(shader);
+  for (uint32_t i = 0; i < vertex_count; ++i) {
+    ExportCollector collector;
+    interpreter.SetExportSink(&collector);
+    interpreter.temp_registers()[0] = first_vertex_value + float(i);
+    interpreter.Execute();
+    interpreter_exports[i] = collector.exports;
+  }
+
+  // Both with the generated code (if supported on the host) and interpreted.
+  for (bool generate_code : {true, false}) {
+    auto batch_interpreter =
+        BatchedShaderInterpreter::Compile(shader, generate_code);
+    REQUIRE(batch_interpreter);
+    if (!generate_code) {
+      REQUIRE_FALSE(batch_interpreter->is_code_generated());
+    }
+    auto state = std::make_unique<BatchedShaderInterpreter::State>();
+    BatchedShaderInterpreter::LoadConstants(*state, regs, memory, nullptr);
+    for (uint32_t i = 0; i < vertex_count;
+         i += BatchedShaderInterpreter::kLaneCount) {
+      for (uint32_t j = 0; j < BatchedShaderInterpreter::kLaneCount; ++j) {
+        state->temps[0][0][j] = first_vertex_value + float(i + j);
+      }
+      batch_interpreter->Execute(*state);
+      for (uint32_t j = 0;
+           j < BatchedShaderInterpreter::kLaneCount && i + j < vertex_count;
+           ++j) {
+        Exports batch_exports;
+        for (uint32_t k = 0; k < 2; ++k) {
+          for (uint32_t l = 0; l < 4; ++l) {
+            if (state->exports_written[k][l][j]) {
+              batch_exports.values[k][l] = state->exports[k][l][j];
+            }
+          }
+        }
+        INFO("Vertex " << (i + j) << ", generated code "
+                       << batch_interpreter->is_code_generated());
+        REQUIRE(batch_exports == interpreter_exports[i + j]);
+      }
+    }
+  }
+}
+}  // namespace
+
+TEST_CASE("Batched shader interpreter matches the interpreter",
+          "[batched_shader_interpreter]") {
+  using ucode::AluScalarOpcode;
+  using ucode::AluVectorOpcode;
+  using ucode::ControlFlowOpcode;
+
+  std::vector<uint32_t> ucode;
+  // 6 control flow instructions, the ALU instructions start at 3.
+  AppendCfPair(ucode, CfExec(ControlFlowOpcode::kExec, 3, 3),
+               CfLoopStart(4, 0));
+  AppendCfPair(ucode, CfExec(ControlFlowOpcode::kExec, 6, 1), CfLoopEnd(2, 0));
+  AppendCfPair(ucode, CfExec(ControlFlowOpcode::kCondExecPred, 7, 1, true),
+               CfExec(ControlFlowOpcode::kExecEnd, 8, 2));
+  // 3: r1 = r0.xxxx * c0, p = r0.x > 0.
+  AppendAlu(ucode, {AluVectorOpcode::kMul,
+                    1,
+                    0b1111,
+                    AluScalarOpcode::kSetpGt,
+                    0,
+                    0b0000,
+                    {{true, 0, kSwizzleXXXX},
+                     {false, 0, kSwizzleXYZW},
+                     {true, 0, kSwizzleScalarX}}});
+  // 4: r2 = r1 * c1 + c2, r4.xw = 1 / c2.w.
+  AppendAlu(ucode, {AluVectorOpcode::kMad,
+                    2,
+                    0b1111,
+                    AluScalarOpcode::kRcp,
+                    4,
+                    0b1001,
+                    {{true, 1, kSwizzleXYZW},
+                     {false, 1, kSwizzleXYZW},
+                     {false, 2, kSwizzleXYZW}}});
+  // 5: r3 = max(|r2|, -r1), r4.y = frac(r2.x).
+  AppendAlu(ucode, {AluVectorOpcode::kMax,
+                    3,
+                    0b1111,
+                    AluScalarOpcode::kFrcs,
+                    4,
+                    0b0010,
+                    {{true, 2, kSwizzleXYZW, false, true},
+                     {true, 1, kSwizzleXYZW, true},
+                     {true, 2, kSwizzleScalarX}}});
+  // 6, in the loop: r3 += c[3 + aL], r4.z = ps + r0.x.
+  AppendAlu(ucode, {AluVectorOpcode::kAdd,
+                    3,
+                    0b1111,
+                    AluScalarOpcode::kAddsPrev,
+                    4,
+                    0b0100,
+                    {{true, 3, kSwizzleXYZW},
+                     {false, 3, kSwizzleXYZW, false, false, true},
+                     {true, 0, kSwizzleScalarX}}});
+  // 7, if p: r3 = dp4(r3, c6), r4.w = sqrt(r4.y).
+  AppendAlu(ucode, {AluVectorOpcode::kDp4,
+                    3,
+                    0b1111,
+                    AluScalarOpcode::kSqrt,
+                    4,
+                    0b1000,
+                    {{true, 3, kSwizzleXYZW},
+                     {false, 6, kSwizzleXYZW},
+                     {true, 4, kSwizzleScalarY}}});
+  // 8: oPos.xyw = r3 + r4, oPos.z = saturate(ps).
+  AppendAlu(ucode, {AluVectorOpcode::kAdd, kExportRegisterPosition, 0b1011,
+                    AluScalarOpcode::kRetainPrev, 0, 0b0100,
+                    {{true, 3, kSwizzleXYZW},
+                     {true, 4, kSwizzleXYZW},
+                     {true, 0, kSwizzleScalarX}},
+                    true, false, true});
+  // 9, if !p: oPts.x = r2.x >= r1.x, oPts.z = c7.w * c7.x.
+  AppendAlu(ucode, {AluVectorOpcode::kSge, kExportRegisterPointSize,
+                    0b0001, AluScalarOpcode::kMuls, 0, 0b0100,
+                    {{true, 2, kSwizzleXYZW},
+                     {true, 1, kSwizzleXYZW},
+                     {false, 7, kSwizzleScalarWX}},
+                    true, false, false, true, false});
+
+  auto register_file = std::make_unique<RegisterFile>();
+  RegisterFile& regs = *register_file;
+  const float constants[8][4] = {
+      {1.0f, -2.0f, 0.5f, 0.0f},   {3.0f, 0.25f, -1.0f, 2.0f},
+      {-4.0f, 1.5f, 0.0f, -8.0f},  {0.125f, 1.0f, 2.0f, 3.0f},
+      {-1.0f, -0.5f, 4.0f, 1.0f},  {2.0f, 2.0f, -2.0f, 0.75f},
+      {0.5f, -0.25f, 1.0f, 0.0f},  {-3.0f, 0.0f, 0.0f, 1.5f}};
+  std::memcpy(&regs[XE_GPU_REG_SHADER_CONSTANT_000_X], constants,
+              sizeof(constants));
+  regs.Get<reg::SQ_VS_CONST>().size = 7;
+  // 3 iterations, aL from 0 with step 1.
+  regs[XE_GPU_REG_SHADER_CONSTANT_LOOP_00].u32 = 3 | (1 << 16);
+
+  RequireSameExportsAsInterpreter(ucode, regs, -2.0f);
+}
+
+TEST_CASE(
+    "Batched shader interpreter matches the interpreter in conditional code",
+    "[batched_shader_interpreter]") {
+  using ucode::AluScalarOpcode;
+  using ucode::AluVectorOpcode;
+  using ucode::ControlFlowOpcode;
+
+  constexpr uint32_t kBoolExec = 5;
+  constexpr uint32_t kBoolJump = 38;
+
+  std::vector<uint32_t> ucode;
+  // 6 control flow instructions, the ALU instructions start at 3.
+  AppendCfPair(ucode, CfExec(ControlFlowOpcode::kExec, 3, 2),
+               CfExec(ControlFlowOpcode::kCondExec, 5, 1, true, kBoolExec));
+  AppendCfPair(ucode, CfCondJmp(4, kBoolJump, true),
+               CfExec(ControlFlowOpcode::kExec, 6, 1));
+  AppendCfPair(ucode, CfExec(ControlFlowOpcode::kExecEnd, 7, 1),
+               uint64_t(ControlFlowOpcode::kNop) << 44);
+  // 3: r1 = r0.xxxx * c0, r2.xz = exp(r0.x).
+  AppendAlu(ucode, {AluVectorOpcode::kMul,
+                    1,
+                    0b1111,
+                    AluScalarOpcode::kExp,
+                    2,
+                    0b0101,
+                    {{true, 0, kSwizzleXXXX},
+                     {false, 0, kSwizzleXYZW},
+                     {true, 0, kSwizzleScalarX}}});
+  // 4: r3 = setp_gt_push(r1, r0.xxxx) (p = r0.x > 0 as r1.w = 0),
+  // r2.y = logc(|r0.x|).
+  AppendAlu(ucode, {AluVectorOpcode::kSetpGtPush,
+                    3,
+                    0b1111,
+                    AluScalarOpcode::kLogc,
+                    2,
+                    0b0010,
+                    {{true, 1, kSwizzleXYZW},
+                     {true, 0, kSwizzleXXXX},
+                     {true, 0, kSwizzleScalarX, false, true}}});
+  // 5, if b5 and p: r3.yzw = max4(-r1), r2.z = rsqc(r0.x).
+  AppendAlu(ucode, {AluVectorOpcode::kMax4,
+                    3,
+                    0b1110,
+                    AluScalarOpcode::kRsqc,
+                    2,
+                    0b0100,
+                    {{true, 1, kSwizzleXYZW, true},
+                     {true, 1, kSwizzleXYZW},
+                     {true, 0, kSwizzleScalarX}},
+                    false, false, false, true, true});
+  // 6, skipped if b38: r3 *= c1, ps *= r0.x.
+  AppendAlu(ucode, {AluVectorOpcode::kMul,
+                    3,
+                    0b1111,
+                    AluScalarOpcode::kMulsPrev,
+                    0,
+                    0b0000,
+                    {{true, 3, kSwizzleXYZW},
+                     {false, 1, kSwizzleXYZW},
+                     {true, 0, kSwizzleScalarX}}});
+  // 7: oPos.xy = r3.xy + r2.xy, oPos.z = saturate(ps), oPos.w = 1.
+  AppendAlu(ucode, {AluVectorOpcode::kAdd, kExportRegisterPosition, 0b1011,
+                    AluScalarOpcode::kRetainPrev, 0, 0b1100,
+                    {{true, 3, kSwizzleXYZW},
+                     {true, 2, kSwizzleXYZW},
+                     {true, 0, kSwizzleScalarX}},
+                    true, false, true});
+
+  auto register_file = std::make_unique<RegisterFile>();
+  RegisterFile& regs = *register_file;
+  const float constants[2][4] = {{0.5f, -1.0f, 0.25f, 0.0f},
+                                 {2.0f, -0.5f, 3.0f, 1.0f}};
+  std::memcpy(&regs[XE_GPU_REG_SHADER_CONSTANT_000_X], constants,
+              sizeof(constants));
+  regs.Get<reg::SQ_VS_CONST>().size = 1;
+  for (uint32_t i = 0; i < 4; ++i) {
+    INFO("Exec bool " << (i & 1) << ", jump bool " << (i >> 1));
+    regs[XE_GPU_REG_SHADER_CONSTANT_BOOL_000_031].u32 = (i & 1) << kBoolExec;
+    regs[XE_GPU_REG_SHADER_CONSTANT_BOOL_032_063].u32 =
+        (i >> 1) << (kBoolJump & 31);
+    RequireSameExportsAsInterpreter(ucode, regs, -3.0f);
+  }
+}
+
+TEST_CASE("Batched shader interpreter matches the interpreter for dumps",
+          "[batched_shader_interpreter]") {
+  std::vector<xe::filesystem::FileInfo> files =
+      xe::filesystem::ListFiles(kDumpedShaderDirectory);
+  std::sort(files.begin(), files.end(),
+            [](const xe::filesystem::FileInfo& a,
+               const xe::filesystem::FileInfo& b) { return a.name < b.name; });
+
+  // Like in the shader interpreter benchmark, vertex fetches return zeros as
+  // no vertex buffers are bound (the fetch constants have zero size).
+  auto register_file = std::make_unique<RegisterFile>();
+  RegisterFile& regs = *register_file;
+  for (uint32_t i = 0; i < 512 * 4; ++i) {
+    regs[XE_GPU_REG_SHADER_CONSTANT_000_X + i].f32 =
+        float(int32_t(i % 17) - 8) * 0.125f;
+  }
+  regs.Get<reg::SQ_VS_CONST>().size = 255;
+  // 3 iterations of every loop, aL from 0 with step 1.
+  for (uint32_t i = 0; i < 32; ++i) {
+    regs[XE_GPU_REG_SHADER_CONSTANT_LOOP_00 + i].u32 = 3 | (1 << 16);
+  }
+  for (uint32_t i = 0; i < 8; ++i) {
+    regs[XE_GPU_REG_SHADER_CONSTANT_BOOL_000_031 + i].u32 = 0x5555AAAA;
+  }
+
+  uint32_t shader_count = 0;
+  std::vector<uint32_t> ucode;
+  for (const xe::filesystem::FileInfo& file_info : files) {
+    // Shader::DumpUcode writes the microcode as .bin.vert.
+    if (file_info.type != xe::filesystem::FileInfo::Type::kFile ||
+        file_info.name.extension() != ".vert" ||
+        file_info.name.stem().extension() != ".bin") {
+      continue;
+    }
+    INFO("Shader " << xe::path_to_utf8(file_info.name));
+    FILE* file =
+        xe::filesystem::OpenFile(file_info.path / file_info.name, "rb");
+    REQUIRE(file);
+    ucode.resize(file_info.total_size / sizeof(uint32_t));
+    bool read = !ucode.empty() &&
+                fread(ucode.data(), sizeof(uint32_t) * ucode.size(), 1, file);
+    fclose(file);
+    REQUIRE(read);
+    // Dumped on a little-endian host.
+    RequireSameExportsAsInterpreter(ucode, regs, 0.0f, std::endian::little);
+    ++shader_count;
+  }
+  REQUIRE(shader_count);
+}
+
+}  // namespace xe::gpu::test
@@ -0,0 +1,20 @@
+project_root = "../../../.."
+include(project_root.."/tools/build")
+
+test_suite("xenia-gpu-tests", project_root, ".", {
+  links = {
+    "capstone",
+    "fmt",
+    "imgui",
+    "xenia-base",
+    "xenia-core",
+    "xenia-cpu",
+    "xenia-gpu",
+    "xxhash",
+
+    -- Needed by xenia-core for Memory.
+    "xenia-kernel",
+    "xenia-ui",
+    "xenia-patcher",
+  },
+})
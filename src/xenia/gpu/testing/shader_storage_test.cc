@@ -0,0 +1,201 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/shader_storage.h"
+
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+#include "third_party/fmt/include/fmt/format.h"
+
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/xxhash.h"
+
+namespace xe::gpu::test {
+
+namespace {
+// 'TEST'.
+constexpr uint32_t kPipelineMagicApi = 0x54534554;
+constexpr uint32_t kPipelineDescriptionVersion = 2;
+constexpr uint32_t kShaderModificationVersion = 1;
+
+struct PipelineDescription {
+  uint64_t vertex_shader_hash;
+  uint32_t state;
+  uint32_t padding;
+};
+
+struct StoredShader {
+  xenos::ShaderType type;
+  std::vector<uint32_t> ucode_dwords;
+  uint64_t ucode_data_hash;
+};
+
+class StorageFiles {
+ public:
+  StorageFiles() {
+    auto root = std::filesystem::temp_directory_path() /
+                fmt::format("xenia_shader_storage_test_{}",
+                            Clock::QueryHostTickCount());
+    std::filesystem::create_directories(root);
+    root_ = root;
+  }
+  ~StorageFiles() { std::filesystem::remove_all(root_); }
+
+  std::filesystem::path shader_path() const { return root_ / "test.xsh"; }
+  std::filesystem::path pipeline_path() const { return root_ / "test.xpso"; }
+
+  bool Open(ShaderStorage& storage, uint32_t pipeline_description_version,
+            uint32_t shader_modification_version,
+            std::vector<StoredShader>& shaders_out,
+            std::vector<PipelineDescription>& pipelines_out) const {
+    shaders_out.clear();
+    pipelines_out.clear();
+    std::vector<uint8_t> pipeline_descriptions;
+    if (!storage.Open(
+            shader_path(), pipeline_path(), kPipelineMagicApi,
+            pipeline_description_version, shader_modification_version,
+            sizeof(PipelineDescription),
+            [&shaders_out](xenos::ShaderType type, const uint32_t* ucode_dwords,
+                           uint32_t ucode_dword_count,
+                           uint64_t ucode_data_hash) {
+              shaders_out.push_back(
+                  {type,
+                   std::vector<uint32_t>(ucode_dwords,
+                                         ucode_dwords + ucode_dword_count),
+                   ucode_data_hash});
+            },
+            pipeline_descriptions)) {
+      return false;
+    }
+    pipelines_out.resize(pipeline_descriptions.size() /
+                         sizeof(PipelineDescription));
+    std::memcpy(pipelines_out.data(), pipeline_descriptions.data(),
+                pipeline_descriptions.size());
+    return pipeline_descriptions.size() % sizeof(PipelineDescription) == 0;
+  }
+
+ private:
+  std::filesystem::path root_;
+};
+}  // namespace
+
+TEST_CASE("Shader storage round trip", "[shader_storage]") {
+  StorageFiles files;
+
+  // In the guest byte order, as loaded from the guest memory.
+  const std::array<uint32_t, 6> ucode = {0x00000000, 0x10021000, 0x00000000,
+                                         0x0100C200, 0x1B1B1B00, 0xE2000000};
+  uint64_t ucode_data_hash = XXH3_64bits(ucode.data(), sizeof(ucode));
+  Shader shader(xenos::ShaderType::kPixel, ucode_data_hash, ucode.data(),
+                ucode.size());
+  PipelineDescription pipelines[2] = {{ucode_data_hash, 1, 0},
+                                      {ucode_data_hash, 2, 0}};
+
+  std::vector<StoredShader> shaders;
+  std::vector<PipelineDescription> loaded_pipelines;
+  {
+    ShaderStorage storage;
+    REQUIRE(files.Open(storage, kPipelineDescriptionVersion,
+                       kShaderModificationVersion, shaders, loaded_pipelines));
+    REQUIRE(shaders.empty());
+    REQUIRE(loaded_pipelines.empty());
+    storage.AppendShader(shader);
+    storage.AppendPipeline(&pipelines[0]);
+    storage.AppendPipeline(&pipelines[1]);
+    storage.Flush();
+  }
+
+  SECTION("Everything appended is loaded") {
+    ShaderStorage storage;
+    REQUIRE(files.Open(storage, kPipelineDescriptionVersion,
+                       kShaderModificationVersion, shaders, loaded_pipelines));
+    REQUIRE(shaders.size() == 1);
+    REQUIRE(shaders[0].type == xenos::ShaderType::kPixel);
+    REQUIRE(shaders[0].ucode_data_hash == ucode_data_hash);
+    REQUIRE(shaders[0].ucode_dwords ==
+            std::vector<uint32_t>(ucode.cbegin(), ucode.cend()));
+    REQUIRE(loaded_pipelines.size() == 2);
+    REQUIRE(!std::memcmp(loaded_pipelines.data(), pipelines,
+                         sizeof(pipelines)));
+  }
+
+  SECTION("Corrupted entries and everything after them are dropped") {
+    {
+      FILE* file = xe::filesystem::OpenFile(files.pipeline_path(), "r+b");
+      REQUIRE(file);
+      // The state of the second description, after the file header and the
+      // first hash and description.
+      REQUIRE(xe::filesystem::Seek(
+          file,
+          int64_t(sizeof(uint32_t) * 4 + sizeof(uint64_t) * 2 +
+                  sizeof(PipelineDescription) + sizeof(uint64_t)),
+          SEEK_SET));
+      uint32_t state = 3;
+      REQUIRE(fwrite(&state, sizeof(state), 1, file));
+      fclose(file);
+      // Part of a shader header.
+      file = xe::filesystem::OpenFile(files.shader_path(), "ab");
+      REQUIRE(file);
+      REQUIRE(fwrite(&ucode_data_hash, sizeof(ucode_data_hash), 1, file));
+      fclose(file);
+    }
+    {
+      ShaderStorage storage;
+      REQUIRE(files.Open(storage, kPipelineDescriptionVersion,
+                         kShaderModificationVersion, shaders,
+                         loaded_pipelines));
+      REQUIRE(shaders.size() == 1);
+      REQUIRE(loaded_pipelines.size() == 1);
+      REQUIRE(loaded_pipelines[0].state == 1);
+      // Appended after the last valid entry.
+      storage.AppendShader(shader);
+      storage.AppendPipeline(&pipelines[1]);
+    }
+    ShaderStorage storage;
+    REQUIRE(files.Open(storage, kPipelineDescriptionVersion,
+                       kShaderModificationVersion, shaders, loaded_pipelines));
+    REQUIRE(shaders.size() == 2);
+    REQUIRE(loaded_pipelines.size() == 2);
+    REQUIRE(loaded_pipelines[1].state == 2);
+  }
+
+  SECTION("Pipelines of another description version are discarded") {
+    ShaderStorage storage;
+    REQUIRE(files.Open(storage, kPipelineDescriptionVersion + 1,
+                       kShaderModificationVersion, shaders, loaded_pipelines));
+    REQUIRE(shaders.size() == 1);
+    REQUIRE(loaded_pipelines.empty());
+  }
+
+  SECTION("Pipelines of another modification version are discarded") {
+    ShaderStorage storage;
+    REQUIRE(files.Open(storage, kPipelineDescriptionVersion,
+                       kShaderModificationVersion + 1, shaders,
+                       loaded_pipelines));
+    REQUIRE(shaders.size() == 1);
+    REQUIRE(loaded_pipelines.empty());
+  }
+
+  SECTION("Versions are not combined") {
+    // The same sum of the versions.
+    ShaderStorage storage;
+    REQUIRE(files.Open(storage, kPipelineDescriptionVersion - 1,
+                       kShaderModificationVersion + 1, shaders,
+                       loaded_pipelines));
+    REQUIRE(shaders.size() == 1);
+    REQUIRE(loaded_pipelines.empty());
+  }
+}
+
+}  // namespace xe::gpu::test
@@ -0,0 +1,81 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/shader_translation_jobs.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe::gpu::test {
+
+namespace {
+// Executes the jobs, returning how many times each has been executed.
+std::vector<uint32_t> ExecuteJobs(ShaderTranslationJobs& jobs,
+                                  bool first_worker_slow) {
+  std::unique_ptr<std::atomic<uint32_t>[]> executions =
+      std::make_unique<std::atomic<uint32_t>[]>(jobs.job_count());
+  for (size_t i = 0; i < jobs.job_count(); ++i) {
+    executions[i] = 0;
+  }
+  jobs.Run("Shader Translation Test", [&](size_t worker_index) {
+    for (size_t i; (i = jobs.AcquireJob(worker_index)) !=
+                   ShaderTranslationJobs::kNoJob;) {
+      ++executions[i];
+      if (first_worker_slow && !worker_index) {
+        // Leave the jobs of this worker to the thieves.
+        volatile uint32_t spin = 0;
+        while (spin < 100000) {
+          spin = spin + 1;
+        }
+      }
+    }
+  });
+  std::vector<uint32_t> result(jobs.job_count());
+  for (size_t i = 0; i < jobs.job_count(); ++i) {
+    result[i] = executions[i];
+  }
+  return result;
+}
+}  // namespace
+
+TEST_CASE("Shader translation jobs are executed once", "[shader_jobs]") {
+  for (size_t job_count : {size_t(0), size_t(1), size_t(7), size_t(1000)}) {
+    for (size_t worker_count : {size_t(1), size_t(3), size_t(16)}) {
+      ShaderTranslationJobs jobs(job_count, worker_count);
+      REQUIRE(jobs.worker_count() == std::min(job_count, worker_count));
+      for (bool first_worker_slow : {false, true}) {
+        ShaderTranslationJobs run_jobs(job_count, worker_count);
+        REQUIRE(ExecuteJobs(run_jobs, first_worker_slow) ==
+                std::vector<uint32_t>(job_count, 1));
+      }
+    }
+  }
+}
+
+TEST_CASE("Shader translation jobs without a worker thread",
+          "[shader_jobs]") {
+  ShaderTranslationJobs jobs(5, 3);
+  // Jobs of the other workers are stolen, in no specific order, when they
+  // haven't started.
+  std::vector<uint32_t> executions(jobs.job_count());
+  size_t job_index;
+  while ((job_index = jobs.AcquireJob(0)) != ShaderTranslationJobs::kNoJob) {
+    ++executions[job_index];
+  }
+  REQUIRE(executions == std::vector<uint32_t>(jobs.job_count(), 1));
+  REQUIRE(jobs.AcquireJob(1) == ShaderTranslationJobs::kNoJob);
+  REQUIRE(jobs.AcquireJob(2) == ShaderTranslationJobs::kNoJob);
+}
+
+}  // namespace xe::gpu::test
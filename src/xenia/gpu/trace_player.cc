@@ -11,6 +11,7 @@
 
 #include <memory>
 
+#include "xenia/base/clock.h"
 #include "xenia/gpu/command_processor.h"
 #include "xenia/gpu/graphics_system.h"
 #include "xenia/gpu/registers.h"
@@ -81,6 +82,17 @@ void TracePlayer::SeekCommand(int target_command) {
   }
 }
 
+void TracePlayer::PlayAllFrames() {
+  if (!frame_count()) {
+    return;
+  }
+  current_frame_index_ = frame_count() - 1;
+  current_command_index_ = -1;
+  const uint8_t* trace_start = trace_data_ + sizeof(TraceHeader);
+  PlayTrace(trace_start, trace_data_ + trace_size_ - trace_start,
+            TracePlaybackMode::kUntilEnd, true);
+}
+
 void TracePlayer::WaitOnPlayback() {
   xe::threading::Wait(playback_event_.get(), true);
 }
@@ -158,8 +170,18 @@ void TracePlayer::PlayTraceOnThread(const uint8_t* trace_data,
         auto cmd = reinterpret_cast<const PacketEndCommand*>(trace_ptr);
         trace_ptr += sizeof(*cmd);
         if (pending_packet) {
-          command_processor->ExecutePacket(pending_packet->base_ptr,
-                                           pending_packet->count);
+          if (packet_executed_callback_) {
+            uint64_t execution_start = xe::Clock::QueryHostTickCount();
+            command_processor->ExecutePacket(pending_packet->base_ptr,
+                                             pending_packet->count);
+            packet_executed_callback_(
+                reinterpret_cast<const uint8_t*>(pending_packet + 1),
+                pending_packet->count,
+                xe::Clock::QueryHostTickCount() - execution_start);
+          } else {
+            command_processor->ExecutePacket(pending_packet->base_ptr,
+                                             pending_packet->count);
+          }
           pending_packet = nullptr;
         }
         if (pending_break) {
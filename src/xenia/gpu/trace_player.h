@@ -11,6 +11,7 @@
 #define XENIA_GPU_TRACE_PLAYER_H_
 
 #include <atomic>
+#include <functional>
 #include <string>
 
 #include "xenia/base/threading.h"
@@ -43,6 +44,19 @@ class TracePlayer : public TraceReader {
 
   void SeekFrame(int target_frame);
   void SeekCommand(int target_command);
+  // Plays all the frames in the trace without breaking on swaps, for measuring
+  // the command processing performance. WaitOnPlayback can be used to wait for
+  // the playback to complete.
+  void PlayAllFrames();
+
+  // If set, called on the command processor thread after every packet
+  // executed during playback, with the host ticks taken by its execution.
+  using PacketExecutedCallback =
+      std::function<void(const uint8_t* packet_data, uint32_t dword_count,
+                         uint64_t host_ticks)>;
+  void SetPacketExecutedCallback(PacketExecutedCallback callback) {
+    packet_executed_callback_ = std::move(callback);
+  }
 
   void WaitOnPlayback();
 
@@ -58,6 +72,7 @@ class TracePlayer : public TraceReader {
   bool playing_trace_ = false;
   std::atomic<uint32_t> playback_percent_ = {0};
   std::unique_ptr<xe::threading::Event> playback_event_;
+  PacketExecutedCallback packet_executed_callback_;
 };
 
 }  // namespace gpu
@@ -100,6 +100,14 @@ void VulkanCommandProcessor::ClearCaches() {
   cache_clear_requested_ = true;
 }
 
+void VulkanCommandProcessor::InitializeShaderStorage(
+    const std::filesystem::path& cache_root, uint32_t title_id, bool blocking) {
+  CommandProcessor::InitializeShaderStorage(cache_root, title_id, blocking);
+  // The pipeline cache loads everything before returning, whether blocking or
+  // not.
+  pipeline_cache_->InitializeShaderStorage(cache_root, title_id);
+}
+
 void VulkanCommandProcessor::TracePlaybackWroteMemory(uint32_t base_ptr,
                                                       uint32_t length) {
   shared_memory_->MemoryInvalidationCallback(base_ptr, length, true);
@@ -2992,6 +3000,8 @@ bool VulkanCommandProcessor::EndSubmission(bool is_swap) {
 
     shared_memory_->EndSubmission();
 
+    pipeline_cache_->EndSubmission();
+
     uniform_buffer_pool_->FlushWrites();
 
     // Submit sparse binds earlier, before executing the deferred command
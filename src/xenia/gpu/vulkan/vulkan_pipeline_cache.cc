@@ -14,19 +14,24 @@
 #include <cstdint>
 #include <cstring>
 #include <memory>
+#include <set>
 #include <utility>
 #include <vector>
 
 #include "third_party/fmt/include/fmt/format.h"
 #include "xenia/base/assert.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/profiling.h"
+#include "xenia/base/string.h"
 #include "xenia/base/xxhash.h"
 #include "xenia/gpu/draw_util.h"
 #include "xenia/gpu/gpu_flags.h"
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/registers.h"
+#include "xenia/gpu/shader_translation_jobs.h"
 #include "xenia/gpu/spirv_builder.h"
 #include "xenia/gpu/spirv_shader_translator.h"
 #include "xenia/gpu/vulkan/vulkan_command_processor.h"
@@ -85,6 +90,8 @@ bool VulkanPipelineCache::Initialize() {
 }
 
 void VulkanPipelineCache::Shutdown() {
+  ShutdownShaderStorage();
+
   const ui::vulkan::VulkanProvider& provider =
       command_processor_.GetVulkanProvider();
   const ui::vulkan::VulkanProvider::DeviceFunctions& dfn = provider.dfn();
@@ -121,12 +128,356 @@ void VulkanPipelineCache::Shutdown() {
   shader_translator_.reset();
 }
 
+void VulkanPipelineCache::InitializeShaderStorage(
+    const std::filesystem::path& cache_root, uint32_t title_id) {
+  ShutdownShaderStorage();
+
+  // The guest shaders and the pipeline descriptions can be moved between
+  // different hosts, while the driver pipeline cache is specific to the device
+  // and the driver.
+  auto shader_storage_root = cache_root / "shaders";
+  auto shader_storage_shareable_root = shader_storage_root / "shareable";
+  auto shader_storage_local_root = shader_storage_root / "local";
+  for (const std::filesystem::path& root :
+       {shader_storage_shareable_root, shader_storage_local_root}) {
+    if (!std::filesystem::exists(root) &&
+        !std::filesystem::create_directories(root)) {
+      XELOGE(
+          "Failed to create the shader storage directory, persistent shader "
+          "storage will be disabled: {}",
+          xe::path_to_utf8(root));
+      return;
+    }
+  }
+
+  const ui::vulkan::VulkanProvider& provider =
+      command_processor_.GetVulkanProvider();
+  const ui::vulkan::VulkanProvider::DeviceFunctions& dfn = provider.dfn();
+  VkDevice device = provider.device();
+
+  bool edram_fragment_shader_interlock =
+      render_target_cache_.GetPath() ==
+      RenderTargetCache::Path::kPixelShaderInterlock;
+
+  // Load the guest shaders (shared with the other backends) and the pipeline
+  // descriptions, which specify the shader modifications to translate.
+  uint64_t shader_storage_initialization_start =
+      xe::Clock::QueryHostTickCount();
+  ++shader_storage_index_;
+  shader_storage_flush_needed_ = false;
+  std::vector<VulkanShader*> shaders_to_translate;
+  std::vector<uint8_t> pipeline_description_data;
+  // 'VKFS' or 'VKRT'.
+  uint32_t pipeline_storage_magic_api =
+      edram_fragment_shader_interlock ? 0x53464B56 : 0x54524B56;
+  if (!shader_storage_.Open(
+          shader_storage_shareable_root / fmt::format("{:08X}.xsh", title_id),
+          shader_storage_shareable_root /
+              fmt::format("{:08X}.{}.vulkan.xpso", title_id,
+                          edram_fragment_shader_interlock ? "fsi" : "rtv"),
+          pipeline_storage_magic_api, PipelineDescription::kVersion,
+          SpirvShaderTranslator::Modification::kVersion,
+          sizeof(PipelineDescription),
+          [this, &shaders_to_translate](
+              xenos::ShaderType type, const uint32_t* ucode_dwords,
+              uint32_t ucode_dword_count, uint64_t ucode_data_hash) {
+            VulkanShader* shader = LoadShader(type, ucode_dwords,
+                                              ucode_dword_count,
+                                              ucode_data_hash);
+            if (shader->ucode_storage_index() == shader_storage_index_) {
+              // Appeared twice in the file for some reason - skip, otherwise
+              // it would be translated twice in parallel.
+              return;
+            }
+            // Loaded from the current storage - don't write again.
+            shader->set_ucode_storage_index(shader_storage_index_);
+            shaders_to_translate.push_back(shader);
+          },
+          pipeline_description_data)) {
+    XELOGE(
+        "Failed to open the Vulkan shader storage, persistent shader storage "
+        "will be disabled");
+    return;
+  }
+  std::vector<PipelineDescription> pipeline_descriptions(
+      pipeline_description_data.size() / sizeof(PipelineDescription));
+  std::memcpy(pipeline_descriptions.data(), pipeline_description_data.data(),
+              sizeof(PipelineDescription) * pipeline_descriptions.size());
+  // Skip the pipelines requiring unsupported device features, to keep the
+  // storage shareable across devices.
+  pipeline_descriptions.erase(
+      std::remove_if(pipeline_descriptions.begin(),
+                     pipeline_descriptions.end(),
+                     [this](const PipelineDescription& description) {
+                       return !ArePipelineRequirementsMet(description);
+                     }),
+      pipeline_descriptions.end());
+  // <Shader hash, modification bits>.
+  std::set<std::pair<uint64_t, uint64_t>> shader_translations_needed;
+  for (const PipelineDescription& description : pipeline_descriptions) {
+    shader_translations_needed.emplace(description.vertex_shader_hash,
+                                       description.vertex_shader_modification);
+    if (description.pixel_shader_hash) {
+      shader_translations_needed.emplace(
+          description.pixel_shader_hash, description.pixel_shader_modification);
+    }
+  }
+
+  // Translate the needed modifications of the shaders in parallel, each shader
+  // on one thread after the modification-independent analysis. The failures
+  // are handled in the order of the shaders in the storage.
+  std::vector<std::vector<VulkanShader::VulkanTranslation*>>
+      shaders_failed_to_translate(shaders_to_translate.size());
+  ShaderTranslationJobs shader_translation_jobs(shaders_to_translate.size());
+  shader_translation_jobs.Run("Shader Translation", [&](size_t worker_index) {
+    StringBuffer ucode_disasm_buffer;
+    SpirvShaderTranslator translator(
+        SpirvShaderTranslator::Features(provider),
+        render_target_cache_.msaa_2x_attachments_supported(),
+        render_target_cache_.msaa_2x_no_attachments_supported(),
+        edram_fragment_shader_interlock);
+    for (size_t i;
+         (i = shader_translation_jobs.AcquireJob(worker_index)) !=
+         ShaderTranslationJobs::kNoJob;) {
+      VulkanShader* shader = shaders_to_translate[i];
+      if (!shader->is_ucode_analyzed()) {
+        shader->AnalyzeUcode(ucode_disasm_buffer);
+      }
+      uint64_t ucode_data_hash = shader->ucode_data_hash();
+      for (auto modification_it = shader_translations_needed.lower_bound(
+               std::make_pair(ucode_data_hash, uint64_t(0)));
+           modification_it != shader_translations_needed.end() &&
+           modification_it->first == ucode_data_hash;
+           ++modification_it) {
+        auto translation = static_cast<VulkanShader::VulkanTranslation*>(
+            shader->GetOrCreateTranslation(modification_it->second));
+        // Only try (and delete in case of failure) if it's a new translation,
+        // not one of a shader already encountered in the game.
+        if (!translation->is_translated() &&
+            !TranslateAnalyzedShader(translator, *translation)) {
+          shaders_failed_to_translate[i].push_back(translation);
+        }
+      }
+    }
+  });
+  for (size_t i = 0; i < shaders_to_translate.size(); ++i) {
+    VulkanShader* shader = shaders_to_translate[i];
+    for (VulkanShader::VulkanTranslation* translation :
+         shaders_failed_to_translate[i]) {
+      shader->DestroyTranslation(translation->modification());
+    }
+    if (!shaders_failed_to_translate[i].empty() &&
+        shader->translations().empty()) {
+      shaders_.erase(shader->ucode_data_hash());
+      delete shader;
+    }
+  }
+  XELOGGPU("Translated {} shaders from the storage in {} milliseconds",
+           shaders_to_translate.size(),
+           (xe::Clock::QueryHostTickCount() -
+            shader_storage_initialization_start) *
+               1000 / xe::Clock::QueryHostTickFrequency());
+
+  // Create the driver pipeline cache from the data saved in the previous runs
+  // if it's for the same device and driver.
+  pipeline_cache_file_path_ =
+      shader_storage_local_root / fmt::format("{:08X}.vulkan.bin", title_id);
+  std::vector<uint8_t> pipeline_cache_data;
+  FILE* pipeline_cache_file =
+      xe::filesystem::OpenFile(pipeline_cache_file_path_, "rb");
+  if (pipeline_cache_file) {
+    if (xe::filesystem::Seek(pipeline_cache_file, 0, SEEK_END)) {
+      int64_t pipeline_cache_file_size =
+          xe::filesystem::Tell(pipeline_cache_file);
+      if (pipeline_cache_file_size > 0 &&
+          xe::filesystem::Seek(pipeline_cache_file, 0, SEEK_SET)) {
+        pipeline_cache_data.resize(size_t(pipeline_cache_file_size));
+        if (!fread(pipeline_cache_data.data(), pipeline_cache_data.size(), 1,
+                   pipeline_cache_file)) {
+          pipeline_cache_data.clear();
+        }
+      }
+    }
+    fclose(pipeline_cache_file);
+  }
+  // VkPipelineCacheHeaderVersionOne, not relying on the drivers to reject data
+  // from other devices.
+  const VkPhysicalDeviceProperties& device_properties =
+      provider.device_properties();
+  struct {
+    uint32_t header_size;
+    uint32_t header_version;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+  } pipeline_cache_header;
+  if (pipeline_cache_data.size() >= sizeof(pipeline_cache_header)) {
+    std::memcpy(&pipeline_cache_header, pipeline_cache_data.data(),
+                sizeof(pipeline_cache_header));
+    if (pipeline_cache_header.header_size < sizeof(pipeline_cache_header) ||
+        pipeline_cache_header.header_version !=
+            VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+        pipeline_cache_header.vendor_id != device_properties.vendorID ||
+        pipeline_cache_header.device_id != device_properties.deviceID ||
+        std::memcmp(pipeline_cache_header.pipeline_cache_uuid,
+                    device_properties.pipelineCacheUUID, VK_UUID_SIZE)) {
+      pipeline_cache_data.clear();
+    }
+  } else {
+    pipeline_cache_data.clear();
+  }
+  VkPipelineCacheCreateInfo pipeline_cache_create_info;
+  pipeline_cache_create_info.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  pipeline_cache_create_info.pNext = nullptr;
+  pipeline_cache_create_info.flags = 0;
+  pipeline_cache_create_info.initialDataSize = pipeline_cache_data.size();
+  pipeline_cache_create_info.pInitialData = pipeline_cache_data.data();
+  if (dfn.vkCreatePipelineCache(device, &pipeline_cache_create_info, nullptr,
+                                &pipeline_cache_) != VK_SUCCESS) {
+    pipeline_cache_create_info.initialDataSize = 0;
+    pipeline_cache_create_info.pInitialData = nullptr;
+    if (dfn.vkCreatePipelineCache(device, &pipeline_cache_create_info, nullptr,
+                                  &pipeline_cache_) != VK_SUCCESS) {
+      XELOGW("VulkanPipelineCache: Failed to create the pipeline cache");
+      pipeline_cache_ = VK_NULL_HANDLE;
+    }
+  }
+
+  // Create the pipelines in parallel, with the objects shared between them
+  // looked up on this thread.
+  uint64_t pipeline_creation_start = xe::Clock::QueryHostTickCount();
+  std::vector<PipelineCreationArguments> pipelines_to_create;
+  for (const PipelineDescription& description : pipeline_descriptions) {
+    if (pipelines_.find(description) != pipelines_.end()) {
+      continue;
+    }
+    auto vertex_shader_it = shaders_.find(description.vertex_shader_hash);
+    if (vertex_shader_it == shaders_.end()) {
+      continue;
+    }
+    auto vertex_shader = static_cast<VulkanShader::VulkanTranslation*>(
+        vertex_shader_it->second->GetTranslation(
+            description.vertex_shader_modification));
+    if (!vertex_shader || !vertex_shader->is_translated() ||
+        !vertex_shader->is_valid()) {
+      continue;
+    }
+    VulkanShader::VulkanTranslation* pixel_shader = nullptr;
+    if (description.pixel_shader_hash) {
+      auto pixel_shader_it = shaders_.find(description.pixel_shader_hash);
+      if (pixel_shader_it == shaders_.end()) {
+        continue;
+      }
+      pixel_shader = static_cast<VulkanShader::VulkanTranslation*>(
+          pixel_shader_it->second->GetTranslation(
+              description.pixel_shader_modification));
+      if (!pixel_shader || !pixel_shader->is_translated() ||
+          !pixel_shader->is_valid()) {
+        continue;
+      }
+    }
+    PipelineCreationArguments creation_arguments;
+    const PipelineLayoutProvider* pipeline_layout;
+    if (!GetPipelineCreationObjects(description, vertex_shader, pixel_shader,
+                                    pipeline_layout,
+                                    creation_arguments.geometry_shader,
+                                    creation_arguments.render_pass)) {
+      continue;
+    }
+    creation_arguments.pipeline =
+        &*pipelines_.emplace(description, Pipeline(pipeline_layout)).first;
+    creation_arguments.vertex_shader = vertex_shader;
+    creation_arguments.pixel_shader = pixel_shader;
+    pipelines_to_create.push_back(creation_arguments);
+  }
+  ShaderTranslationJobs pipeline_creation_jobs(pipelines_to_create.size());
+  pipeline_creation_jobs.Run("Vulkan Pipelines", [&](size_t worker_index) {
+    for (size_t i;
+         (i = pipeline_creation_jobs.AcquireJob(worker_index)) !=
+         ShaderTranslationJobs::kNoJob;) {
+      EnsurePipelineCreated(pipelines_to_create[i]);
+    }
+  });
+  // Failed pipelines are retried when needed for drawing, like in the runs
+  // without the storage.
+  size_t pipelines_created = 0;
+  for (const PipelineCreationArguments& creation_arguments :
+       pipelines_to_create) {
+    if (creation_arguments.pipeline->second.pipeline != VK_NULL_HANDLE) {
+      ++pipelines_created;
+    } else {
+      PipelineDescription description = creation_arguments.pipeline->first;
+      pipelines_.erase(description);
+    }
+  }
+  XELOGGPU(
+      "Created {} graphics pipelines from the storage in {} milliseconds",
+      pipelines_created,
+      (xe::Clock::QueryHostTickCount() - pipeline_creation_start) * 1000 /
+          xe::Clock::QueryHostTickFrequency());
+}
+
+void VulkanPipelineCache::ShutdownShaderStorage() {
+  shader_storage_.Close();
+  shader_storage_flush_needed_ = false;
+
+  if (pipeline_cache_ != VK_NULL_HANDLE) {
+    const ui::vulkan::VulkanProvider& provider =
+        command_processor_.GetVulkanProvider();
+    const ui::vulkan::VulkanProvider::DeviceFunctions& dfn = provider.dfn();
+    VkDevice device = provider.device();
+    size_t pipeline_cache_data_size = 0;
+    std::vector<uint8_t> pipeline_cache_data;
+    if (dfn.vkGetPipelineCacheData(device, pipeline_cache_,
+                                   &pipeline_cache_data_size,
+                                   nullptr) == VK_SUCCESS &&
+        pipeline_cache_data_size) {
+      pipeline_cache_data.resize(pipeline_cache_data_size);
+      if (dfn.vkGetPipelineCacheData(device, pipeline_cache_,
+                                     &pipeline_cache_data_size,
+                                     pipeline_cache_data.data()) !=
+          VK_SUCCESS) {
+        pipeline_cache_data.clear();
+      }
+    }
+    if (!pipeline_cache_data.empty()) {
+      FILE* pipeline_cache_file =
+          xe::filesystem::OpenFile(pipeline_cache_file_path_, "wb");
+      if (pipeline_cache_file) {
+        fwrite(pipeline_cache_data.data(), pipeline_cache_data_size, 1,
+               pipeline_cache_file);
+        fclose(pipeline_cache_file);
+      } else {
+        XELOGE("Failed to open the Vulkan pipeline cache file for writing: {}",
+               xe::path_to_utf8(pipeline_cache_file_path_));
+      }
+    }
+    dfn.vkDestroyPipelineCache(device, pipeline_cache_, nullptr);
+    pipeline_cache_ = VK_NULL_HANDLE;
+  }
+  pipeline_cache_file_path_.clear();
+}
+
+void VulkanPipelineCache::EndSubmission() {
+  if (shader_storage_flush_needed_) {
+    shader_storage_flush_needed_ = false;
+    shader_storage_.Flush();
+  }
+}
+
 VulkanShader* VulkanPipelineCache::LoadShader(xenos::ShaderType shader_type,
                                               const uint32_t* host_address,
                                               uint32_t dword_count) {
   // Hash the input memory and lookup the shader.
-  uint64_t data_hash =
-      XXH3_64bits(host_address, dword_count * sizeof(uint32_t));
+  return LoadShader(shader_type, host_address, dword_count,
+                    XXH3_64bits(host_address, dword_count * sizeof(uint32_t)));
+}
+
+VulkanShader* VulkanPipelineCache::LoadShader(xenos::ShaderType shader_type,
+                                              const uint32_t* host_address,
+                                              uint32_t dword_count,
+                                              uint64_t data_hash) {
   auto it = shaders_.find(data_hash);
   if (it != shaders_.end()) {
     // Shader has been previously loaded.
@@ -238,6 +589,7 @@ bool VulkanPipelineCache::EnsureShadersTranslated(
       XELOGE("Failed to translate the vertex shader!");
       return false;
     }
+    StoreShader(vertex_shader->shader());
   }
   if (!vertex_shader->is_valid()) {
     // Translation attempted previously, but not valid.
@@ -250,6 +602,7 @@ bool VulkanPipelineCache::EnsureShadersTranslated(
         XELOGE("Failed to translate the pixel shader!");
         return false;
       }
+      StoreShader(pixel_shader->shader());
     }
     if (!pixel_shader->is_valid()) {
       // Translation attempted previously, but not valid.
@@ -298,6 +651,37 @@ bool VulkanPipelineCache::ConfigurePipeline(
   }
 
   // Create the pipeline if not the latest and not already existing.
+  PipelineCreationArguments creation_arguments;
+  const PipelineLayoutProvider* pipeline_layout;
+  if (!GetPipelineCreationObjects(description, vertex_shader, pixel_shader,
+                                  pipeline_layout,
+                                  creation_arguments.geometry_shader,
+                                  creation_arguments.render_pass)) {
+    return false;
+  }
+  auto& pipeline =
+      *pipelines_.emplace(description, Pipeline(pipeline_layout)).first;
+  creation_arguments.pipeline = &pipeline;
+  creation_arguments.vertex_shader = vertex_shader;
+  creation_arguments.pixel_shader = pixel_shader;
+  if (!EnsurePipelineCreated(creation_arguments)) {
+    return false;
+  }
+  if (shader_storage_.is_open()) {
+    shader_storage_.AppendPipeline(&description);
+    shader_storage_flush_needed_ = true;
+  }
+  pipeline_out = pipeline.second.pipeline;
+  pipeline_layout_out = pipeline_layout;
+  return true;
+}
+
+bool VulkanPipelineCache::GetPipelineCreationObjects(
+    const PipelineDescription& description,
+    const VulkanShader::VulkanTranslation* vertex_shader,
+    const VulkanShader::VulkanTranslation* pixel_shader,
+    const PipelineLayoutProvider*& pipeline_layout_out,
+    VkShaderModule& geometry_shader_out, VkRenderPass& render_pass_out) {
   const PipelineLayoutProvider* pipeline_layout =
       command_processor_.GetPipelineLayout(
           pixel_shader
@@ -337,23 +721,13 @@ bool VulkanPipelineCache::ConfigurePipeline(
               RenderTargetCache::Path::kPixelShaderInterlock
           ? render_target_cache_.GetFragmentShaderInterlockRenderPass()
           : render_target_cache_.GetHostRenderTargetsRenderPass(
-                render_pass_key);
+                description.render_pass_key);
   if (render_pass == VK_NULL_HANDLE) {
     return false;
   }
-  PipelineCreationArguments creation_arguments;
-  auto& pipeline =
-      *pipelines_.emplace(description, Pipeline(pipeline_layout)).first;
-  creation_arguments.pipeline = &pipeline;
-  creation_arguments.vertex_shader = vertex_shader;
-  creation_arguments.pixel_shader = pixel_shader;
-  creation_arguments.geometry_shader = geometry_shader;
-  creation_arguments.render_pass = render_pass;
-  if (!EnsurePipelineCreated(creation_arguments)) {
-    return false;
-  }
-  pipeline_out = pipeline.second.pipeline;
   pipeline_layout_out = pipeline_layout;
+  geometry_shader_out = geometry_shader;
+  render_pass_out = render_pass;
   return true;
 }
 
@@ -378,6 +752,8 @@ bool VulkanPipelineCache::TranslateAnalyzedShader(
 
   // Set up the texture binding layout.
   if (shader.EnterBindingLayoutUserUIDSetup()) {
+    // Shaders may be translated on multiple threads when loading the storage.
+    std::lock_guard<std::mutex> layouts_lock(layouts_mutex_);
     // Obtain the unique IDs of the binding layout if there are any texture
     // bindings, for invalidation in the command processor.
     size_t texture_binding_layout_uid = kLayoutUIDEmpty;
@@ -436,6 +812,16 @@ bool VulkanPipelineCache::TranslateAnalyzedShader(
   return true;
 }
 
+void VulkanPipelineCache::StoreShader(Shader& shader) {
+  if (!shader_storage_.is_open() ||
+      shader.ucode_storage_index() == shader_storage_index_) {
+    return;
+  }
+  shader.set_ucode_storage_index(shader_storage_index_);
+  shader_storage_.AppendShader(shader);
+  shader_storage_flush_needed_ = true;
+}
+
 void VulkanPipelineCache::WritePipelineRenderTargetDescription(
     reg::RB_BLENDCONTROL blend_control, uint32_t write_mask,
     PipelineRenderTarget& render_target_out) const {
@@ -2297,7 +2683,7 @@ bool VulkanPipelineCache::EnsurePipelineCreated(
   const ui::vulkan::VulkanProvider::DeviceFunctions& dfn = provider.dfn();
   VkDevice device = provider.device();
   VkPipeline pipeline;
-  if (dfn.vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
+  if (dfn.vkCreateGraphicsPipelines(device, pipeline_cache_, 1,
                                     &pipeline_create_info, nullptr,
                                     &pipeline) != VK_SUCCESS) {
     // TODO(Triang3l): Move these error messages outside.
@@ -12,8 +12,10 @@
 
 #include <cstddef>
 #include <cstring>
+#include <filesystem>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <utility>
 
@@ -23,6 +25,7 @@
 #include "xenia/gpu/primitive_processor.h"
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/registers.h"
+#include "xenia/gpu/shader_storage.h"
 #include "xenia/gpu/spirv_shader_translator.h"
 #include "xenia/gpu/vulkan/vulkan_render_target_cache.h"
 #include "xenia/gpu/vulkan/vulkan_shader.h"
@@ -59,6 +62,15 @@ class VulkanPipelineCache {
   bool Initialize();
   void Shutdown();
 
+  // Translates the shaders and creates the pipelines used by the title in the
+  // previous runs, and starts storing the new ones. Everything is loaded before
+  // returning.
+  void InitializeShaderStorage(const std::filesystem::path& cache_root,
+                               uint32_t title_id);
+  void ShutdownShaderStorage();
+
+  void EndSubmission();
+
   VulkanShader* LoadShader(xenos::ShaderType shader_type,
                            const uint32_t* host_address, uint32_t dword_count);
   // Analyze shader microcode on the translator thread.
@@ -179,6 +191,8 @@ class VulkanPipelineCache {
     // Filled only for the attachments present in the render pass object.
     PipelineRenderTarget render_targets[xenos::kMaxColorRenderTargets];
 
+    static constexpr uint32_t kVersion = 0x20221017;
+
     // Including all the padding, for a stable hash.
     PipelineDescription() { Reset(); }
     PipelineDescription(const PipelineDescription& description) {
@@ -246,9 +260,15 @@ class VulkanPipelineCache {
     }
   };
 
+  VulkanShader* LoadShader(xenos::ShaderType shader_type,
+                           const uint32_t* host_address, uint32_t dword_count,
+                           uint64_t data_hash);
+
   // Can be called from multiple threads.
   bool TranslateAnalyzedShader(SpirvShaderTranslator& translator,
                                VulkanShader::VulkanTranslation& translation);
+  // Writes the shader to the storage if it's not there yet.
+  void StoreShader(Shader& shader);
 
   void WritePipelineRenderTargetDescription(
       reg::RB_BLENDCONTROL blend_control, uint32_t write_mask,
@@ -272,6 +292,15 @@ class VulkanPipelineCache {
       GeometryShaderKey& key_out);
   VkShaderModule GetGeometryShader(GeometryShaderKey key);
 
+  // Gets the objects, other than the shaders, that need to be looked up on the
+  // command processor thread for creating the pipeline.
+  bool GetPipelineCreationObjects(
+      const PipelineDescription& description,
+      const VulkanShader::VulkanTranslation* vertex_shader,
+      const VulkanShader::VulkanTranslation* pixel_shader,
+      const PipelineLayoutProvider*& pipeline_layout_out,
+      VkShaderModule& geometry_shader_out, VkRenderPass& render_pass_out);
+
   // Can be called from creation threads - all needed data must be fully set up
   // at the point of the call: shaders must be translated, pipeline layout and
   // render pass objects must be available.
@@ -324,6 +353,19 @@ class VulkanPipelineCache {
   // Previously used pipeline, to avoid lookups if the state wasn't changed.
   const std::pair<const PipelineDescription, Pipeline>* last_pipeline_ =
       nullptr;
+
+  // Guest shaders and pipeline descriptions of the current title, for preload
+  // in the next emulator runs.
+  ShaderStorage shader_storage_;
+  // For only writing shaders to the currently open storage once, incremented
+  // when switching the storage.
+  uint32_t shader_storage_index_ = 0;
+  bool shader_storage_flush_needed_ = false;
+
+  // Pipeline cache of the driver for the title, saved to
+  // pipeline_cache_file_path_ when the storage is shut down.
+  VkPipelineCache pipeline_cache_ = VK_NULL_HANDLE;
+  std::filesystem::path pipeline_cache_file_path_;
 };
 
 }  // namespace vulkan
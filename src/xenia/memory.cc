@@ -21,6 +21,7 @@
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/threading.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/cpu/mmio_handler.h"
 
 // TODO(benvanik): move xbox.h out
@@ -32,6 +33,24 @@ DEFINE_bool(protect_on_release, false,
             "Protect released memory to prevent accesses.", "Memory");
 DEFINE_bool(scribble_heap, false,
             "Scribble 0xCD into all allocated heap memory.", "Memory");
+DEFINE_bool(
+    huge_pages, false,
+    "Ask the host to back guest memory in the heaps with 64 KB or larger pages "
+    "with transparent huge pages (Linux), reducing TLB misses on accesses to "
+    "large allocations. Parts of huge pages with their protection changed, "
+    "such as by the GPU watching writes, are split back into small pages.",
+    "Memory");
+DEFINE_string(
+    physical_write_watch, "mprotect",
+    "How guest writes to physical memory used by the GPU are detected on "
+    "Linux.\n"
+    " mprotect: Making the pages read-only and handling the access "
+    "violations.\n"
+    " userfaultfd: Write-protecting the pages with userfaultfd (Linux 6.4+), "
+    "with the writes handled by a separate thread, avoiding splitting the "
+    "mappings of the guest memory. Falls back to mprotect if not "
+    "available.",
+    "Memory");
 
 namespace xe {
 uint32_t get_page_count(uint32_t value, uint32_t page_size) {
@@ -98,6 +117,12 @@ Memory::~Memory() {
   // Uninstall the MMIO handler, as we won't be able to service more
   // requests.
   mmio_handler_.reset();
+  physical_write_watch_.reset();
+
+  if (cvars::huge_pages) {
+    XELOGI("Memory: {} MB of guest memory was backed by huge pages",
+           QueryHugePageBackedSize() >> 20);
+  }
 
   for (auto invalidation_callback : physical_memory_invalidation_callbacks_) {
     delete invalidation_callback;
@@ -157,6 +182,18 @@ bool Memory::Initialize() {
   virtual_membase_ = mapping_base_;
   physical_membase_ = mapping_base_ + 0x100000000ull;
 
+  // Before committing any physical memory, as committed ranges are added to
+  // the watch.
+  if (cvars::physical_write_watch == "userfaultfd") {
+    physical_write_watch_ = xe::memory::WriteWatch::Create(
+        PhysicalWriteWatchCallbackThunk, this);
+    if (!physical_write_watch_) {
+      XELOGW(
+          "userfaultfd write-protection is not available, watching physical "
+          "memory with mprotect");
+    }
+  }
+
   // Prepare virtual heaps.
   heaps_.v00000000.Initialize(this, virtual_membase_, HeapType::kGuestVirtual,
                               0x00000000, 0x40000000, 4096);
@@ -540,6 +577,27 @@ bool Memory::AccessViolationCallbackThunk(
       std::move(global_lock_locked_once), host_address, is_write);
 }
 
+bool Memory::PhysicalWriteWatchCallbackThunk(void* context, void* host_address,
+                                             bool may_wait) {
+  // On the thread of the watch, the writer may be holding the global critical
+  // region while it's waiting for the write to be handled.
+  global_unique_lock_type global_lock =
+      may_wait ? xe::global_critical_region::AcquireDirect()
+               : xe::global_critical_region::TryAcquire();
+  if (!global_lock.owns_lock()) {
+    return false;
+  }
+  reinterpret_cast<Memory*>(context)->AccessViolationCallback(
+      std::move(global_lock), host_address, true);
+  return true;
+}
+
+void Memory::ProcessPendingPhysicalWrites() {
+  if (physical_write_watch_) {
+    physical_write_watch_->ProcessPendingWrites();
+  }
+}
+
 bool Memory::TriggerPhysicalMemoryCallbacks(
     global_unique_lock_type global_lock_locked_once, uint32_t virtual_address,
     uint32_t length, bool is_write, bool unwatch_exact_range, bool unprotect) {
@@ -617,6 +675,19 @@ void Memory::SystemHeapFree(uint32_t address, uint32_t* out_region_size) {
   heap->Release(address, out_region_size);
 }
 
+uint64_t Memory::QueryHugePageBackedSize() {
+  if (!cvars::huge_pages) {
+    return 0;
+  }
+  return heaps_.v00000000.QueryHugePageBackedSize() +
+         heaps_.v40000000.QueryHugePageBackedSize() +
+         heaps_.v80000000.QueryHugePageBackedSize() +
+         heaps_.v90000000.QueryHugePageBackedSize() +
+         heaps_.vA0000000.QueryHugePageBackedSize() +
+         heaps_.vC0000000.QueryHugePageBackedSize() +
+         heaps_.vE0000000.QueryHugePageBackedSize();
+}
+
 void Memory::DumpMap() {
   XELOGE("==================================================================");
   XELOGE("Memory Dump");
@@ -626,6 +697,7 @@ void Memory::DumpMap() {
          system_allocation_granularity_);
   XELOGE("                Virtual Membase: {}", virtual_membase_);
   XELOGE("               Physical Membase: {}", physical_membase_);
+  XELOGE("               Huge Page Backed: {}", QueryHugePageBackedSize());
   XELOGE("");
   XELOGE("------------------------------------------------------------------");
   XELOGE("Virtual Heaps");
@@ -647,26 +719,22 @@ void Memory::DumpMap() {
   XELOGE("");
 }
 
-bool Memory::Save(ByteStream* stream) {
+void Memory::Save(std::vector<uint8_t>& out, bool incremental) {
   XELOGD("Serializing memory...");
-  heaps_.v00000000.Save(stream);
-  heaps_.v40000000.Save(stream);
-  heaps_.v80000000.Save(stream);
-  heaps_.v90000000.Save(stream);
-  heaps_.physical.Save(stream);
-
-  return true;
+  heaps_.v00000000.Save(out, incremental);
+  heaps_.v40000000.Save(out, incremental);
+  heaps_.v80000000.Save(out, incremental);
+  heaps_.v90000000.Save(out, incremental);
+  heaps_.physical.Save(out, incremental);
 }
 
-bool Memory::Restore(ByteStream* stream) {
+bool Memory::Restore(ByteStream* const* streams, size_t stream_count) {
   XELOGD("Restoring memory...");
-  heaps_.v00000000.Restore(stream);
-  heaps_.v40000000.Restore(stream);
-  heaps_.v80000000.Restore(stream);
-  heaps_.v90000000.Restore(stream);
-  heaps_.physical.Restore(stream);
-
-  return true;
+  return heaps_.v00000000.Restore(streams, stream_count) &&
+         heaps_.v40000000.Restore(streams, stream_count) &&
+         heaps_.v80000000.Restore(streams, stream_count) &&
+         heaps_.v90000000.Restore(streams, stream_count) &&
+         heaps_.physical.Restore(streams, stream_count);
 }
 
 xe::memory::PageAccess ToPageAccess(uint32_t protect) {
@@ -720,6 +788,10 @@ void BaseHeap::Initialize(Memory* memory, uint8_t* membase, HeapType heap_type,
   host_address_offset_ = host_address_offset;
   page_table_.resize(heap_size / page_size);
   unreserved_page_count_ = uint32_t(page_table_.size());
+  // The protection of the pages of the heaps with small pages changes too
+  // often for huge pages to stay intact.
+  huge_pages_ = cvars::huge_pages && page_size_ >= 64 * 1024 &&
+                xe::memory::huge_page_size() != 0;
 }
 
 void BaseHeap::Dispose() {
@@ -735,6 +807,14 @@ void BaseHeap::Dispose() {
   }
 }
 
+uint64_t BaseHeap::QueryHugePageBackedSize() {
+  if (!huge_pages_) {
+    return 0;
+  }
+  return xe::memory::QueryHugePageBackedLength(TranslateRelative(0),
+                                               heap_size_);
+}
+
 void BaseHeap::DumpMap() {
   auto global_lock = global_critical_region_.Acquire();
   XELOGE("------------------------------------------------------------------");
@@ -745,6 +825,7 @@ void BaseHeap::DumpMap() {
   XELOGE("            Page Size: {0} ({0:08X})", page_size_);
   XELOGE("           Page Count: {}", page_table_.size());
   XELOGE("  Host Address Offset: {0} ({0:08X})", host_address_offset_);
+  XELOGE("     Huge Page Backed: {}", QueryHugePageBackedSize());
   bool is_empty_span = false;
   uint32_t empty_span_start = 0;
   for (uint32_t i = 0; i < uint32_t(page_table_.size()); ++i) {
@@ -786,75 +867,121 @@ void BaseHeap::DumpMap() {
   }
 }
 
-bool BaseHeap::Save(ByteStream* stream) {
+void BaseHeap::Save(std::vector<uint8_t>& out, bool incremental) {
   XELOGD("Heap {:08X}-{:08X}", heap_base_, heap_base_ + (heap_size_ - 1));
 
-  for (size_t i = 0; i < page_table_.size(); i++) {
-    auto& page = page_table_[i];
-    stream->Write(page.qword);
-    if (!page.state) {
-      // Unallocated.
+  auto append = [&out](const void* data, size_t size) {
+    size_t offset = out.size();
+    out.resize(offset + size);
+    std::memcpy(out.data() + offset, data, size);
+  };
+  uint32_t page_count = uint32_t(page_table_.size());
+  saved_page_hashes_.resize(page_count);
+  uint32_t committed_page_count = 0;
+  for (const PageEntry& page : page_table_) {
+    committed_page_count += (page.state & kMemoryAllocationCommit) ? 1 : 0;
+  }
+  out.reserve(out.size() + sizeof(uint32_t) * 2 +
+              sizeof(PageEntry) * page_count +
+              (sizeof(uint32_t) + page_size_) * size_t(committed_page_count));
+
+  append(&page_count, sizeof(page_count));
+  append(page_table_.data(), sizeof(PageEntry) * page_count);
+  size_t saved_page_count_offset = out.size();
+  uint32_t saved_page_count = 0;
+  append(&saved_page_count, sizeof(saved_page_count));
+  for (uint32_t i = 0; i < page_count; ++i) {
+    const PageEntry& page = page_table_[i];
+    if (!(page.state & kMemoryAllocationCommit)) {
+      saved_page_hashes_[i] = 0;
       continue;
     }
-
-    // TODO(DrChat): write compressed with snappy.
-    if (page.state & kMemoryAllocationCommit) {
-      void* addr = TranslateRelative(i * page_size_);
-
-      memory::PageAccess old_access;
-      memory::Protect(addr, page_size_, memory::PageAccess::kReadWrite,
-                      &old_access);
-
-      stream->Write(addr, page_size_);
-
-      memory::Protect(addr, page_size_, old_access, nullptr);
+    void* addr = TranslateRelative(i * page_size_);
+    bool readable = (page.current_protect & kMemoryProtectRead) != 0;
+    if (!readable) {
+      xe::memory::Protect(addr, page_size_, memory::PageAccess::kReadOnly,
+                          nullptr);
+    }
+    uint64_t hash = XXH3_64bits(addr, page_size_);
+    // 0 is for pages not saved.
+    hash = std::max(hash, uint64_t(1));
+    if (!incremental || saved_page_hashes_[i] != hash) {
+      saved_page_hashes_[i] = hash;
+      append(&i, sizeof(i));
+      append(addr, page_size_);
+      ++saved_page_count;
+    }
+    if (!readable) {
+      xe::memory::Protect(addr, page_size_, ToPageAccess(page.current_protect),
+                          nullptr);
     }
   }
-
-  return true;
+  std::memcpy(out.data() + saved_page_count_offset, &saved_page_count,
+              sizeof(saved_page_count));
 }
 
-bool BaseHeap::Restore(ByteStream* stream) {
+bool BaseHeap::Restore(ByteStream* const* streams, size_t stream_count) {
   XELOGD("Heap {:08X}-{:08X}", heap_base_, heap_base_ + (heap_size_ - 1));
 
-  for (size_t i = 0; i < page_table_.size(); i++) {
-    auto& page = page_table_[i];
-    page.qword = stream->Read<uint64_t>();
-    if (!page.state) {
-      // Unallocated.
-      continue;
+  // The page table of the last save is the current one.
+  uint32_t page_count = uint32_t(page_table_.size());
+  for (size_t i = 0; i < stream_count; ++i) {
+    if (streams[i]->Read<uint32_t>() != page_count) {
+      return false;
     }
-
-    memory::PageAccess page_access = memory::PageAccess::kNoAccess;
-    if ((page.current_protect & kMemoryProtectRead) &&
-        (page.current_protect & kMemoryProtectWrite)) {
-      page_access = memory::PageAccess::kReadWrite;
-    } else if (page.current_protect & kMemoryProtectRead) {
-      page_access = memory::PageAccess::kReadOnly;
+    if (i + 1 < stream_count) {
+      streams[i]->Advance(sizeof(PageEntry) * page_count);
+    } else {
+      streams[i]->Read(page_table_.data(), sizeof(PageEntry) * page_count);
     }
+  }
 
-    // Commit the memory if it isn't already. We do not need to reserve any
-    // memory, as the mapping has already taken care of that.
-    if (page.state & kMemoryAllocationCommit) {
-      xe::memory::AllocFixed(TranslateRelative(i * page_size_), page_size_,
+  // Commit the memory if it isn't already. We do not need to reserve any
+  // memory, as the mapping has already taken care of that.
+  for (uint32_t i = 0; i < page_count; ++i) {
+    if (page_table_[i].state & kMemoryAllocationCommit) {
+      void* host_address = TranslateRelative(i * page_size_);
+      xe::memory::AllocFixed(host_address, page_size_,
                              memory::AllocationType::kCommit,
                              memory::PageAccess::kReadWrite);
+      if (huge_pages_) {
+        xe::memory::AdviseHugePages(host_address, page_size_);
+      }
     }
+  }
 
-    // Now read into memory. We'll set R/W protection first, then set the
-    // protection back to its previous state.
-    // TODO(DrChat): read compressed with snappy.
-    if (page.state & kMemoryAllocationCommit) {
-      void* addr = TranslateRelative(i * page_size_);
-      xe::memory::Protect(addr, page_size_, memory::PageAccess::kReadWrite,
-                          nullptr);
-
-      stream->Read(addr, page_size_);
+  // Pages saved later overwrite the ones from the saves before.
+  for (size_t i = 0; i < stream_count; ++i) {
+    uint32_t saved_page_count = streams[i]->Read<uint32_t>();
+    for (uint32_t j = 0; j < saved_page_count; ++j) {
+      uint32_t page_number = streams[i]->Read<uint32_t>();
+      if (page_number >= page_count) {
+        return false;
+      }
+      if (page_table_[page_number].state & kMemoryAllocationCommit) {
+        streams[i]->Read(TranslateRelative(page_number * page_size_),
+                         page_size_);
+      } else {
+        streams[i]->Advance(page_size_);
+      }
+    }
+  }
 
-      xe::memory::Protect(addr, page_size_, page_access, nullptr);
+  // Set the protection back to its saved state.
+  for (uint32_t i = 0; i < page_count; ++i) {
+    const PageEntry& page = page_table_[i];
+    if (!(page.state & kMemoryAllocationCommit)) {
+      continue;
+    }
+    memory::PageAccess page_access = ToPageAccess(page.current_protect);
+    if (page_access != memory::PageAccess::kReadWrite) {
+      xe::memory::Protect(TranslateRelative(i * page_size_), page_size_,
+                          page_access, nullptr);
     }
   }
 
+  // Not known to be the same as in any save made from now on.
+  saved_page_hashes_.assign(page_count, 0);
   return true;
 }
 
@@ -947,6 +1074,9 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
       XELOGE("BaseHeap::AllocFixed failed to alloc range from host");
       return false;
     }
+    if (huge_pages_) {
+      xe::memory::AdviseHugePages(result, page_count * page_size_);
+    }
 
     if (cvars::scribble_heap && protect & kMemoryProtectWrite) {
       std::memset(result, 0xCD, page_count * page_size_);
@@ -1109,6 +1239,9 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
       XELOGE("BaseHeap::Alloc failed to alloc range from host");
       return false;
     }
+    if (huge_pages_) {
+      xe::memory::AdviseHugePages(result, page_count << page_size_shift_);
+    }
 
     if (cvars::scribble_heap && (protect & kMemoryProtectWrite)) {
       std::memset(result, 0xCD, page_count << page_size_shift_);
@@ -1521,6 +1654,7 @@ bool PhysicalHeap::Alloc(uint32_t size, uint32_t alignment,
     // TODO(benvanik): don't leak parent memory.
     return false;
   }
+  AddToWriteWatch(address, size, allocation_type);
   *out_address = address;
   return true;
 }
@@ -1557,6 +1691,7 @@ bool PhysicalHeap::AllocFixed(uint32_t base_address, uint32_t size,
     // TODO(benvanik): don't leak parent memory.
     return false;
   }
+  AddToWriteWatch(address, size, allocation_type);
 
   return true;
 }
@@ -1598,6 +1733,7 @@ bool PhysicalHeap::AllocRange(uint32_t low_address, uint32_t high_address,
     // TODO(benvanik): don't leak parent memory.
     return false;
   }
+  AddToWriteWatch(address, size, allocation_type);
   *out_address = address;
   return true;
 }
@@ -1720,11 +1856,37 @@ void PhysicalHeap::EnableAccessCallbacks(uint32_t physical_address,
   }
 }
 
+void PhysicalHeap::ProtectWatchedSystemPages(uint32_t system_page_first,
+                                             uint32_t system_page_count,
+                                             xe::memory::PageAccess access) {
+  uint8_t* host_address =
+      membase_ + heap_base_ + (system_page_first << system_page_shift_);
+  size_t length = size_t(system_page_count) << system_page_shift_;
+  xe::memory::WriteWatch* write_watch = memory_->physical_write_watch_.get();
+  if (write_watch && access != xe::memory::PageAccess::kNoAccess) {
+    write_watch->Protect(host_address, length,
+                         access == xe::memory::PageAccess::kReadOnly);
+  } else {
+    xe::memory::Protect(host_address, length, access);
+  }
+}
+
+void PhysicalHeap::AddToWriteWatch(uint32_t address, uint32_t size,
+                                   uint32_t allocation_type) {
+  xe::memory::WriteWatch* write_watch = memory_->physical_write_watch_.get();
+  if (!write_watch || allocation_type == kMemoryAllocationReserve) {
+    return;
+  }
+  if (!write_watch->AddRange(TranslateRelative(address - heap_base_), size)) {
+    XELOGE("PhysicalHeap::AddToWriteWatch failed to watch {:08X}-{:08X}",
+           address, address + size - 1);
+  }
+}
+
 template <bool enable_invalidation_notifications>
 XE_NOINLINE void PhysicalHeap::EnableAccessCallbacksInner(
     const uint32_t system_page_first, const uint32_t system_page_last,
     xe::memory::PageAccess protect_access) XE_RESTRICT {
-  uint8_t* protect_base = membase_ + heap_base_;
   uint32_t protect_system_page_first = UINT32_MAX;
 
   SystemPageFlagsBlock* XE_RESTRICT sys_page_flags = system_page_flags_.data();
@@ -1799,21 +1961,18 @@ XE_NOINLINE void PhysicalHeap::EnableAccessCallbacksInner(
       }
     } else {
       if (protect_system_page_first != UINT32_MAX) {
-        xe::memory::Protect(
-            protect_base + (protect_system_page_first << system_page_shift_),
-            (i - protect_system_page_first) << system_page_shift_,
-            protect_access);
+        ProtectWatchedSystemPages(protect_system_page_first,
+                                  i - protect_system_page_first,
+                                  protect_access);
         protect_system_page_first = UINT32_MAX;
       }
     }
   }
 
   if (protect_system_page_first != UINT32_MAX) {
-    xe::memory::Protect(
-        protect_base + (protect_system_page_first << system_page_shift_),
-        (system_page_last + 1 - protect_system_page_first)
-            << system_page_shift_,
-        protect_access);
+    ProtectWatchedSystemPages(protect_system_page_first,
+                              system_page_last + 1 - protect_system_page_first,
+                              protect_access);
   }
 }
 bool PhysicalHeap::TriggerCallbacks(
@@ -1934,7 +2093,6 @@ bool PhysicalHeap::TriggerCallbacks(
 
   // Unprotect ranges that need unprotection.
   if (unprotect) {
-    uint8_t* protect_base = membase_ + heap_base_;
     uint32_t unprotect_system_page_first = UINT32_MAX;
     for (uint32_t i = system_page_first; i <= system_page_last; ++i) {
       // Check if need to allow writing to this page.
@@ -1955,20 +2113,17 @@ bool PhysicalHeap::TriggerCallbacks(
         }
       } else {
         if (unprotect_system_page_first != UINT32_MAX) {
-          xe::memory::Protect(
-              protect_base +
-                  (unprotect_system_page_first << system_page_shift_),
-              (i - unprotect_system_page_first) << system_page_shift_,
-              xe::memory::PageAccess::kReadWrite);
+          ProtectWatchedSystemPages(unprotect_system_page_first,
+                                    i - unprotect_system_page_first,
+                                    xe::memory::PageAccess::kReadWrite);
           unprotect_system_page_first = UINT32_MAX;
         }
       }
     }
     if (unprotect_system_page_first != UINT32_MAX) {
-      xe::memory::Protect(
-          protect_base + (unprotect_system_page_first << system_page_shift_),
-          (system_page_last + 1 - unprotect_system_page_first)
-              << system_page_shift_,
+      ProtectWatchedSystemPages(
+          unprotect_system_page_first,
+          system_page_last + 1 - unprotect_system_page_first,
           xe::memory::PageAccess::kReadWrite);
     }
   }
@@ -140,6 +140,10 @@ class BaseHeap {
   // Disposes and decommits all memory and clears the page table.
   virtual void Dispose();
 
+  // Returns how many bytes of the heap are currently backed by huge pages on
+  // the host.
+  uint64_t QueryHugePageBackedSize();
+
   // Dumps information about all allocations within the heap to the log.
   void DumpMap();
 
@@ -198,8 +202,13 @@ class BaseHeap {
   xe::memory::PageAccess QueryRangeAccess(uint32_t low_address,
                                           uint32_t high_address);
 
-  bool Save(ByteStream* stream);
-  bool Restore(ByteStream* stream);
+  // Appends the page table and the contents of the committed pages, or, if
+  // incremental, only of the pages changed since the last save, which are
+  // found by hashing them.
+  void Save(std::vector<uint8_t>& out, bool incremental);
+  // Restores from a chain of saves, each incremental one after the save it was
+  // made on top of.
+  bool Restore(ByteStream* const* streams, size_t stream_count);
 
   void Reset();
 
@@ -221,6 +230,10 @@ class BaseHeap {
   uint32_t unreserved_page_count_;
   xe::global_critical_region global_critical_region_;
   std::vector<PageEntry> page_table_;
+  // Hashes of the contents of the pages when last saved, 0 if not saved.
+  std::vector<uint64_t> saved_page_hashes_;
+  // Whether committed pages are advised to be backed by huge pages.
+  bool huge_pages_ = false;
 };
 
 // Normal heap allowing allocations from guest virtual address ranges.
@@ -297,6 +310,16 @@ class PhysicalHeap : public BaseHeap {
   }
 
  protected:
+  // Changes the protection of pages watched for writes, through the write
+  // watch of the memory if it's used.
+  void ProtectWatchedSystemPages(uint32_t system_page_first,
+                                 uint32_t system_page_count,
+                                 xe::memory::PageAccess access);
+  // Committing maps the pages anew on the host, which removes them from the
+  // write watch.
+  void AddToWriteWatch(uint32_t address, uint32_t size,
+                       uint32_t allocation_type);
+
   VirtualHeap* parent_heap_;
 
   uint32_t system_page_size_;
@@ -503,6 +526,13 @@ class Memory {
       uint32_t length, bool is_write, bool unwatch_exact_range,
       bool unprotect = true);
 
+  // With the userfaultfd physical write watch, triggers the callbacks for the
+  // writes that could not be handled while the writer was waiting because the
+  // global critical region was locked. Must be called without the global
+  // critical region locked before using the data that may have been written by
+  // the CPU.
+  void ProcessPendingPhysicalWrites();
+
   // Allocates virtual memory from the 'system' heap.
   // System memory is kept separate from game memory but is still accessible
   // using normal guest virtual addresses. Kernel structures and other internal
@@ -533,11 +563,19 @@ class Memory {
                                 uint32_t& reserved_pages, uint32_t& used_pages,
                                 uint32_t& reserved_bytes);
 
+  // Returns how many bytes of the guest memory are currently backed by huge
+  // pages on the host, with the huge_pages option.
+  uint64_t QueryHugePageBackedSize();
+
   // Dumps a map of all allocated memory to the log.
   void DumpMap();
 
-  bool Save(ByteStream* stream);
-  bool Restore(ByteStream* stream);
+  // Appends the state of the guest memory to out. If incremental, only the
+  // pages changed since the last save are included.
+  void Save(std::vector<uint8_t>& out, bool incremental);
+  // Restores from a chain of saves, each incremental one after the save it was
+  // made on top of.
+  bool Restore(ByteStream* const* streams, size_t stream_count);
 
   void SetMMIOExceptionRecordingCallback(cpu::MmioAccessRecordCallback callback,
                                          void* context);
@@ -554,6 +592,9 @@ class Memory {
   static bool AccessViolationCallbackThunk(
       global_unique_lock_type global_lock_locked_once, void* context,
       void* host_address, bool is_write);
+  static bool PhysicalWriteWatchCallbackThunk(void* context,
+                                              void* host_address,
+                                              bool may_wait);
 
   std::filesystem::path file_name_;
   uint32_t system_page_size_ = 0;
@@ -580,6 +621,9 @@ class Memory {
   } views_ = {{0}};
 
   std::unique_ptr<cpu::MMIOHandler> mmio_handler_;
+  // Used instead of changing the protection for physical memory write
+  // watches if available and enabled.
+  std::unique_ptr<xe::memory::WriteWatch> physical_write_watch_;
 
   struct {
     VirtualHeap v00000000;